@@ -0,0 +1,167 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Accelerators
+ *
+ * custom-0 and custom-1 decode to OP_ACCEL in every engine; the translated
+ * tier runs it through T_CALL, the lockstep lanes through the scalar handler
+ * with rs1, rs2 and rd synced, which is all an accelerator sees of the
+ * registers. The built-ins are plain C: a 16 element dot product and a table
+ * based AES encryption round, operations a small accelerator would do in a
+ * few cycles and the guest in hundreds of RV32I instructions.
+ */
+
+//rd = sum of a[i] * b[i] over the 16 words at rs1 and rs2
+static int ACCEL_dot16(CPU *cpu, uint32_t rs1, uint32_t rs2, uint32_t funct7, uint32_t *rd, void *context)
+{
+	const uint8_t *a = CPU_get_memory(cpu, rs1, 64);
+	const uint8_t *b = CPU_get_memory(cpu, rs2, 64);
+	if (!a || !b)
+	{
+		return 0;
+	}
+	uint32_t x[16], y[16], sum = 0;
+	memcpy(x, a, sizeof(x));
+	memcpy(y, b, sizeof(y));
+	for (int i = 0; i < 16; i++)
+	{
+		sum += x[i] * y[i];
+	}
+	*rd = sum;
+	return 1;
+}
+
+static const uint8_t ACCEL_sbox[256] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+//multiplication by x in GF(2^8)
+static uint8_t ACCEL_xtime(uint8_t b)
+{
+	return (uint8_t)(b << 1 ^ (b & 0x80 ? 0x1B : 0));
+}
+
+//SubBytes, ShiftRows, MixColumns (not in the last round) and AddRoundKey on the
+//column-major state of FIPS-197 at rs1, with the round key at rs2
+static int ACCEL_aes_round(CPU *cpu, uint32_t rs1, uint32_t rs2, uint32_t funct7, uint32_t *rd, void *context)
+{
+	uint8_t *state = CPU_get_memory(cpu, rs1, 16);
+	const uint8_t *key = CPU_get_memory(cpu, rs2, 16);
+	if (!state || !key)
+	{
+		return 0;
+	}
+	uint8_t s[16];
+	for (int c = 0; c < 4; c++)
+	{
+		for (int r = 0; r < 4; r++)
+		{
+			s[4 * c + r] = ACCEL_sbox[state[4 * ((c + r) & 3) + r]];
+		}
+	}
+	if (!(funct7 & 1))
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			uint8_t *column = s + 4 * c;
+			uint8_t all = column[0] ^ column[1] ^ column[2] ^ column[3];
+			uint8_t first = column[0];
+			column[0] ^= all ^ ACCEL_xtime(column[0] ^ column[1]);
+			column[1] ^= all ^ ACCEL_xtime(column[1] ^ column[2]);
+			column[2] ^= all ^ ACCEL_xtime(column[2] ^ column[3]);
+			column[3] ^= all ^ ACCEL_xtime(column[3] ^ first);
+		}
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		state[i] = s[i] ^ key[i];
+	}
+	*rd = 0;
+	return 1;
+}
+
+static const CPU_accelerator ACCEL_builtins[] = {
+	[CPU_ACCEL_DOT16] = ACCEL_dot16,
+	[CPU_ACCEL_AES_ROUND] = ACCEL_aes_round,
+};
+
+static const struct
+{
+	const char *name_;
+	int accel_;
+} ACCEL_names[] = {
+	{"dot16", CPU_ACCEL_DOT16},
+	{"aes", CPU_ACCEL_AES_ROUND},
+};
+
+void ACCEL(CPU *cpu, uint32_t instruction)
+{
+	int slot = getFunc3(instruction) | (getOpCode(instruction) == CUSTOM_1) << 3;
+	const ACCEL_slot *accel = &cpu->accel_[slot];
+	uint32_t result;
+	if (!accel->function_ || !accel->function_(cpu, cpu->regfile_[getRS1(instruction)], cpu->regfile_[getRS2(instruction)],
+											   (uint32_t)instruction >> 25, &result, accel->context_))
+	{
+		//the pc stays, the CPU halts
+		cpu->accel_stats_.illegal_++;
+		return;
+	}
+	cpu->accel_stats_.calls_[slot]++;
+	cpu->regfile_[getRD(instruction)] = result;
+	cpu->pc_ += 4;
+}
+
+int CPU_set_accelerator(CPU *cpu, int slot, CPU_accelerator accelerator, void *context)
+{
+	if (slot < 0 || slot >= CPU_ACCEL_SLOTS)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	cpu->accel_[slot].function_ = accelerator;
+	cpu->accel_[slot].context_ = context;
+	return CPU_OK;
+}
+
+int CPU_set_accel(CPU *cpu, int slot, int accel)
+{
+	if (accel < CPU_ACCEL_DOT16 || accel > CPU_ACCEL_AES_ROUND)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	return CPU_set_accelerator(cpu, slot, ACCEL_builtins[accel], NULL);
+}
+
+int CPU_accel_function(const char *name)
+{
+	for (size_t i = 0; i < sizeof(ACCEL_names) / sizeof(ACCEL_names[0]); i++)
+	{
+		if (strcmp(ACCEL_names[i].name_, name) == 0)
+		{
+			return ACCEL_names[i].accel_;
+		}
+	}
+	return -1;
+}
+
+void CPU_get_accel_stats(const CPU *cpu, CPU_accel_stats *stats)
+{
+	*stats = cpu->accel_stats_;
+}
@@ -0,0 +1,456 @@
+/**
+ * Benchmark harness
+ *
+ * Runs every workload on every engine of the emulator, best of a few runs, and
+ * reports guest MIPS, host nanoseconds per guest instruction and the peak RSS of
+ * the emulator process. A run whose output does not match the checksum of its
+ * workload fails. The results are written as JSON (one result per line) for -c;
+ * -p adds the host performance counters (--perf) per guest instruction.
+ *
+ *   ./bench/bench [-r runs] [-p] [-o results.json] [-c previous.json] [-e engines] [-w workloads] ./hu_risc-v_emu
+ *
+ * Paths of the workloads are relative to the repository root.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_MAX_STEPS "--steps=100000000000"
+#define BENCH_MAX_RESULTS 256
+
+typedef struct
+{
+	const char *name_;
+	const char *instruction_mem_;
+	const char *data_mem_;
+	uint32_t checksum_;		 //of the output, see BENCH_checksum
+	const char *options_[3]; //extra emulator options, NULL terminated
+	int sweep_;				 //several instances (--sweep), also run on the lockstep engine
+} BENCH_workload;
+
+static const BENCH_workload BENCH_workloads[] = {
+	{"primzahlen", "ProgrammPrimzahlen/instruction_mem.bin", "ProgrammPrimzahlen/data_mem.bin", 0x24AA6DF2},
+	{"printf", "ProgrammEins/instruction_mem.bin", "ProgrammEins/data_mem.bin", 0x84B41180},
+	{"asmtest", "AssemblerTestProgramm/build/instruction_mem.bin", "AssemblerTestProgramm/build/data_mem.bin", 0x349030E2},
+	{"sieve", "bench/kernels/build/sieve/instruction_mem.bin", "bench/kernels/build/sieve/data_mem.bin", 0x5A4DDE80},
+	{"crc32", "bench/kernels/build/crc32/instruction_mem.bin", "bench/kernels/build/crc32/data_mem.bin", 0x1EDEAC3A},
+	{"matmul", "bench/kernels/build/matmul/instruction_mem.bin", "bench/kernels/build/matmul/data_mem.bin", 0x41CDC9C5},
+	{"qsort", "bench/kernels/build/qsort/instruction_mem.bin", "bench/kernels/build/qsort/data_mem.bin", 0x96D7877A},
+	{"coremark", "bench/kernels/build/coremark/instruction_mem.bin", "bench/kernels/build/coremark/data_mem.bin", 0x597C25B5},
+	//the same random accesses on huge page and small page backed RAM, -p shows the dTLB misses
+	{"randmem", "bench/kernels/build/randmem/instruction_mem.bin", "bench/kernels/build/randmem/data_mem.bin", 0x8F26E99D, {"--ram=64M"}},
+	{"randmem-4k", "bench/kernels/build/randmem/instruction_mem.bin", "bench/kernels/build/randmem/data_mem.bin", 0x8F26E99D,
+	 {"--ram=64M", "--no-hugepages"}},
+	//eight data memories, the instructions are the sum over all instances
+	{"sweep", "bench/kernels/build/sweep/instruction_mem.bin", "bench/kernels/build/sweep/data_mem.bin", 0x71E452AA,
+	 {"--sweep=bench/kernels/build/sweep/data_mem_2.bin,bench/kernels/build/sweep/data_mem_3.bin,"
+	  "bench/kernels/build/sweep/data_mem_4.bin,bench/kernels/build/sweep/data_mem_5.bin,"
+	  "bench/kernels/build/sweep/data_mem_6.bin,bench/kernels/build/sweep/data_mem_7.bin,"
+	  "bench/kernels/build/sweep/data_mem_8.bin"},
+	 1},
+	//one parallel kernel on one and on four harts (host threads)
+	{"smp-1", "bench/kernels/build/smp/instruction_mem.bin", "bench/kernels/build/smp/data_mem.bin", 0xB3651445},
+	{"smp-4", "bench/kernels/build/smp/instruction_mem.bin", "bench/kernels/build/smp/data_mem.bin", 0xB3651445, {"--harts=4"}},
+	//the -hle, -sw and vector variants retire other instruction counts than their twin: compare the seconds
+	{"strings", "bench/kernels/build/strings/instruction_mem.bin", "bench/kernels/build/strings/data_mem.bin", 0xF2550676},
+	{"strings-hle", "bench/kernels/build/strings/instruction_mem.bin", "bench/kernels/build/strings/data_mem.bin", 0xF2550676,
+	 {"--hle", "--symbols=bench/kernels/build/strings/strings.elf"}},
+	{"dma", "bench/kernels/build/dma/instruction_mem.bin", "bench/kernels/build/dma/data_mem.bin", 0x5B2E89E9},
+	{"files", "bench/kernels/build/files/instruction_mem.bin", "bench/kernels/build/files/data_mem.bin", 0x9EE6D1FD, {"--sandbox=."}},
+	{"accel-sw", "bench/kernels/build/accel/instruction_mem.bin", "bench/kernels/build/accel/data_mem.bin", 0xE805265F},
+	{"accel", "bench/kernels/build/accel/instruction_mem.bin", "bench/kernels/build/accel/data_mem_accel.bin", 0x658B963A, {"--accel"}},
+	{"float", "bench/kernels/build/float/instruction_mem.bin", "bench/kernels/build/float/data_mem.bin", 0x76CD104D},
+	{"vector-sw", "bench/kernels/build/vector/instruction_mem.bin", "bench/kernels/build/vector/data_mem.bin", 0xA58658CE},
+	{"vector", "bench/kernels/build/vector/instruction_mem.bin", "bench/kernels/build/vector/data_mem_vector.bin", 0xA58658CE},
+	{"os", "bench/kernels/build/os/instruction_mem.bin", "bench/kernels/build/os/data_mem.bin", 0x279C8DC1, {"--privileged"}},
+	{"disk", "bench/kernels/build/disk/instruction_mem.bin", "bench/kernels/build/disk/data_mem.bin", 0x9E9C3206,
+	 {"--blk=programmieraufgabe.pdf,ro"}},
+	{"guests-1000", "ProgrammEins/instruction_mem.bin", "ProgrammEins/data_mem.bin", 0xF36A8BB4, {"--guests=1000", "--no-hugepages"}},
+};
+
+#define BENCH_WORKLOAD_COUNT (sizeof(BENCH_workloads) / sizeof(BENCH_workloads[0]))
+
+//values of the --engine option of the emulator, lockstep only for sweeps
+static const char *BENCH_engines[] = {"interp", "predecode", "tiered", "lockstep"};
+
+#define BENCH_ENGINE_COUNT (sizeof(BENCH_engines) / sizeof(BENCH_engines[0]))
+
+//counters of the perf: line of the emulator
+static const char *BENCH_counters[] = {
+	"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses", "task_clock_ns", "page_faults"};
+
+#define BENCH_COUNTER_COUNT (sizeof(BENCH_counters) / sizeof(BENCH_counters[0]))
+
+typedef struct
+{
+	char workload_[32];
+	char engine_[32];
+	unsigned long long instructions_;
+	double seconds_;
+	double mips_;
+	long peak_rss_kib_;
+	long long counters_[BENCH_COUNTER_COUNT]; //-1 if not measured
+} BENCH_result;
+
+//"all" or name in a comma separated list
+static int BENCH_selected(const char *list, const char *name)
+{
+	size_t length = strlen(name);
+	if (strcmp(list, "all") == 0)
+	{
+		return 1;
+	}
+	for (const char *item = list; *item;)
+	{
+		size_t item_length = strcspn(item, ",");
+		if (item_length == length && strncmp(item, name, length) == 0)
+		{
+			return 1;
+		}
+		item += item_length;
+		if (*item == ',')
+		{
+			item++;
+		}
+	}
+	return 0;
+}
+
+//"perf: cycles=123 instructions=456 ..."
+static void BENCH_parse_counters(const char *line, BENCH_result *result)
+{
+	for (const char *item = strchr(line, ' '); item; item = strchr(item + 1, ' '))
+	{
+		for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++)
+		{
+			size_t length = strlen(BENCH_counters[i]);
+			if (strncmp(item + 1, BENCH_counters[i], length) == 0 && item[1 + length] == '=')
+			{
+				result->counters_[i] = strtoll(item + 2 + length, NULL, 10);
+			}
+		}
+	}
+}
+
+/**
+ * FNV-1a of the output of the emulator without the register dumps, which
+ * differ between runs when harts race for work; the console output of the guest
+ * and the lines of the emulator around it stay in.
+ */
+static uint32_t BENCH_checksum(FILE *output)
+{
+	uint32_t hash = 2166136261u;
+	char line[4096];
+	int registers = 0;
+	unsigned index, value;
+	char end;
+	while (fgets(line, sizeof(line), output))
+	{
+		if (strcmp(line, "Regfile values:\n") == 0)
+		{
+			registers = 1;
+			continue;
+		}
+		if (registers && sscanf(line, "%u: %X%c", &index, &value, &end) == 3 && end == '\n')
+		{
+			continue;
+		}
+		registers = 0;
+		for (const char *c = line; *c; c++)
+		{
+			hash = (hash ^ (uint8_t)*c) * 16777619u;
+		}
+	}
+	return hash;
+}
+
+//one run of the emulator, the stats line comes back through a pipe on stderr and the output in a temporary file
+static int BENCH_run(const char *emulator, const BENCH_workload *workload, const char *engine, int perf, BENCH_result *result)
+{
+	for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++)
+	{
+		result->counters_[i] = -1;
+	}
+
+	char engine_option[64];
+	snprintf(engine_option, sizeof(engine_option), "--engine=%s", engine);
+
+	int fds[2];
+	fflush(stdout); //the child must not inherit buffered output
+	FILE *output = tmpfile();
+	if (!output)
+	{
+		perror("tmpfile");
+		return -1;
+	}
+	if (pipe(fds) == -1)
+	{
+		perror("pipe");
+		fclose(output);
+		return -1;
+	}
+	pid_t pid = fork();
+	if (pid == -1)
+	{
+		perror("fork");
+		fclose(output);
+		return -1;
+	}
+	if (pid == 0)
+	{
+		dup2(fileno(output), STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		const char *args[16] = {emulator, workload->instruction_mem_, workload->data_mem_, engine_option, BENCH_MAX_STEPS, "--stats"};
+		int count = 6;
+		for (int i = 0; workload->options_[i]; i++)
+		{
+			args[count++] = workload->options_[i];
+		}
+		if (perf)
+		{
+			args[count++] = "--perf";
+		}
+		execv(emulator, (char *const *)args);
+		_exit(127);
+	}
+	close(fds[1]);
+
+	FILE *errors = fdopen(fds[0], "r");
+	char line[512];
+	int found = 0;
+	while (fgets(line, sizeof(line), errors))
+	{
+		if (sscanf(line, "stats: instructions=%llu seconds=%lf mips=%lf", &result->instructions_, &result->seconds_, &result->mips_) == 3)
+		{
+			found = 1;
+		}
+		else if (strncmp(line, "perf:", 5) == 0)
+		{
+			BENCH_parse_counters(line, result);
+		}
+	}
+	fclose(errors);
+
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !found)
+	{
+		fprintf(stderr, "%s on %s failed\n", workload->name_, engine);
+		fclose(output);
+		return -1;
+	}
+	result->peak_rss_kib_ = usage.ru_maxrss;
+
+	rewind(output);
+	uint32_t checksum = BENCH_checksum(output);
+	fclose(output);
+	if (checksum != workload->checksum_)
+	{
+		fprintf(stderr, "%s on %s: output checksum %08X, expected %08X\n", workload->name_, engine, checksum, workload->checksum_);
+		return -1;
+	}
+	return 0;
+}
+
+static void BENCH_write(const char *path, const BENCH_result *results, int count)
+{
+	FILE *out = fopen(path, "w");
+	if (!out)
+	{
+		perror(path);
+		return;
+	}
+
+	char commit[64] = "unknown";
+	FILE *git = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+	if (git)
+	{
+		if (fgets(commit, sizeof(commit), git))
+		{
+			commit[strcspn(commit, "\n")] = '\0';
+		}
+		pclose(git);
+	}
+
+	fprintf(out, "{\n\"commit\": \"%s\",\n\"time\": %lld,\n\"results\": [\n", commit, (long long)time(NULL));
+	for (int i = 0; i < count; i++)
+	{
+		const BENCH_result *result = &results[i];
+		fprintf(out, "{\"workload\": \"%s\", \"engine\": \"%s\", \"instructions\": %llu, \"seconds\": %.9f, \"mips\": %.3f, \"ns_per_instruction\": %.3f, \"peak_rss_kib\": %ld",
+				result->workload_, result->engine_, result->instructions_, result->seconds_, result->mips_,
+				result->instructions_ ? result->seconds_ * 1e9 / result->instructions_ : 0.0, result->peak_rss_kib_);
+		for (size_t j = 0; j < BENCH_COUNTER_COUNT; j++)
+		{
+			if (result->counters_[j] >= 0)
+			{
+				fprintf(out, ", \"host_%s\": %lld", BENCH_counters[j], result->counters_[j]);
+			}
+		}
+		fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+	}
+	fprintf(out, "]\n}\n");
+	fclose(out);
+}
+
+//reads the results of an earlier BENCH_write
+static int BENCH_read(const char *path, BENCH_result *results, int max)
+{
+	FILE *in = fopen(path, "r");
+	if (!in)
+	{
+		perror(path);
+		return 0;
+	}
+	char line[512];
+	int count = 0;
+	while (count < max && fgets(line, sizeof(line), in))
+	{
+		BENCH_result *result = &results[count];
+		if (sscanf(line, "{\"workload\": \"%31[^\"]\", \"engine\": \"%31[^\"]\", \"instructions\": %llu, \"seconds\": %lf, \"mips\": %lf",
+				   result->workload_, result->engine_, &result->instructions_, &result->seconds_, &result->mips_) == 5)
+		{
+			count++;
+		}
+	}
+	fclose(in);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	int runs = 3;
+	int perf = 0;
+	const char *output = "bench_results.json";
+	const char *previous = NULL;
+	const char *engines = "all";
+	const char *workloads = "all";
+	int option;
+
+	while ((option = getopt(argc, argv, "r:po:c:e:w:")) != -1)
+	{
+		switch (option)
+		{
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 'p':
+			perf = 1;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'c':
+			previous = optarg;
+			break;
+		case 'e':
+			engines = optarg;
+			break;
+		case 'w':
+			workloads = optarg;
+			break;
+		default:
+			return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc || runs < 1)
+	{
+		printf("usage: %s [-r runs] [-p] [-o results.json] [-c previous.json] [-e engines] [-w workloads] <emulator>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *emulator = argv[optind];
+
+	BENCH_result results[BENCH_MAX_RESULTS];
+	BENCH_result before[BENCH_MAX_RESULTS];
+	int count = 0;
+	int before_count = previous ? BENCH_read(previous, before, BENCH_MAX_RESULTS) : 0;
+	int failed = 0;
+
+	printf("%-12s %-10s %14s %10s %10s %10s %9s\n", "workload", "engine", "instructions", "seconds", "MIPS", "ns/instr", "RSS KiB");
+	for (size_t w = 0; w < BENCH_WORKLOAD_COUNT; w++)
+	{
+		if (!BENCH_selected(workloads, BENCH_workloads[w].name_))
+		{
+			continue;
+		}
+		for (size_t e = 0; e < BENCH_ENGINE_COUNT && count < BENCH_MAX_RESULTS; e++)
+		{
+			if (!BENCH_selected(engines, BENCH_engines[e]) ||
+				(strcmp(BENCH_engines[e], "lockstep") == 0 && !BENCH_workloads[w].sweep_))
+			{
+				continue;
+			}
+			BENCH_result *best = &results[count];
+			memset(best, 0, sizeof(BENCH_result));
+			for (int r = 0; r < runs; r++)
+			{
+				BENCH_result run;
+				if (BENCH_run(emulator, &BENCH_workloads[w], BENCH_engines[e], perf, &run) != 0)
+				{
+					failed = 1;
+					break;
+				}
+				if (r == 0 || run.seconds_ < best->seconds_)
+				{
+					*best = run;
+				}
+			}
+			if (best->instructions_ == 0)
+			{
+				continue;
+			}
+			snprintf(best->workload_, sizeof(best->workload_), "%s", BENCH_workloads[w].name_);
+			snprintf(best->engine_, sizeof(best->engine_), "%s", BENCH_engines[e]);
+			printf("%-12s %-10s %14llu %10.4f %10.2f %10.3f %9ld", best->workload_, best->engine_, best->instructions_,
+				   best->seconds_, best->mips_, best->seconds_ * 1e9 / best->instructions_, best->peak_rss_kib_);
+			for (int i = 0; i < before_count; i++)
+			{
+				if (strcmp(before[i].workload_, best->workload_) == 0 && strcmp(before[i].engine_, best->engine_) == 0 && before[i].mips_ > 0)
+				{
+					printf("  %+.1f%%", 100.0 * (best->mips_ / before[i].mips_ - 1.0));
+				}
+			}
+			printf("\n");
+			count++;
+		}
+	}
+
+	if (perf)
+	{
+		//n/a where the host (or a VM) does not expose the counter
+		printf("\nhost events per guest instruction:\n%-12s %-10s %10s %10s %12s %12s %12s %12s\n", "workload", "engine",
+			   "cycles", "instr", "br-miss/1k", "L1D-miss/1k", "LLC-miss/1k", "dTLB-miss/1k");
+		for (int i = 0; i < count; i++)
+		{
+			const BENCH_result *result = &results[i];
+			double guest = (double)result->instructions_;
+			printf("%-12s %-10s", result->workload_, result->engine_);
+			for (size_t j = 0; j < 6; j++)
+			{
+				int width = j < 2 ? 10 : 12;
+				if (result->counters_[j] < 0)
+				{
+					printf(" %*s", width, "n/a");
+				}
+				else
+				{
+					printf(" %*.3f", width, result->counters_[j] / guest * (j < 2 ? 1.0 : 1000.0));
+				}
+			}
+			printf("\n");
+		}
+	}
+
+	BENCH_write(output, results, count);
+	printf("\nresults written to %s\n", output);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Builds the prebuilt images in build/ without a RISC-V gcc: every kernel is a
+# single position independent .text section (data only through absolute
+# addresses), so assembling and copying the sections out is the whole link.
+# With riscv32-unknown-elf-gcc installed, the Makefile does the same.
+set -e
+cd "$(dirname "$0")"
+for kernel in sieve crc32 matmul qsort coremark randmem sweep smp strings dma files disk accel float vector os; do
+	mkdir -p build/$kernel
+	llvm-mc -triple=riscv32 -mattr=-relax,+a,+f,+d,+zve32x -filetype=obj -o build/$kernel/$kernel.o $kernel.S
+	llvm-objcopy -O binary -j .text build/$kernel/$kernel.o build/$kernel/instruction_mem.bin
+	llvm-objcopy -O binary -j .data build/$kernel/$kernel.o build/$kernel/data_mem.bin
+	# the symbols of strings name the functions for --hle
+	if [ $kernel = strings ]; then
+		mv build/$kernel/$kernel.o build/$kernel/$kernel.elf
+	else
+		rm build/$kernel/$kernel.o
+	fi
+done
+# data memories of the other seeds of the sweep kernel
+for seed in 2 3 4 5 6 7 8; do
+	llvm-mc -triple=riscv32 -mattr=-relax -filetype=obj --defsym SEED=$seed -o build/sweep/sweep.o sweep.S
+	llvm-objcopy -O binary -j .data build/sweep/sweep.o build/sweep/data_mem_$seed.bin
+	rm build/sweep/sweep.o
+done
+# the data memory of the accel kernel that uses the custom instructions
+llvm-mc -triple=riscv32 -mattr=-relax -filetype=obj --defsym ACCEL=1 -o build/accel/accel.o accel.S
+llvm-objcopy -O binary -j .data build/accel/accel.o build/accel/data_mem_accel.bin
+rm build/accel/accel.o
+# the data memory of the vector kernel that uses the V extension
+llvm-mc -triple=riscv32 -mattr=-relax,+zve32x -filetype=obj --defsym VECTOR=1 -o build/vector/vector.o vector.S
+llvm-objcopy -O binary -j .data build/vector/vector.o build/vector/data_mem_vector.bin
+rm build/vector/vector.o
@@ -0,0 +1,341 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Block device
+ *
+ * A thread per device serves the queue of the guest (layout in hurv.h) with
+ * pread and pwrite straight into the data memory, so the guest runs on while
+ * the host does the I/O. A byte to CPU_BLK_NOTIFY only wakes the thread; it
+ * takes avail with acquire, serves the requests in order and publishes each
+ * one with a release store of used, then sets bit 0 of the ISR. The thread
+ * keeps its own position in the queue, the guest cannot move it back.
+ */
+
+#define BLK_MAX_QUEUE 1024
+
+struct BLK_device
+{
+	CPU *cpu_; //the memory owner
+	int fd_;
+	int writable_;
+	uint64_t sectors_;
+	pthread_t thread_;
+	pthread_mutex_t lock_;
+	pthread_cond_t work_; //a notify or stop
+	pthread_cond_t idle_; //a batch served
+	int notified_;
+	int busy_;
+	int stop_;
+	uint32_t next_; //requests served, the device side of used
+	CPU_blk_stats stats_;
+};
+
+static uint64_t BLK_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static BLK_device *BLK_of(const CPU *cpu)
+{
+	return (cpu->memory_owner_ ? cpu->memory_owner_ : cpu)->blk_;
+}
+
+static uint32_t BLK_read(const CPU *cpu, uint32_t addr)
+{
+	uint32_t value;
+	memcpy(&value, cpu->data_mem_ + addr, 4);
+	return value;
+}
+
+static void BLK_write(CPU *cpu, uint32_t addr, uint32_t value)
+{
+	memcpy(cpu->data_mem_ + addr, &value, 4);
+}
+
+//the whole length or an error, pread and pwrite may do less at once
+static int BLK_transfer(BLK_device *dev, int out, uint8_t *buffer, uint64_t length, uint64_t offset)
+{
+	while (length)
+	{
+		ssize_t done = out ? pwrite(dev->fd_, buffer, length, offset) : pread(dev->fd_, buffer, length, offset);
+		if (done < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (done <= 0)
+		{
+			return 0;
+		}
+		buffer += done;
+		length -= done;
+		offset += done;
+	}
+	return 1;
+}
+
+//one request, returns its status
+static uint32_t BLK_serve(BLK_device *dev, uint32_t request, CPU_blk_stats *stats)
+{
+	CPU *cpu = dev->cpu_;
+	uint32_t type = BLK_read(cpu, request);
+	uint64_t sector = BLK_read(cpu, request + 4);
+	uint32_t buffer = BLK_read(cpu, request + 8);
+	uint32_t length = BLK_read(cpu, request + 12);
+
+	if (type == CPU_BLK_FLUSH)
+	{
+		return !dev->writable_ || fdatasync(dev->fd_) == 0 ? CPU_BLK_OK : CPU_BLK_IOERR;
+	}
+	if (type != CPU_BLK_IN && type != CPU_BLK_OUT)
+	{
+		return CPU_BLK_UNSUPP;
+	}
+	if (length % CPU_BLK_SECTOR || sector + length / CPU_BLK_SECTOR > dev->sectors_ ||
+		(uint64_t)buffer + length > cpu->data_mem_size_ || (type == CPU_BLK_OUT && !dev->writable_))
+	{
+		return CPU_BLK_IOERR;
+	}
+	if (!BLK_transfer(dev, type == CPU_BLK_OUT, cpu->data_mem_ + buffer, length, sector * CPU_BLK_SECTOR))
+	{
+		return CPU_BLK_IOERR;
+	}
+	if (type == CPU_BLK_OUT)
+	{
+		stats->written_ += length;
+	}
+	else
+	{
+		stats->read_ += length;
+	}
+	return CPU_BLK_OK;
+}
+
+//all requests the guest added so far; a queue that does not fit is not served
+static void BLK_serve_queue(BLK_device *dev, CPU_blk_stats *stats)
+{
+	CPU *cpu = dev->cpu_;
+	if (cpu->data_mem_size_ < CPU_BLK_ISR + 4)
+	{
+		return;
+	}
+	uint32_t queue = BLK_read(cpu, CPU_BLK_QUEUE);
+	uint32_t size = BLK_read(cpu, CPU_BLK_QUEUE_SIZE);
+	if (!size || size > BLK_MAX_QUEUE || (size & (size - 1)) || (queue & 3) ||
+		(uint64_t)queue + 20 * size + 8 > cpu->data_mem_size_)
+	{
+		return;
+	}
+	uint32_t *avail = (uint32_t *)(cpu->data_mem_ + queue + 16 * size);
+	uint32_t *used = avail + 1;
+	uint32_t *status = avail + 2;
+	uint32_t end;
+
+	while ((end = __atomic_load_n(avail, __ATOMIC_ACQUIRE)) != dev->next_)
+	{
+		for (; dev->next_ != end; dev->next_++)
+		{
+			uint32_t slot = dev->next_ & (size - 1);
+			uint32_t result = BLK_serve(dev, queue + 16 * slot, stats);
+			stats->requests_++;
+			stats->errors_ += result != CPU_BLK_OK;
+			status[slot] = result;
+			__atomic_store_n(used, dev->next_ + 1, __ATOMIC_RELEASE);
+		}
+		__atomic_fetch_or((uint32_t *)(cpu->data_mem_ + CPU_BLK_ISR), 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void *BLK_main(void *arg)
+{
+	BLK_device *dev = arg;
+
+	pthread_mutex_lock(&dev->lock_);
+	while (!dev->stop_)
+	{
+		if (!dev->notified_)
+		{
+			pthread_cond_wait(&dev->work_, &dev->lock_);
+			continue;
+		}
+		dev->notified_ = 0;
+		dev->busy_ = 1;
+		pthread_mutex_unlock(&dev->lock_);
+
+		CPU_blk_stats stats = {0};
+		uint64_t start = BLK_now();
+		BLK_serve_queue(dev, &stats);
+		stats.busy_ns_ = BLK_now() - start;
+
+		pthread_mutex_lock(&dev->lock_);
+		dev->stats_.requests_ += stats.requests_;
+		dev->stats_.errors_ += stats.errors_;
+		dev->stats_.read_ += stats.read_;
+		dev->stats_.written_ += stats.written_;
+		dev->stats_.busy_ns_ += stats.busy_ns_;
+		dev->busy_ = 0;
+		pthread_cond_broadcast(&dev->idle_);
+	}
+	pthread_mutex_unlock(&dev->lock_);
+	return NULL;
+}
+
+//with the lock held
+static void BLK_wait_idle(BLK_device *dev)
+{
+	while (dev->busy_ || dev->notified_)
+	{
+		pthread_cond_wait(&dev->idle_, &dev->lock_);
+	}
+}
+
+void BLK_notify(CPU *cpu)
+{
+	BLK_device *dev = BLK_of(cpu);
+	if (!dev)
+	{
+		return;
+	}
+	pthread_mutex_lock(&dev->lock_);
+	dev->notified_ = 1;
+	pthread_cond_signal(&dev->work_);
+	pthread_mutex_unlock(&dev->lock_);
+}
+
+void BLK_reset(CPU *cpu)
+{
+	BLK_device *dev = cpu->blk_;
+	if (!dev)
+	{
+		return;
+	}
+	pthread_mutex_lock(&dev->lock_);
+	BLK_wait_idle(dev);
+	dev->next_ = 0;
+	pthread_mutex_unlock(&dev->lock_);
+}
+
+void BLK_publish(CPU *cpu)
+{
+	BLK_device *dev = cpu->blk_;
+	if (!dev || cpu->data_mem_size_ < CPU_BLK_CAPACITY + 8)
+	{
+		return;
+	}
+	BLK_write(cpu, CPU_BLK_CAPACITY, (uint32_t)dev->sectors_);
+	BLK_write(cpu, CPU_BLK_CAPACITY + 4, (uint32_t)(dev->sectors_ >> 32));
+}
+
+void BLK_detach(CPU *cpu)
+{
+	BLK_device *dev = cpu->blk_;
+	if (!dev)
+	{
+		return;
+	}
+	pthread_mutex_lock(&dev->lock_);
+	BLK_wait_idle(dev);
+	dev->stop_ = 1;
+	pthread_cond_signal(&dev->work_);
+	pthread_mutex_unlock(&dev->lock_);
+	pthread_join(dev->thread_, NULL);
+	pthread_cond_destroy(&dev->work_);
+	pthread_cond_destroy(&dev->idle_);
+	pthread_mutex_destroy(&dev->lock_);
+	close(dev->fd_);
+	free(dev);
+	cpu->blk_ = NULL;
+}
+
+int CPU_attach_block(CPU *cpu, const char *path, int writable)
+{
+	if (cpu->memory_owner_ || cpu->blk_)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	int fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return CPU_ERROR_OPEN;
+	}
+	BLK_device *dev = calloc(1, sizeof(BLK_device));
+	if (!dev)
+	{
+		close(fd);
+		return CPU_ERROR_MEMORY;
+	}
+	dev->cpu_ = cpu;
+	dev->fd_ = fd;
+	dev->writable_ = writable;
+	dev->sectors_ = (uint64_t)st.st_size / CPU_BLK_SECTOR;
+	pthread_mutex_init(&dev->lock_, NULL);
+	pthread_cond_init(&dev->work_, NULL);
+	pthread_cond_init(&dev->idle_, NULL);
+	if (pthread_create(&dev->thread_, NULL, BLK_main, dev) != 0)
+	{
+		pthread_cond_destroy(&dev->work_);
+		pthread_cond_destroy(&dev->idle_);
+		pthread_mutex_destroy(&dev->lock_);
+		close(fd);
+		free(dev);
+		return CPU_ERROR_MEMORY;
+	}
+	cpu->blk_ = dev;
+	BLK_publish(cpu);
+	return CPU_OK;
+}
+
+int BLK_pending(const CPU *cpu)
+{
+	return BLK_of(cpu) && cpu->data_mem_size_ >= CPU_BLK_ISR + 4 &&
+		   (__atomic_load_n((uint32_t *)(cpu->data_mem_ + CPU_BLK_ISR), __ATOMIC_ACQUIRE) & 1);
+}
+
+int CPU_blk_wait(CPU *cpu)
+{
+	BLK_device *dev = BLK_of(cpu);
+	if (!dev)
+	{
+		return 0;
+	}
+	pthread_mutex_lock(&dev->lock_);
+	BLK_wait_idle(dev);
+	pthread_mutex_unlock(&dev->lock_);
+	if (!cpu->waiting_ || !BLK_pending(cpu))
+	{
+		return 0;
+	}
+	cpu->waiting_ = 0;
+	return 1;
+}
+
+void CPU_get_blk_stats(const CPU *cpu, CPU_blk_stats *stats)
+{
+	BLK_device *dev = BLK_of(cpu);
+	memset(stats, 0, sizeof(*stats));
+	if (!dev)
+	{
+		return;
+	}
+	pthread_mutex_lock(&dev->lock_);
+	*stats = dev->stats_;
+	pthread_mutex_unlock(&dev->lock_);
+}
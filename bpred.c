@@ -0,0 +1,566 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Branch predictor simulation
+ *
+ * Every conditional branch (BEQ..BGEU) and every call/return through JAL1/JALR1
+ * is shown to all enabled predictors, so several of them can be compared in one
+ * run. The predictors only model the prediction, the guest program is not affected.
+ */
+
+#define BP_MAX_PREDICTORS 8
+#define BP_TABLE_BITS 12 //entries of the bimodal/gshare/TAGE base tables: 2^12
+#define BP_RAS_DEPTH 16
+#define BP_REPORT_TOP 20 //number of branch PCs in the per-PC table
+
+typedef struct
+{
+	const char *name_;
+	void *(*create_)(void); //NULL for predictors without state, returns NULL when out of memory
+	//conditional branches, NULL for predictors that only handle returns
+	//update_ is always called right after predict_ for the same branch
+	int (*predict_)(void *state, uint32_t pc, uint32_t target);
+	void (*update_)(void *state, uint32_t pc, int taken);
+	//calls and returns, NULL for pure direction predictors
+	void (*call_)(void *state, uint32_t return_pc);
+	uint32_t (*return_)(void *state);
+} BP_ops;
+
+typedef struct
+{
+	const BP_ops *ops_;
+	void *state_;
+	uint64_t lookups_;
+	uint64_t mispredicts_;
+	uint64_t *pc_mispredicts_; //per control transfer, indexed like the instruction memory
+} BP_predictor;
+
+struct BP_sim
+{
+	BP_predictor predictors_[BP_MAX_PREDICTORS];
+	int count_;
+	const uint8_t *instr_mem_;
+	size_t pcs_;
+	uint64_t *pc_executed_;
+	uint64_t *pc_taken_;
+};
+
+//index of a pc in the per-PC tables, same masking as the instruction fetch
+static size_t BP_pc_index(uint32_t pc)
+{
+	return (pc & 0xFFFFF) >> 2;
+}
+
+//saturating 2 bit counter, taken if >= 2
+static void BP_counter_update(uint8_t *counter, int taken)
+{
+	if (taken && *counter < 3)
+	{
+		(*counter)++;
+	}
+	else if (!taken && *counter > 0)
+	{
+		(*counter)--;
+	}
+}
+
+//static: backward taken, forward not taken, without state
+static int BTFN_predict(void *state, uint32_t pc, uint32_t target)
+{
+	return target < pc;
+}
+
+static void BTFN_update(void *state, uint32_t pc, int taken)
+{
+}
+
+//bimodal: one 2 bit counter per (hashed) branch address
+typedef struct
+{
+	uint8_t counters_[1 << BP_TABLE_BITS];
+} Bimodal_state;
+
+static void *Bimodal_create(void)
+{
+	Bimodal_state *state = malloc(sizeof(Bimodal_state));
+	if (state)
+	{
+		memset(state->counters_, 1, sizeof(state->counters_)); //weakly not taken
+	}
+	return state;
+}
+
+static int Bimodal_predict(void *state, uint32_t pc, uint32_t target)
+{
+	Bimodal_state *bimodal = state;
+	return bimodal->counters_[(pc >> 2) & ((1 << BP_TABLE_BITS) - 1)] >= 2;
+}
+
+static void Bimodal_update(void *state, uint32_t pc, int taken)
+{
+	Bimodal_state *bimodal = state;
+	BP_counter_update(&bimodal->counters_[(pc >> 2) & ((1 << BP_TABLE_BITS) - 1)], taken);
+}
+
+//gshare: 2 bit counters indexed by branch address xor global history
+typedef struct
+{
+	uint8_t counters_[1 << BP_TABLE_BITS];
+	uint32_t history_;
+} Gshare_state;
+
+static void *Gshare_create(void)
+{
+	Gshare_state *state = malloc(sizeof(Gshare_state));
+	if (state)
+	{
+		memset(state->counters_, 1, sizeof(state->counters_));
+		state->history_ = 0;
+	}
+	return state;
+}
+
+static uint32_t Gshare_index(Gshare_state *gshare, uint32_t pc)
+{
+	return ((pc >> 2) ^ gshare->history_) & ((1 << BP_TABLE_BITS) - 1);
+}
+
+static int Gshare_predict(void *state, uint32_t pc, uint32_t target)
+{
+	Gshare_state *gshare = state;
+	return gshare->counters_[Gshare_index(gshare, pc)] >= 2;
+}
+
+static void Gshare_update(void *state, uint32_t pc, int taken)
+{
+	Gshare_state *gshare = state;
+	BP_counter_update(&gshare->counters_[Gshare_index(gshare, pc)], taken);
+	gshare->history_ = (gshare->history_ << 1) | (taken ? 1 : 0);
+}
+
+//TAGE-lite: bimodal base predictor plus tagged tables with geometric history lengths
+#define TAGE_TABLES 4
+#define TAGE_INDEX_BITS (BP_TABLE_BITS - 2)
+#define TAGE_TAG_BITS 9
+#define TAGE_U_RESET_PERIOD (1 << 18) //branches between usefulness decays
+
+static const int TAGE_history_length[TAGE_TABLES] = {5, 12, 27, 60};
+
+typedef struct
+{
+	int8_t counter_; //3 bit signed, taken if >= 0
+	uint16_t tag_;
+	uint8_t useful_;
+} TAGE_entry;
+
+typedef struct
+{
+	uint8_t base_[1 << BP_TABLE_BITS];
+	TAGE_entry tables_[TAGE_TABLES][1 << TAGE_INDEX_BITS];
+	uint64_t history_;
+	uint64_t branches_;
+	//lookup of the last predict_, reused by update_
+	uint32_t index_[TAGE_TABLES];
+	uint16_t tag_[TAGE_TABLES];
+	int provider_;
+	int provider_prediction_;
+	int alt_prediction_;
+} TAGE_state;
+
+//xor folds the youngest length bits of the history down to bits bits
+static uint32_t TAGE_fold(uint64_t history, int length, int bits)
+{
+	uint64_t remaining = length < 64 ? history & ((1ull << length) - 1) : history;
+	uint32_t folded = 0;
+	while (remaining)
+	{
+		folded ^= remaining & ((1u << bits) - 1);
+		remaining >>= bits;
+	}
+	return folded;
+}
+
+static void *TAGE_create(void)
+{
+	TAGE_state *state = calloc(1, sizeof(TAGE_state));
+	if (state)
+	{
+		memset(state->base_, 1, sizeof(state->base_));
+	}
+	return state;
+}
+
+static int TAGE_predict(void *state, uint32_t pc, uint32_t target)
+{
+	TAGE_state *tage = state;
+	uint32_t address = pc >> 2;
+	int base_prediction = tage->base_[address & ((1 << BP_TABLE_BITS) - 1)] >= 2;
+
+	tage->provider_ = -1;
+	tage->provider_prediction_ = base_prediction;
+	tage->alt_prediction_ = base_prediction;
+	for (int i = 0; i < TAGE_TABLES; i++)
+	{
+		int length = TAGE_history_length[i];
+		tage->index_[i] = (address ^ (address >> TAGE_INDEX_BITS) ^ TAGE_fold(tage->history_, length, TAGE_INDEX_BITS)) & ((1 << TAGE_INDEX_BITS) - 1);
+		tage->tag_[i] = (address ^ TAGE_fold(tage->history_, length, TAGE_TAG_BITS) ^ (TAGE_fold(tage->history_, length, TAGE_TAG_BITS - 1) << 1)) & ((1 << TAGE_TAG_BITS) - 1);
+
+		TAGE_entry *entry = &tage->tables_[i][tage->index_[i]];
+		if (entry->tag_ == tage->tag_[i])
+		{
+			//longest matching history provides, the one before is the alternative
+			tage->alt_prediction_ = tage->provider_prediction_;
+			tage->provider_ = i;
+			tage->provider_prediction_ = entry->counter_ >= 0;
+		}
+	}
+	return tage->provider_prediction_;
+}
+
+static void TAGE_update(void *state, uint32_t pc, int taken)
+{
+	TAGE_state *tage = state;
+	int provider = tage->provider_;
+
+	if (provider >= 0)
+	{
+		TAGE_entry *entry = &tage->tables_[provider][tage->index_[provider]];
+		if (tage->provider_prediction_ != tage->alt_prediction_)
+		{
+			if (tage->provider_prediction_ == taken && entry->useful_ < 3)
+			{
+				entry->useful_++;
+			}
+			else if (tage->provider_prediction_ != taken && entry->useful_ > 0)
+			{
+				entry->useful_--;
+			}
+		}
+		if (taken && entry->counter_ < 3)
+		{
+			entry->counter_++;
+		}
+		else if (!taken && entry->counter_ > -4)
+		{
+			entry->counter_--;
+		}
+	}
+	else
+	{
+		BP_counter_update(&tage->base_[(pc >> 2) & ((1 << BP_TABLE_BITS) - 1)], taken);
+	}
+
+	//on a mispredict allocate an entry with a longer history
+	if (tage->provider_prediction_ != taken && provider < TAGE_TABLES - 1)
+	{
+		int allocated = 0;
+		for (int i = provider + 1; i < TAGE_TABLES && !allocated; i++)
+		{
+			TAGE_entry *entry = &tage->tables_[i][tage->index_[i]];
+			if (entry->useful_ == 0)
+			{
+				entry->tag_ = tage->tag_[i];
+				entry->counter_ = taken ? 0 : -1;
+				allocated = 1;
+			}
+		}
+		for (int i = provider + 1; i < TAGE_TABLES && !allocated; i++)
+		{
+			tage->tables_[i][tage->index_[i]].useful_--;
+		}
+	}
+
+	if (++tage->branches_ % TAGE_U_RESET_PERIOD == 0)
+	{
+		for (int i = 0; i < TAGE_TABLES; i++)
+		{
+			for (int j = 0; j < (1 << TAGE_INDEX_BITS); j++)
+			{
+				tage->tables_[i][j].useful_ >>= 1;
+			}
+		}
+	}
+	tage->history_ = (tage->history_ << 1) | (taken ? 1 : 0);
+}
+
+//return address stack, overwrites the oldest entry on overflow
+typedef struct
+{
+	uint32_t stack_[BP_RAS_DEPTH];
+	uint32_t top_; //number of pushes minus pops, wraps around the stack
+	uint32_t depth_;
+} RAS_state;
+
+static void *RAS_create(void)
+{
+	return calloc(1, sizeof(RAS_state));
+}
+
+static void RAS_call(void *state, uint32_t return_pc)
+{
+	RAS_state *ras = state;
+	ras->stack_[ras->top_++ % BP_RAS_DEPTH] = return_pc;
+	if (ras->depth_ < BP_RAS_DEPTH)
+	{
+		ras->depth_++;
+	}
+}
+
+static uint32_t RAS_return(void *state)
+{
+	RAS_state *ras = state;
+	if (ras->depth_ == 0)
+	{
+		return 0;
+	}
+	ras->depth_--;
+	return ras->stack_[--ras->top_ % BP_RAS_DEPTH];
+}
+
+static const BP_ops BP_available[] = {
+	{"btfn", NULL, BTFN_predict, BTFN_update, NULL, NULL},
+	{"bimodal", Bimodal_create, Bimodal_predict, Bimodal_update, NULL, NULL},
+	{"gshare", Gshare_create, Gshare_predict, Gshare_update, NULL, NULL},
+	{"tage", TAGE_create, TAGE_predict, TAGE_update, NULL, NULL},
+	{"ras", RAS_create, NULL, NULL, RAS_call, RAS_return},
+};
+
+#define BP_AVAILABLE_COUNT (sizeof(BP_available) / sizeof(BP_available[0]))
+
+//-1 if there is no room for another predictor or no memory for it
+static int BP_add(BP_sim *sim, const BP_ops *ops)
+{
+	if (sim->count_ == BP_MAX_PREDICTORS)
+	{
+		return -1;
+	}
+	//counted even if it fails, BP_destroy frees what was allocated
+	BP_predictor *predictor = &sim->predictors_[sim->count_++];
+	predictor->ops_ = ops;
+	predictor->state_ = ops->create_ ? ops->create_() : NULL;
+	predictor->pc_mispredicts_ = calloc(sim->pcs_ ? sim->pcs_ : 1, sizeof(uint64_t));
+	return (ops->create_ && !predictor->state_) || !predictor->pc_mispredicts_ ? -1 : 0;
+}
+
+//spec is "all" or a comma separated list of predictor names, e.g. "gshare,ras"
+BP_sim *BP_create(const char *spec, const CPU *cpu)
+{
+	BP_sim *sim = calloc(1, sizeof(BP_sim));
+	if (!sim)
+	{
+		return NULL;
+	}
+	sim->instr_mem_ = cpu->instr_mem_;
+	sim->pcs_ = cpu->instr_mem_size_ / 4;
+	sim->pc_executed_ = calloc(sim->pcs_ ? sim->pcs_ : 1, sizeof(uint64_t));
+	sim->pc_taken_ = calloc(sim->pcs_ ? sim->pcs_ : 1, sizeof(uint64_t));
+	if (!sim->pc_executed_ || !sim->pc_taken_)
+	{
+		BP_destroy(sim);
+		return NULL;
+	}
+
+	while (*spec)
+	{
+		size_t length = strcspn(spec, ",");
+		int all = length == 3 && strncmp(spec, "all", 3) == 0;
+		int found = all;
+		for (size_t i = 0; i < BP_AVAILABLE_COUNT; i++)
+		{
+			if (all)
+			{
+				found &= BP_add(sim, &BP_available[i]) == 0;
+			}
+			else if (strlen(BP_available[i].name_) == length && strncmp(spec, BP_available[i].name_, length) == 0)
+			{
+				found = BP_add(sim, &BP_available[i]) == 0;
+				break;
+			}
+		}
+		if (!found)
+		{
+			BP_destroy(sim);
+			return NULL;
+		}
+		spec += length;
+		if (*spec == ',')
+		{
+			spec++;
+		}
+	}
+	return sim;
+}
+
+void BP_destroy(BP_sim *sim)
+{
+	for (int i = 0; i < sim->count_; i++)
+	{
+		free(sim->predictors_[i].state_);
+		free(sim->predictors_[i].pc_mispredicts_);
+	}
+	free(sim->pc_executed_);
+	free(sim->pc_taken_);
+	free(sim);
+}
+
+//conditional branch at pc with its (static) target and the real outcome
+void BP_branch(BP_sim *sim, uint32_t pc, uint32_t target, int taken)
+{
+	size_t index = BP_pc_index(pc);
+	if (index >= sim->pcs_)
+	{
+		return;
+	}
+	sim->pc_executed_[index]++;
+	sim->pc_taken_[index] += taken;
+
+	for (int i = 0; i < sim->count_; i++)
+	{
+		BP_predictor *predictor = &sim->predictors_[i];
+		if (!predictor->ops_->predict_)
+		{
+			continue;
+		}
+		int prediction = predictor->ops_->predict_(predictor->state_, pc, target);
+		predictor->ops_->update_(predictor->state_, pc, taken);
+		predictor->lookups_++;
+		if (prediction != taken)
+		{
+			predictor->mispredicts_++;
+			predictor->pc_mispredicts_[index]++;
+		}
+	}
+}
+
+//x1 (ra) and x5 (t0) are link registers by the calling convention
+int BP_is_link(int8_t reg)
+{
+	return reg == 1 || reg == 5;
+}
+
+//JAL/JALR at pc, classified into call and return by the link register hints
+void BP_jump(BP_sim *sim, uint32_t pc, uint32_t instruction, uint32_t target)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int is_call = BP_is_link(rd);
+	int is_return = getOpCode(instruction) == JALR && BP_is_link(rs1) && !(is_call && rd == rs1);
+	size_t index = BP_pc_index(pc);
+
+	if (index >= sim->pcs_ || (!is_call && !is_return))
+	{
+		return;
+	}
+	if (is_return)
+	{
+		sim->pc_executed_[index]++;
+	}
+
+	for (int i = 0; i < sim->count_; i++)
+	{
+		BP_predictor *predictor = &sim->predictors_[i];
+		if (!predictor->ops_->call_)
+		{
+			continue;
+		}
+		if (is_return)
+		{
+			predictor->lookups_++;
+			if (predictor->ops_->return_(predictor->state_) != target)
+			{
+				predictor->mispredicts_++;
+				predictor->pc_mispredicts_[index]++;
+			}
+		}
+		if (is_call)
+		{
+			predictor->ops_->call_(predictor->state_, pc + 4);
+		}
+	}
+}
+
+typedef struct
+{
+	size_t index_;
+	uint64_t executed_;
+} BP_pc_count;
+
+static int BP_compare_executed(const void *a, const void *b)
+{
+	const BP_pc_count *left = a;
+	const BP_pc_count *right = b;
+	return left->executed_ < right->executed_ ? 1 : left->executed_ > right->executed_ ? -1 : 0;
+}
+
+void BP_report(BP_sim *sim, FILE *out)
+{
+	fprintf(out, "\n-----------------------branch predictor simulation------------------------\n");
+	fprintf(out, "%-10s %14s %14s %9s\n", "predictor", "lookups", "mispredicts", "rate");
+	for (int i = 0; i < sim->count_; i++)
+	{
+		BP_predictor *predictor = &sim->predictors_[i];
+		fprintf(out, "%-10s %14llu %14llu %8.2f%%\n", predictor->ops_->name_,
+				(unsigned long long)predictor->lookups_, (unsigned long long)predictor->mispredicts_,
+				predictor->lookups_ ? 100.0 * predictor->mispredicts_ / predictor->lookups_ : 0.0);
+	}
+
+	//hottest branches and returns, with the mispredict rate of every predictor that saw them
+	size_t used = 0;
+	BP_pc_count *counts = malloc((sim->pcs_ ? sim->pcs_ : 1) * sizeof(BP_pc_count));
+	if (!counts)
+	{
+		return;
+	}
+	for (size_t i = 0; i < sim->pcs_; i++)
+	{
+		if (sim->pc_executed_[i])
+		{
+			counts[used].index_ = i;
+			counts[used].executed_ = sim->pc_executed_[i];
+			used++;
+		}
+	}
+	qsort(counts, used, sizeof(BP_pc_count), BP_compare_executed);
+
+	fprintf(out, "\n%-8s %-6s %12s %7s", "pc", "kind", "executed", "taken");
+	for (int i = 0; i < sim->count_; i++)
+	{
+		fprintf(out, " %8s", sim->predictors_[i].ops_->name_);
+	}
+	fprintf(out, "\n");
+	for (size_t i = 0; i < used && i < BP_REPORT_TOP; i++)
+	{
+		size_t index = counts[i].index_;
+		uint64_t executed = counts[i].executed_;
+		int is_branch = getOpCode(*(uint32_t *)(sim->instr_mem_ + (index << 2))) == B;
+
+		fprintf(out, "%08zX %-6s %12llu", index << 2, is_branch ? "branch" : "return", (unsigned long long)executed);
+		if (is_branch)
+		{
+			fprintf(out, " %6.1f%%", 100.0 * sim->pc_taken_[index] / executed);
+		}
+		else
+		{
+			fprintf(out, " %7s", "-");
+		}
+		for (int j = 0; j < sim->count_; j++)
+		{
+			BP_predictor *predictor = &sim->predictors_[j];
+			if ((is_branch && predictor->ops_->predict_) || (!is_branch && predictor->ops_->return_))
+			{
+				fprintf(out, " %7.1f%%", 100.0 * predictor->pc_mispredicts_[index] / executed);
+			}
+			else
+			{
+				fprintf(out, " %8s", "-");
+			}
+		}
+		fprintf(out, "\n");
+	}
+	free(counts);
+}
@@ -0,0 +1,1837 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+#define CPU_INSTR_MEM_MAX 0x100000 //the instruction fetch masks the pc with 0xFFFFF
+#define CPU_HUGE_PAGE 0x200000
+
+void CPU_output_stdout(void *context, uint8_t byte)
+{
+	putchar((char)byte);
+}
+
+/**
+ * Guest RAM comes from mmap so it can be backed by huge pages: random accesses
+ * over a few MiB of guest memory otherwise miss the host dTLB all the time.
+ * Preallocated hugetlbfs pages (MAP_HUGETLB) are tried first, then transparent
+ * huge pages on a 2 MiB aligned mapping, the size is rounded up to 2 MiB for both.
+ */
+static int CPU_map_data_mem(CPU *cpu, size_t size, int flags)
+{
+	size_t mapped = (size + CPU_HUGE_PAGE - 1) & ~(size_t)(CPU_HUGE_PAGE - 1);
+	void *memory;
+
+	if (!(flags & CPU_MEM_NO_HUGEPAGES))
+	{
+		memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (memory != MAP_FAILED)
+		{
+			cpu->data_mem_ = memory;
+			cpu->data_mem_mapped_ = mapped;
+			cpu->data_mem_backing_ = CPU_BACKING_HUGETLB;
+			return CPU_OK;
+		}
+
+		//over-allocate by one huge page and cut the mapping to an aligned one
+		uint8_t *raw = mmap(NULL, mapped + CPU_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw == MAP_FAILED)
+		{
+			return CPU_ERROR_MEMORY;
+		}
+		uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + CPU_HUGE_PAGE - 1) & ~(uintptr_t)(CPU_HUGE_PAGE - 1));
+		if (aligned > raw)
+		{
+			munmap(raw, aligned - raw);
+		}
+		munmap(aligned + mapped, raw + CPU_HUGE_PAGE - aligned);
+		cpu->data_mem_ = aligned;
+		cpu->data_mem_mapped_ = mapped;
+		cpu->data_mem_backing_ = madvise(aligned, mapped, MADV_HUGEPAGE) == 0 ? CPU_BACKING_THP : CPU_BACKING_SMALL;
+		return CPU_OK;
+	}
+
+	mapped = (size + 0xFFF) & ~(size_t)0xFFF;
+	memory = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		return CPU_ERROR_MEMORY;
+	}
+#ifdef MADV_NOHUGEPAGE
+	madvise(memory, mapped, MADV_NOHUGEPAGE);
+#endif
+	cpu->data_mem_ = memory;
+	cpu->data_mem_mapped_ = mapped;
+	cpu->data_mem_backing_ = CPU_BACKING_SMALL;
+	return CPU_OK;
+}
+
+//creates an empty cpu with data_mem_size bytes of guest RAM, CPU_load gives it a program
+CPU *CPU_create_with_memory(size_t data_mem_size, int flags)
+{
+	//guest addresses are 32 bit
+	if (data_mem_size == 0 || data_mem_size > CPU_MAX_DATA_MEM_SIZE)
+	{
+		return NULL;
+	}
+	CPU *cpu = (CPU *)calloc(1, sizeof(CPU));
+	if (!cpu)
+	{
+		return NULL;
+	}
+	cpu->data_mem_size_ = data_mem_size;
+	cpu->data_limit_ = data_mem_size;
+	if (CPU_map_data_mem(cpu, data_mem_size, flags) != CPU_OK)
+	{
+		free(cpu);
+		return NULL;
+	}
+	cpu->pc_ = 0x0;
+	cpu->output_ = CPU_output_stdout;
+	cpu->tier_thresholds_[CPU_TIER_INTERP] = CPU_DEFAULT_PREDECODE_THRESHOLD;
+	cpu->tier_thresholds_[CPU_TIER_PREDECODE] = CPU_DEFAULT_TRANSLATE_THRESHOLD;
+	cpu->ir_optimize_ = 1;
+	return cpu;
+}
+
+CPU *CPU_create(void)
+{
+	return CPU_create_with_memory(CPU_DEFAULT_DATA_MEM_SIZE, CPU_MEM_DEFAULT);
+}
+
+void CPU_destroy(CPU *cpu)
+{
+	if (!cpu)
+	{
+		return;
+	}
+	if (cpu->decoded_)
+	{
+		DCACHE_save(cpu);
+		CPU_decoded_destroy(cpu->decoded_);
+	}
+	free(cpu->decode_cache_);
+	HLE_clear(cpu);
+	SYS_clear(cpu);
+	BLK_detach(cpu);
+	CPU_set_privileged(cpu, 0);
+	if (cpu->tcache_owned_)
+	{
+		TCACHE_destroy(cpu->tcache_);
+	}
+	//a hart only borrows the memory of its boot hart
+	if (!cpu->memory_owner_)
+	{
+		free(cpu->instr_mem_);
+		munmap(cpu->data_mem_, cpu->data_mem_mapped_);
+		free(cpu->data_image_);
+	}
+	free(cpu);
+}
+
+//reads a whole file into a new buffer
+static int CPU_read_file(const char *filename, uint8_t **data, size_t *size)
+{
+	FILE *input_file = fopen(filename, "rb");
+	if (!input_file)
+	{
+		return CPU_ERROR_OPEN;
+	}
+	struct stat sb;
+	if (fstat(fileno(input_file), &sb) == -1)
+	{
+		fclose(input_file);
+		return CPU_ERROR_OPEN;
+	}
+	*size = sb.st_size;
+	*data = malloc(*size ? *size : 1);
+	if (!*data)
+	{
+		fclose(input_file);
+		return CPU_ERROR_MEMORY;
+	}
+	if (fread(*data, 1, *size, input_file) != *size)
+	{
+		free(*data);
+		fclose(input_file);
+		return CPU_ERROR_OPEN;
+	}
+	fclose(input_file);
+	return CPU_OK;
+}
+
+int CPU_load(CPU *cpu, const char *instr_mem_path, const char *data_mem_path)
+{
+	uint8_t *instr_mem;
+	uint8_t *data_mem;
+	size_t instr_mem_size;
+	size_t data_mem_size;
+
+	int status = CPU_read_file(instr_mem_path, &instr_mem, &instr_mem_size);
+	if (status != CPU_OK)
+	{
+		return status;
+	}
+	status = CPU_read_file(data_mem_path, &data_mem, &data_mem_size);
+	if (status != CPU_OK)
+	{
+		free(instr_mem);
+		return status;
+	}
+	status = CPU_load_image(cpu, instr_mem, instr_mem_size, data_mem, data_mem_size);
+	free(instr_mem);
+	free(data_mem);
+	return status;
+}
+
+int CPU_load_image(CPU *cpu, const void *instr_mem, size_t instr_mem_size, const void *data_mem, size_t data_mem_size)
+{
+	if (cpu->memory_owner_)
+	{
+		return CPU_ERROR_ARGUMENT; //the program of a hart is the one of its boot hart
+	}
+	if (instr_mem_size > CPU_INSTR_MEM_MAX || data_mem_size > cpu->data_mem_size_)
+	{
+		return CPU_ERROR_SIZE;
+	}
+	//zeros up to the end of the last page, the iTLB of privileged mode maps whole pages
+	size_t instr_pages = (instr_mem_size + 0xFFF) & ~(size_t)0xFFF;
+	uint8_t *instr_copy = calloc(instr_pages ? instr_pages : 1, 1);
+	uint8_t *data_copy = malloc(data_mem_size ? data_mem_size : 1);
+	if (!instr_copy || !data_copy)
+	{
+		free(instr_copy);
+		free(data_copy);
+		return CPU_ERROR_MEMORY;
+	}
+	memcpy(instr_copy, instr_mem, instr_mem_size);
+	memcpy(data_copy, data_mem, data_mem_size);
+
+	//blocks decoded from the old program are stale
+	if (cpu->decoded_)
+	{
+		DCACHE_save(cpu);
+		CPU_decoded_destroy(cpu->decoded_);
+		cpu->decoded_ = NULL;
+	}
+	//hooks are at addresses of the old program
+	HLE_clear(cpu);
+	free(cpu->instr_mem_);
+	free(cpu->data_image_);
+	cpu->instr_mem_ = instr_copy;
+	cpu->instr_mem_size_ = instr_mem_size;
+	cpu->data_image_ = data_copy;
+	cpu->data_image_size_ = data_mem_size;
+	CPU_reset(cpu);
+	return CPU_OK;
+}
+
+//the pre-decoded blocks only depend on the instruction memory and are kept,
+//the shared memory is reset with the boot hart only
+void CPU_reset(CPU *cpu)
+{
+	memset(cpu->regfile_, 0, sizeof(cpu->regfile_));
+	memset(cpu->fregs_, 0, sizeof(cpu->fregs_));
+	cpu->fcsr_ = 0;
+	VEC_reset(cpu);
+	cpu->pc_ = 0x0;
+	cpu->instret_ = 0;
+	memset(cpu->tier_instructions_, 0, sizeof(cpu->tier_instructions_));
+	memset(&cpu->jump_stats_, 0, sizeof(cpu->jump_stats_));
+	memset(&cpu->hook_stats_, 0, sizeof(cpu->hook_stats_));
+	memset(&cpu->dma_stats_, 0, sizeof(cpu->dma_stats_));
+	memset(&cpu->accel_stats_, 0, sizeof(cpu->accel_stats_));
+	cpu->ras_count_ = 0;
+	cpu->halted_ = 0;
+	cpu->waiting_ = 0;
+	cpu->faulted_ = 0;
+	cpu->mscratch_ = 0;
+	cpu->reserved_ = 0;
+	if (cpu->mmu_)
+	{
+		MMU_reset(cpu);
+	}
+	SYS_reset(cpu);
+	if (cpu->memory_owner_)
+	{
+		return;
+	}
+	//the device does not write into the memory any more
+	BLK_reset(cpu);
+	//the pages are given back and come back zeroed when the guest touches them
+	//again, cheaper than clearing all of the RAM when a run only used a part of it
+	if (madvise(cpu->data_mem_, cpu->data_mem_mapped_, MADV_DONTNEED) != 0)
+	{
+		memset(cpu->data_mem_, 0, cpu->data_mem_size_);
+	}
+	if (cpu->data_image_)
+	{
+		memcpy(cpu->data_mem_, cpu->data_image_, cpu->data_image_size_);
+	}
+	BLK_publish(cpu);
+}
+
+int CPU_set_engine(CPU *cpu, int engine)
+{
+	if (engine != ENGINE_INTERP && engine != ENGINE_PREDECODE && engine != ENGINE_TIERED)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	cpu->engine_ = engine;
+	return CPU_OK;
+}
+
+void CPU_set_tier_thresholds(CPU *cpu, uint32_t predecode, uint32_t translate)
+{
+	cpu->tier_thresholds_[CPU_TIER_INTERP] = predecode;
+	cpu->tier_thresholds_[CPU_TIER_PREDECODE] = translate;
+}
+
+uint64_t CPU_get_tier_instructions(const CPU *cpu, int tier)
+{
+	return tier >= CPU_TIER_INTERP && tier <= CPU_TIER_TRANSLATED ? cpu->tier_instructions_[tier] : 0;
+}
+
+void CPU_set_ir_optimize(CPU *cpu, int enable)
+{
+	cpu->ir_optimize_ = enable;
+}
+
+void CPU_get_ir_stats(const CPU *cpu, CPU_ir_stats *stats)
+{
+	*stats = cpu->ir_stats_;
+}
+
+int CPU_set_translation_cache(CPU *cpu, TCACHE *cache)
+{
+	//the blocks already translated are counted in the old cache
+	if (cpu->decoded_ && cpu->decoded_->cache_)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	if (cpu->tcache_owned_)
+	{
+		TCACHE_destroy(cpu->tcache_);
+	}
+	cpu->tcache_ = cache;
+	cpu->tcache_owned_ = 0;
+	return CPU_OK;
+}
+
+TCACHE *CPU_get_translation_cache(const CPU *cpu)
+{
+	return cpu->tcache_;
+}
+
+void CPU_get_jump_stats(const CPU *cpu, CPU_jump_stats *stats)
+{
+	*stats = cpu->jump_stats_;
+}
+
+int CPU_set_decode_cache(CPU *cpu, const char *dir)
+{
+	char *copy = NULL;
+	if (dir && !(copy = strdup(dir)))
+	{
+		return CPU_ERROR_MEMORY;
+	}
+	free(cpu->decode_cache_);
+	cpu->decode_cache_ = copy;
+	return CPU_OK;
+}
+
+size_t CPU_get_decode_cache_blocks(const CPU *cpu)
+{
+	return cpu->decoded_ ? cpu->decoded_->cached_blocks_ : 0;
+}
+
+void CPU_set_output(CPU *cpu, CPU_output output, void *context)
+{
+	cpu->output_ = output ? output : CPU_output_stdout;
+	cpu->output_context_ = context;
+}
+
+void CPU_set_input(CPU *cpu, CPU_input input, void *context)
+{
+	cpu->input_ = input;
+	cpu->input_context_ = context;
+}
+
+void CPU_set_bpred(CPU *cpu, BP_sim *sim)
+{
+	cpu->bpred_ = sim;
+}
+
+//only the pre-decoded engine writes trace records
+void CPU_set_trace(CPU *cpu, TRACE_ring *ring)
+{
+	cpu->trace_ = ring;
+	if (ring)
+	{
+		cpu->engine_ = ENGINE_PREDECODE;
+	}
+}
+
+void CPU_set_sampler(CPU *cpu, SAMPLE_profiler *profiler)
+{
+	cpu->sampler_ = profiler;
+}
+
+uint32_t CPU_get_register(const CPU *cpu, int index)
+{
+	return index >= 0 && index < 32 ? cpu->regfile_[index] : 0;
+}
+
+void CPU_set_register(CPU *cpu, int index, uint32_t value)
+{
+	if (index > 0 && index < 32)
+	{
+		cpu->regfile_[index] = value;
+	}
+}
+
+uint8_t *CPU_get_memory(CPU *cpu, uint32_t addr, size_t size)
+{
+	return (uint64_t)addr + size <= cpu->data_mem_size_ ? cpu->data_mem_ + addr : NULL;
+}
+
+uint32_t CPU_get_pc(const CPU *cpu)
+{
+	return cpu->pc_;
+}
+
+uint64_t CPU_get_instret(const CPU *cpu)
+{
+	return cpu->instret_;
+}
+
+int CPU_is_halted(const CPU *cpu)
+{
+	return cpu->halted_;
+}
+
+int CPU_is_waiting(const CPU *cpu)
+{
+	return cpu->waiting_;
+}
+
+int CPU_get_fault(const CPU *cpu, uint32_t *address)
+{
+	if (cpu->faulted_ && address)
+	{
+		*address = cpu->fault_address_;
+	}
+	return cpu->faulted_;
+}
+
+//every engine stops at a waiting load without retiring it, a fault stops them the same way
+uint8_t *CPU_memory_fault(CPU *cpu, uint32_t addr)
+{
+	cpu->faulted_ = 1;
+	cpu->fault_address_ = addr;
+	cpu->waiting_ = 1;
+	return NULL;
+}
+
+void CPU_settle_fault(CPU *cpu)
+{
+	if (cpu->faulted_)
+	{
+		cpu->waiting_ = 0;
+		cpu->halted_ = 1;
+	}
+}
+
+void CPU_wake(CPU *cpu)
+{
+	cpu->waiting_ = 0;
+}
+
+size_t CPU_get_instr_mem_size(const CPU *cpu)
+{
+	return cpu->instr_mem_size_;
+}
+
+size_t CPU_get_data_mem_size(const CPU *cpu)
+{
+	return cpu->data_mem_size_;
+}
+
+int CPU_get_data_mem_backing(const CPU *cpu)
+{
+	return cpu->data_mem_backing_;
+}
+
+size_t CPU_get_data_image_size(const CPU *cpu)
+{
+	return cpu->data_image_size_;
+}
+
+const char *CPU_error_string(int status)
+{
+	switch (status)
+	{
+	case CPU_OK:
+		return "no error";
+	case CPU_ERROR_OPEN:
+		return "cannot read the image file";
+	case CPU_ERROR_SIZE:
+		return "image does not fit into the memory";
+	case CPU_ERROR_MEMORY:
+		return "out of memory";
+	case CPU_ERROR_ARGUMENT:
+		return "invalid argument";
+	}
+	return "unknown error";
+}
+
+/**
+ * Instruction fetch Instruction decode, Execute, Memory access, Write back
+ */
+
+//implementing functions
+
+int8_t getRS1(uint32_t instruction)
+{
+	// rs1 in bits 19..15
+	return (instruction >> 15) & 0x1f;
+};
+int8_t getRS2(uint32_t instruction)
+{
+	// rs2 in bits 24..20
+	return (instruction >> 20) & 0x1f;
+};
+
+//gives the address of the destination register
+int8_t getRD(uint32_t instruction)
+{
+	// RD is in bits 7...11
+	return (instruction >> 7) & 0x1f;
+}
+
+uint8_t getOpCode(uint32_t instruction)
+{
+	uint8_t opcode = (instruction & 0x7f);
+	return opcode;
+};
+
+int8_t getFunc3(uint32_t instruction)
+{
+	return (instruction >> 12) & 0x7;
+};
+
+int8_t getFunc7(uint32_t instruction)
+{
+	return (instruction >> 25) & 0x7f;
+};
+
+//PROBLEM IS IN SHAMT-- ENDLESS LOOP but why?
+int32_t shamt(uint32_t instruction)
+{ //shifting 20 bits to the left and ANDing with last 5 bits
+	//printf("%d", 9999);
+
+	uint32_t temp_instr = (instruction >> 20) & 0x1f;
+
+	if ((instruction >> 31) == 1)
+	{
+		return (temp_instr | 0xffffffe0);
+	}
+	else
+	{
+		//return (temp_instr & 0x0000001f);
+		return (temp_instr | 0x00000000);
+	}
+}
+
+int32_t imm_I(uint32_t instruction)
+{
+	//sign extend the bit after shifting
+	uint32_t temp_instr = (instruction & 0xfff00000) >> 20;
+
+	//if bit is 1, then 'or' with the temp_instr
+	if ((instruction >> 31) == 1)
+	{
+		return (temp_instr | 0xfffff000);
+	}
+	else
+	{
+		return (temp_instr & 0x00000fff);
+	}
+}
+
+
+int32_t imm_S(uint32_t instruction)
+{
+    int32_t S_immediate=(instruction&0x80000000) ? 0xFFFFF000 | (instruction&0xFE000000)>>20 | (instruction&0xF80)>>7
+    : (instruction&0xFE000000)>>20 | (instruction&0xF80)>>7;
+
+    return S_immediate;
+}
+
+
+int32_t imm_B(uint32_t instruction)
+{
+	return ((int32_t)(instruction & 0x80000000) >> 19) | ((instruction & 0x80) << 4) // imm[11]
+		   | ((instruction >> 20) & 0x7e0)											 // imm[10:5]
+		   | ((instruction >> 7) & 0x1e);											 // imm[4:1]
+};
+
+uint32_t imm_U(uint32_t instruction)
+{
+	return (int32_t)(instruction & 0xfffff000);
+}
+
+int32_t imm_J(uint32_t instruction)
+{
+	//printf("%d", 123);
+
+	// imm[20|10:1|11|19:12] = inst[31|30:21|20|19:12]
+	return ((int32_t)(instruction & 0x80000000) >> 11) | (instruction & 0xff000) // imm[19:12]
+		   | ((instruction >> 9) & 0x800)										 // imm[11]
+		   | ((instruction >> 20) & 0x7fe);										 // imm[10:1]
+};
+
+//R Type Instructions
+void ADD(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] + cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void SUB(CPU *cpu, uint32_t instruction)
+{
+	//printf("%d", 55555);
+
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] - cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void SLL(CPU *cpu, uint32_t instruction)
+{ //I am temporarily changing uint to int to check if it works (22.08.22)
+	//printf("%d", 55555);
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+
+	cpu->regfile_[rd] = cpu->regfile_[rs1] << cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void SLT(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = (int32_t)cpu->regfile_[rs1] < (int32_t)cpu->regfile_[rs2] ? 1 : 0;
+	cpu->pc_ += 4;
+}
+
+void SLTU(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = (uint32_t)cpu->regfile_[rs1] < (uint32_t)cpu->regfile_[rs2] ? 1 : 0;
+	cpu->pc_ += 4;
+}
+
+void XOR(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] ^ cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void SRL(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] >> cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void SRA(CPU *cpu, uint32_t instruction) // TODO
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = (int32_t)cpu->regfile_[rs1] >> cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void OR(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] | cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void AND(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] & cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+//I-Type Instruction
+void JALR1(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	cpu->regfile_[rd] = cpu->pc_ + 0x4;
+	cpu->pc_ = (cpu->regfile_[rs1] + ((int32_t)imm));
+}
+
+void LB(CPU *cpu, uint32_t instruction) // TODO
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	uint32_t address = cpu->regfile_[rs1] + imm;
+	uint8_t *host = CPU_load_address(cpu, address, 1);
+	uint8_t tmp;
+	if (!host)
+	{
+		return;
+	}
+	if (host == cpu->data_mem_ + CPU_CONSOLE_IN && cpu->input_)
+	{
+		int byte = cpu->input_(cpu->input_context_);
+		if (byte == CPU_INPUT_WAIT)
+		{
+			//the load is repeated after CPU_wake
+			cpu->waiting_ = 1;
+			return;
+		}
+		tmp = (uint8_t)byte;
+	}
+	else
+	{
+		tmp = *host;
+	}
+
+	//take last 8 bits
+	if ((tmp & 0x80) > 1)
+	{
+		cpu->regfile_[rd] = 0xffffff00 | tmp;
+	}
+	else
+	{
+		cpu->regfile_[rd] = 0x000000ff & tmp;
+	}
+
+	cpu->pc_ += 0x4;
+}
+
+void LH(CPU *cpu, uint32_t instruction) // TODO
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	uint8_t *host = CPU_load_address(cpu, cpu->regfile_[rs1] + imm, 2);
+	if (!host)
+	{
+		return;
+	}
+	uint16_t tmp = *(uint16_t *)host;
+
+	//Take last 16 bits
+	if ((tmp & 0x8000) > 1)
+	{
+		cpu->regfile_[rd] = 0xffff0000 | tmp;
+	}
+	else
+	{
+		cpu->regfile_[rd] = 0x0000ffff & tmp;
+	}
+
+	cpu->pc_ += 0x4;
+}
+
+void LW(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	uint8_t *host = CPU_load_address(cpu, cpu->regfile_[rs1] + imm, 4);
+	if (!host)
+	{
+		return;
+	}
+	cpu->regfile_[rd] = *(uint32_t *)host;
+	cpu->pc_ += 0x4;
+}
+
+void LBU(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	uint8_t *host = CPU_load_address(cpu, cpu->regfile_[rs1] + imm, 1);
+	if (!host)
+	{
+		return;
+	}
+	//read console input
+	if (host == cpu->data_mem_ + CPU_CONSOLE_IN && cpu->input_)
+	{
+		int byte = cpu->input_(cpu->input_context_);
+		if (byte == CPU_INPUT_WAIT)
+		{
+			cpu->waiting_ = 1;
+			return;
+		}
+		cpu->regfile_[rd] = (uint8_t)byte;
+	}
+	else
+	{
+		cpu->regfile_[rd] = *host;
+	}
+	cpu->pc_ += 0x4;
+}
+
+void LHU(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	uint8_t *host = CPU_load_address(cpu, cpu->regfile_[rs1] + imm, 2);
+	if (!host)
+	{
+		return;
+	}
+	cpu->regfile_[rd] = *(uint16_t *)host;
+	cpu->pc_ += 0x4;
+}
+
+void ADDI(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] + imm;
+	cpu->pc_ += 0x4;
+}
+
+void SLTI(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] < imm ? 1 : 0;
+	cpu->pc_ += 4;
+}
+
+void SLTIU(CPU *cpu, uint32_t instruction)
+{
+	uint8_t rd = getRD(instruction);
+	uint8_t rs1 = getRS1(instruction);
+	uint32_t imm = imm_I(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] < imm ? 1 : 0;
+	cpu->pc_ += 4;
+}
+
+void XORI(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] ^ imm;
+	cpu->pc_ += 0x4;
+}
+
+void ORI(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] | imm;
+	cpu->pc_ += 0x4;
+}
+
+void ANDI(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int32_t imm = imm_I(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] & imm;
+	cpu->pc_ += 0x4;
+}
+
+//S-Type Instructions
+void SB(CPU *cpu, uint32_t instruction) 
+{
+	uint8_t rd = getRD(instruction);
+	uint8_t rs1 = getRS1(instruction);
+	uint8_t rs2 = getRS2(instruction);
+	uint32_t imm = imm_S(instruction);
+	uint8_t *host = CPU_store_address(cpu, cpu->regfile_[rs1] + (int32_t)imm, 1);
+	if (!host)
+	{
+		return;
+	}
+
+	//Print character for SB
+	if ((cpu->regfile_[rs1]  == CPU_CONSOLE_OUT))
+	{
+		cpu->output_(cpu->output_context_, (uint8_t)cpu->regfile_[rs2]);
+	}
+
+	//the devices are at physical addresses
+	uint32_t address = host - cpu->data_mem_;
+	*host = (uint8_t)cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+	if (__builtin_expect((address & ~0xFFu) == CPU_DEVICE_PAGE, 0))
+	{
+		CPU_device_store(cpu, address, (uint8_t)cpu->regfile_[rs2]);
+	}
+}
+
+void CPU_device_store(CPU *cpu, uint32_t address, uint8_t byte)
+{
+	if (address == CPU_DMA_CONTROL)
+	{
+		DMA_start(cpu, byte);
+	}
+	else if (address == CPU_BLK_NOTIFY)
+	{
+		BLK_notify(cpu);
+	}
+}
+
+void SH(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_S(instruction);
+	uint8_t *host = CPU_store_address(cpu, cpu->regfile_[rs1] + imm, 2);
+	if (!host)
+	{
+		return;
+	}
+	*(uint16_t *)host = (uint16_t)cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+void SW(CPU *cpu, uint32_t instruction) //PROBLEM HERE 
+{
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_S(instruction);
+	// printf("%d\n", imm);
+	// fflush(stdout);
+
+	//print imm s in decimal and then ffslush 
+	//pritnf imm word -- 14 immediate 
+	uint8_t *host = CPU_store_address(cpu, cpu->regfile_[rs1] + (int32_t)imm, 4);
+	if (!host)
+	{
+		return;
+	}
+	*(uint32_t *)host = (uint32_t)cpu->regfile_[rs2];
+	cpu->pc_ += 0x4;
+}
+
+//B-Type Instruction
+void BEQ(CPU *cpu, uint32_t instruction)
+{
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_B(instruction);
+
+	if (cpu->regfile_[rs1] == cpu->regfile_[rs2])
+	{
+		cpu->pc_ = cpu->pc_ + (int32_t)imm;
+	}
+	else
+	{
+		cpu->pc_ += 0x4;
+	}
+}
+
+void BNE(CPU *cpu, uint32_t instruction)
+{
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_B(instruction);
+
+	if (cpu->regfile_[rs1] != cpu->regfile_[rs2])
+	{
+		cpu->pc_ = cpu->pc_ + (int32_t)imm;
+	}
+	else
+	{
+		cpu->pc_ += 0x4;
+	}
+}
+
+void BLT(CPU *cpu, uint32_t instruction)
+{
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_B(instruction);
+
+	if (cpu->regfile_[rs1] < cpu->regfile_[rs2])
+	{
+		cpu->pc_ = cpu->pc_ + imm;
+	}
+	else
+	{
+		cpu->pc_ += 0x4;
+	}
+}
+
+void BGE(CPU *cpu, uint32_t instruction)
+{
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_B(instruction);
+
+	if ((int32_t)cpu->regfile_[rs1] >= (int32_t)cpu->regfile_[rs2])
+	{
+		cpu->pc_ = cpu->pc_ + (int32_t)imm;
+	}
+	else
+	{
+		cpu->pc_ += 0x4;
+	}
+}
+
+void BLTU(CPU *cpu, uint32_t instruction)
+{
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_B(instruction);
+
+	if ((uint32_t)cpu->regfile_[rs1] < (uint32_t)cpu->regfile_[rs2])
+	{
+		cpu->pc_ = cpu->pc_ + imm;
+	}
+	else
+	{
+		cpu->pc_ += 0x4;
+	}
+}
+
+void BGEU(CPU *cpu, uint32_t instruction)
+{
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	int32_t imm = imm_B(instruction);
+
+	if ((uint32_t)cpu->regfile_[rs1] >= (uint32_t)cpu->regfile_[rs2])
+	{
+		cpu->pc_ = cpu->pc_ + imm;
+	}
+	else
+	{
+		cpu->pc_ += 0x4;
+	}
+}
+
+//U_Type Instruction
+void LUI1(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int32_t imm = imm_U(instruction);
+	cpu->regfile_[rd] = imm;
+	cpu->pc_ += 0x4;
+}
+
+void AUIPC1(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int32_t imm = imm_U(instruction);
+	cpu->regfile_[rd] = cpu->pc_ + imm;
+	cpu->pc_ += 0x4;
+}
+
+//J-Type Instruction
+void JAL1(CPU *cpu, uint32_t instruction)
+{
+	//printf("%d", 66666);
+	int8_t rd = getRD(instruction);
+	int32_t imm = imm_J(instruction);
+	cpu->regfile_[rd] = cpu->pc_ + 0x4;
+	cpu->pc_ = cpu->pc_ + (int32_t)imm;
+}
+
+//Shift Instruction
+void SLLI(CPU *cpu, uint32_t instruction)
+{
+	//printf("%d", 00000);
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+	cpu->regfile_[rd] = cpu->regfile_[rs1] << rs2;
+	cpu->pc_ += 0x04;
+}
+
+void SRLI(CPU *cpu, uint32_t instruction)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int8_t rs2 = getRS2(instruction);
+
+	cpu->regfile_[rd] = cpu->regfile_[rs1] >> rs2;
+	cpu->pc_ += 0x04;
+}
+
+void SRAI(CPU *cpu, uint32_t instruction) // TODO
+{
+	//printf("%d", 66666);
+	//I am temporarily changing uint to int to check if it works (22.08.22)
+	int32_t imm = shamt(instruction);
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+
+	//######### with a star (vorzeichen)
+	cpu->regfile_[rd] = (int32_t)cpu->regfile_[rs1] >> imm;
+	cpu->pc_ += 0x04;
+}
+
+//FENCE: the harts share the guest memory through host threads
+void FENCE(CPU *cpu, uint32_t instruction)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	cpu->pc_ += 0x4;
+}
+
+//WFI: the CPU waits until CPU_wake, or CPU_blk_wait for the interrupt of the block device
+void WFI(CPU *cpu, uint32_t instruction)
+{
+	cpu->waiting_ = 1;
+	cpu->pc_ += 0x4;
+}
+
+/**
+ * Zicsr. Only the machine CSRs a program needs to tell the harts apart are
+ * kept: mhartid (read only) and mscratch, the FP CSRs fflags, frm and fcsr and
+ * the read-only vector CSRs vl, vtype and vlenb. Other CSRs read as 0 and
+ * ignore writes (vstart, vxrm and vxsat of the vector extension among them).
+ * Privileged mode adds the trap and paging CSRs of machine and supervisor mode
+ * (mmu.c) and checks the privilege and the read-only CSRs: the pc stays and
+ * the instruction traps as illegal.
+ */
+#define CSR_FFLAGS 0x001
+#define CSR_FRM 0x002
+#define CSR_FCSR 0x003
+#define CSR_MSCRATCH 0x340
+#define CSR_VL 0xC20
+#define CSR_VTYPE 0xC21
+#define CSR_VLENB 0xC22
+#define CSR_MHARTID 0xF14
+
+static uint32_t CPU_csr_read(CPU *cpu, uint32_t csr)
+{
+	switch (csr)
+	{
+	case CSR_MHARTID:
+		return cpu->hartid_;
+	case CSR_MSCRATCH:
+		return cpu->mscratch_;
+	case CSR_FFLAGS:
+		return FPU_read_fcsr(cpu) & 0x1F;
+	case CSR_FRM:
+		return cpu->fcsr_ >> 5 & 0x7;
+	case CSR_FCSR:
+		return FPU_read_fcsr(cpu);
+	case CSR_VL:
+		return cpu->vl_;
+	case CSR_VTYPE:
+		return cpu->vtype_;
+	case CSR_VLENB:
+		return VEC_VLENB;
+	}
+	return cpu->mmu_ ? MMU_csr_read(cpu, csr) : 0;
+}
+
+static void CPU_csr_write(CPU *cpu, uint32_t csr, uint32_t value)
+{
+	switch (csr)
+	{
+	case CSR_MSCRATCH:
+		cpu->mscratch_ = value;
+		break;
+	case CSR_FFLAGS:
+		FPU_write_fcsr(cpu, (cpu->fcsr_ & ~0x1Fu) | (value & 0x1F));
+		break;
+	case CSR_FRM:
+		FPU_write_fcsr(cpu, (FPU_read_fcsr(cpu) & 0x1F) | (value & 0x7) << 5);
+		break;
+	case CSR_FCSR:
+		FPU_write_fcsr(cpu, value);
+		break;
+	default:
+		if (cpu->mmu_)
+		{
+			MMU_csr_write(cpu, csr, value);
+		}
+		break;
+	}
+}
+
+//the I variants take the rs1 field as a 5 bit immediate
+static void CPU_csr(CPU *cpu, uint32_t instruction, uint32_t value)
+{
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	uint32_t csr = instruction >> 20;
+	if (cpu->mmu_ && !MMU_csr_allowed(cpu, csr, (getFunc3(instruction) & 0x3) == 0x01 || rs1 != 0))
+	{
+		return;
+	}
+	uint32_t old = CPU_csr_read(cpu, csr);
+
+	switch (getFunc3(instruction) & 0x3)
+	{
+	case (0x01):
+		CPU_csr_write(cpu, csr, value);
+		break;
+	case (0x02):
+		if (rs1 != 0)
+		{
+			CPU_csr_write(cpu, csr, old | value);
+		}
+		break;
+	case (0x03):
+		if (rs1 != 0)
+		{
+			CPU_csr_write(cpu, csr, old & ~value);
+		}
+		break;
+	}
+	cpu->regfile_[rd] = old;
+	cpu->pc_ += 0x4;
+}
+
+void CSRRW(CPU *cpu, uint32_t instruction)
+{
+	CPU_csr(cpu, instruction, cpu->regfile_[getRS1(instruction)]);
+}
+
+void CSRRS(CPU *cpu, uint32_t instruction)
+{
+	CPU_csr(cpu, instruction, cpu->regfile_[getRS1(instruction)]);
+}
+
+void CSRRC(CPU *cpu, uint32_t instruction)
+{
+	CPU_csr(cpu, instruction, cpu->regfile_[getRS1(instruction)]);
+}
+
+void CSRRWI(CPU *cpu, uint32_t instruction)
+{
+	CPU_csr(cpu, instruction, getRS1(instruction));
+}
+
+void CSRRSI(CPU *cpu, uint32_t instruction)
+{
+	CPU_csr(cpu, instruction, getRS1(instruction));
+}
+
+void CSRRCI(CPU *cpu, uint32_t instruction)
+{
+	CPU_csr(cpu, instruction, getRS1(instruction));
+}
+
+/**
+ * A extension (word size) on host atomics of the shared guest memory, every
+ * access sequentially consistent whatever the aq/rl bits say. A misaligned
+ * address leaves the pc unchanged like an unimplemented instruction, in
+ * privileged mode it traps.
+ *
+ * LR/SC do not take a lock: LR remembers the address and the value it read and
+ * SC is a compare and swap against that value. Harts never wait for each other,
+ * the price is that an SC also succeeds when other harts changed the word and
+ * changed it back in between (ABA), which the usual LR/SC loops do not mind.
+ */
+static uint32_t *CPU_amo_address(CPU *cpu, uint32_t instruction, int store)
+{
+	uint32_t address = cpu->regfile_[getRS1(instruction)];
+	if (address & 0x3)
+	{
+		if (cpu->mmu_)
+		{
+			MMU_trap(cpu, store ? MMU_STORE_MISALIGNED : MMU_LOAD_MISALIGNED, address);
+		}
+		return NULL;
+	}
+	return (uint32_t *)(store ? CPU_store_address(cpu, address, 4) : CPU_load_address(cpu, address, 4));
+}
+
+void LR_W(CPU *cpu, uint32_t instruction)
+{
+	uint32_t *word = CPU_amo_address(cpu, instruction, 0);
+	if (!word)
+	{
+		return;
+	}
+	uint32_t value = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+	cpu->reserved_ = 1;
+	cpu->reservation_ = cpu->regfile_[getRS1(instruction)];
+	cpu->reservation_value_ = value;
+	cpu->regfile_[getRD(instruction)] = value;
+	cpu->pc_ += 0x4;
+}
+
+void SC_W(CPU *cpu, uint32_t instruction)
+{
+	uint32_t *word = CPU_amo_address(cpu, instruction, 1);
+	if (!word)
+	{
+		return;
+	}
+	uint32_t expected = cpu->reservation_value_;
+	int stored = cpu->reserved_ && cpu->reservation_ == cpu->regfile_[getRS1(instruction)] &&
+				 __atomic_compare_exchange_n(word, &expected, cpu->regfile_[getRS2(instruction)], 0, __ATOMIC_SEQ_CST,
+											 __ATOMIC_SEQ_CST);
+	cpu->reserved_ = 0;
+	cpu->regfile_[getRD(instruction)] = stored ? 0 : 1;
+	cpu->pc_ += 0x4;
+}
+
+enum amo_op
+{
+	AMO_SWAP,
+	AMO_ADD,
+	AMO_XOR,
+	AMO_AND,
+	AMO_OR,
+	AMO_MIN,
+	AMO_MAX,
+	AMO_MINU,
+	AMO_MAXU
+};
+
+//rd gets the old value of the word, the new one is computed from it and rs2
+static void CPU_amo(CPU *cpu, uint32_t instruction, int op)
+{
+	uint32_t *word = CPU_amo_address(cpu, instruction, 1);
+	if (!word)
+	{
+		return;
+	}
+	uint32_t value = cpu->regfile_[getRS2(instruction)];
+	uint32_t old;
+
+	switch (op)
+	{
+	case AMO_SWAP:
+		old = __atomic_exchange_n(word, value, __ATOMIC_SEQ_CST);
+		break;
+	case AMO_ADD:
+		old = __atomic_fetch_add(word, value, __ATOMIC_SEQ_CST);
+		break;
+	case AMO_XOR:
+		old = __atomic_fetch_xor(word, value, __ATOMIC_SEQ_CST);
+		break;
+	case AMO_AND:
+		old = __atomic_fetch_and(word, value, __ATOMIC_SEQ_CST);
+		break;
+	case AMO_OR:
+		old = __atomic_fetch_or(word, value, __ATOMIC_SEQ_CST);
+		break;
+	default:
+	{
+		//min and max have no host instruction
+		uint32_t result;
+		old = __atomic_load_n(word, __ATOMIC_SEQ_CST);
+		do
+		{
+			switch (op)
+			{
+			case AMO_MIN:
+				result = (int32_t)old < (int32_t)value ? old : value;
+				break;
+			case AMO_MAX:
+				result = (int32_t)old > (int32_t)value ? old : value;
+				break;
+			case AMO_MINU:
+				result = old < value ? old : value;
+				break;
+			default:
+				result = old > value ? old : value;
+				break;
+			}
+		} while (!__atomic_compare_exchange_n(word, &old, result, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	}
+	}
+	cpu->regfile_[getRD(instruction)] = old;
+	cpu->pc_ += 0x4;
+}
+
+void AMOSWAP_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_SWAP);
+}
+
+void AMOADD_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_ADD);
+}
+
+void AMOXOR_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_XOR);
+}
+
+void AMOAND_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_AND);
+}
+
+void AMOOR_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_OR);
+}
+
+void AMOMIN_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_MIN);
+}
+
+void AMOMAX_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_MAX);
+}
+
+void AMOMINU_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_MINU);
+}
+
+void AMOMAXU_W(CPU *cpu, uint32_t instruction)
+{
+	CPU_amo(cpu, instruction, AMO_MAXU);
+}
+
+//the whole interpreter switch, inlined into CPU_execute
+static inline __attribute__((always_inline)) void CPU_dispatch(CPU *cpu, uint32_t instruction)
+{
+	uint32_t pc = cpu->pc_;
+	uint8_t opCode = getOpCode(instruction); //check if I need to do &(address) of instruction
+	int8_t func3 = getFunc3(instruction);
+	int8_t func7 = getFunc7(instruction);
+
+	switch (opCode)
+	{
+
+	case R:
+		switch (func3)
+		{
+		case (0x00):
+			switch (func7)
+			{
+			case (0x00):
+				ADD(cpu, instruction);
+				break;
+			case (0x20):
+				SUB(cpu, instruction);
+				break;
+			}
+			break;
+
+		case (0x01):
+			SLL(cpu, instruction);
+			break;
+
+		case (0x02):
+			SLT(cpu, instruction);
+			break;
+		case (0x03):
+			SLTU(cpu, instruction);
+			break;
+		case (0x04):
+			XOR(cpu, instruction);
+			break;
+
+		case (0x05):
+			switch (func7)
+			{
+			case (0x00):
+				SRL(cpu, instruction);
+				break;
+			case (0x20):
+				SRA(cpu, instruction);
+				break;
+			}
+			break;
+
+		case (0x06):
+			OR(cpu, instruction);
+			break;
+		case (0x07):
+			AND(cpu, instruction);
+			break;
+
+		default:;
+		}
+		break;
+
+	case I:
+		switch (func3)
+		{
+		case (0x00):
+			ADDI(cpu, instruction);
+			break;
+		case (0x02):
+			SLTI(cpu, instruction);
+			break;
+		case (0x01):
+			SLLI(cpu, instruction);
+			break;
+		case (0x03):
+			SLTIU(cpu, instruction);
+			break;
+		case (0x04):
+			XORI(cpu, instruction);
+			break;
+		case (0x06):
+			ORI(cpu, instruction);
+			break;
+		case (0x07):
+			ANDI(cpu, instruction);
+			break;
+		case (0x05):
+			switch (func7)
+			{
+			case (0x00):
+				SRLI(cpu, instruction);
+				break;
+			case (0x20):
+				SRAI(cpu, instruction);
+				break;
+			}
+			break;
+		}
+		break;
+
+	case S:
+		switch (func3)
+		{
+		case (0x00):
+			SB(cpu, instruction);
+			break;
+		case (0x01):
+			SH(cpu, instruction);
+			break;
+		case (0x02):
+			SW(cpu, instruction);
+			break;
+		}
+		break;
+
+	case L:
+		switch (func3)
+		{
+		case (0x00):
+			LB(cpu, instruction);
+			break;
+		case (0x01):
+			LH(cpu, instruction);
+			break;
+		case (0x02):
+			LW(cpu, instruction);
+			break;
+		case (0x04):
+			LBU(cpu, instruction);
+			break;
+		case (0x05):
+			LHU(cpu, instruction);
+			break;
+		}
+		break;
+
+	case B:
+		switch (func3)
+		{
+		case (0x00):
+			BEQ(cpu, instruction);
+			break;
+		case (0x01):
+			BNE(cpu, instruction);
+			break;
+		case (0x04):
+			BLT(cpu, instruction);
+			break;
+		case (0x05):
+			BGE(cpu, instruction);
+			break;
+		case (0x06):
+			BLTU(cpu, instruction);
+			break;
+		case (0x07):
+			BGEU(cpu, instruction);
+			break;
+		}
+		if (cpu->bpred_)
+		{
+			BP_branch(cpu->bpred_, pc, pc + imm_B(instruction), cpu->pc_ != pc + 4);
+		}
+		break;
+
+	case LUI:
+		LUI1(cpu, instruction);
+		break;
+
+	case AUIPC:
+		AUIPC1(cpu, instruction);
+		break;
+
+	case JAL:
+		JAL1(cpu, instruction);
+		if (cpu->bpred_)
+		{
+			BP_jump(cpu->bpred_, pc, instruction, cpu->pc_);
+		}
+		break;
+
+	case JALR:
+		JALR1(cpu, instruction);
+		if (cpu->bpred_)
+		{
+			BP_jump(cpu->bpred_, pc, instruction, cpu->pc_);
+		}
+		break;
+
+	case MISC_MEM:
+		if (func3 == 0x00)
+		{
+			FENCE(cpu, instruction);
+		}
+		break;
+
+	case SYSTEM:
+		switch (func3)
+		{
+		case (0x00):
+			if (instruction == 0x10500073)
+			{
+				WFI(cpu, instruction);
+			}
+			else if (instruction == 0x00000073)
+			{
+				ECALL(cpu, instruction);
+			}
+			else if (cpu->mmu_)
+			{
+				MMU_system(cpu, instruction);
+			}
+			break;
+		case (0x01):
+			CSRRW(cpu, instruction);
+			break;
+		case (0x02):
+			CSRRS(cpu, instruction);
+			break;
+		case (0x03):
+			CSRRC(cpu, instruction);
+			break;
+		case (0x05):
+			CSRRWI(cpu, instruction);
+			break;
+		case (0x06):
+			CSRRSI(cpu, instruction);
+			break;
+		case (0x07):
+			CSRRCI(cpu, instruction);
+			break;
+		}
+		break;
+
+	case AMO:
+		if (func3 != 0x02)
+		{
+			break;
+		}
+		//funct5 in bits 31..27
+		switch (func7 >> 2)
+		{
+		case (0x02):
+			LR_W(cpu, instruction);
+			break;
+		case (0x03):
+			SC_W(cpu, instruction);
+			break;
+		case (0x01):
+			AMOSWAP_W(cpu, instruction);
+			break;
+		case (0x00):
+			AMOADD_W(cpu, instruction);
+			break;
+		case (0x04):
+			AMOXOR_W(cpu, instruction);
+			break;
+		case (0x0C):
+			AMOAND_W(cpu, instruction);
+			break;
+		case (0x08):
+			AMOOR_W(cpu, instruction);
+			break;
+		case (0x10):
+			AMOMIN_W(cpu, instruction);
+			break;
+		case (0x14):
+			AMOMAX_W(cpu, instruction);
+			break;
+		case (0x18):
+			AMOMINU_W(cpu, instruction);
+			break;
+		case (0x1C):
+			AMOMAXU_W(cpu, instruction);
+			break;
+		}
+		break;
+
+	case CUSTOM_0:
+	case CUSTOM_1:
+		ACCEL(cpu, instruction);
+		break;
+
+	//F and D: the decoder of the micro-ops picks the handler, an invalid encoding leaves the pc
+	case LOAD_FP:
+	case STORE_FP:
+	case MADD:
+	case MSUB:
+	case NMSUB:
+	case NMADD:
+	case FP:
+	case VECTOR:
+	{
+		uint16_t op = opCode == VECTOR ? VEC_decode(instruction) : FPU_decode(instruction);
+		if (op != OP_INVALID)
+		{
+			CPU_ops[op].handler_(cpu, instruction);
+		}
+		break;
+	}
+	}
+
+	cpu->regfile_[0] = 0;
+}
+
+//the dispatch of the interpreter on a cache line of its own, so its speed does not move with the code before it
+__attribute__((aligned(64))) void CPU_execute(CPU *cpu)
+{
+
+	uint32_t pc = cpu->pc_;
+	uint32_t instruction = *(uint32_t *)(cpu->instr_mem_ + (pc & 0xFFFFF));
+	// TODO
+
+	if (HLE_hooked(cpu, pc) && HLE_call(cpu))
+	{
+		//the hooked call returned to ra
+		if (cpu->bpred_)
+		{
+			BP_jump(cpu->bpred_, pc, HLE_RETURN, cpu->pc_);
+		}
+		return;
+	}
+	CPU_dispatch(cpu, instruction);
+}
+
+void CPU_execute_instruction(CPU *cpu, uint32_t instruction)
+{
+	CPU_dispatch(cpu, instruction);
+}
+
+uint64_t CPU_run_interpreter(CPU *cpu, uint64_t max_steps)
+{
+	uint64_t steps = 0;
+
+	while (steps < max_steps)
+	{
+		uint32_t pc = cpu->pc_;
+		if ((pc & 0xFFFFF) + 4 > cpu->instr_mem_size_)
+		{
+			cpu->halted_ = 1;
+			break;
+		}
+		uint64_t calls = cpu->hook_stats_.calls_;
+		CPU_execute(cpu);
+		if (cpu->waiting_)
+		{
+			//WFI retired, a load waiting for input did not
+			steps += cpu->pc_ != pc;
+			break;
+		}
+		steps++;
+		if (cpu->sampler_)
+		{
+			//a hooked call that ran returned to ra
+			uint32_t instruction = cpu->hook_stats_.calls_ != calls ? HLE_RETURN : *(uint32_t *)(cpu->instr_mem_ + (pc & 0xFFFFF));
+			SAMPLE_retire(cpu->sampler_, pc, 1, pc, instruction, cpu->pc_);
+		}
+		if (cpu->pc_ == pc)
+		{
+			cpu->halted_ = 1;
+			break;
+		}
+	}
+	return steps;
+}
+
+//halting rules in hurv.h
+uint64_t CPU_run(CPU *cpu, uint64_t max_steps)
+{
+	uint64_t steps;
+
+	if (cpu->waiting_)
+	{
+		return 0;
+	}
+	cpu->faulted_ = 0;
+	if (cpu->engine_ != ENGINE_INTERP && !cpu->mmu_ && !cpu->decoded_)
+	{
+		cpu->decoded_ = CPU_decoded_create(cpu);
+	}
+	FPU_enter();
+	if (cpu->mmu_)
+	{
+		steps = MMU_run(cpu, max_steps);
+	}
+	else if (!cpu->decoded_)
+	{
+		//the interpreter engine, or no memory for the tables of the others
+		steps = CPU_run_interpreter(cpu, max_steps);
+	}
+	else if (cpu->engine_ == ENGINE_PREDECODE)
+	{
+		steps = CPU_run_predecoded(cpu, max_steps);
+	}
+	else if (cpu->engine_ == ENGINE_TIERED)
+	{
+		steps = CPU_run_tiered(cpu, max_steps);
+	}
+	else
+	{
+		steps = CPU_run_interpreter(cpu, max_steps);
+	}
+	FPU_leave(cpu);
+	CPU_settle_fault(cpu);
+	cpu->instret_ += steps;
+	return steps;
+}
+
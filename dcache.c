@@ -0,0 +1,300 @@
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Persistent pre-decode cache
+ *
+ * The blocks and micro-ops of the pre-decoded engine are written to a file in
+ * the cache directory when the CPU lets them go (CPU_destroy, loading another
+ * program) and new blocks were decoded. The file name is the content hash of
+ * the instruction memory and the build ID of the emulator, so a rebuilt
+ * emulator with other op numbers never picks up an old file. A later run of
+ * the same program maps the file (MAP_PRIVATE, the block counters are written
+ * copy on write) and starts without decoding anything that was decoded before;
+ * blocks it reaches for the first time are decoded as usual.
+ *
+ *   DCACHE_header, int32_t block_of_[pcs], CPU_block blocks_[], CPU_uop uops_[]
+ *
+ * The arrays start at multiples of 8. A file is only used after it has been
+ * checked completely: the header and the hash of the three arrays in it, every
+ * index, every micro-op against the decoding of its word of the instruction
+ * memory and every block ending where the decoder would end it, so a damaged or
+ * foreign file costs a decode but never a wrong result.
+ */
+
+#define DCACHE_MAGIC 0x43445548 //"HUDC"
+#define DCACHE_VERSION 3
+
+typedef struct
+{
+	uint32_t magic_;
+	uint32_t version_;
+	uint64_t build_id_;
+	uint64_t image_hash_;
+	uint64_t image_size_;
+	uint64_t block_count_;
+	uint64_t uop_count_;
+	uint64_t payload_hash_; //DCACHE_payload_hash
+} DCACHE_header;
+
+//64 bit multiplicative hash, 8 bytes at a time
+static uint64_t DCACHE_hash(const void *data, size_t size, uint64_t hash)
+{
+	const uint8_t *p = data;
+	for (; size >= 8; p += 8, size -= 8)
+	{
+		uint64_t word;
+		memcpy(&word, p, 8);
+		hash = (hash ^ word) * 0x100000001B3ull;
+		hash ^= hash >> 29;
+	}
+	for (; size; p++, size--)
+	{
+		hash = (hash ^ *p) * 0x100000001B3ull;
+	}
+	return hash ^ (hash >> 32);
+}
+
+//GNU build ID of the executable libhurv is linked into, the first object
+static int DCACHE_build_id_note(struct dl_phdr_info *info, size_t size, void *data)
+{
+	uint64_t *id = data;
+	for (int i = 0; i < info->dlpi_phnum; i++)
+	{
+		const ElfW(Phdr) *header = &info->dlpi_phdr[i];
+		if (header->p_type != PT_NOTE)
+		{
+			continue;
+		}
+		const uint8_t *p = (const uint8_t *)(info->dlpi_addr + header->p_vaddr);
+		const uint8_t *end = p + header->p_memsz;
+		while (p + sizeof(ElfW(Nhdr)) <= end)
+		{
+			const ElfW(Nhdr) *note = (const ElfW(Nhdr) *)p;
+			const uint8_t *name = p + sizeof(ElfW(Nhdr));
+			const uint8_t *desc = name + ((note->n_namesz + 3) & ~3u);
+			if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 && memcmp(name, "GNU", 4) == 0)
+			{
+				*id = DCACHE_hash(desc, note->n_descsz, *id);
+				return 1;
+			}
+			p = desc + ((note->n_descsz + 3) & ~3u);
+		}
+	}
+	return 1;
+}
+
+//the op numbering and the layout of the tables, plus the build ID if the linker wrote one
+static uint64_t DCACHE_build_id(void)
+{
+	static uint64_t build_id;
+	uint64_t id = __atomic_load_n(&build_id, __ATOMIC_RELAXED);
+	if (id)
+	{
+		return id;
+	}
+	id = DCACHE_hash(NULL, 0, 0xCBF29CE484222325ull ^ (sizeof(CPU_block) << 8 | sizeof(CPU_uop)));
+	for (int op = 0; op < OP_COUNT; op++)
+	{
+		id = DCACHE_hash(CPU_ops[op].mnemonic_, strlen(CPU_ops[op].mnemonic_) + 1, id);
+	}
+	dl_iterate_phdr(DCACHE_build_id_note, &id);
+	id |= 1;
+	__atomic_store_n(&build_id, id, __ATOMIC_RELAXED);
+	return id;
+}
+
+static size_t DCACHE_align(size_t offset)
+{
+	return (offset + 7) & ~(size_t)7;
+}
+
+//file of the program of cpu in the cache directory
+static void DCACHE_path(const CPU *cpu, char *path, size_t size, uint64_t image_hash)
+{
+	snprintf(path, size, "%s/%016llx-%016llx.hud", cpu->decode_cache_, (unsigned long long)image_hash,
+			 (unsigned long long)DCACHE_build_id());
+}
+
+//block_of, blocks and uops as they are in the file, the padding left out
+static uint64_t DCACHE_payload_hash(const int32_t *block_of, size_t pcs, const CPU_block *blocks, size_t block_count,
+									const CPU_uop *uops, size_t uop_count)
+{
+	uint64_t hash = DCACHE_hash(block_of, pcs * sizeof(int32_t), 0xCBF29CE484222325ull);
+	hash = DCACHE_hash(blocks, block_count * sizeof(CPU_block), hash);
+	return DCACHE_hash(uops, uop_count * sizeof(CPU_uop), hash);
+}
+
+//the mapped tables agree with each other and with the decoding of the instruction memory
+static int DCACHE_check(const CPU *cpu, const int32_t *block_of, CPU_block *blocks, size_t block_count,
+						const CPU_uop *uops, size_t uop_count)
+{
+	size_t pcs = cpu->instr_mem_size_ / 4;
+	for (size_t i = 0; i < pcs; i++)
+	{
+		if (block_of[i] < -1 || (block_of[i] >= 0 && ((size_t)block_of[i] >= block_count || blocks[block_of[i]].pc_index_ != i)))
+		{
+			return 0;
+		}
+	}
+	for (size_t b = 0; b < block_count; b++)
+	{
+		CPU_block *block = &blocks[b];
+		if (block->pc_index_ >= pcs || block_of[block->pc_index_] != (int32_t)b || block->length_ == 0 ||
+			block->length_ > pcs - block->pc_index_ || block->start_ > uop_count || block->length_ > uop_count - block->start_)
+		{
+			return 0;
+		}
+		for (uint32_t i = 0; i < block->length_; i++)
+		{
+			//only the last op ends the block, unless it runs into the end of the instruction memory
+			const CPU_uop *uop = &uops[block->start_ + i];
+			int ends = CPU_ends_block(uop->op_);
+			if (uop->instruction_ != *(uint32_t *)(cpu->instr_mem_ + 4 * (block->pc_index_ + i)) ||
+				uop->op_ != CPU_decode(uop->instruction_) || uop->trace_ != TRACE_layout(uop->instruction_, uop->op_) ||
+				(i + 1 == block->length_ ? !ends && block->pc_index_ + i + 1 < pcs : ends))
+			{
+				return 0;
+			}
+		}
+		if (block->count_ || block->taken_)
+		{
+			block->count_ = 0;
+			block->taken_ = 0;
+		}
+	}
+	return 1;
+}
+
+CPU_decoded *DCACHE_load(const CPU *cpu)
+{
+	char path[4096];
+	uint64_t image_hash = DCACHE_hash(cpu->instr_mem_, cpu->instr_mem_size_, 0xCBF29CE484222325ull);
+	DCACHE_path(cpu, path, sizeof(path), image_hash);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		return NULL;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < sizeof(DCACHE_header))
+	{
+		close(fd);
+		return NULL;
+	}
+	size_t size = sb.st_size;
+	uint8_t *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	const DCACHE_header *header = (const DCACHE_header *)mapping;
+	size_t pcs = cpu->instr_mem_size_ / 4;
+	size_t blocks_offset = DCACHE_align(sizeof(DCACHE_header) + pcs * sizeof(int32_t));
+	size_t uops_offset = blocks_offset + header->block_count_ * sizeof(CPU_block);
+	CPU_decoded *decoded = NULL;
+	if (header->magic_ == DCACHE_MAGIC && header->version_ == DCACHE_VERSION && header->build_id_ == DCACHE_build_id() &&
+		header->image_hash_ == image_hash && header->image_size_ == cpu->instr_mem_size_ && header->block_count_ <= pcs &&
+		header->uop_count_ <= size / sizeof(CPU_uop) && uops_offset + header->uop_count_ * sizeof(CPU_uop) == size &&
+		header->payload_hash_ == DCACHE_payload_hash((const int32_t *)(mapping + sizeof(DCACHE_header)), pcs,
+													 (const CPU_block *)(mapping + blocks_offset), header->block_count_,
+													 (const CPU_uop *)(mapping + uops_offset), header->uop_count_) &&
+		DCACHE_check(cpu, (const int32_t *)(mapping + sizeof(DCACHE_header)), (CPU_block *)(mapping + blocks_offset),
+					 header->block_count_, (const CPU_uop *)(mapping + uops_offset), header->uop_count_))
+	{
+		decoded = calloc(1, sizeof(CPU_decoded));
+	}
+	if (!decoded)
+	{
+		munmap(mapping, size);
+		return NULL;
+	}
+	decoded->pcs_ = pcs;
+	decoded->block_of_ = (int32_t *)(mapping + sizeof(DCACHE_header));
+	decoded->blocks_ = (CPU_block *)(mapping + blocks_offset);
+	decoded->block_count_ = decoded->block_capacity_ = header->block_count_;
+	decoded->uops_ = (CPU_uop *)(mapping + uops_offset);
+	decoded->uop_count_ = decoded->uop_capacity_ = header->uop_count_;
+	decoded->mapping_ = mapping;
+	decoded->mapping_size_ = size;
+	decoded->cached_blocks_ = header->block_count_;
+	return decoded;
+}
+
+static int DCACHE_write(int fd, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	while (size)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n <= 0)
+		{
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+void DCACHE_save(const CPU *cpu)
+{
+	CPU_decoded *decoded = cpu->decoded_;
+	//blocks cut at hooked pcs are not the ones of the program
+	if (!cpu->decode_cache_ || !decoded || decoded->block_count_ == decoded->cached_blocks_ || cpu->hook_count_)
+	{
+		return;
+	}
+	DCACHE_header header = {DCACHE_MAGIC, DCACHE_VERSION, DCACHE_build_id(),
+							DCACHE_hash(cpu->instr_mem_, cpu->instr_mem_size_, 0xCBF29CE484222325ull),
+							cpu->instr_mem_size_, decoded->block_count_, decoded->uop_count_, 0};
+	char path[4096];
+	char temporary[4096 + 16];
+	DCACHE_path(cpu, path, sizeof(path), header.image_hash_);
+	snprintf(temporary, sizeof(temporary), "%s.XXXXXX", path);
+
+	//written next to the final name and renamed, so readers see a whole file or none
+	int fd = mkstemp(temporary);
+	if (fd == -1)
+	{
+		return;
+	}
+	static const uint8_t padding[8];
+	size_t block_of_size = decoded->pcs_ * sizeof(int32_t);
+	size_t blocks_size = decoded->block_count_ * sizeof(CPU_block);
+	CPU_block *blocks = malloc(blocks_size ? blocks_size : 1);
+	int status = blocks ? 0 : -1;
+	if (blocks)
+	{
+		//the counters belong to this run
+		memcpy(blocks, decoded->blocks_, blocks_size);
+		for (size_t i = 0; i < decoded->block_count_; i++)
+		{
+			blocks[i].count_ = 0;
+			blocks[i].taken_ = 0;
+		}
+		header.payload_hash_ = DCACHE_payload_hash(decoded->block_of_, decoded->pcs_, blocks, decoded->block_count_,
+												   decoded->uops_, decoded->uop_count_);
+		status = DCACHE_write(fd, &header, sizeof(header)) | DCACHE_write(fd, decoded->block_of_, block_of_size) |
+				 DCACHE_write(fd, padding, DCACHE_align(sizeof(header) + block_of_size) - sizeof(header) - block_of_size) |
+				 DCACHE_write(fd, blocks, blocks_size) | DCACHE_write(fd, decoded->uops_, decoded->uop_count_ * sizeof(CPU_uop));
+	}
+	free(blocks);
+	if (close(fd) == -1 || status != 0 || rename(temporary, path) == -1)
+	{
+		unlink(temporary);
+	}
+}
@@ -0,0 +1,137 @@
+#include <pthread.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * DMA engine
+ *
+ * The registers are words of the data memory next to the console. Storing an
+ * operation byte to CPU_DMA_CONTROL runs it at once with the host's memmove,
+ * memset and memcmp and a sliced CRC32, so the guest sees the result from the
+ * next instruction on and never has to poll. There is no interrupt, the tree
+ * has no traps to deliver one; CPU_DMA_STATUS is the completion signal.
+ */
+
+static uint32_t DMA_crc_table[8][256];
+static pthread_once_t DMA_crc_once = PTHREAD_ONCE_INIT;
+
+//reflected CRC-32 of zlib and Ethernet, a table per byte of a 64 bit word
+static void DMA_crc_init(void)
+{
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		uint32_t crc = i;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			crc = crc & 1 ? crc >> 1 ^ 0xEDB88320 : crc >> 1;
+		}
+		DMA_crc_table[0][i] = crc;
+	}
+	for (uint32_t i = 0; i < 256; i++)
+	{
+		for (int k = 1; k < 8; k++)
+		{
+			uint32_t crc = DMA_crc_table[k - 1][i];
+			DMA_crc_table[k][i] = crc >> 8 ^ DMA_crc_table[0][crc & 0xFF];
+		}
+	}
+}
+
+static uint32_t DMA_crc32(uint32_t crc, const uint8_t *data, uint64_t size)
+{
+	pthread_once(&DMA_crc_once, DMA_crc_init);
+	crc = ~crc;
+	for (; size >= 8; data += 8, size -= 8)
+	{
+		uint32_t low, high;
+		memcpy(&low, data, 4);
+		memcpy(&high, data + 4, 4);
+		low ^= crc;
+		crc = DMA_crc_table[7][low & 0xFF] ^ DMA_crc_table[6][low >> 8 & 0xFF] ^
+			  DMA_crc_table[5][low >> 16 & 0xFF] ^ DMA_crc_table[4][low >> 24] ^
+			  DMA_crc_table[3][high & 0xFF] ^ DMA_crc_table[2][high >> 8 & 0xFF] ^
+			  DMA_crc_table[1][high >> 16 & 0xFF] ^ DMA_crc_table[0][high >> 24];
+	}
+	for (; size; data++, size--)
+	{
+		crc = crc >> 8 ^ DMA_crc_table[0][(crc ^ *data) & 0xFF];
+	}
+	return ~crc;
+}
+
+static uint32_t DMA_read(const CPU *cpu, uint32_t addr)
+{
+	uint32_t value;
+	memcpy(&value, cpu->data_mem_ + addr, 4);
+	return value;
+}
+
+static void DMA_write(CPU *cpu, uint32_t addr, uint32_t value)
+{
+	memcpy(cpu->data_mem_ + addr, &value, 4);
+}
+
+void DMA_start(CPU *cpu, uint8_t operation)
+{
+	if (operation < CPU_DMA_COPY || operation > CPU_DMA_CRC32 || cpu->data_mem_size_ < CPU_DMA_RESULT + 4)
+	{
+		return;
+	}
+	uint32_t src = DMA_read(cpu, CPU_DMA_SOURCE);
+	uint32_t dst = DMA_read(cpu, CPU_DMA_DEST);
+	uint32_t length = DMA_read(cpu, CPU_DMA_LENGTH);
+	uint8_t *mem = cpu->data_mem_;
+	cpu->dma_stats_.operations_++;
+
+	//the fill value is no address
+	int reads = operation != CPU_DMA_FILL;
+	int writes = operation == CPU_DMA_COPY || operation == CPU_DMA_FILL;
+	int compares = operation == CPU_DMA_COMPARE;
+	if ((reads && (uint64_t)src + length > cpu->data_mem_size_) ||
+		((writes || compares) && (uint64_t)dst + length > cpu->data_mem_size_))
+	{
+		DMA_write(cpu, CPU_DMA_STATUS, CPU_DMA_ERROR);
+		return;
+	}
+
+	switch (operation)
+	{
+	case CPU_DMA_COPY:
+		memmove(mem + dst, mem + src, length);
+		break;
+	case CPU_DMA_FILL:
+		memset(mem + dst, (uint8_t)src, length);
+		break;
+	case CPU_DMA_COMPARE:
+	{
+		uint32_t offset = 0;
+		//memcmp finds a difference in whole vectors, the byte is looked for in the chunk
+		for (uint32_t chunk = 4096; offset < length; offset += chunk)
+		{
+			uint32_t size = length - offset < chunk ? length - offset : chunk;
+			if (memcmp(mem + src + offset, mem + dst + offset, size) != 0)
+			{
+				while (mem[src + offset] == mem[dst + offset])
+				{
+					offset++;
+				}
+				break;
+			}
+		}
+		DMA_write(cpu, CPU_DMA_RESULT, offset < length ? offset : length);
+		break;
+	}
+	case CPU_DMA_CRC32:
+		DMA_write(cpu, CPU_DMA_RESULT, DMA_crc32(DMA_read(cpu, CPU_DMA_RESULT), mem + src, length));
+		break;
+	}
+	cpu->dma_stats_.bytes_ += length;
+	DMA_write(cpu, CPU_DMA_STATUS, CPU_DMA_DONE);
+}
+
+void CPU_get_dma_stats(const CPU *cpu, CPU_dma_stats *stats)
+{
+	*stats = cpu->dma_stats_;
+}
@@ -0,0 +1,591 @@
+#include <fenv.h>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * F and D extensions on the host FPU
+ *
+ * The 32 f registers are 64 bits wide; a single is NaN-boxed (upper half all
+ * ones) and an operand that is not reads as the canonical NaN. Arithmetic runs
+ * as the host's float and double operations, fused multiply-add as fma; a NaN
+ * result becomes the canonical NaN like RISC-V wants.
+ *
+ * The host runs in round to nearest, even. Only an instruction with another
+ * rounding mode (in rm or, dynamic, in frm) switches the host mode around its
+ * operation; RMM has no host mode and rounds like RNE, the results only differ
+ * on exact ties. This file is built with -frounding-math so the compiler keeps
+ * the operations between the switches.
+ *
+ * fflags are the host's sticky exception flags: CPU_run clears them when it
+ * starts and ORs them into fflags when it returns (the lockstep engine does it
+ * around each FP instruction of a lane), a read of fflags or fcsr folds them in
+ * on the way. Only what the host does not flag the same way (comparisons,
+ * conversions to integers, min/max) is set here.
+ */
+
+enum FPU_rounding
+{
+	FPU_RNE,
+	FPU_RTZ,
+	FPU_RDN,
+	FPU_RUP,
+	FPU_RMM,
+	FPU_DYN = 7
+};
+
+enum FPU_flag
+{
+	FPU_NX = 0x01,
+	FPU_UF = 0x02,
+	FPU_OF = 0x04,
+	FPU_DZ = 0x08,
+	FPU_NV = 0x10
+};
+
+#define FPU_BOX 0xFFFFFFFF00000000ull
+#define FPU_NAN_S 0x7FC00000u
+#define FPU_NAN_D 0x7FF8000000000000ull
+#define FPU_SIGN_S 0x80000000u
+#define FPU_SIGN_D 0x8000000000000000ull
+
+static const int FPU_host_rounding[] = {FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD};
+
+static uint32_t FPU_host_flags(void)
+{
+	int raised = fetestexcept(FE_ALL_EXCEPT);
+	return (raised & FE_INEXACT ? FPU_NX : 0) | (raised & FE_UNDERFLOW ? FPU_UF : 0) |
+		   (raised & FE_OVERFLOW ? FPU_OF : 0) | (raised & FE_DIVBYZERO ? FPU_DZ : 0) |
+		   (raised & FE_INVALID ? FPU_NV : 0);
+}
+
+void FPU_enter(void)
+{
+	feclearexcept(FE_ALL_EXCEPT);
+}
+
+void FPU_leave(CPU *cpu)
+{
+	cpu->fcsr_ |= FPU_host_flags();
+}
+
+uint32_t FPU_read_fcsr(CPU *cpu)
+{
+	FPU_leave(cpu);
+	return cpu->fcsr_;
+}
+
+void FPU_write_fcsr(CPU *cpu, uint32_t value)
+{
+	cpu->fcsr_ = value & 0xFF;
+	feclearexcept(FE_ALL_EXCEPT);
+}
+
+//bits of the single in f[r], the canonical NaN unless it is NaN-boxed
+static inline uint32_t FPU_bits_s(const CPU *cpu, int r)
+{
+	uint64_t bits = cpu->fregs_[r];
+	return bits >> 32 == 0xFFFFFFFF ? (uint32_t)bits : FPU_NAN_S;
+}
+
+static inline float FPU_get_s(const CPU *cpu, int r)
+{
+	uint32_t bits = FPU_bits_s(cpu, r);
+	float value;
+	memcpy(&value, &bits, 4);
+	return value;
+}
+
+static inline double FPU_get_d(const CPU *cpu, int r)
+{
+	double value;
+	memcpy(&value, &cpu->fregs_[r], 8);
+	return value;
+}
+
+static inline void FPU_set_bits_s(CPU *cpu, int r, uint32_t bits)
+{
+	cpu->fregs_[r] = FPU_BOX | bits;
+}
+
+//results of arithmetic: a NaN is the canonical one
+static inline void FPU_set_s(CPU *cpu, int r, float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	FPU_set_bits_s(cpu, r, isnan(value) ? FPU_NAN_S : bits);
+}
+
+static inline void FPU_set_d(CPU *cpu, int r, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, 8);
+	cpu->fregs_[r] = isnan(value) ? FPU_NAN_D : bits;
+}
+
+static inline int FPU_snan_s(uint32_t bits)
+{
+	return (bits & 0x7FC00000) == 0x7F800000 && (bits & 0x003FFFFF);
+}
+
+static inline int FPU_snan_d(uint64_t bits)
+{
+	return (bits & 0x7FF8000000000000ull) == 0x7FF0000000000000ull && (bits & 0x0007FFFFFFFFFFFFull);
+}
+
+//rounding mode of the instruction; the reserved ones round like RNE
+static inline int FPU_rm(const CPU *cpu, uint32_t instruction)
+{
+	int rm = instruction >> 12 & 7;
+	return rm == FPU_DYN ? cpu->fcsr_ >> 5 & 7 : rm;
+}
+
+//result = expr in the rounding mode of the instruction, the host mode only changes for RTZ, RDN and RUP
+#define FPU_ROUNDED(cpu, instruction, result, expr)          \
+	do                                                       \
+	{                                                        \
+		int rm_ = FPU_rm(cpu, instruction);                  \
+		if (rm_ == FPU_RNE || rm_ >= FPU_RMM)                \
+		{                                                    \
+			result = (expr);                                 \
+		}                                                    \
+		else                                                 \
+		{                                                    \
+			fesetround(FPU_host_rounding[rm_]);              \
+			result = (expr);                                 \
+			fesetround(FE_TONEAREST);                        \
+		}                                                    \
+	} while (0)
+
+//loads and stores, like LW and SW
+void FLW(CPU *cpu, uint32_t instruction)
+{
+	const uint8_t *host = CPU_load_address(cpu, cpu->regfile_[getRS1(instruction)] + imm_I(instruction), 4);
+	uint32_t bits;
+	if (!host)
+	{
+		return;
+	}
+	memcpy(&bits, host, 4);
+	FPU_set_bits_s(cpu, getRD(instruction), bits);
+	cpu->pc_ += 0x4;
+}
+
+void FLD(CPU *cpu, uint32_t instruction)
+{
+	const uint8_t *host = CPU_load_address(cpu, cpu->regfile_[getRS1(instruction)] + imm_I(instruction), 8);
+	if (!host)
+	{
+		return;
+	}
+	memcpy(&cpu->fregs_[getRD(instruction)], host, 8);
+	cpu->pc_ += 0x4;
+}
+
+void FSW(CPU *cpu, uint32_t instruction)
+{
+	uint8_t *host = CPU_store_address(cpu, cpu->regfile_[getRS1(instruction)] + imm_S(instruction), 4);
+	uint32_t bits = (uint32_t)cpu->fregs_[getRS2(instruction)];
+	if (!host)
+	{
+		return;
+	}
+	memcpy(host, &bits, 4);
+	cpu->pc_ += 0x4;
+}
+
+void FSD(CPU *cpu, uint32_t instruction)
+{
+	uint8_t *host = CPU_store_address(cpu, cpu->regfile_[getRS1(instruction)] + imm_S(instruction), 8);
+	if (!host)
+	{
+		return;
+	}
+	memcpy(host, &cpu->fregs_[getRS2(instruction)], 8);
+	cpu->pc_ += 0x4;
+}
+
+//arithmetic on a = f[rs1], b = f[rs2], c = f[rs3]
+#define FPU_ARITHMETIC(name, t, type, expr)                                    \
+	void name(CPU *cpu, uint32_t instruction)                                  \
+	{                                                                          \
+		type a = FPU_get_##t(cpu, getRS1(instruction));                        \
+		type b = FPU_get_##t(cpu, getRS2(instruction));                        \
+		type c = FPU_get_##t(cpu, instruction >> 27);                          \
+		type result;                                                           \
+		(void)b;                                                               \
+		(void)c;                                                               \
+		FPU_ROUNDED(cpu, instruction, result, expr);                           \
+		FPU_set_##t(cpu, getRD(instruction), result);                          \
+		cpu->pc_ += 0x4;                                                       \
+	}
+
+FPU_ARITHMETIC(FMADD_S, s, float, fmaf(a, b, c))
+FPU_ARITHMETIC(FMSUB_S, s, float, fmaf(a, b, -c))
+FPU_ARITHMETIC(FNMSUB_S, s, float, fmaf(-a, b, c))
+FPU_ARITHMETIC(FNMADD_S, s, float, fmaf(-a, b, -c))
+FPU_ARITHMETIC(FADD_S, s, float, a + b)
+FPU_ARITHMETIC(FSUB_S, s, float, a - b)
+FPU_ARITHMETIC(FMUL_S, s, float, a * b)
+FPU_ARITHMETIC(FDIV_S, s, float, a / b)
+FPU_ARITHMETIC(FSQRT_S, s, float, sqrtf(a))
+FPU_ARITHMETIC(FMADD_D, d, double, fma(a, b, c))
+FPU_ARITHMETIC(FMSUB_D, d, double, fma(a, b, -c))
+FPU_ARITHMETIC(FNMSUB_D, d, double, fma(-a, b, c))
+FPU_ARITHMETIC(FNMADD_D, d, double, fma(-a, b, -c))
+FPU_ARITHMETIC(FADD_D, d, double, a + b)
+FPU_ARITHMETIC(FSUB_D, d, double, a - b)
+FPU_ARITHMETIC(FMUL_D, d, double, a * b)
+FPU_ARITHMETIC(FDIV_D, d, double, a / b)
+FPU_ARITHMETIC(FSQRT_D, d, double, sqrt(a))
+
+//sign injection works on the bits, NaNs included
+void FSGNJ_S(CPU *cpu, uint32_t instruction)
+{
+	uint32_t a = FPU_bits_s(cpu, getRS1(instruction));
+	uint32_t b = FPU_bits_s(cpu, getRS2(instruction));
+	uint32_t sign;
+	switch (getFunc3(instruction))
+	{
+	case (0x00):
+		sign = b & FPU_SIGN_S;
+		break;
+	case (0x01):
+		sign = ~b & FPU_SIGN_S;
+		break;
+	default:
+		sign = (a ^ b) & FPU_SIGN_S;
+		break;
+	}
+	FPU_set_bits_s(cpu, getRD(instruction), (a & ~FPU_SIGN_S) | sign);
+	cpu->pc_ += 0x4;
+}
+
+void FSGNJ_D(CPU *cpu, uint32_t instruction)
+{
+	uint64_t a = cpu->fregs_[getRS1(instruction)];
+	uint64_t b = cpu->fregs_[getRS2(instruction)];
+	uint64_t sign;
+	switch (getFunc3(instruction))
+	{
+	case (0x00):
+		sign = b & FPU_SIGN_D;
+		break;
+	case (0x01):
+		sign = ~b & FPU_SIGN_D;
+		break;
+	default:
+		sign = (a ^ b) & FPU_SIGN_D;
+		break;
+	}
+	cpu->fregs_[getRD(instruction)] = (a & ~FPU_SIGN_D) | sign;
+	cpu->pc_ += 0x4;
+}
+
+//minimumNumber/maximumNumber of IEEE 754-2019: a single NaN operand loses,
+//-0 is below +0; funct3 1 is the maximum
+#define FPU_MINMAX(name, t, type, bits_type, bits)                                                \
+	void name(CPU *cpu, uint32_t instruction)                                                     \
+	{                                                                                             \
+		bits_type a_bits = bits(cpu, getRS1(instruction));                                        \
+		bits_type b_bits = bits(cpu, getRS2(instruction));                                        \
+		type a = FPU_get_##t(cpu, getRS1(instruction));                                           \
+		type b = FPU_get_##t(cpu, getRS2(instruction));                                           \
+		int max = getFunc3(instruction) == 0x01;                                                  \
+		type result;                                                                              \
+		if (FPU_snan_##t(a_bits) || FPU_snan_##t(b_bits))                                         \
+		{                                                                                         \
+			cpu->fcsr_ |= FPU_NV;                                                                 \
+		}                                                                                         \
+		if (isnan(a) || isnan(b))                                                                 \
+		{                                                                                         \
+			result = isnan(a) ? b : a; /*two NaNs give the canonical one*/                        \
+		}                                                                                         \
+		else if (a == b)                                                                          \
+		{                                                                                         \
+			result = (signbit(a) != 0) == max ? b : a;                                            \
+		}                                                                                         \
+		else                                                                                      \
+		{                                                                                         \
+			result = (a < b) == max ? b : a;                                                      \
+		}                                                                                         \
+		FPU_set_##t(cpu, getRD(instruction), result);                                             \
+		cpu->pc_ += 0x4;                                                                          \
+	}
+
+static inline uint64_t FPU_bits_d(const CPU *cpu, int r)
+{
+	return cpu->fregs_[r];
+}
+
+FPU_MINMAX(FMIN_S, s, float, uint32_t, FPU_bits_s)
+FPU_MINMAX(FMIN_D, d, double, uint64_t, FPU_bits_d)
+
+//FEQ is quiet, FLT and FLE signal on any NaN; funct3 2 eq, 1 lt, 0 le
+#define FPU_COMPARE(name, t, type, bits)                                                          \
+	void name(CPU *cpu, uint32_t instruction)                                                     \
+	{                                                                                             \
+		type a = FPU_get_##t(cpu, getRS1(instruction));                                           \
+		type b = FPU_get_##t(cpu, getRS2(instruction));                                           \
+		int func3 = getFunc3(instruction);                                                        \
+		uint32_t result = 0;                                                                      \
+		if (isnan(a) || isnan(b))                                                                 \
+		{                                                                                         \
+			if (func3 != 0x02 || FPU_snan_##t(bits(cpu, getRS1(instruction))) ||                  \
+				FPU_snan_##t(bits(cpu, getRS2(instruction))))                                     \
+			{                                                                                     \
+				cpu->fcsr_ |= FPU_NV;                                                             \
+			}                                                                                     \
+		}                                                                                         \
+		else                                                                                      \
+		{                                                                                         \
+			result = func3 == 0x02 ? a == b : func3 == 0x01 ? a < b : a <= b;                     \
+		}                                                                                         \
+		cpu->regfile_[getRD(instruction)] = result;                                               \
+		cpu->pc_ += 0x4;                                                                          \
+	}
+
+FPU_COMPARE(FCMP_S, s, float, FPU_bits_s)
+FPU_COMPARE(FCMP_D, d, double, FPU_bits_d)
+
+//the bit of fclass for sign, exponent and mantissa
+static uint32_t FPU_class(int sign, int exponent_all, int exponent_zero, int mantissa_zero, int quiet)
+{
+	if (exponent_all)
+	{
+		return mantissa_zero ? (sign ? 1u << 0 : 1u << 7) : quiet ? 1u << 9 : 1u << 8;
+	}
+	if (exponent_zero)
+	{
+		return mantissa_zero ? (sign ? 1u << 3 : 1u << 4) : (sign ? 1u << 2 : 1u << 5);
+	}
+	return sign ? 1u << 1 : 1u << 6;
+}
+
+void FCLASS_S(CPU *cpu, uint32_t instruction)
+{
+	uint32_t bits = FPU_bits_s(cpu, getRS1(instruction));
+	uint32_t exponent = bits >> 23 & 0xFF;
+	cpu->regfile_[getRD(instruction)] =
+		FPU_class(bits >> 31, exponent == 0xFF, exponent == 0, !(bits & 0x7FFFFF), bits >> 22 & 1);
+	cpu->pc_ += 0x4;
+}
+
+void FCLASS_D(CPU *cpu, uint32_t instruction)
+{
+	uint64_t bits = cpu->fregs_[getRS1(instruction)];
+	uint32_t exponent = bits >> 52 & 0x7FF;
+	cpu->regfile_[getRD(instruction)] =
+		FPU_class(bits >> 63, exponent == 0x7FF, exponent == 0, !(bits & 0xFFFFFFFFFFFFFull), bits >> 51 & 1);
+	cpu->pc_ += 0x4;
+}
+
+//value rounded to an integer in mode rm, without raising inexact
+static double FPU_integral(double value, int rm)
+{
+	switch (rm)
+	{
+	case FPU_RTZ:
+		return trunc(value);
+	case FPU_RDN:
+		return floor(value);
+	case FPU_RUP:
+		return ceil(value);
+	case FPU_RMM:
+		return round(value);
+	}
+	return nearbyint(value);
+}
+
+//FCVT.W and FCVT.WU: out of range and NaN saturate and signal invalid (NaN to the maximum)
+static uint32_t FPU_to_int(CPU *cpu, uint32_t instruction, double value)
+{
+	int is_unsigned = getRS2(instruction) == 1;
+	if (isnan(value))
+	{
+		cpu->fcsr_ |= FPU_NV;
+		return is_unsigned ? UINT32_MAX : INT32_MAX;
+	}
+	double rounded = FPU_integral(value, FPU_rm(cpu, instruction));
+	if (rounded < (is_unsigned ? 0.0 : -2147483648.0))
+	{
+		cpu->fcsr_ |= FPU_NV;
+		return is_unsigned ? 0 : (uint32_t)INT32_MIN;
+	}
+	if (rounded > (is_unsigned ? 4294967295.0 : 2147483647.0))
+	{
+		cpu->fcsr_ |= FPU_NV;
+		return is_unsigned ? UINT32_MAX : INT32_MAX;
+	}
+	if (rounded != value)
+	{
+		cpu->fcsr_ |= FPU_NX;
+	}
+	return is_unsigned ? (uint32_t)rounded : (uint32_t)(int32_t)rounded;
+}
+
+void FCVT_W_S(CPU *cpu, uint32_t instruction)
+{
+	cpu->regfile_[getRD(instruction)] = FPU_to_int(cpu, instruction, FPU_get_s(cpu, getRS1(instruction)));
+	cpu->pc_ += 0x4;
+}
+
+void FCVT_W_D(CPU *cpu, uint32_t instruction)
+{
+	cpu->regfile_[getRD(instruction)] = FPU_to_int(cpu, instruction, FPU_get_d(cpu, getRS1(instruction)));
+	cpu->pc_ += 0x4;
+}
+
+//FCVT.S.W and FCVT.S.WU (rs2 1), rounded
+void FCVT_S_W(CPU *cpu, uint32_t instruction)
+{
+	uint32_t x = cpu->regfile_[getRS1(instruction)];
+	float result;
+	if (getRS2(instruction) == 1)
+	{
+		FPU_ROUNDED(cpu, instruction, result, (float)x);
+	}
+	else
+	{
+		FPU_ROUNDED(cpu, instruction, result, (float)(int32_t)x);
+	}
+	FPU_set_s(cpu, getRD(instruction), result);
+	cpu->pc_ += 0x4;
+}
+
+//FCVT.D.W and FCVT.D.WU, exact
+void FCVT_D_W(CPU *cpu, uint32_t instruction)
+{
+	uint32_t x = cpu->regfile_[getRS1(instruction)];
+	FPU_set_d(cpu, getRD(instruction), getRS2(instruction) == 1 ? (double)x : (double)(int32_t)x);
+	cpu->pc_ += 0x4;
+}
+
+void FCVT_S_D(CPU *cpu, uint32_t instruction)
+{
+	double a = FPU_get_d(cpu, getRS1(instruction));
+	float result;
+	FPU_ROUNDED(cpu, instruction, result, (float)a);
+	FPU_set_s(cpu, getRD(instruction), result);
+	cpu->pc_ += 0x4;
+}
+
+void FCVT_D_S(CPU *cpu, uint32_t instruction)
+{
+	FPU_set_d(cpu, getRD(instruction), FPU_get_s(cpu, getRS1(instruction)));
+	cpu->pc_ += 0x4;
+}
+
+//moves keep the bits: FMV.X.W takes the lower half whether it is boxed or not
+void FMV_X_W(CPU *cpu, uint32_t instruction)
+{
+	cpu->regfile_[getRD(instruction)] = (uint32_t)cpu->fregs_[getRS1(instruction)];
+	cpu->pc_ += 0x4;
+}
+
+void FMV_W_X(CPU *cpu, uint32_t instruction)
+{
+	FPU_set_bits_s(cpu, getRD(instruction), cpu->regfile_[getRS1(instruction)]);
+	cpu->pc_ += 0x4;
+}
+
+//micro-op of an instruction of the FP opcodes, OP_INVALID for the reserved encodings
+uint16_t FPU_decode(uint32_t instruction)
+{
+	uint8_t opcode = getOpCode(instruction);
+	int func3 = getFunc3(instruction);
+	int rm = instruction >> 12 & 7;
+	int rs2 = getRS2(instruction);
+	int fmt = instruction >> 25 & 3;
+
+	if (opcode == LOAD_FP || opcode == STORE_FP)
+	{
+		if (func3 == 0x02)
+		{
+			return opcode == LOAD_FP ? OP_FLW : OP_FSW;
+		}
+		if (func3 == 0x03)
+		{
+			return opcode == LOAD_FP ? OP_FLD : OP_FSD;
+		}
+		//the other widths are the vector loads and stores
+		return VEC_decode(instruction);
+	}
+	//only S and D; rm 5 and 6 are reserved where funct3 is the rounding mode
+	if (fmt > 1)
+	{
+		return OP_INVALID;
+	}
+	int d = fmt == 1;
+	int rounded = rm != 5 && rm != 6;
+	switch (opcode)
+	{
+	case MADD:
+		return !rounded ? OP_INVALID : d ? OP_FMADD_D : OP_FMADD_S;
+	case MSUB:
+		return !rounded ? OP_INVALID : d ? OP_FMSUB_D : OP_FMSUB_S;
+	case NMSUB:
+		return !rounded ? OP_INVALID : d ? OP_FNMSUB_D : OP_FNMSUB_S;
+	case NMADD:
+		return !rounded ? OP_INVALID : d ? OP_FNMADD_D : OP_FNMADD_S;
+	}
+	switch (getFunc7(instruction) >> 2)
+	{
+	case (0x00):
+		return !rounded ? OP_INVALID : d ? OP_FADD_D : OP_FADD_S;
+	case (0x01):
+		return !rounded ? OP_INVALID : d ? OP_FSUB_D : OP_FSUB_S;
+	case (0x02):
+		return !rounded ? OP_INVALID : d ? OP_FMUL_D : OP_FMUL_S;
+	case (0x03):
+		return !rounded ? OP_INVALID : d ? OP_FDIV_D : OP_FDIV_S;
+	case (0x0B):
+		return !rounded || rs2 != 0 ? OP_INVALID : d ? OP_FSQRT_D : OP_FSQRT_S;
+	case (0x04):
+		return func3 > 0x02 ? OP_INVALID : d ? OP_FSGNJ_D : OP_FSGNJ_S;
+	case (0x05):
+		return func3 > 0x01 ? OP_INVALID : d ? OP_FMIN_D : OP_FMIN_S;
+	case (0x08):
+		//FCVT.S.D (fmt S, rs2 1) and FCVT.D.S (fmt D, rs2 0)
+		return !rounded || rs2 != !d ? OP_INVALID : d ? OP_FCVT_D_S : OP_FCVT_S_D;
+	case (0x14):
+		return func3 > 0x02 ? OP_INVALID : d ? OP_FCMP_D : OP_FCMP_S;
+	case (0x18):
+		return !rounded || rs2 > 1 ? OP_INVALID : d ? OP_FCVT_W_D : OP_FCVT_W_S;
+	case (0x1A):
+		return !rounded || rs2 > 1 ? OP_INVALID : d ? OP_FCVT_D_W : OP_FCVT_S_W;
+	case (0x1C):
+		if (rs2 != 0)
+		{
+			break;
+		}
+		if (func3 == 0x01)
+		{
+			return d ? OP_FCLASS_D : OP_FCLASS_S;
+		}
+		return func3 == 0x00 && !d ? OP_FMV_X_W : OP_INVALID;
+	case (0x1E):
+		return rs2 == 0 && func3 == 0x00 && !d ? OP_FMV_W_X : OP_INVALID;
+	}
+	return OP_INVALID;
+}
+
+uint64_t CPU_get_fregister(const CPU *cpu, int index)
+{
+	return index >= 0 && index < 32 ? cpu->fregs_[index] : 0;
+}
+
+void CPU_set_fregister(CPU *cpu, int index, uint64_t value)
+{
+	if (index >= 0 && index < 32)
+	{
+		cpu->fregs_[index] = value;
+	}
+}
+
+uint32_t CPU_get_fcsr(const CPU *cpu)
+{
+	return cpu->fcsr_;
+}
@@ -0,0 +1,254 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Function hooks (high-level emulation)
+ *
+ * A hooked pc is checked by CPU_execute and decoded into an OP_HLE micro-op
+ * that forms a block of its own, so every engine, the translated tier through
+ * T_CALL, runs the hook when execution reaches the pc; a call that the hook
+ * declines runs the instruction at the pc and goes on with the guest function.
+ * The built-in hooks replace the byte loops of memcpy, memset, strlen and
+ * printf's _strnlen_s with the vectorized ones of the host C library. What the
+ * caller can see afterwards is what the guest function leaves: the memory, a0
+ * and the return to ra. The temporaries the guest function would have
+ * clobbered keep their values, which no caller may rely on.
+ */
+
+//[addr, addr + size) is in the data memory and neither it nor the pointer just
+//behind it is in the device page (console, DMA, block device), where the bytes
+//a loop stores start the devices
+static int HLE_plain(const CPU *cpu, uint32_t addr, uint64_t size)
+{
+	uint64_t end = (uint64_t)addr + size;
+	return end <= cpu->data_mem_size_ && !(addr < CPU_DEVICE_PAGE + 0x100 && end >= CPU_DEVICE_PAGE);
+}
+
+//memcpy(a0 dst, a1 src, a2 n), an overlap is undefined and left to the guest code
+static int HLE_memcpy(CPU *cpu, void *context)
+{
+	uint32_t dst = cpu->regfile_[10];
+	uint32_t src = cpu->regfile_[11];
+	uint32_t n = cpu->regfile_[12];
+	if (!HLE_plain(cpu, dst, n) || !HLE_plain(cpu, src, n) || (n && dst < (uint64_t)src + n && src < (uint64_t)dst + n))
+	{
+		return 0;
+	}
+	memcpy(cpu->data_mem_ + dst, cpu->data_mem_ + src, n);
+	cpu->hook_stats_.bytes_ += n;
+	return 1;
+}
+
+//memset(a0 dst, a1 c, a2 n)
+static int HLE_memset(CPU *cpu, void *context)
+{
+	uint32_t dst = cpu->regfile_[10];
+	uint32_t n = cpu->regfile_[12];
+	if (!HLE_plain(cpu, dst, n))
+	{
+		return 0;
+	}
+	memset(cpu->data_mem_ + dst, (uint8_t)cpu->regfile_[11], n);
+	cpu->hook_stats_.bytes_ += n;
+	return 1;
+}
+
+//length of the string at s, at most max bytes; -1 if the guest loop would run off the data memory
+static int64_t HLE_length(const CPU *cpu, uint32_t s, uint32_t max)
+{
+	if (s >= cpu->data_mem_size_)
+	{
+		return -1;
+	}
+	size_t scan = cpu->data_mem_size_ - s < max ? cpu->data_mem_size_ - s : max;
+	const uint8_t *end = memchr(cpu->data_mem_ + s, 0, scan);
+	if (!end && scan < max)
+	{
+		return -1;
+	}
+	size_t length = end ? (size_t)(end - (cpu->data_mem_ + s)) : scan;
+	//the loop reads the byte that stops it, the terminator or the one after max bytes
+	return HLE_plain(cpu, s, length + 1) ? (int64_t)length : -1;
+}
+
+//strlen(a0 s)
+static int HLE_strlen(CPU *cpu, void *context)
+{
+	int64_t length = HLE_length(cpu, cpu->regfile_[10], UINT32_MAX);
+	if (length < 0)
+	{
+		return 0;
+	}
+	cpu->regfile_[10] = length;
+	cpu->hook_stats_.bytes_ += length + 1;
+	return 1;
+}
+
+//strnlen(a0 s, a1 max), the same as _strnlen_s(str, maxsize) of printf.c
+static int HLE_strnlen(CPU *cpu, void *context)
+{
+	int64_t length = HLE_length(cpu, cpu->regfile_[10], cpu->regfile_[11]);
+	if (length < 0)
+	{
+		return 0;
+	}
+	cpu->regfile_[10] = length;
+	cpu->hook_stats_.bytes_ += length + 1;
+	return 1;
+}
+
+static const struct
+{
+	const char *name_;
+	int function_;
+} HLE_names[] = {
+	{"memcpy", CPU_HLE_MEMCPY},
+	{"memset", CPU_HLE_MEMSET},
+	{"strlen", CPU_HLE_STRLEN},
+	{"strnlen", CPU_HLE_STRNLEN},
+	{"_strnlen_s", CPU_HLE_STRNLEN},
+};
+
+static const CPU_hook HLE_builtins[] = {
+	[CPU_HLE_MEMCPY] = HLE_memcpy,
+	[CPU_HLE_MEMSET] = HLE_memset,
+	[CPU_HLE_STRLEN] = HLE_strlen,
+	[CPU_HLE_STRNLEN] = HLE_strnlen,
+};
+
+int HLE_call(CPU *cpu)
+{
+	uint32_t pc = cpu->pc_ & 0xFFFFF;
+	for (size_t i = 0; i < cpu->hook_count_; i++)
+	{
+		const HLE_entry *entry = &cpu->hooks_[i];
+		if (entry->pc_ != pc)
+		{
+			continue;
+		}
+		if (!entry->hook_(cpu, entry->context_))
+		{
+			cpu->hook_stats_.declined_++;
+			return 0;
+		}
+		cpu->hook_stats_.calls_++;
+		cpu->regfile_[0] = 0;
+		cpu->pc_ = cpu->regfile_[1];
+		return 1;
+	}
+	return 0;
+}
+
+void HLE(CPU *cpu, uint32_t instruction)
+{
+	if (!HLE_call(cpu))
+	{
+		CPU_ops[CPU_decode(instruction)].handler_(cpu, instruction);
+	}
+}
+
+void HLE_clear(CPU *cpu)
+{
+	free(cpu->hooks_);
+	free(cpu->hook_map_);
+	cpu->hooks_ = NULL;
+	cpu->hook_map_ = NULL;
+	cpu->hook_count_ = 0;
+}
+
+int CPU_set_hook(CPU *cpu, uint32_t pc, CPU_hook hook, void *context)
+{
+	pc &= 0xFFFFF;
+	if ((pc & 3) || pc + 4 > cpu->instr_mem_size_)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	if (!cpu->hook_map_)
+	{
+		cpu->hook_map_ = calloc(HLE_MAP_WORDS, sizeof(uint64_t));
+		if (!cpu->hook_map_)
+		{
+			return CPU_ERROR_MEMORY;
+		}
+	}
+	//the blocks decoded so far do not stop at the pc, the decode cache is
+	//written while it still holds blocks without hooks
+	if (cpu->decoded_)
+	{
+		DCACHE_save(cpu);
+		CPU_decoded_destroy(cpu->decoded_);
+		cpu->decoded_ = NULL;
+	}
+	size_t i = 0;
+	while (i < cpu->hook_count_ && cpu->hooks_[i].pc_ != pc)
+	{
+		i++;
+	}
+	if (hook && i == cpu->hook_count_)
+	{
+		HLE_entry *hooks = realloc(cpu->hooks_, (cpu->hook_count_ + 1) * sizeof(HLE_entry));
+		if (!hooks)
+		{
+			return CPU_ERROR_MEMORY;
+		}
+		cpu->hooks_ = hooks;
+		cpu->hook_count_++;
+	}
+	if (hook)
+	{
+		cpu->hooks_[i] = (HLE_entry){pc, hook, context};
+		cpu->hook_map_[pc >> 8] |= 1ull << (pc >> 2 & 63);
+	}
+	else if (i < cpu->hook_count_)
+	{
+		cpu->hooks_[i] = cpu->hooks_[--cpu->hook_count_];
+		cpu->hook_map_[pc >> 8] &= ~(1ull << (pc >> 2 & 63));
+	}
+	return CPU_OK;
+}
+
+int CPU_set_hle(CPU *cpu, uint32_t pc, int function)
+{
+	if (function < CPU_HLE_MEMCPY || function > CPU_HLE_STRNLEN)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	return CPU_set_hook(cpu, pc, HLE_builtins[function], NULL);
+}
+
+int CPU_hle_function(const char *name)
+{
+	for (size_t i = 0; i < sizeof(HLE_names) / sizeof(HLE_names[0]); i++)
+	{
+		if (strcmp(HLE_names[i].name_, name) == 0)
+		{
+			return HLE_names[i].function_;
+		}
+	}
+	return -1;
+}
+
+int CPU_find_symbol(const char *filename, const char *name, uint32_t *addr)
+{
+	SYM_table table = {0};
+	if (SYM_load(&table, filename) == -1)
+	{
+		SYM_free(&table);
+		return CPU_ERROR_OPEN;
+	}
+	const SYM_symbol *symbol = SYM_find(&table, name);
+	if (symbol)
+	{
+		*addr = symbol->addr_;
+	}
+	SYM_free(&table);
+	return symbol ? CPU_OK : CPU_ERROR_ARGUMENT;
+}
+
+void CPU_get_hook_stats(const CPU *cpu, CPU_hook_stats *stats)
+{
+	*stats = cpu->hook_stats_;
+}
@@ -0,0 +1,607 @@
+/**
+ * libhurv - HU RISC-V (RV32I) emulator as a library
+ *
+ * A CPU is created empty, loaded with an instruction and a data memory image and
+ * run for a budget of instructions. All state lives in the CPU object (and in
+ * the optional instrumentation objects attached to it), so any number of CPUs
+ * can be hosted in one process; one CPU must only be used by one thread at a
+ * time. Functions that can fail return CPU_OK or a negative CPU_ERROR_* code,
+ * CPU_error_string describes it. The library never exits the process.
+ *
+ *   CPU *cpu = CPU_create();
+ *   if (!cpu || CPU_load(cpu, "instruction_mem.bin", "data_mem.bin") != CPU_OK) ...
+ *   CPU_run(cpu, 1000000);
+ *   CPU_reset(cpu); //run again from the loaded images
+ *   CPU_destroy(cpu);
+ */
+
+#ifndef HURV_H
+#define HURV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct CPU CPU;
+typedef struct BP_sim BP_sim;
+typedef struct TRACE_ring TRACE_ring;
+typedef struct TRACE_writer TRACE_writer;
+typedef struct SAMPLE_profiler SAMPLE_profiler;
+typedef struct TCACHE TCACHE;
+
+enum CPU_status
+{
+	CPU_OK = 0,
+	CPU_ERROR_OPEN = -1,	 //image file could not be opened or read
+	CPU_ERROR_SIZE = -2,	 //image does not fit into the memory
+	CPU_ERROR_MEMORY = -3,	 //out of host memory
+	CPU_ERROR_ARGUMENT = -4 //invalid argument, e.g. unknown engine
+};
+
+enum engine
+{
+	ENGINE_INTERP,	  //CPU_execute, decodes every instruction again
+	ENGINE_PREDECODE, //basic blocks of pre-decoded micro-ops
+	ENGINE_TIERED	  //starts on the interpreter, hot code moves to pre-decoded and translated blocks
+};
+
+//tiers of ENGINE_TIERED
+enum CPU_tier
+{
+	CPU_TIER_INTERP,
+	CPU_TIER_PREDECODE,
+	CPU_TIER_TRANSLATED
+};
+
+#define CPU_DEFAULT_PREDECODE_THRESHOLD 2
+#define CPU_DEFAULT_TRANSLATE_THRESHOLD 50
+
+//console of the guest: SB with base register 0x5000 writes a byte, LB/LBU from
+//0x5004 reads one (-1 at the end of the input) once an input callback is set
+#define CPU_CONSOLE_OUT 0x5000
+#define CPU_CONSOLE_IN 0x5004
+#define CPU_INPUT_WAIT (-2) //no input yet: the CPU waits at the load, see CPU_run
+
+//DMA engine of the guest: SB of an operation to CPU_DMA_CONTROL runs it on the
+//words at CPU_DMA_SOURCE, CPU_DMA_DEST and CPU_DMA_LENGTH before the next
+//instruction and sets CPU_DMA_STATUS; other bytes stored there are ignored.
+//The control store needs the address in its base register, SB with base 0x5000
+//is the console.
+#define CPU_DMA_CONTROL 0x5010
+#define CPU_DMA_STATUS 0x5014
+#define CPU_DMA_SOURCE 0x5018 //fill: the byte value
+#define CPU_DMA_DEST 0x501C
+#define CPU_DMA_LENGTH 0x5020
+#define CPU_DMA_RESULT 0x5024 //compare: offset of the first difference or the length; crc32: in and out
+
+enum CPU_dma_operation
+{
+	CPU_DMA_COPY = 1, //memmove, the ranges may overlap
+	CPU_DMA_FILL,
+	CPU_DMA_COMPARE, //source with dest
+	CPU_DMA_CRC32	 //of source, continued from the result (0 to start) like zlib's crc32
+};
+
+enum CPU_dma_status
+{
+	CPU_DMA_DONE = 1,
+	CPU_DMA_ERROR //a range is outside the data memory, nothing was touched
+};
+
+//block device of the guest, see CPU_attach_block: the words of the queue
+//registers and a byte stored to CPU_BLK_NOTIFY (with the address in the base
+//register like CPU_DMA_CONTROL) tell the device there are new requests
+#define CPU_BLK_QUEUE 0x5030	  //guest address of the queue
+#define CPU_BLK_QUEUE_SIZE 0x5034 //requests it holds, a power of two up to 1024
+#define CPU_BLK_NOTIFY 0x5038
+#define CPU_BLK_ISR 0x503C		//bit 0 set by the device on completions, cleared by the guest
+#define CPU_BLK_CAPACITY 0x5040 //sectors, low and high word, written by the device
+#define CPU_BLK_SECTOR 512
+
+typedef void (*CPU_output)(void *context, uint8_t byte);
+typedef int (*CPU_input)(void *context); //next input byte, -1 or CPU_INPUT_WAIT
+
+#define CPU_DEFAULT_DATA_MEM_SIZE 0x400000
+#define CPU_MAX_DATA_MEM_SIZE 0x100000000ull
+
+enum CPU_memory_flags
+{
+	CPU_MEM_DEFAULT = 0,
+	CPU_MEM_NO_HUGEPAGES = 1 //back the guest RAM with small pages only
+};
+
+//how the guest RAM is backed
+enum CPU_backing
+{
+	CPU_BACKING_SMALL,
+	CPU_BACKING_THP,	//transparent huge pages requested with madvise
+	CPU_BACKING_HUGETLB //preallocated huge pages (MAP_HUGETLB)
+};
+
+//NULL if out of memory; the console goes to stdout until CPU_set_output
+CPU *CPU_create(void); //CPU_DEFAULT_DATA_MEM_SIZE bytes of RAM
+CPU *CPU_create_with_memory(size_t data_mem_size, int flags);
+void CPU_destroy(CPU *cpu);
+
+//loads the images from files or from memory and resets the CPU
+int CPU_load(CPU *cpu, const char *instr_mem_path, const char *data_mem_path);
+int CPU_load_image(CPU *cpu, const void *instr_mem, size_t instr_mem_size, const void *data_mem, size_t data_mem_size);
+
+//registers, pc and data memory back to the state right after loading
+void CPU_reset(CPU *cpu);
+
+/**
+ * Runs until the program halts or max_steps instructions are retired and returns
+ * the number retired. A program halts when an instruction leaves the pc
+ * unchanged (the "j ." at the end of the test programs or an instruction that is
+ * not implemented) or when the pc leaves the instruction memory; in privileged
+ * mode most of these trap instead, see CPU_set_privileged.
+ * CPU_run also returns when the CPU starts waiting: after WFI, or at a console
+ * load whose input callback returned CPU_INPUT_WAIT (the load is not retired and
+ * runs again). A waiting CPU does not run until CPU_wake. Without host memory
+ * for the blocks of the pre-decoded or tiered engine the run goes on in the
+ * interpreter, which feeds only the sampling profiler.
+ *
+ * Guests are isolated: every load and store of every engine is checked against
+ * the data memory of its CPU, like the buffers of the devices, the DMA engine,
+ * the system calls and the hooks, so no guest address reaches host memory
+ * outside it. A load or store outside the data memory halts the CPU at that
+ * instruction without retiring it (an access fault in privileged mode), and
+ * CPU_get_fault gives its address until the next run.
+ */
+uint64_t CPU_run(CPU *cpu, uint64_t max_steps);
+int CPU_is_waiting(const CPU *cpu);
+void CPU_wake(CPU *cpu);
+int CPU_get_fault(const CPU *cpu, uint32_t *address); //1 if the last run halted at an access outside the data memory
+
+/**
+ * Lockstep engine for parameter sweeps: runs count CPUs loaded with the same
+ * instruction memory (CPU_ERROR_ARGUMENT otherwise) together, several per host
+ * core with one SIMD lane per CPU, each up to max_steps instructions. Gives the
+ * same results as CPU_run on every CPU; the instrumentation is not fed. CPUs in
+ * privileged mode (all or none) run one after another with CPU_run.
+ */
+typedef struct
+{
+	uint64_t steps_;		  //lockstep steps, each one instruction for all lanes at its pc
+	uint64_t lane_steps_;	  //instructions retired by those steps
+	uint64_t fallback_lanes_; //CPUs finished with CPU_run after the lanes diverged for too long
+	uint64_t scalar_steps_;	  //instructions retired by CPU_run: fallbacks and a CPU left alone in its group
+} LOCKSTEP_stats;
+
+int CPU_run_lockstep(CPU **cpus, int count, uint64_t max_steps, LOCKSTEP_stats *stats); //stats may be NULL
+
+/**
+ * Harts: CPU_create_hart makes a CPU that shares the memory and the program of
+ * the loaded boot CPU (mhartid 0), the guest reads hartid from the mhartid CSR;
+ * all harts start at pc 0. The boot CPU has to outlive its harts, CPU_load and
+ * CPU_load_image are refused on a hart and CPU_reset of a hart leaves the shared
+ * memory alone. CPU_run_smp runs count harts on a host thread each (harts[0] on
+ * the calling one), each up to max_steps instructions, and returns when all
+ * have stopped. The A extension (LR/SC and AMOs on words) and FENCE work across harts.
+ */
+CPU *CPU_create_hart(CPU *boot, uint32_t hartid); //NULL if out of memory or boot is a hart itself
+uint32_t CPU_get_hartid(const CPU *cpu);
+int CPU_run_smp(CPU **harts, int count, uint64_t max_steps);
+
+/**
+ * N:M scheduler: time-slices any number of CPUs (guests) in quanta of
+ * instructions on a pool of worker threads. Each worker has its own run queue
+ * ordered by priority (higher first), then deadline (earlier first, in ns from
+ * SCHED_add, 0 for none), then round robin, and steals from the others when it
+ * runs dry. A guest runs until it halts or has retired max_steps instructions;
+ * a waiting guest (see CPU_run) is parked until SCHED_wake, a wake that comes
+ * while the guest still runs is kept for its next park. While a CPU is in the
+ * pool it must not be used otherwise; its callbacks are called on the workers,
+ * so trace rings (one per thread) cannot be attached.
+ */
+typedef struct SCHED_pool SCHED_pool;
+typedef struct SCHED_guest SCHED_guest;
+
+typedef struct
+{
+	uint64_t guests_;
+	uint64_t quanta_; //time slices run, the context switches
+	uint64_t instructions_;
+	uint64_t steals_; //quanta a worker took from another queue
+	uint64_t parks_;
+	uint64_t wakes_;
+	uint64_t finished_;
+	uint64_t deadline_misses_; //guests finished after their deadline
+} SCHED_stats;
+
+SCHED_pool *SCHED_create(int workers, uint64_t quantum); //NULL if out of memory or no thread could start
+SCHED_guest *SCHED_add(SCHED_pool *pool, CPU *cpu, int priority, uint64_t deadline_ns, uint64_t max_steps); //NULL if out of memory
+void SCHED_wake(SCHED_guest *guest);
+int SCHED_is_parked(const SCHED_guest *guest);
+int SCHED_wait(SCHED_pool *pool); //until no guest is runnable, returns the number parked
+void SCHED_get_stats(SCHED_pool *pool, SCHED_stats *stats);
+void SCHED_destroy(SCHED_pool *pool); //stops after the running quanta, the CPUs stay with the caller
+
+int CPU_set_engine(CPU *cpu, int engine);
+//ENGINE_TIERED: a pc is decoded after execution entered it predecode times on the
+//interpreter, a block is translated after it ran translate times pre-decoded
+void CPU_set_tier_thresholds(CPU *cpu, uint32_t predecode, uint32_t translate);
+uint64_t CPU_get_tier_instructions(const CPU *cpu, int tier); //retired on an enum CPU_tier since the last reset
+
+/**
+ * Blocks of the translated tier are optimized before they run: constant and
+ * copy propagation, store-to-load forwarding and dead register writes within
+ * the block, across loads and stores whose addresses are checked when the
+ * block starts. The counts cover all blocks translated since CPU_create.
+ */
+typedef struct
+{
+	uint64_t blocks_;	 //blocks optimized
+	uint64_t ops_;		 //their ops before the passes
+	uint64_t folded_;	 //results and branches computed from constants
+	uint64_t forwarded_; //loads that took the value of an earlier store or load
+	uint64_t redundant_; //writes of a value the register already held, dropped
+	uint64_t dead_;		 //register writes overwritten before any read, dropped
+	uint64_t guarded_;	 //loads and stores checked at the block entry, no early exits
+	uint64_t executed_;	 //dropped ops times the complete runs of their blocks
+} CPU_ir_stats;
+
+void CPU_set_ir_optimize(CPU *cpu, int enable); //on by default, for blocks translated afterwards
+void CPU_get_ir_stats(const CPU *cpu, CPU_ir_stats *stats);
+
+/**
+ * The tiered engine finds the block after a JALR without looking up the target:
+ * a return (JALR through ra or t0) is checked against a return-address stack
+ * that JAL/JALR with a link register push, other indirect jumps of translated
+ * blocks against an inline cache of the translations of their last two
+ * targets, which they go on with like with a chained block. The counts cover
+ * the runs since the last reset.
+ */
+typedef struct
+{
+	uint64_t returns_;	//returns checked against the return-address stack
+	uint64_t ras_hits_; //returns that went to the pushed address and its block
+	uint64_t indirect_; //other JALRs of translated blocks (and returns the stack missed)
+	uint64_t ic_hits_;	//those that went to a target in the inline cache
+} CPU_jump_stats;
+
+void CPU_get_jump_stats(const CPU *cpu, CPU_jump_stats *stats);
+
+/**
+ * Translation cache: the translated blocks of the tiered engine count against
+ * a byte budget, which any number of CPUs can share (also across threads; the
+ * cache has to outlive them). A translation that goes over the budget starts a
+ * new generation, and every CPU drops its blocks that did not run during the
+ * generation before, unlinking the blocks chained to them; a dropped block that
+ * gets hot again is translated again. A CPU without a cache of its own gets a
+ * private one with CPU_DEFAULT_TRANSLATION_BUDGET when it first translates.
+ */
+#define CPU_DEFAULT_TRANSLATION_BUDGET (32u << 20)
+
+typedef struct
+{
+	uint64_t budget_;
+	uint64_t bytes_; //held by translated blocks now
+	uint64_t peak_bytes_;
+	uint64_t blocks_;		  //translated blocks now
+	uint64_t translations_;	  //blocks translated
+	uint64_t retranslations_; //of those, blocks translated again after they were dropped
+	uint64_t evictions_;	  //blocks dropped because the cache was full
+	uint64_t flushes_;		  //generations started
+	uint64_t unlinks_;		  //chains from other blocks to dropped blocks cut
+} TCACHE_stats;
+
+TCACHE *TCACHE_create(size_t budget); //NULL if out of memory
+void TCACHE_get_stats(const TCACHE *cache, TCACHE_stats *stats);
+void TCACHE_destroy(TCACHE *cache);
+
+//before the first CPU_run; NULL for a private cache
+int CPU_set_translation_cache(CPU *cpu, TCACHE *cache);
+TCACHE *CPU_get_translation_cache(const CPU *cpu); //NULL before the first translation
+
+/**
+ * Persistent pre-decode cache: the blocks the pre-decoded engine decoded are
+ * kept in a file in dir, named by the hash of the instruction memory and the
+ * build ID of the emulator, and mapped by later runs of the same program so
+ * they start without decoding. The file is written by CPU_destroy or when
+ * another program is loaded; the directory has to exist. NULL turns it off.
+ */
+int CPU_set_decode_cache(CPU *cpu, const char *dir);
+size_t CPU_get_decode_cache_blocks(const CPU *cpu); //blocks the last run started with from the cache
+void CPU_set_output(CPU *cpu, CPU_output output, void *context);
+void CPU_set_input(CPU *cpu, CPU_input input, void *context); //NULL: loads from 0x5004 read memory
+
+/**
+ * Function hooks (high-level emulation): a call to a hooked pc runs a native
+ * function instead of the guest code. The hook reads its arguments with
+ * CPU_get_register and CPU_get_memory, sets its results with CPU_set_register
+ * and returns 1, the CPU then continues at ra; the call retires as one
+ * instruction. A hook returning 0 runs the guest function instead, for the
+ * arguments it cannot give the exact result for. Hooks stay across CPU_reset
+ * and are dropped when a program is loaded; the lockstep lanes ignore them.
+ */
+typedef int (*CPU_hook)(CPU *cpu, void *context);
+
+int CPU_set_hook(CPU *cpu, uint32_t pc, CPU_hook hook, void *context); //NULL removes the hook at pc
+
+//built-in hooks with the C library semantics, they run the guest code for an
+//overlapping memcpy and for ranges outside the data memory or over the console
+enum CPU_hle
+{
+	CPU_HLE_MEMCPY,
+	CPU_HLE_MEMSET,
+	CPU_HLE_STRLEN,
+	CPU_HLE_STRNLEN //also _strnlen_s of printf.c
+};
+
+int CPU_set_hle(CPU *cpu, uint32_t pc, int function); //enum CPU_hle
+int CPU_hle_function(const char *name); //enum CPU_hle of a function name, -1 if there is no built-in
+//address of a function in an ELF file or GNU ld .map file: CPU_ERROR_OPEN, or CPU_ERROR_ARGUMENT if it is not there
+int CPU_find_symbol(const char *filename, const char *name, uint32_t *addr);
+
+typedef struct
+{
+	uint64_t calls_;	//calls the hooks ran
+	uint64_t declined_; //calls left to the guest code
+	uint64_t bytes_;	//copied, set or scanned by the built-in hooks
+} CPU_hook_stats;
+
+void CPU_get_hook_stats(const CPU *cpu, CPU_hook_stats *stats); //since the last reset
+
+/**
+ * Accelerators: the custom-0 and custom-1 opcodes (0x0B, 0x2B) run native
+ * functions of the host as single instructions, to measure what a hardware
+ * accelerator would bring before it is built. An R-type instruction of either
+ * opcode selects one of CPU_ACCEL_SLOTS slots, funct3 plus 8 for custom-1. The
+ * accelerator gets the values of rs1 and rs2 and funct7, may use the data
+ * memory through CPU_get_memory and returns 1 with the value for rd. An empty
+ * slot or an accelerator returning 0 makes the instruction illegal: the CPU
+ * halts like at any instruction that is not implemented. Accelerators stay
+ * across CPU_reset and loads.
+ */
+#define CPU_ACCEL_SLOTS 16
+
+typedef int (*CPU_accelerator)(CPU *cpu, uint32_t rs1, uint32_t rs2, uint32_t funct7, uint32_t *rd, void *context);
+
+int CPU_set_accelerator(CPU *cpu, int slot, CPU_accelerator accelerator, void *context); //NULL empties the slot
+
+//built-in accelerators
+enum CPU_accel
+{
+	CPU_ACCEL_DOT16,	//rd: dot product of the 16 int32 at rs1 and at rs2, wrapping
+	CPU_ACCEL_AES_ROUND //AES encryption round of the 16 byte state at rs1 with the round key at rs2, in place;
+						//funct7 1 is the last round (no MixColumns); rd: 0
+};
+
+int CPU_set_accel(CPU *cpu, int slot, int accel); //enum CPU_accel
+int CPU_accel_function(const char *name);		  //enum CPU_accel of "dot16" or "aes", -1 otherwise
+
+typedef struct
+{
+	uint64_t calls_[CPU_ACCEL_SLOTS]; //instructions retired by the accelerator of each slot
+	uint64_t illegal_;				  //custom instructions without an accelerator or refused by it
+} CPU_accel_stats;
+
+void CPU_get_accel_stats(const CPU *cpu, CPU_accel_stats *stats); //since the last reset
+
+typedef struct
+{
+	uint64_t operations_; //started through CPU_DMA_CONTROL, failed ones included
+	uint64_t bytes_;	  //copied, filled, compared or summed
+} CPU_dma_stats;
+
+void CPU_get_dma_stats(const CPU *cpu, CPU_dma_stats *stats); //since the last reset
+
+/**
+ * System calls: with CPU_set_syscalls, ECALL runs the system call in a7 with the
+ * arguments in a0..a5 and returns the result or -errno in a0, the calls and
+ * numbers of newlib's libgloss for RISC-V: exit (93, also 94), read (63), write
+ * (64), open (1024) and openat (56, at AT_FDCWD only), close (57), lseek (62),
+ * fstat (80), brk (214), gettimeofday (169) and clock_gettime64 (403). read and
+ * write go straight between the host descriptor and the data memory; guest fds
+ * 0..2 are the host's standard streams, fds 1 and 2 the console when
+ * CPU_set_output gave the CPU one. open only reaches files inside the
+ * directories given to CPU_syscall_allow, none by default: "." and ".." of the
+ * path are folded lexically and no symbolic link below the directory is
+ * followed, also not a dangling one with O_CREAT. exit halts the CPU
+ * with the pc at the ECALL. Without CPU_set_syscalls ECALL is not implemented
+ * and halts like any such instruction.
+ */
+#define CPU_SYSCALL_FILES 32 //guest file descriptors per CPU
+
+typedef struct
+{
+	uint64_t calls_;
+	uint64_t read_;	   //bytes read into the data memory
+	uint64_t written_; //bytes written from it
+} CPU_syscall_stats;
+
+int CPU_set_syscalls(CPU *cpu, int enable); //off again closes the files the guest opened
+int CPU_syscall_allow(CPU *cpu, const char *directory); //CPU_ERROR_OPEN if it is not a directory
+//first program break, by default the end of the data image rounded up to a page;
+//brk moves it up to the stack pointer
+int CPU_set_brk(CPU *cpu, uint32_t addr);
+int CPU_get_exit_code(const CPU *cpu, int *code); //1 and the code of exit once the guest called it
+void CPU_get_syscall_stats(const CPU *cpu, CPU_syscall_stats *stats); //since the last reset
+
+/**
+ * Block device: a host file as a disk of CPU_BLK_SECTOR byte sectors, served by
+ * a host thread of its own so the guest computes while the device reads and
+ * writes. The queue in guest memory is a split ring like virtio's, with size
+ * slots and one buffer per request:
+ *
+ *   queue + 16 * slot   request: type, sector, buffer address, length in bytes
+ *   queue + 16 * size   avail: requests the guest added, counting up
+ *   queue + 16 * size + 4                 used: requests the device served
+ *   queue + 16 * size + 8 + 4 * slot      status of the request in slot
+ *
+ * The guest fills slot avail % size, increments avail and stores a byte to
+ * CPU_BLK_NOTIFY; the device serves the requests in order, straight between the
+ * file and the buffer, and sets the status, used and bit 0 of CPU_BLK_ISR.
+ * The guest polls used or the ISR, or waits with WFI: CPU_blk_wait wakes a CPU
+ * waiting while bit 0 of the ISR is set (the guest clears it before it waits
+ * again). In privileged mode bit 0 of the ISR is also the external interrupt
+ * line, mip.SEIP: with mie.SEIE set it traps to machine mode, or to supervisor
+ * mode when mideleg delegates it (cause 0x80000009), before the next
+ * instruction. Without privileged mode there are no interrupts. The harts of
+ * one memory share its device; the emulator wakes instances after CPU_run and
+ * CPU_run_lockstep, guests of the scheduler and harts poll.
+ */
+enum CPU_blk_type
+{
+	CPU_BLK_IN = 0,	  //file to buffer
+	CPU_BLK_OUT = 1,  //buffer to file
+	CPU_BLK_FLUSH = 4 //to stable storage
+};
+
+enum CPU_blk_status
+{
+	CPU_BLK_OK = 0,
+	CPU_BLK_IOERR = 1, //outside the disk or the data memory, a length that is no multiple of a sector, a write to a read-only disk
+	CPU_BLK_UNSUPP = 2
+};
+
+typedef struct
+{
+	uint64_t requests_;
+	uint64_t errors_; //requests served with a status other than CPU_BLK_OK
+	uint64_t read_;	  //bytes read from the file
+	uint64_t written_;
+	uint64_t busy_ns_; //time the device thread spent serving requests
+} CPU_blk_stats;
+
+//CPU_ERROR_OPEN if the file cannot be opened, CPU_ERROR_ARGUMENT for a hart or a second device
+int CPU_attach_block(CPU *cpu, const char *path, int writable);
+//until the device is idle; 1 and the CPU woken if it was waiting and the ISR is set
+int CPU_blk_wait(CPU *cpu);
+void CPU_get_blk_stats(const CPU *cpu, CPU_blk_stats *stats); //since the device was attached
+
+/**
+ * Privileged mode: with CPU_set_privileged the CPU has machine, supervisor and
+ * user mode and Sv32 paging, for small guest operating systems. It starts in
+ * machine mode with paging off. Exceptions trap to mtvec, or to stvec when
+ * medeleg delegates them: illegal instructions, EBREAK, ECALL, page faults,
+ * access faults outside the memories and accesses that are misaligned across a
+ * page. Everything that halts without privileged mode traps, only a jump to
+ * itself, exit and a trap into machine mode while mtvec is 0 halt. The only
+ * interrupt is the one of the block device (see CPU_attach_block), mtvec and
+ * stvec may be vectored for it; WFI waits for CPU_wake or CPU_blk_wait as
+ * before. ECALL in machine mode is the system call of
+ * CPU_set_syscalls when they are on, like a call into the firmware.
+ *
+ * Loads and stores go through a direct-mapped TLB of CPU_TLB_ENTRIES entries
+ * indexed by the virtual page number that caches the host address of the page,
+ * instruction fetch through a second one; the page table walk only runs on a
+ * miss. Entries are tagged with the ASID of satp, so switching address spaces
+ * does not flush them. SFENCE.VMA drops all entries, those of one ASID (global
+ * pages stay) or those of one page. Page tables, physical pages of loads and
+ * stores and the devices are in the data memory, instruction fetch translates
+ * into the instruction memory (the memories stay apart as without paging, and
+ * the instruction memory repeats every MiB): a program maps its code at the
+ * addresses of the instruction image. Privileged
+ * mode runs on the interpreter whatever the engine, without function hooks and
+ * without the sampling profiler.
+ */
+#define CPU_TLB_ENTRIES 256
+
+enum CPU_privilege
+{
+	CPU_PRIV_USER = 0,
+	CPU_PRIV_SUPERVISOR = 1,
+	CPU_PRIV_MACHINE = 3
+};
+
+typedef struct
+{
+	uint64_t itlb_hits_; //instruction fetches
+	uint64_t itlb_misses_;
+	uint64_t dtlb_hits_; //loads and stores
+	uint64_t dtlb_misses_;
+	uint64_t pte_reads_; //page table entries read by the walks of the misses
+	uint64_t flushes_;	 //SFENCE.VMA
+	uint64_t page_faults_;
+	uint64_t traps_; //exceptions taken, page faults included
+	uint64_t interrupts_; //of the block device taken
+} CPU_tlb_stats;
+
+int CPU_set_privileged(CPU *cpu, int enable); //off again goes back to the flat memory
+int CPU_get_privilege(const CPU *cpu);		  //enum CPU_privilege, machine mode without privileged mode
+void CPU_get_tlb_stats(const CPU *cpu, CPU_tlb_stats *stats); //since the last reset
+
+uint32_t CPU_get_register(const CPU *cpu, int index);
+void CPU_set_register(CPU *cpu, int index, uint32_t value); //x0 stays 0
+uint64_t CPU_get_fregister(const CPU *cpu, int index);	  //F and D: a single NaN-boxed in the low half
+void CPU_set_fregister(CPU *cpu, int index, uint64_t value);
+uint32_t CPU_get_fcsr(const CPU *cpu); //frm and the fflags as of the last return of CPU_run
+#define CPU_VLEN 256 //bits of a vector register (V extension, ELEN 32)
+uint8_t *CPU_get_vregister(CPU *cpu, int index); //CPU_VLEN / 8 bytes, register groups continue in the next; NULL outside 0..31
+uint8_t *CPU_get_memory(CPU *cpu, uint32_t addr, size_t size); //NULL unless the range is inside the data memory
+uint32_t CPU_get_pc(const CPU *cpu);
+uint64_t CPU_get_instret(const CPU *cpu); //retired instructions since the last reset
+int CPU_is_halted(const CPU *cpu);
+size_t CPU_get_instr_mem_size(const CPU *cpu);
+size_t CPU_get_data_image_size(const CPU *cpu);
+size_t CPU_get_data_mem_size(const CPU *cpu);
+int CPU_get_data_mem_backing(const CPU *cpu); //enum CPU_backing
+
+const char *CPU_error_string(int status);
+
+/**
+ * Instrumentation. The objects are owned by the caller and attached with the
+ * CPU_set_* functions (NULL detaches); they have to outlive their use by CPU_run.
+ * The functions creating them return NULL when out of memory.
+ */
+
+//spec is "all" or a comma separated list of btfn,bimodal,gshare,tage,ras; NULL if a name is unknown or out of memory
+BP_sim *BP_create(const char *spec, const CPU *cpu);
+void BP_report(BP_sim *sim, FILE *out);
+void BP_destroy(BP_sim *sim);
+void CPU_set_bpred(CPU *cpu, BP_sim *sim);
+
+//binary execution trace (format in trace.h), one ring per emulating thread
+TRACE_writer *TRACE_writer_create(const char *path);
+TRACE_ring *TRACE_attach(TRACE_writer *writer);
+void TRACE_flush(TRACE_ring *ring);
+uint64_t TRACE_writer_close(TRACE_writer *writer); //returns the number of records written
+void CPU_set_trace(CPU *cpu, TRACE_ring *ring);	   //switches the CPU to the pre-decoded engine
+
+//opcode mix, hot PCs and blocks of the pre-decoded engine
+void PROF_report(const CPU *cpu, FILE *out);
+
+//sampled call stacks every period instructions (0: default), collapsed stack output
+SAMPLE_profiler *SAMPLE_create(uint64_t period, uint32_t entry_pc);
+int SAMPLE_load_symbols(SAMPLE_profiler *profiler, const char *filename); //ELF or GNU ld .map file
+void SAMPLE_report(const SAMPLE_profiler *profiler, FILE *out);
+uint64_t SAMPLE_get_samples(const SAMPLE_profiler *profiler);
+uint64_t SAMPLE_get_period(const SAMPLE_profiler *profiler);
+void SAMPLE_destroy(SAMPLE_profiler *profiler);
+void CPU_set_sampler(CPU *cpu, SAMPLE_profiler *profiler);
+
+/**
+ * Host performance counters (Linux perf_event_open, user space only) for the
+ * calling thread. Counters the host or the VM does not provide are reported as n/a.
+ */
+
+enum perf_counter
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_BRANCH_MISSES,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_DTLB_MISSES,
+	PERF_TASK_CLOCK, //ns
+	PERF_PAGE_FAULTS,
+	PERF_COUNTERS
+};
+
+typedef struct
+{
+	int fd_[PERF_COUNTERS];
+	uint64_t value_[PERF_COUNTERS];
+	int valid_[PERF_COUNTERS];
+} PERF_counters;
+
+int PERF_open(PERF_counters *counters); //returns the number of counters that could be opened
+void PERF_start(PERF_counters *counters);
+void PERF_stop(PERF_counters *counters);
+void PERF_close(PERF_counters *counters);
+void PERF_report(const PERF_counters *counters, uint64_t guest_instructions, FILE *out);
+
+#endif
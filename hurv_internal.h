@@ -0,0 +1,639 @@
+/**
+ * Internals of libhurv shared by the core, the engines and the instrumentation.
+ * Not part of the public API (hurv.h).
+ */
+
+#ifndef HURV_INTERNAL_H
+#define HURV_INTERNAL_H
+
+#include "hurv.h"
+
+enum opcode_decode
+{
+	R = 0x33,
+	I = 0x13,
+	S = 0x23,
+	L = 0x03,
+	B = 0x63,
+	JALR = 0x67,
+	JAL = 0x6F,
+	AUIPC = 0x17,
+	LUI = 0x37,
+	MISC_MEM = 0x0F, //FENCE
+	SYSTEM = 0x73,	 //Zicsr
+	AMO = 0x2F,		 //A extension
+	CUSTOM_0 = 0x0B, //accelerators
+	CUSTOM_1 = 0x2B,
+	LOAD_FP = 0x07, //F and D extensions
+	STORE_FP = 0x27,
+	MADD = 0x43,
+	MSUB = 0x47,
+	NMSUB = 0x4B,
+	NMADD = 0x4F,
+	FP = 0x53,
+	VECTOR = 0x57 //V extension; its loads and stores are LOAD_FP and STORE_FP
+};
+
+#define VEC_VLENB (CPU_VLEN / 8)
+
+typedef struct CPU_decoded CPU_decoded;
+typedef struct BLK_device BLK_device;
+typedef struct MMU_state MMU_state;
+
+#define CPU_RAS_DEPTH 16
+
+typedef struct
+{
+	uint32_t pc_; //masked to the instruction memory
+	CPU_hook hook_;
+	void *context_;
+} HLE_entry;
+
+typedef struct
+{
+	CPU_accelerator function_;
+	void *context_;
+} ACCEL_slot;
+
+#define HLE_MAP_WORDS ((0x100000 >> 2) / 64) //a bit per instruction word of the 1 MiB pc space
+
+//system call state of a CPU (syscall.c)
+typedef struct
+{
+	int files_[CPU_SYSCALL_FILES]; //host descriptor of a guest fd, -1 if closed
+	char **allowed_;			   //sandbox: real paths of the directories open may reach
+	int *allowed_fds_;			   //O_PATH descriptors of these directories, open resolves beneath them
+	size_t allowed_count_;
+	uint32_t brk_base_; //0: the end of the data image
+	uint32_t brk_;
+	int exited_;
+	int exit_code_;
+	CPU_syscall_stats stats_;
+} SYS_state;
+
+struct CPU
+{
+	size_t data_mem_size_;
+	size_t instr_mem_size_;
+	uint32_t regfile_[32];
+	uint32_t pc_;
+	uint64_t fregs_[32]; //F and D, singles NaN-boxed
+	uint32_t fcsr_;		 //frm in bits 7..5, fflags in 4..0 (without the host flags of the current run, see fpu.c)
+	uint8_t *instr_mem_;
+	uint8_t *data_mem_;
+	MMU_state *mmu_; //privileged mode, NULL if off: loads and stores index data_mem_ directly
+	uint64_t data_limit_; //data_mem_size_, 0 in privileged mode where every access looks at the TLB
+	size_t data_mem_mapped_; //data_mem_size_ rounded up to the page size
+	int data_mem_backing_;
+	uint8_t *data_image_; //loaded data memory image, restored by CPU_reset
+	size_t data_image_size_;
+	uint64_t instret_; //retired instructions
+	int halted_;
+	uint32_t tier_thresholds_[2];	 //tiered engine: executions before a pc is decoded and before a block is translated
+	uint64_t tier_instructions_[3]; //tiered engine: retired per enum CPU_tier
+	int ir_optimize_;				 //tiered engine: IR_optimize translated blocks
+	CPU_ir_stats ir_stats_;
+	uint32_t ras_pc_[CPU_RAS_DEPTH]; //tiered engine: return-address stack, return pcs and their blocks
+	int32_t ras_block_[CPU_RAS_DEPTH];
+	uint32_t ras_top_;
+	uint32_t ras_count_;
+	CPU_jump_stats jump_stats_;
+	TCACHE *tcache_;	//tiered engine: translation cache, NULL until the first translation
+	int tcache_owned_; //private cache, destroyed with the CPU
+	int waiting_; //stopped by WFI or by a load waiting for console input, until CPU_wake
+	int faulted_; //a load or store outside the data memory stopped the run, CPU_run halts the CPU
+	uint32_t fault_address_;
+	int engine_;
+	CPU_output output_; //console
+	void *output_context_;
+	CPU_input input_; //NULL if there is no console input
+	void *input_context_;
+	CPU_decoded *decoded_;	   //pre-decoded blocks, created by the first CPU_run
+	char *decode_cache_;	   //directory of the persistent pre-decode cache, NULL if off
+	HLE_entry *hooks_;		   //function hooks, see hle.c
+	size_t hook_count_;
+	uint64_t *hook_map_; //pcs with a hook, NULL while there is none
+	CPU_hook_stats hook_stats_;
+	ACCEL_slot accel_[CPU_ACCEL_SLOTS]; //custom-0/1 accelerators, see accel.c
+	CPU_accel_stats accel_stats_;
+	CPU_dma_stats dma_stats_;
+	SYS_state *syscalls_; //NULL while ECALL is not implemented
+	BLK_device *blk_;	  //block device, NULL if none is attached; harts use the one of the memory owner
+	BP_sim *bpred_;			   //optional branch predictor simulation, NULL if off
+	TRACE_ring *trace_;		   //optional execution trace, NULL if off
+	SAMPLE_profiler *sampler_; //optional sampling profiler, NULL if off
+	CPU *memory_owner_;		   //hart sharing the memory of this CPU (CPU_create_hart), NULL if it is its own
+	uint32_t hartid_;
+	uint32_t mscratch_;
+	int reserved_; //LR/SC reservation
+	uint32_t reservation_;
+	uint32_t reservation_value_;
+	uint32_t vl_; //V extension, see vector.c
+	uint32_t vtype_;
+	uint8_t vregs_[32 * VEC_VLENB]; //the vector registers one after another, last so the hot fields stay together
+};
+
+//helper functions
+int8_t getFunc3(uint32_t instruction);
+int8_t getRS1(uint32_t instruction);
+int8_t getRS2(uint32_t instruction);
+int8_t getRD(uint32_t instruction);
+uint8_t getOpCode(uint32_t instruction);
+int8_t getFunc7(uint32_t instruction);
+int32_t shamt(uint32_t instruction);
+
+//immediate functions
+int32_t imm_I(uint32_t instruction);
+int32_t imm_S(uint32_t instruction);
+int32_t imm_B(uint32_t instruction);
+uint32_t imm_U(uint32_t instruction);
+int32_t imm_J(uint32_t instruction);
+
+//R-Type functions
+void ADD(CPU *cpu, uint32_t instruction);
+void SUB(CPU *cpu, uint32_t instruction);
+void SLL(CPU *cpu, uint32_t instruction);
+void SLT(CPU *cpu, uint32_t instruction);
+void SLTU(CPU *cpu, uint32_t instruction);
+void XOR(CPU *cpu, uint32_t instruction);
+void SRL(CPU *cpu, uint32_t instruction);
+void SRA(CPU *cpu, uint32_t instruction);
+void OR(CPU *cpu, uint32_t instruction);
+void AND(CPU *cpu, uint32_t instruction);
+
+//I-Type functions
+void JALR1(CPU *cpu, uint32_t instruction);
+void LB(CPU *cpu, uint32_t instruction);
+void LH(CPU *cpu, uint32_t instruction);
+void LW(CPU *cpu, uint32_t instruction);
+void LBU(CPU *cpu, uint32_t instruction);
+void LHU(CPU *cpu, uint32_t instruction);
+void ADDI(CPU *cpu, uint32_t instruction);
+void SLTI(CPU *cpu, uint32_t instruction);
+void SLTIU(CPU *cpu, uint32_t instruction);
+void XORI(CPU *cpu, uint32_t instruction);
+void ORI(CPU *cpu, uint32_t instruction);
+void ANDI(CPU *cpu, uint32_t instruction);
+
+//S-Type functions
+void SB(CPU *cpu, uint32_t instruction);
+void SH(CPU *cpu, uint32_t instruction);
+void SW(CPU *cpu, uint32_t instruction);
+
+//B_Type function
+void BEQ(CPU *cpu, uint32_t instruction);
+void BNE(CPU *cpu, uint32_t instruction);
+void BLT(CPU *cpu, uint32_t instruction);
+void BGE(CPU *cpu, uint32_t instruction);
+void BLTU(CPU *cpu, uint32_t instruction);
+void BGEU(CPU *cpu, uint32_t instruction);
+
+//U-Type functions
+void LUI1(CPU *cpu, uint32_t instruction);
+void AUIPC1(CPU *cpu, uint32_t instruction);
+
+//J_Type functions
+void JAL1(CPU *cpu, uint32_t instruction);
+
+//shift functions
+void SLLI(CPU *cpu, uint32_t instruction);
+void SRLI(CPU *cpu, uint32_t instruction);
+void SRAI(CPU *cpu, uint32_t instruction);
+
+//FENCE, WFI, Zicsr and A extension
+void FENCE(CPU *cpu, uint32_t instruction);
+void WFI(CPU *cpu, uint32_t instruction);
+void CSRRW(CPU *cpu, uint32_t instruction);
+void CSRRS(CPU *cpu, uint32_t instruction);
+void CSRRC(CPU *cpu, uint32_t instruction);
+void CSRRWI(CPU *cpu, uint32_t instruction);
+void CSRRSI(CPU *cpu, uint32_t instruction);
+void CSRRCI(CPU *cpu, uint32_t instruction);
+void LR_W(CPU *cpu, uint32_t instruction);
+void SC_W(CPU *cpu, uint32_t instruction);
+void AMOSWAP_W(CPU *cpu, uint32_t instruction);
+void AMOADD_W(CPU *cpu, uint32_t instruction);
+void AMOXOR_W(CPU *cpu, uint32_t instruction);
+void AMOAND_W(CPU *cpu, uint32_t instruction);
+void AMOOR_W(CPU *cpu, uint32_t instruction);
+void AMOMIN_W(CPU *cpu, uint32_t instruction);
+void AMOMAX_W(CPU *cpu, uint32_t instruction);
+void AMOMINU_W(CPU *cpu, uint32_t instruction);
+void AMOMAXU_W(CPU *cpu, uint32_t instruction);
+
+//function hooks (hle.c)
+void HLE(CPU *cpu, uint32_t instruction); //the hook at the pc, or the instruction if it declined
+int HLE_call(CPU *cpu);					   //runs the hook at the pc, 1 if it returned to ra
+void HLE_clear(CPU *cpu);
+static inline int HLE_hooked(const CPU *cpu, uint32_t pc)
+{
+	uint32_t index = (pc & 0xFFFFF) >> 2;
+	return cpu->hook_map_ && (cpu->hook_map_[index >> 6] >> (index & 63) & 1);
+}
+#define HLE_RETURN 0x00008067 //"ret", the instrumentation sees a hooked call that ran return with it
+
+//V extension (vector.c)
+void VSETVL(CPU *cpu, uint32_t instruction); //vsetvli, vsetivli and vsetvl
+void VLE(CPU *cpu, uint32_t instruction);
+void VLSE(CPU *cpu, uint32_t instruction);
+void VSE(CPU *cpu, uint32_t instruction);
+void VSSE(CPU *cpu, uint32_t instruction);
+void VLM(CPU *cpu, uint32_t instruction);
+void VSM(CPU *cpu, uint32_t instruction);
+void VARITH(CPU *cpu, uint32_t instruction); //element-wise integer operations, vmerge and vmv.v by funct6
+void VCMP(CPU *cpu, uint32_t instruction);	 //integer compares into a mask
+void VRED(CPU *cpu, uint32_t instruction);	 //reductions
+void VMASK(CPU *cpu, uint32_t instruction);	 //mask logical operations
+void VCPOP(CPU *cpu, uint32_t instruction);
+void VFIRST(CPU *cpu, uint32_t instruction);
+void VMV_X_S(CPU *cpu, uint32_t instruction);
+void VMV_S_X(CPU *cpu, uint32_t instruction);
+void VID(CPU *cpu, uint32_t instruction);
+uint16_t VEC_decode(uint32_t instruction); //micro-op of an OP-V instruction or a vector load or store
+void VEC_reset(CPU *cpu);
+
+//F and D extensions (fpu.c)
+void FLW(CPU *cpu, uint32_t instruction);
+void FLD(CPU *cpu, uint32_t instruction);
+void FSW(CPU *cpu, uint32_t instruction);
+void FSD(CPU *cpu, uint32_t instruction);
+void FMADD_S(CPU *cpu, uint32_t instruction);
+void FMSUB_S(CPU *cpu, uint32_t instruction);
+void FNMSUB_S(CPU *cpu, uint32_t instruction);
+void FNMADD_S(CPU *cpu, uint32_t instruction);
+void FADD_S(CPU *cpu, uint32_t instruction);
+void FSUB_S(CPU *cpu, uint32_t instruction);
+void FMUL_S(CPU *cpu, uint32_t instruction);
+void FDIV_S(CPU *cpu, uint32_t instruction);
+void FSQRT_S(CPU *cpu, uint32_t instruction);
+void FSGNJ_S(CPU *cpu, uint32_t instruction); //FSGNJ, FSGNJN and FSGNJX by funct3
+void FMIN_S(CPU *cpu, uint32_t instruction);  //FMIN and FMAX
+void FCMP_S(CPU *cpu, uint32_t instruction);  //FEQ, FLT and FLE
+void FCLASS_S(CPU *cpu, uint32_t instruction);
+void FCVT_W_S(CPU *cpu, uint32_t instruction); //FCVT.W.S and FCVT.WU.S by rs2
+void FCVT_S_W(CPU *cpu, uint32_t instruction); //FCVT.S.W and FCVT.S.WU
+void FMV_X_W(CPU *cpu, uint32_t instruction);
+void FMV_W_X(CPU *cpu, uint32_t instruction);
+void FMADD_D(CPU *cpu, uint32_t instruction);
+void FMSUB_D(CPU *cpu, uint32_t instruction);
+void FNMSUB_D(CPU *cpu, uint32_t instruction);
+void FNMADD_D(CPU *cpu, uint32_t instruction);
+void FADD_D(CPU *cpu, uint32_t instruction);
+void FSUB_D(CPU *cpu, uint32_t instruction);
+void FMUL_D(CPU *cpu, uint32_t instruction);
+void FDIV_D(CPU *cpu, uint32_t instruction);
+void FSQRT_D(CPU *cpu, uint32_t instruction);
+void FSGNJ_D(CPU *cpu, uint32_t instruction);
+void FMIN_D(CPU *cpu, uint32_t instruction);
+void FCMP_D(CPU *cpu, uint32_t instruction);
+void FCLASS_D(CPU *cpu, uint32_t instruction);
+void FCVT_W_D(CPU *cpu, uint32_t instruction);
+void FCVT_D_W(CPU *cpu, uint32_t instruction);
+void FCVT_S_D(CPU *cpu, uint32_t instruction);
+void FCVT_D_S(CPU *cpu, uint32_t instruction);
+uint16_t FPU_decode(uint32_t instruction); //micro-op of an instruction of the FP opcodes
+void FPU_enter(void);					   //the host flags from here on are the guest's
+void FPU_leave(CPU *cpu);				   //the host flags into fflags
+uint32_t FPU_read_fcsr(CPU *cpu);
+void FPU_write_fcsr(CPU *cpu, uint32_t value);
+
+//privileged mode and Sv32 paging (mmu.c)
+enum MMU_access
+{
+	MMU_FETCH,
+	MMU_LOAD,
+	MMU_STORE
+};
+
+//mcause and scause of the exceptions
+enum MMU_cause
+{
+	MMU_FETCH_MISALIGNED = 0,
+	MMU_FETCH_ACCESS = 1,
+	MMU_ILLEGAL = 2,
+	MMU_BREAKPOINT = 3,
+	MMU_LOAD_MISALIGNED = 4,
+	MMU_LOAD_ACCESS = 5,
+	MMU_STORE_MISALIGNED = 6,
+	MMU_STORE_ACCESS = 7,
+	MMU_ECALL_U = 8, //+ the privilege of the caller
+	MMU_FETCH_PAGE_FAULT = 12,
+	MMU_LOAD_PAGE_FAULT = 13,
+	MMU_STORE_PAGE_FAULT = 15
+};
+
+#define MMU_INTERRUPT 0x80000000u					//cause bit of the interrupts
+#define MMU_SUPERVISOR_EXTERNAL (MMU_INTERRUPT | 9) //the interrupt of the block device
+
+#define MMU_TLB_INVALID 0xFFFFFFFFu
+#define MMU_BARE (1u << 30) //context of untranslated accesses, the TLB then maps a page to itself
+
+typedef struct
+{
+	uint32_t tag_;		 //virtual page number | context, MMU_TLB_INVALID if empty; loads and fetches may use the entry
+	uint32_t write_tag_; //tag_ if stores may use it too (writable and dirty), MMU_TLB_INVALID otherwise
+	uintptr_t addend_;	 //host address of the page minus its virtual address
+	uint32_t global_;
+} MMU_tlb_entry;
+
+struct MMU_state
+{
+	MMU_tlb_entry dtlb_[CPU_TLB_ENTRIES];
+	MMU_tlb_entry itlb_[CPU_TLB_ENTRIES];
+	uint32_t data_context_; //(ASID | user << 9) << 20 of loads and stores, MMU_BARE without translation
+	uint32_t fetch_context_;
+	int priv_; //enum CPU_privilege
+	uint32_t mstatus_;
+	uint32_t medeleg_;
+	uint32_t mideleg_;
+	uint32_t mie_;
+	uint32_t mtvec_;
+	uint32_t mepc_;
+	uint32_t mcause_;
+	uint32_t mtval_;
+	uint32_t stvec_;
+	uint32_t sscratch_;
+	uint32_t sepc_;
+	uint32_t scause_;
+	uint32_t stval_;
+	uint32_t satp_;
+	CPU_tlb_stats stats_;
+};
+
+uint8_t *MMU_translate(CPU *cpu, uint32_t addr, uint32_t size, int access); //TLB miss: NULL if the access trapped
+void MMU_trap(CPU *cpu, uint32_t cause, uint32_t tval);
+void MMU_reset(CPU *cpu);
+uint64_t MMU_run(CPU *cpu, uint64_t max_steps);
+int MMU_csr_allowed(const CPU *cpu, uint32_t csr, int write);
+uint32_t MMU_csr_read(CPU *cpu, uint32_t csr);
+void MMU_csr_write(CPU *cpu, uint32_t csr, uint32_t value);
+void MMU_system(CPU *cpu, uint32_t instruction); //MRET, SRET, SFENCE.VMA and EBREAK
+int MMU_ecall(CPU *cpu);						 //1 if ECALL trapped instead of running a system call
+
+//a load or store outside the data memory: stops the run like a waiting load, NULL
+__attribute__((cold)) uint8_t *CPU_memory_fault(CPU *cpu, uint32_t addr);
+void CPU_settle_fault(CPU *cpu); //after a run: the stopped CPU halts at the access
+
+/**
+ * Host address of size bytes at addr for a load or a store. Without privileged
+ * mode it is the data memory at addr, past its end CPU_memory_fault: the handler
+ * returns with the pc unchanged and the CPU halts at the access. In privileged mode it
+ * is a TLB hit or MMU_translate; NULL if the access trapped, the pc is at the
+ * handler then.
+ */
+static inline uint8_t *CPU_load_address(CPU *cpu, uint32_t addr, uint32_t size)
+{
+	MMU_state *mmu = cpu->mmu_;
+	if (__builtin_expect((uint64_t)addr + size <= cpu->data_limit_, 1))
+	{
+		return cpu->data_mem_ + addr;
+	}
+	if (!mmu)
+	{
+		return CPU_memory_fault(cpu, addr);
+	}
+	const MMU_tlb_entry *entry = &mmu->dtlb_[addr >> 12 & (CPU_TLB_ENTRIES - 1)];
+	if (entry->tag_ == (addr >> 12 | mmu->data_context_) && (addr & 0xFFF) + size <= 0x1000)
+	{
+		mmu->stats_.dtlb_hits_++;
+		return (uint8_t *)(entry->addend_ + addr);
+	}
+	return MMU_translate(cpu, addr, size, MMU_LOAD);
+}
+
+static inline uint8_t *CPU_store_address(CPU *cpu, uint32_t addr, uint32_t size)
+{
+	MMU_state *mmu = cpu->mmu_;
+	if (__builtin_expect((uint64_t)addr + size <= cpu->data_limit_, 1))
+	{
+		return cpu->data_mem_ + addr;
+	}
+	if (!mmu)
+	{
+		return CPU_memory_fault(cpu, addr);
+	}
+	const MMU_tlb_entry *entry = &mmu->dtlb_[addr >> 12 & (CPU_TLB_ENTRIES - 1)];
+	if (entry->write_tag_ == (addr >> 12 | mmu->data_context_) && (addr & 0xFFF) + size <= 0x1000)
+	{
+		mmu->stats_.dtlb_hits_++;
+		return (uint8_t *)(entry->addend_ + addr);
+	}
+	return MMU_translate(cpu, addr, size, MMU_STORE);
+}
+
+//accelerators (accel.c)
+void ACCEL(CPU *cpu, uint32_t instruction);
+
+//system calls (syscall.c)
+void ECALL(CPU *cpu, uint32_t instruction);
+void SYS_reset(CPU *cpu); //closes the files of the guest, the break goes back to its base
+void SYS_clear(CPU *cpu);
+void CPU_output_stdout(void *context, uint8_t byte); //the default console
+
+//devices: a byte stored into the page of the console goes to CPU_device_store, off the path of the other stores
+#define CPU_DEVICE_PAGE 0x5000
+__attribute__((cold, noinline)) void CPU_device_store(CPU *cpu, uint32_t address, uint8_t byte);
+
+//DMA engine (dma.c)
+void DMA_start(CPU *cpu, uint8_t operation); //a byte stored to CPU_DMA_CONTROL
+
+//block device (blk.c)
+void BLK_notify(CPU *cpu); //a byte stored to CPU_BLK_NOTIFY
+void BLK_reset(CPU *cpu);  //waits for the requests in flight and forgets the queue
+void BLK_publish(CPU *cpu); //the capacity registers into the data memory
+int BLK_pending(const CPU *cpu); //the interrupt line: a device is attached and bit 0 of its ISR is set
+void BLK_detach(CPU *cpu);
+
+void CPU_execute(CPU *cpu);
+void CPU_execute_instruction(CPU *cpu, uint32_t instruction); //CPU_execute after the fetch and the hooks
+
+//pre-decoded engine
+enum uop_decode
+{
+	OP_INVALID,
+	OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+	OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI,
+	OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU,
+	OP_SB, OP_SH, OP_SW,
+	OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+	OP_LUI, OP_AUIPC, OP_JAL, OP_JALR,
+	OP_FENCE, OP_WFI, OP_CSRRW, OP_CSRRS, OP_CSRRC, OP_CSRRWI, OP_CSRRSI, OP_CSRRCI,
+	OP_LR_W, OP_SC_W, OP_AMOSWAP_W, OP_AMOADD_W, OP_AMOXOR_W, OP_AMOAND_W, OP_AMOOR_W,
+	OP_AMOMIN_W, OP_AMOMAX_W, OP_AMOMINU_W, OP_AMOMAXU_W,
+	OP_HLE, //first instruction of a hooked function, a block of its own
+	OP_ECALL,
+	OP_ACCEL,
+	OP_FLW, OP_FLD, OP_FSW, OP_FSD,
+	OP_FMADD_S, OP_FMSUB_S, OP_FNMSUB_S, OP_FNMADD_S, OP_FADD_S, OP_FSUB_S, OP_FMUL_S, OP_FDIV_S, OP_FSQRT_S,
+	OP_FSGNJ_S, OP_FMIN_S, OP_FCMP_S, OP_FCLASS_S, OP_FCVT_W_S, OP_FCVT_S_W, OP_FMV_X_W, OP_FMV_W_X,
+	OP_FMADD_D, OP_FMSUB_D, OP_FNMSUB_D, OP_FNMADD_D, OP_FADD_D, OP_FSUB_D, OP_FMUL_D, OP_FDIV_D, OP_FSQRT_D,
+	OP_FSGNJ_D, OP_FMIN_D, OP_FCMP_D, OP_FCLASS_D, OP_FCVT_W_D, OP_FCVT_D_W, OP_FCVT_S_D, OP_FCVT_D_S,
+	OP_VSETVL, OP_VLE, OP_VLSE, OP_VSE, OP_VSSE, OP_VLM, OP_VSM, OP_VARITH, OP_VCMP, OP_VRED, OP_VMASK,
+	OP_VCPOP, OP_VFIRST, OP_VMV_X_S, OP_VMV_S_X, OP_VID,
+	OP_COUNT
+};
+
+typedef void (*CPU_handler)(CPU *cpu, uint32_t instruction);
+
+typedef struct
+{
+	const char *mnemonic_;
+	CPU_handler handler_;
+} CPU_op;
+
+extern const CPU_op CPU_ops[OP_COUNT];
+
+typedef struct
+{
+	uint32_t instruction_;
+	uint16_t op_;
+	uint8_t trace_; //flags of its trace record, TRACE_layout
+} CPU_uop;
+
+typedef struct
+{
+	uint32_t start_;    //first micro-op in CPU_decoded.uops_
+	uint32_t pc_index_; //instruction memory index of the first instruction
+	uint32_t length_;
+	uint64_t count_; //times the whole block was executed
+	uint64_t taken_; //times the branch at the end of the block was taken
+} CPU_block;
+
+/**
+ * Translated tier: a hot block turned into ops with the register numbers,
+ * immediates and jump targets already extracted, run by TRANS_run
+ */
+enum trans_kind
+{
+	T_ADD, T_SUB, T_SLL, T_SLT, T_SLTU, T_XOR, T_SRL, T_SRA, T_OR, T_AND,
+	T_ADDI, T_SLTIU, T_XORI, T_ORI, T_ANDI, T_SLLI, T_SRLI, T_SRAI, T_LI,
+	T_LB, T_LH, T_LW, T_LBU, T_LHU, T_SB, T_SH, T_SW,
+	T_BEQ, T_BNE, T_BLTU, T_BGE, T_BGEU, T_JAL, T_JALR,
+	T_CALL, //the handler of a micro-op, for everything else
+	T_EXIT,	 //end of a block without a jump: continue at imm_
+	T_GUARD, //in front of the block: the pc_ bytes at x[rs1_] + imm_ are in the data memory
+	T_GLH, T_GLW, T_GLHU, T_GSB, T_GSH, T_GSW //accesses inside a guard of the block, not checked again
+};
+
+typedef struct
+{
+	uint8_t kind_; //enum trans_kind
+	uint8_t rd_;
+	uint8_t rs1_;
+	uint8_t rs2_;
+	uint32_t imm_; //immediate, taken target or the instruction of T_CALL
+	uint32_t pc_;  //pc of the guest instruction
+} TRANS_op;
+
+#define TRANS_UNGUARDED 0xFFFFFFFFu //TRANS_run: a guard failed, nothing ran
+
+typedef struct TRANS_block
+{
+	uint32_t pc_;
+	uint32_t length_; //guest instructions
+	uint32_t op_count_;
+	uint32_t eliminated_; //ops dropped by IR_optimize
+	uint32_t ic_pc_[2];	  //inline cache of the JALR ending the block: last targets and their translations
+	struct TRANS_block *ic_block_[2];
+	int32_t id_;		  //block in CPU_decoded
+	uint32_t bytes_;	  //allocated, counted in the translation cache
+	uint32_t generation_; //generation of the translation cache it last ran in
+	uint32_t exit_pc_[2]; //direct successors: taken target and fall through, 1 if there is none
+	struct TRANS_block *chain_[2]; //their translations once linked, NULL until then
+	struct TRANS_block *alias_;	   //translation of the same block entered at another alias of its pc
+	TRANS_op ops_[];
+} TRANS_block;
+
+TRANS_block *TRANS_translate(const CPU_uop *uops, uint32_t length, uint32_t pc);
+uint32_t TRANS_run(CPU *cpu, const TRANS_block *block); //retired instructions or TRANS_UNGUARDED, sets the pc
+TRANS_block *IR_optimize(TRANS_block *block, CPU_ir_stats *stats); //the block, moved if it got guards
+
+//translation cache, see tcache.c
+struct TCACHE
+{
+	size_t budget_;
+	size_t bytes_;
+	size_t peak_bytes_;
+	uint32_t generation_; //read on every block lookup of the tiered engine
+	uint64_t blocks_;
+	uint64_t translations_;
+	uint64_t retranslations_;
+	uint64_t evictions_;
+	uint64_t flushes_;
+	uint64_t unlinks_;
+};
+
+int TCACHE_add(TCACHE *cache, size_t bytes, int retranslation); //1 if over the budget now
+void TCACHE_remove(TCACHE *cache, size_t bytes, int evicted);
+void TCACHE_unlinked(TCACHE *cache, uint64_t links);
+static inline uint32_t TCACHE_generation(const TCACHE *cache)
+{
+	return __atomic_load_n(&cache->generation_, __ATOMIC_RELAXED);
+}
+uint32_t TCACHE_flush(TCACHE *cache); //starts a new generation and returns it
+
+struct CPU_decoded
+{
+	size_t pcs_;
+	int32_t *block_of_; //block starting at a pc index, -1 if not decoded yet
+	CPU_block *blocks_;
+	size_t block_count_;
+	size_t block_capacity_;
+	CPU_uop *uops_;
+	size_t uop_count_;
+	size_t uop_capacity_;
+	uint64_t *partial_counts_; //per pc, blocks cut short by the step budget
+	uint8_t *mapping_;		   //decode cache file the tables start out in, NULL if decoded here
+	size_t mapping_size_;
+	size_t cached_blocks_; //blocks that came from the decode cache
+	uint32_t *heat_;	   //tiered engine: entries into a pc that is not decoded yet
+	TRANS_block **translated_; //tiered engine: per block, NULL until it is hot
+	uint8_t *evicted_;		   //tiered engine: per block, dropped by the translation cache before
+	size_t translated_capacity_;
+	TCACHE *cache_;		  //translation cache the blocks are counted in
+	uint32_t generation_; //generation of the cache the blocks were last checked in
+};
+
+uint16_t CPU_decode(uint32_t instruction);
+int CPU_ends_block(uint16_t op);
+CPU_decoded *CPU_decoded_create(const CPU *cpu);							 //NULL if out of memory
+int32_t CPU_decode_block(CPU *cpu, CPU_decoded *decoded, size_t pc_index); //-1 if out of memory
+void CPU_decoded_destroy(CPU_decoded *decoded);
+uint64_t CPU_run_predecoded(CPU *cpu, uint64_t max_steps);
+uint64_t CPU_run_tiered(CPU *cpu, uint64_t max_steps);
+uint64_t CPU_run_interpreter(CPU *cpu, uint64_t max_steps); //where the engines go on without memory for their blocks
+
+//persistent pre-decode cache (dcache.c)
+CPU_decoded *DCACHE_load(const CPU *cpu); //NULL if there is no valid file for the program
+void DCACHE_save(const CPU *cpu);		  //if blocks were decoded since the load
+
+//symbol tables of ELF files and GNU ld map files (symbols.c)
+typedef struct
+{
+	uint32_t addr_; //masked to the instruction memory like the pc
+	uint32_t size_; //0 if unknown, the symbol then reaches up to the next one
+	char *name_;
+} SYM_symbol;
+
+typedef struct
+{
+	SYM_symbol *symbols_; //sorted by address
+	size_t count_;
+	size_t capacity_;
+} SYM_table;
+
+int SYM_load(SYM_table *table, const char *filename);
+const SYM_symbol *SYM_lookup(const SYM_table *table, uint32_t pc);
+const SYM_symbol *SYM_find(const SYM_table *table, const char *name);
+void SYM_free(SYM_table *table);
+
+//instrumentation hooks of the engines
+void BP_branch(BP_sim *sim, uint32_t pc, uint32_t target, int taken);
+void BP_jump(BP_sim *sim, uint32_t pc, uint32_t instruction, uint32_t target);
+int BP_is_link(int8_t reg);
+uint8_t TRACE_layout(uint32_t instruction, uint16_t op);
+void TRACE_uop(CPU *cpu, const CPU_uop *uop);
+uint32_t TRACE_block(CPU *cpu, const CPU_uop *uops, uint32_t length); //the uops that ran, up to a wait
+void SAMPLE_retire(SAMPLE_profiler *profiler, uint32_t first_pc, uint32_t count, uint32_t last_pc, uint32_t instruction, uint32_t next_pc);
+
+#endif
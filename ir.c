@@ -0,0 +1,727 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Block optimizer of the translated tier
+ *
+ * A translated block is lifted into SSA form: every op that writes a register
+ * defines a new value, reads name the value instead of the register, and the
+ * values of the registers at the block entry are values 0..31 (value 0 is the
+ * constant 0 of x0). On the way in, values with constant operands are computed
+ * (constant propagation, a branch with a known outcome becomes an exit), moves
+ * and identities like "addi rd, rs, 0" name the value of their source (copy
+ * propagation), and a load from the base value and offset of an earlier store
+ * or load in the block takes that value (store-to-load forwarding); a byte
+ * store that may go to a device forgets all of memory. A write of a value
+ * the register already holds is dropped.
+ *
+ * Lowering goes back to TRANS_ops on the guest registers: every read takes the
+ * register that got the value first, so moves are not read any more, and a
+ * backward pass drops register writes that are overwritten before any read.
+ * Where the block can end early (T_CALL, a console load, a load or store that
+ * may be outside the data memory) all registers are live, so an early exit
+ * sees the same registers as the unoptimized block. A load or store whose
+ * address is a register at the block entry plus a constant (sp and s0 relative
+ * ones, constant addresses on x0) cannot end it: the range of these addresses
+ * per register is a T_GUARD TRANS_run checks before the block starts, and the
+ * tiered engine runs the block pre-decoded when it fails. Blocks get guards
+ * only where they let a dead write go, elsewhere the accesses check themselves.
+ * This is what -O0 code is full of: "sw a5,-20(s0)" followed by
+ * "lw a5,-20(s0)", and temporaries that are written twice.
+ */
+
+#define IR_NONE 0xFFFFFFFFu
+#define IR_ALL 0xFFFFFFFEu	//live mask of x1..x31
+#define IR_MEM_ENTRIES 16
+#define IR_GUARDS 4 //registers with a guard per block
+
+typedef struct
+{
+	uint32_t constant_;
+	uint8_t known_;
+	uint32_t root_; //the value is register root_ at the block entry plus offset_, IR_NONE if not known
+	int64_t offset_;
+} IR_value;
+
+typedef struct
+{
+	TRANS_op op_;	 //as emitted, T_LI for constants and T_ADDI 0 for copies
+	uint32_t value_; //written to rd_, first of the 31 new values of x1..x31 for T_CALL
+	uint32_t a_;	 //value read as rs1_
+	uint32_t b_;	 //value read as rs2_
+	uint8_t exit_;	 //the block may end here with all registers up to date
+	uint8_t dropped_;
+	uint8_t guarded_; //a load or store inside a guard, lowered to its T_G* kind
+} IR_inst;
+
+//addresses x[reg_] + low_ up to x[reg_] + high_ that guarded accesses go to
+typedef struct
+{
+	int64_t low_;
+	int64_t high_;
+	uint32_t reg_;
+} IR_range;
+
+//memory contents known from an earlier store or load
+typedef struct
+{
+	uint32_t base_;	  //value of the base register, IR_NONE if the address is constant
+	uint32_t offset_; //the constant address if base_ is IR_NONE
+	uint32_t kind_;	  //load that gets value_: T_LW, T_LH or T_LHU
+	uint32_t value_;
+} IR_entry;
+
+typedef struct
+{
+	IR_inst *insts_;
+	uint32_t count_;
+	IR_value *values_;
+	uint32_t value_count_;
+	uint32_t reg_[32];
+	IR_entry mem_[IR_MEM_ENTRIES];
+	uint32_t mem_count_;
+	IR_range guards_[IR_GUARDS];
+	uint32_t guard_count_;
+	CPU_ir_stats *stats_;
+} IR_block;
+
+static uint32_t IR_new(IR_block *ir, int known, uint32_t constant)
+{
+	ir->values_[ir->value_count_].known_ = known;
+	ir->values_[ir->value_count_].constant_ = constant;
+	//a constant is x0 plus the constant
+	ir->values_[ir->value_count_].root_ = known ? 0 : IR_NONE;
+	ir->values_[ir->value_count_].offset_ = constant;
+	return ir->value_count_++;
+}
+
+static int IR_known(const IR_block *ir, uint32_t value)
+{
+	return ir->values_[value].known_;
+}
+
+static uint32_t IR_const(const IR_block *ir, uint32_t value)
+{
+	return ir->values_[value].constant_;
+}
+
+//the same value or the same constant
+static int IR_same(const IR_block *ir, uint32_t a, uint32_t b)
+{
+	return a == b || (IR_known(ir, a) && IR_known(ir, b) && IR_const(ir, a) == IR_const(ir, b));
+}
+
+//exactly as TRANS_run computes it
+static uint32_t IR_eval(int kind, uint32_t a, uint32_t b)
+{
+	switch (kind)
+	{
+	case T_ADD: case T_ADDI: return a + b;
+	case T_SUB: return a - b;
+	case T_SLL: return a << (b & 31);
+	case T_SLT: return (int32_t)a < (int32_t)b;
+	case T_SLTU: case T_SLTIU: return a < b;
+	case T_XOR: case T_XORI: return a ^ b;
+	case T_SRL: return a >> (b & 31);
+	case T_SRA: return (int32_t)a >> (b & 31);
+	case T_OR: case T_ORI: return a | b;
+	case T_AND: case T_ANDI: return a & b;
+	case T_SLLI: return a << b;
+	case T_SRLI: return a >> b;
+	case T_SRAI: return (int32_t)a >> (int32_t)b;
+	}
+	return 0;
+}
+
+//the immediate form of a register op whose rs2 is the constant b, -1 if there is none
+static int IR_immediate(int kind, uint32_t b, uint32_t *imm)
+{
+	*imm = b;
+	switch (kind)
+	{
+	case T_ADD: return T_ADDI;
+	case T_SUB: *imm = -b; return T_ADDI;
+	case T_SLTU: return T_SLTIU;
+	case T_XOR: return T_XORI;
+	case T_OR: return T_ORI;
+	case T_AND: return T_ANDI;
+	case T_SLL: *imm = b & 31; return T_SLLI;
+	case T_SRL: *imm = b & 31; return T_SRLI;
+	case T_SRA: *imm = b & 31; return T_SRAI;
+	}
+	return -1;
+}
+
+static void IR_constant(IR_block *ir, IR_inst *inst, uint32_t constant)
+{
+	inst->op_.kind_ = T_LI;
+	inst->op_.imm_ = constant;
+	inst->value_ = IR_new(ir, 1, constant);
+	ir->stats_->folded_++;
+}
+
+//value is in a register or constant
+static void IR_copy(const IR_block *ir, IR_inst *inst, uint32_t value)
+{
+	inst->op_.kind_ = IR_known(ir, value) ? T_LI : T_ADDI;
+	inst->op_.imm_ = IR_known(ir, value) ? IR_const(ir, value) : 0;
+	inst->a_ = IR_known(ir, value) ? IR_NONE : value;
+	inst->value_ = value;
+}
+
+static int IR_held(const IR_block *ir, uint32_t value)
+{
+	for (uint32_t r = 0; r < 32; r++)
+	{
+		if (ir->reg_[r] == value)
+		{
+			return 1;
+		}
+	}
+	return IR_known(ir, value);
+}
+
+//ALU ops with an immediate, a_ is not constant
+static void IR_alu_immediate(IR_block *ir, IR_inst *inst)
+{
+	uint32_t imm = inst->op_.imm_;
+	switch (inst->op_.kind_)
+	{
+	case T_ADDI: case T_XORI: case T_ORI: case T_SLLI: case T_SRLI: case T_SRAI:
+		if (imm == 0)
+		{
+			IR_copy(ir, inst, inst->a_);
+			return;
+		}
+		break;
+	case T_ANDI:
+		if (imm == 0xFFFFFFFFu)
+		{
+			IR_copy(ir, inst, inst->a_);
+			return;
+		}
+		if (imm == 0)
+		{
+			IR_constant(ir, inst, 0);
+			return;
+		}
+		break;
+	}
+	inst->value_ = IR_new(ir, 0, 0);
+	//a pointer moved by a constant, e.g. the frame of "addi sp, sp, -32"
+	const IR_value *a = &ir->values_[inst->a_];
+	int64_t offset = a->offset_ + (int32_t)imm;
+	if (inst->op_.kind_ == T_ADDI && a->root_ != IR_NONE && offset >= INT32_MIN && offset <= INT32_MAX)
+	{
+		ir->values_[inst->value_].root_ = a->root_;
+		ir->values_[inst->value_].offset_ = offset;
+	}
+}
+
+static void IR_alu(IR_block *ir, IR_inst *inst)
+{
+	int kind = inst->op_.kind_;
+	uint32_t a = inst->a_;
+	uint32_t b = inst->b_;
+	if (kind >= T_ADDI)
+	{
+		if (IR_known(ir, a))
+		{
+			IR_constant(ir, inst, IR_eval(kind, IR_const(ir, a), inst->op_.imm_));
+			return;
+		}
+		IR_alu_immediate(ir, inst);
+		return;
+	}
+	if (IR_known(ir, a) && IR_known(ir, b))
+	{
+		IR_constant(ir, inst, IR_eval(kind, IR_const(ir, a), IR_const(ir, b)));
+		return;
+	}
+	uint32_t imm;
+	int immediate = -1;
+	if (IR_known(ir, b))
+	{
+		immediate = IR_immediate(kind, IR_const(ir, b), &imm);
+	}
+	else if (IR_known(ir, a) && (kind == T_ADD || kind == T_XOR || kind == T_OR || kind == T_AND))
+	{
+		immediate = IR_immediate(kind, IR_const(ir, a), &imm);
+		inst->a_ = b;
+	}
+	if (immediate >= 0)
+	{
+		inst->op_.kind_ = immediate;
+		inst->op_.imm_ = imm;
+		inst->b_ = IR_NONE;
+		IR_alu_immediate(ir, inst);
+		return;
+	}
+	if (a == b)
+	{
+		if (kind == T_SUB || kind == T_XOR || kind == T_SLT || kind == T_SLTU)
+		{
+			IR_constant(ir, inst, 0);
+			return;
+		}
+		if (kind == T_AND || kind == T_OR)
+		{
+			IR_copy(ir, inst, a);
+			return;
+		}
+	}
+	inst->value_ = IR_new(ir, 0, 0);
+}
+
+static int IR_size(int kind)
+{
+	switch (kind)
+	{
+	case T_LW: case T_SW: return 4;
+	case T_LH: case T_LHU: case T_SH: return 2;
+	}
+	return 1;
+}
+
+//base and offset of the address of a load or store
+static void IR_address(const IR_block *ir, const IR_inst *inst, uint32_t *base, uint32_t *offset)
+{
+	if (IR_known(ir, inst->a_))
+	{
+		*base = IR_NONE;
+		*offset = IR_const(ir, inst->a_) + inst->op_.imm_;
+	}
+	else
+	{
+		*base = inst->a_;
+		*offset = inst->op_.imm_;
+	}
+}
+
+//1 if the access of inst cannot be outside the data memory once the guards passed
+static int IR_guard(IR_block *ir, const IR_inst *inst)
+{
+	const IR_value *base = &ir->values_[inst->a_];
+	if (base->root_ == IR_NONE)
+	{
+		return 0;
+	}
+	//a constant address wraps around like the address TRANS_run computes
+	int64_t low = base->root_ ? base->offset_ + (int32_t)inst->op_.imm_ : (uint32_t)(base->offset_ + inst->op_.imm_);
+	int64_t high = low + IR_size(inst->op_.kind_);
+	uint32_t i = 0;
+	while (i < ir->guard_count_ && ir->guards_[i].reg_ != base->root_)
+	{
+		i++;
+	}
+	if (i == IR_GUARDS)
+	{
+		return 0;
+	}
+	if (i == ir->guard_count_)
+	{
+		ir->guards_[ir->guard_count_++] = (IR_range){low, high, base->root_};
+	}
+	IR_range *range = &ir->guards_[i];
+	low = low < range->low_ ? low : range->low_;
+	high = high > range->high_ ? high : range->high_;
+	if (high - low > UINT32_MAX)
+	{
+		//the size of a T_GUARD has 32 bits
+		return 0;
+	}
+	range->low_ = low;
+	range->high_ = high;
+	return 1;
+}
+
+static int IR_guarded_kind(int kind)
+{
+	switch (kind)
+	{
+	case T_LH: return T_GLH;
+	case T_LW: return T_GLW;
+	case T_LHU: return T_GLHU;
+	case T_SB: return T_GSB;
+	case T_SH: return T_GSH;
+	default: return T_GSW;
+	}
+}
+
+static void IR_remember(IR_block *ir, uint32_t base, uint32_t offset, int kind, uint32_t value)
+{
+	if (ir->mem_count_ < IR_MEM_ENTRIES)
+	{
+		ir->mem_[ir->mem_count_++] = (IR_entry){base, offset, kind, value};
+	}
+}
+
+static void IR_load(IR_block *ir, IR_inst *inst)
+{
+	int kind = inst->op_.kind_;
+	uint32_t base, offset;
+	IR_address(ir, inst, &base, &offset);
+	if (kind == T_LB || kind == T_LBU)
+	{
+		//may read the console and wait for input there, or be outside the data memory
+		inst->exit_ = 1;
+		inst->value_ = IR_new(ir, 0, 0);
+		return;
+	}
+	for (uint32_t i = 0; i < ir->mem_count_; i++)
+	{
+		IR_entry *entry = &ir->mem_[i];
+		//the value may not be in any register any more
+		if (entry->base_ == base && entry->offset_ == offset && entry->kind_ == (uint32_t)kind && IR_held(ir, entry->value_))
+		{
+			IR_copy(ir, inst, entry->value_);
+			ir->stats_->forwarded_++;
+			return;
+		}
+	}
+	//may be outside the data memory unless guarded; a forwarded load reads where an access already went
+	inst->guarded_ = IR_guard(ir, inst);
+	inst->exit_ = !inst->guarded_;
+	inst->value_ = IR_new(ir, 0, 0);
+	IR_remember(ir, base, offset, kind, inst->value_);
+}
+
+static void IR_store(IR_block *ir, IR_inst *inst)
+{
+	uint32_t base, offset;
+	IR_address(ir, inst, &base, &offset);
+	inst->guarded_ = IR_guard(ir, inst);
+	inst->exit_ = !inst->guarded_; //may be outside the data memory
+	//a byte to a device register may start the DMA engine, which writes anywhere
+	if (inst->op_.kind_ == T_SB && (base != IR_NONE || (offset & ~0xFFu) == CPU_DEVICE_PAGE))
+	{
+		ir->mem_count_ = 0;
+		return;
+	}
+	uint32_t size = IR_size(inst->op_.kind_);
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < ir->mem_count_; i++)
+	{
+		IR_entry *entry = &ir->mem_[i];
+		//another base register may point anywhere
+		int overlap = entry->base_ != base || entry->offset_ - offset < size || offset - entry->offset_ < (uint32_t)IR_size(entry->kind_);
+		if (!overlap)
+		{
+			ir->mem_[kept++] = *entry;
+		}
+	}
+	ir->mem_count_ = kept;
+	if (inst->op_.kind_ == T_SW)
+	{
+		IR_remember(ir, base, offset, T_LW, inst->b_);
+	}
+}
+
+static void IR_branch(IR_block *ir, IR_inst *inst)
+{
+	uint32_t a = inst->a_;
+	uint32_t b = inst->b_;
+	int taken;
+	if (IR_known(ir, a) && IR_known(ir, b))
+	{
+		uint32_t x = IR_const(ir, a);
+		uint32_t y = IR_const(ir, b);
+		switch (inst->op_.kind_)
+		{
+		case T_BEQ: taken = x == y; break;
+		case T_BNE: taken = x != y; break;
+		case T_BLTU: taken = x < y; break;
+		case T_BGE: taken = (int32_t)x >= (int32_t)y; break;
+		default: taken = x >= y; break;
+		}
+	}
+	else if (a == b)
+	{
+		taken = inst->op_.kind_ == T_BEQ || inst->op_.kind_ == T_BGE || inst->op_.kind_ == T_BGEU;
+	}
+	else
+	{
+		return;
+	}
+	inst->op_.kind_ = T_EXIT;
+	inst->op_.imm_ = taken ? inst->op_.imm_ : inst->op_.pc_ + 4;
+	inst->a_ = inst->b_ = IR_NONE;
+	ir->stats_->folded_++;
+}
+
+//lifts the ops into SSA values and runs the forward passes on them
+static void IR_lift(IR_block *ir, const TRANS_block *block)
+{
+	for (uint32_t r = 0; r < 32; r++)
+	{
+		IR_new(ir, r == 0, 0);
+		ir->values_[r].root_ = r;
+		ir->reg_[r] = r;
+	}
+	for (uint32_t i = 0; i < block->op_count_; i++)
+	{
+		IR_inst *inst = &ir->insts_[i];
+		const TRANS_op *op = &block->ops_[i];
+		int kind = op->kind_;
+		*inst = (IR_inst){*op, IR_NONE, ir->reg_[op->rs1_], ir->reg_[op->rs2_], 0, 0};
+		if (kind <= T_SRAI)
+		{
+			if (kind >= T_ADDI)
+			{
+				inst->b_ = IR_NONE;
+			}
+			IR_alu(ir, inst);
+		}
+		else if (kind == T_LI)
+		{
+			inst->a_ = inst->b_ = IR_NONE;
+			inst->value_ = IR_new(ir, 1, op->imm_);
+		}
+		else if (kind <= T_LHU)
+		{
+			inst->b_ = IR_NONE;
+			IR_load(ir, inst);
+		}
+		else if (kind <= T_SW)
+		{
+			IR_store(ir, inst);
+		}
+		else if (kind <= T_BGEU)
+		{
+			IR_branch(ir, inst);
+		}
+		else if (kind == T_JAL || kind == T_JALR)
+		{
+			//JALR writes rd before it reads rs1
+			inst->value_ = IR_new(ir, 1, op->pc_ + 4);
+			if (op->rd_)
+			{
+				ir->reg_[op->rd_] = inst->value_;
+			}
+			inst->a_ = kind == T_JALR ? ir->reg_[op->rs1_] : IR_NONE;
+			inst->b_ = IR_NONE;
+			if (kind == T_JALR && IR_known(ir, inst->a_))
+			{
+				inst->op_.kind_ = T_JAL;
+				inst->op_.imm_ = IR_const(ir, inst->a_) + op->imm_;
+				inst->a_ = IR_NONE;
+				ir->stats_->folded_++;
+			}
+			continue;
+		}
+		else if (kind == T_CALL)
+		{
+			//the handler may read and write anything
+			inst->exit_ = 1;
+			inst->a_ = inst->b_ = IR_NONE;
+			inst->value_ = ir->value_count_;
+			for (uint32_t r = 1; r < 32; r++)
+			{
+				ir->reg_[r] = IR_new(ir, 0, 0);
+			}
+			ir->mem_count_ = 0;
+			continue;
+		}
+		else
+		{
+			inst->a_ = inst->b_ = IR_NONE;
+		}
+
+		if (inst->value_ != IR_NONE)
+		{
+			if (IR_same(ir, ir->reg_[op->rd_], inst->value_))
+			{
+				inst->dropped_ = 1;
+				ir->stats_->redundant_++;
+				continue;
+			}
+			ir->reg_[op->rd_] = inst->value_;
+		}
+	}
+}
+
+//the register that got the value first; x0 for 0
+static uint8_t IR_register(const IR_block *ir, const uint32_t *holds, const uint32_t *since, uint32_t value)
+{
+	uint8_t best = 0;
+	uint32_t best_since = IR_NONE;
+	for (uint32_t r = 0; r < 32; r++)
+	{
+		if (since[r] < best_since && IR_same(ir, holds[r], value))
+		{
+			best = r;
+			best_since = since[r];
+		}
+	}
+	return best;
+}
+
+//picks the registers that are read, then drops the writes that are never read;
+//1 if a dropped write is read where a guarded access could have ended the block
+static int IR_lower(IR_block *ir)
+{
+	uint32_t holds[32];
+	uint32_t since[32];
+	for (uint32_t r = 0; r < 32; r++)
+	{
+		holds[r] = r;
+		since[r] = 0;
+	}
+	for (uint32_t i = 0; i < ir->count_; i++)
+	{
+		IR_inst *inst = &ir->insts_[i];
+		if (inst->dropped_)
+		{
+			continue;
+		}
+		int kind = inst->op_.kind_;
+		if (kind == T_JALR && inst->op_.rd_)
+		{
+			holds[inst->op_.rd_] = inst->value_;
+			since[inst->op_.rd_] = i + 1;
+		}
+		if (inst->a_ != IR_NONE)
+		{
+			inst->op_.rs1_ = IR_register(ir, holds, since, inst->a_);
+		}
+		if (inst->b_ != IR_NONE)
+		{
+			inst->op_.rs2_ = IR_register(ir, holds, since, inst->b_);
+		}
+		if (kind == T_CALL)
+		{
+			for (uint32_t r = 1; r < 32; r++)
+			{
+				holds[r] = inst->value_ + r - 1;
+				since[r] = i + 1;
+			}
+		}
+		else if (inst->value_ != IR_NONE && inst->op_.rd_ && kind != T_JALR)
+		{
+			holds[inst->op_.rd_] = inst->value_;
+			since[inst->op_.rd_] = i + 1;
+		}
+	}
+
+	uint32_t live = IR_ALL;
+	uint32_t unguarded = IR_ALL; //live if the guarded accesses were exits
+	int guarded = 0;
+	for (uint32_t i = ir->count_; i-- > 0;)
+	{
+		IR_inst *inst = &ir->insts_[i];
+		if (inst->dropped_)
+		{
+			continue;
+		}
+		int kind = inst->op_.kind_;
+		uint32_t rd = inst->op_.rd_;
+		if (kind == T_CALL)
+		{
+			live = unguarded = IR_ALL;
+			continue;
+		}
+		if (inst->value_ != IR_NONE && rd)
+		{
+			if (!(live & (1u << rd)) && !inst->exit_ && kind != T_JAL && kind != T_JALR)
+			{
+				inst->dropped_ = 1;
+				ir->stats_->dead_++;
+				guarded |= (unguarded >> rd) & 1;
+				continue;
+			}
+			live &= ~(1u << rd);
+			unguarded &= ~(1u << rd);
+		}
+		if (inst->exit_)
+		{
+			live = IR_ALL;
+		}
+		if (inst->exit_ || inst->guarded_)
+		{
+			unguarded = IR_ALL;
+		}
+		if (inst->a_ != IR_NONE)
+		{
+			live |= 1u << inst->op_.rs1_;
+			unguarded |= 1u << inst->op_.rs1_;
+		}
+		if (inst->b_ != IR_NONE)
+		{
+			live |= 1u << inst->op_.rs2_;
+			unguarded |= 1u << inst->op_.rs2_;
+		}
+	}
+	return guarded;
+}
+
+TRANS_block *IR_optimize(TRANS_block *block, CPU_ir_stats *stats)
+{
+	uint32_t calls = 0;
+	for (uint32_t i = 0; i < block->op_count_; i++)
+	{
+		calls += block->ops_[i].kind_ == T_CALL;
+	}
+	IR_block ir = {0};
+	ir.insts_ = malloc(block->op_count_ * sizeof(IR_inst));
+	ir.values_ = malloc((32 + block->op_count_ + 31 * calls) * sizeof(IR_value));
+	if (!ir.insts_ || !ir.values_)
+	{
+		//the block stays as it is
+		free(ir.insts_);
+		free(ir.values_);
+		return block;
+	}
+	ir.count_ = block->op_count_;
+	ir.stats_ = stats;
+
+	IR_lift(&ir, block);
+	if (!IR_lower(&ir))
+	{
+		//no write could be dropped thanks to the guards, the accesses check themselves
+		ir.guard_count_ = 0;
+		for (uint32_t i = 0; i < ir.count_; i++)
+		{
+			ir.insts_[i].guarded_ = 0;
+		}
+	}
+	if (ir.guard_count_)
+	{
+		//the guards go in front of the ops
+		size_t bytes = block->bytes_ + ir.guard_count_ * sizeof(TRANS_op);
+		TRANS_block *grown = realloc(block, bytes);
+		if (!grown)
+		{
+			free(ir.insts_);
+			free(ir.values_);
+			return block;
+		}
+		block = grown;
+		block->bytes_ = bytes;
+	}
+	for (uint32_t i = 0; i < ir.guard_count_; i++)
+	{
+		IR_range *range = &ir.guards_[i];
+		block->ops_[i] = (TRANS_op){T_GUARD, 0, range->reg_, 0, (uint32_t)range->low_, (uint32_t)(range->high_ - range->low_)};
+	}
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < ir.count_; i++)
+	{
+		if (!ir.insts_[i].dropped_)
+		{
+			TRANS_op *op = &block->ops_[ir.guard_count_ + count++];
+			*op = ir.insts_[i].op_;
+			op->kind_ = ir.insts_[i].guarded_ ? IR_guarded_kind(op->kind_) : op->kind_;
+			stats->guarded_ += ir.insts_[i].guarded_;
+		}
+	}
+	stats->blocks_++;
+	stats->ops_ += block->op_count_;
+	block->eliminated_ = block->op_count_ - count;
+	block->op_count_ = ir.guard_count_ + count;
+	free(ir.insts_);
+	free(ir.values_);
+	return block;
+}
@@ -0,0 +1,367 @@
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Lockstep engine
+ *
+ * Runs several CPUs with the same instruction memory (a parameter sweep over
+ * different data memories) LOCKSTEP_LANES at a time. The register file is kept
+ * as structure of arrays, one vector per register with one lane per CPU, so the
+ * ALU ops, LUI/AUIPC, the jumps and the branches are vector operations over all
+ * lanes (GCC vector extensions; the Makefile builds this file with -march=native).
+ * Loads and stores go through the scalar handlers lane by lane, because every
+ * lane has its own data memory.
+ *
+ * Every step executes the instruction at the lowest pc of the running lanes for
+ * all lanes that are at that pc. Lanes that took the other side of a branch
+ * wait until the others catch up, which makes if/else and loops with a data
+ * dependent trip count converge again. When the lanes stay apart for more than
+ * LOCKSTEP_DIVERGE_LIMIT steps the group falls back to running the lanes one
+ * after another with CPU_run. Results are the same as with the interpreter;
+ * the instrumentation (trace, branch predictors, sampling) is not fed.
+ */
+
+//one vector register of lanes
+#ifndef LOCKSTEP_LANES
+#if defined(__AVX512F__)
+#define LOCKSTEP_LANES 16
+#elif defined(__AVX2__)
+#define LOCKSTEP_LANES 8
+#else
+#define LOCKSTEP_LANES 4
+#endif
+#endif
+#define LOCKSTEP_DIVERGE_LIMIT 4096
+
+typedef uint32_t LANE_u32 __attribute__((vector_size(LOCKSTEP_LANES * 4)));
+typedef int32_t LANE_i32 __attribute__((vector_size(LOCKSTEP_LANES * 4)));
+
+typedef struct
+{
+	LANE_u32 regfile_[32];
+	LANE_u32 pc_;
+	LANE_u32 running_; //all ones: not halted and budget left
+	LANE_u32 halted_;
+	LANE_u32 waiting_; //all ones: stopped by WFI or a console load waiting for input
+	LANE_u32 chunk_steps_; //retired in the current chunk
+	uint64_t steps_[LOCKSTEP_LANES];
+	CPU *cpus_[LOCKSTEP_LANES];
+	int count_;
+} LOCKSTEP_group;
+
+//per lane a where mask is set, b elsewhere
+#define LOCKSTEP_SELECT(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+//writes value to rd in the lanes of mask
+static inline __attribute__((always_inline)) void LOCKSTEP_write(LOCKSTEP_group *group, int8_t rd, LANE_u32 value, LANE_u32 mask)
+{
+	if (rd != 0)
+	{
+		group->regfile_[rd] = LOCKSTEP_SELECT(mask, value, group->regfile_[rd]);
+	}
+}
+
+//new pc of the lanes of mask after the instruction at pc, the vector ops of the lockstep step
+static void LOCKSTEP_execute(LOCKSTEP_group *group, uint16_t op, uint32_t instruction, uint32_t pc, const LANE_u32 *lanes, LANE_u32 *next)
+{
+	LANE_u32 *x = group->regfile_;
+	int8_t rd = getRD(instruction);
+	LANE_u32 a = x[getRS1(instruction)];
+	LANE_u32 b = x[getRS2(instruction)];
+	LANE_u32 imm = (LANE_u32){0} + (uint32_t)imm_I(instruction);
+	LANE_u32 branch_pc = (LANE_u32){0} + (pc + imm_B(instruction));
+	LANE_u32 mask = *lanes;
+
+	*next = (LANE_u32){0} + (pc + 4);
+	switch (op)
+	{
+	//register shifts: the handlers shift by the whole register, which x86 masks to 5 bits
+	case OP_ADD: LOCKSTEP_write(group, rd, a + b, mask); break;
+	case OP_SUB: LOCKSTEP_write(group, rd, a - b, mask); break;
+	case OP_SLL: LOCKSTEP_write(group, rd, a << (b & 31), mask); break;
+	case OP_SLT: LOCKSTEP_write(group, rd, (LANE_u32)((LANE_i32)a < (LANE_i32)b) & 1, mask); break;
+	case OP_SLTU: LOCKSTEP_write(group, rd, (LANE_u32)(a < b) & 1, mask); break;
+	case OP_XOR: LOCKSTEP_write(group, rd, a ^ b, mask); break;
+	case OP_SRL: LOCKSTEP_write(group, rd, a >> (b & 31), mask); break;
+	case OP_SRA: LOCKSTEP_write(group, rd, (LANE_u32)((LANE_i32)a >> (LANE_i32)(b & 31)), mask); break;
+	case OP_OR: LOCKSTEP_write(group, rd, a | b, mask); break;
+	case OP_AND: LOCKSTEP_write(group, rd, a & b, mask); break;
+	case OP_ADDI: LOCKSTEP_write(group, rd, a + imm, mask); break;
+	//SLTI compares unsigned like its handler
+	case OP_SLTI: LOCKSTEP_write(group, rd, (LANE_u32)(a < imm) & 1, mask); break;
+	case OP_SLTIU: LOCKSTEP_write(group, rd, (LANE_u32)(a < imm) & 1, mask); break;
+	case OP_XORI: LOCKSTEP_write(group, rd, a ^ imm, mask); break;
+	case OP_ORI: LOCKSTEP_write(group, rd, a | imm, mask); break;
+	case OP_ANDI: LOCKSTEP_write(group, rd, a & imm, mask); break;
+	case OP_SLLI: LOCKSTEP_write(group, rd, a << getRS2(instruction), mask); break;
+	case OP_SRLI: LOCKSTEP_write(group, rd, a >> getRS2(instruction), mask); break;
+	case OP_SRAI: LOCKSTEP_write(group, rd, (LANE_u32)((LANE_i32)a >> shamt(instruction)), mask); break;
+	case OP_LUI: LOCKSTEP_write(group, rd, (LANE_u32){0} + imm_U(instruction), mask); break;
+	case OP_AUIPC: LOCKSTEP_write(group, rd, (LANE_u32){0} + (pc + imm_U(instruction)), mask); break;
+	case OP_JAL:
+		LOCKSTEP_write(group, rd, *next, mask);
+		*next = (LANE_u32){0} + (pc + imm_J(instruction));
+		break;
+	case OP_JALR:
+		//like the handler, rd is written before rs1 is read
+		LOCKSTEP_write(group, rd, *next, mask);
+		*next = x[getRS1(instruction)] + imm;
+		break;
+
+	//BLT compares unsigned like its handler
+	case OP_BEQ: *next = LOCKSTEP_SELECT((LANE_u32)(a == b), branch_pc, *next); break;
+	case OP_BNE: *next = LOCKSTEP_SELECT((LANE_u32)(a != b), branch_pc, *next); break;
+	case OP_BLT: *next = LOCKSTEP_SELECT((LANE_u32)(a < b), branch_pc, *next); break;
+	case OP_BGE: *next = LOCKSTEP_SELECT((LANE_u32)((LANE_i32)a >= (LANE_i32)b), branch_pc, *next); break;
+	case OP_BLTU: *next = LOCKSTEP_SELECT((LANE_u32)(a < b), branch_pc, *next); break;
+	case OP_BGEU: *next = LOCKSTEP_SELECT((LANE_u32)(a >= b), branch_pc, *next); break;
+
+	case OP_ECALL:
+	{
+		//system calls read a0..a7 and write a0
+		LANE_u32 result = x[10];
+		for (int i = 0; i < group->count_; i++)
+		{
+			if (!mask[i])
+			{
+				continue;
+			}
+			CPU *cpu = group->cpus_[i];
+			for (int j = 10; j <= 17; j++)
+			{
+				cpu->regfile_[j] = x[j][i];
+			}
+			cpu->regfile_[2] = x[2][i];
+			cpu->pc_ = pc;
+			ECALL(cpu, instruction);
+			result[i] = cpu->regfile_[10];
+			(*next)[i] = cpu->pc_;
+		}
+		LOCKSTEP_write(group, 10, result, mask);
+		break;
+	}
+
+	default:
+	{
+		//memory and invalid ops: the scalar handler on the CPU of every lane
+		LANE_u32 result = x[rd];
+		int8_t rs1 = getRS1(instruction);
+		int8_t rs2 = getRS2(instruction);
+		for (int i = 0; i < group->count_; i++)
+		{
+			if (!mask[i])
+			{
+				continue;
+			}
+			CPU *cpu = group->cpus_[i];
+			cpu->regfile_[rs1] = x[rs1][i];
+			cpu->regfile_[rs2] = x[rs2][i];
+			cpu->regfile_[rd] = x[rd][i]; //stores keep immediate bits in rd
+			cpu->pc_ = pc;
+			if (op >= OP_FLW && op <= OP_FCVT_D_S)
+			{
+				//the lanes share the host FP flags
+				FPU_enter();
+				CPU_ops[op].handler_(cpu, instruction);
+				FPU_leave(cpu);
+			}
+			else
+			{
+				CPU_ops[op].handler_(cpu, instruction);
+			}
+			result[i] = cpu->regfile_[rd];
+			(*next)[i] = cpu->pc_;
+			group->waiting_[i] = cpu->waiting_ ? UINT32_MAX : 0;
+			cpu->regfile_[0] = 0;
+		}
+		LOCKSTEP_write(group, rd, result, mask);
+		break;
+	}
+	}
+}
+
+//adds the steps of the current chunk to the lane counts
+static void LOCKSTEP_count(LOCKSTEP_group *group)
+{
+	for (int i = 0; i < LOCKSTEP_LANES; i++)
+	{
+		group->steps_[i] += group->chunk_steps_[i];
+	}
+	group->chunk_steps_ = (LANE_u32){0};
+}
+
+//registers, pc, halt state and instruction counts back into the CPUs of the group
+static void LOCKSTEP_store(LOCKSTEP_group *group)
+{
+	LOCKSTEP_count(group);
+	for (int i = 0; i < group->count_; i++)
+	{
+		CPU *cpu = group->cpus_[i];
+		for (int j = 0; j < 32; j++)
+		{
+			cpu->regfile_[j] = group->regfile_[j][i];
+		}
+		cpu->pc_ = group->pc_[i];
+		cpu->halted_ |= group->halted_[i] != 0;
+		cpu->instret_ += group->steps_[i];
+		CPU_settle_fault(cpu);
+	}
+}
+
+static void LOCKSTEP_run_group(LOCKSTEP_group *group, const uint16_t *ops, uint64_t max_steps, LOCKSTEP_stats *stats)
+{
+	const CPU *first = group->cpus_[0];
+	uint32_t diverged = 0;
+
+	memset(group, 0, offsetof(LOCKSTEP_group, cpus_));
+	for (int i = 0; i < group->count_; i++)
+	{
+		for (int j = 0; j < 32; j++)
+		{
+			group->regfile_[j][i] = group->cpus_[i]->regfile_[j];
+		}
+		group->pc_[i] = group->cpus_[i]->pc_;
+		group->cpus_[i]->faulted_ = 0;
+		group->running_[i] = group->cpus_[i]->halted_ || group->cpus_[i]->waiting_ || max_steps == 0 ? 0 : UINT32_MAX;
+	}
+
+	//a lane retires at most one instruction per step, so none runs out of budget
+	//within a chunk of the budget left to the lane furthest ahead
+	for (;;)
+	{
+		uint64_t furthest = 0;
+		for (int i = 0; i < LOCKSTEP_LANES; i++)
+		{
+			furthest = group->running_[i] && group->steps_[i] > furthest ? group->steps_[i] : furthest;
+		}
+		uint64_t chunk = max_steps - furthest < (1u << 30) ? max_steps - furthest : (1u << 30);
+		for (uint64_t step = 0; step < chunk; step++)
+		{
+			//lowest pc of the running lanes, those at it run this step
+			LANE_u32 pcs = group->pc_ | ~group->running_;
+			uint32_t pc = UINT32_MAX;
+			int running = 0;
+			for (int i = 0; i < LOCKSTEP_LANES; i++)
+			{
+				pc = pcs[i] < pc ? pcs[i] : pc;
+				running += group->running_[i] & 1;
+			}
+			if (running == 0)
+			{
+				LOCKSTEP_store(group);
+				return;
+			}
+			LANE_u32 mask = (LANE_u32)(pcs == pc) & group->running_;
+
+			if ((pc & 0xFFFFF) + 4 > first->instr_mem_size_)
+			{
+				//left the instruction memory: halted like in the interpreter
+				group->halted_ |= mask;
+				group->running_ &= ~mask;
+				continue;
+			}
+
+			int active = 0;
+			for (int i = 0; i < LOCKSTEP_LANES; i++)
+			{
+				active += mask[i] & 1;
+			}
+			if (active < running && ++diverged > LOCKSTEP_DIVERGE_LIMIT)
+			{
+				//apart for too long, the remaining lanes run on their own
+				LOCKSTEP_store(group);
+				for (int i = 0; i < group->count_; i++)
+				{
+					if (group->running_[i])
+					{
+						stats->fallback_lanes_++;
+						stats->scalar_steps_ += CPU_run(group->cpus_[i], max_steps - group->steps_[i]);
+					}
+				}
+				return;
+			}
+			if (active == running)
+			{
+				diverged = 0;
+			}
+
+			uint32_t instruction = *(uint32_t *)(first->instr_mem_ + (pc & 0xFFFFF));
+			LANE_u32 next;
+			LOCKSTEP_execute(group, ops[(pc & 0xFFFFF) >> 2], instruction, pc, &mask, &next);
+			//a waiting load leaves the pc unchanged without halting or retiring
+			LANE_u32 waiting = mask & group->waiting_;
+			LANE_u32 halted = mask & (LANE_u32)(next == pc);
+			group->pc_ = LOCKSTEP_SELECT(mask, next, group->pc_);
+			group->chunk_steps_ -= mask & ~(halted & waiting);
+			group->halted_ |= halted & ~waiting;
+			group->running_ &= ~(halted | waiting);
+			stats->steps_++;
+			stats->lane_steps_ += active;
+		}
+		LOCKSTEP_count(group);
+		for (int i = 0; i < LOCKSTEP_LANES; i++)
+		{
+			group->running_[i] = group->steps_[i] < max_steps ? group->running_[i] : 0;
+		}
+	}
+}
+
+int CPU_run_lockstep(CPU **cpus, int count, uint64_t max_steps, LOCKSTEP_stats *stats)
+{
+	LOCKSTEP_stats ignored;
+	if (!stats)
+	{
+		stats = &ignored;
+	}
+	memset(stats, 0, sizeof(LOCKSTEP_stats));
+	if (count <= 0)
+	{
+		return CPU_OK;
+	}
+	for (int i = 1; i < count; i++)
+	{
+		if (cpus[i]->instr_mem_size_ != cpus[0]->instr_mem_size_ || !cpus[i]->mmu_ != !cpus[0]->mmu_ ||
+			memcmp(cpus[i]->instr_mem_, cpus[0]->instr_mem_, cpus[0]->instr_mem_size_) != 0)
+		{
+			return CPU_ERROR_ARGUMENT;
+		}
+	}
+
+	size_t pcs = cpus[0]->instr_mem_size_ / 4;
+	uint16_t *ops = malloc((pcs ? pcs : 1) * sizeof(uint16_t));
+	LOCKSTEP_group *group = aligned_alloc(64, (sizeof(LOCKSTEP_group) + 63) & ~(size_t)63);
+	if (!ops || !group)
+	{
+		free(ops);
+		free(group);
+		return CPU_ERROR_MEMORY;
+	}
+	for (size_t i = 0; i < pcs; i++)
+	{
+		ops[i] = CPU_decode(*(uint32_t *)(cpus[0]->instr_mem_ + (i << 2)));
+	}
+
+	for (int first = 0; first < count; first += LOCKSTEP_LANES)
+	{
+		group->count_ = count - first < LOCKSTEP_LANES ? count - first : LOCKSTEP_LANES;
+		memcpy(group->cpus_, cpus + first, group->count_ * sizeof(CPU *));
+		if (group->count_ == 1 || cpus[0]->mmu_)
+		{
+			//nothing to share the steps with, or privileged mode, which runs on the interpreter
+			for (int i = 0; i < group->count_; i++)
+			{
+				stats->scalar_steps_ += CPU_run(group->cpus_[i], max_steps);
+			}
+			continue;
+		}
+		LOCKSTEP_run_group(group, ops, max_steps, stats);
+	}
+
+	free(group);
+	free(ops);
+	return CPU_OK;
+}
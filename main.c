@@ -1,898 +1,1019 @@
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <stdint.h>
+#include <time.h>
+#include <unistd.h>
 
-enum opcode_decode
-{
-	R = 0x33,
-	I = 0x13,
-	S = 0x23,
-	L = 0x03,
-	B = 0x63,
-	JALR = 0x67,
-	JAL = 0x6F,
-	AUIPC = 0x17,
-	LUI = 0x37
-};
+#include "hurv.h"
 
+//console output of an instance (sweep or guest), printed after the run
 typedef struct
 {
-	size_t data_mem_size_;
-	uint32_t regfile_[32];
-	uint32_t pc_;
-	uint8_t *instr_mem_;
-	uint8_t *data_mem_;
-} CPU;
-
-void CPU_open_instruction_mem(CPU *cpu, const char *filename);
-void CPU_load_data_mem(CPU *cpu, const char *filename);
-
-//helper functions
-int8_t getFunc3(uint32_t instruction);
-int8_t getRS1(uint32_t instruction);
-int8_t getRS2(uint32_t instruction);
-int8_t getRD(uint32_t instruction);
-uint8_t getOpCode(uint32_t instruction);
-int8_t getFunc7(uint32_t instruction);
-int32_t shamt(uint32_t instruction);
-
-//immediate functions
-int32_t imm_I(uint32_t instruction);
-int32_t imm_S(uint32_t instruction);
-int32_t imm_B(uint32_t instruction);
-uint32_t imm_U(uint32_t instruction);
-int32_t imm_J(uint32_t instruction);
-
-//R-Type functions
-void ADD(CPU *cpu, uint32_t instruction);
-void SUB(CPU *cpu, uint32_t instruction);
-void SLL(CPU *cpu, uint32_t instruction);
-void SLT(CPU *cpu, uint32_t instruction);
-void SLTU(CPU *cpu, uint32_t instruction);
-void XOR(CPU *cpu, uint32_t instruction);
-void SRL(CPU *cpu, uint32_t instruction);
-void SRA(CPU *cpu, uint32_t instruction);
-void OR(CPU *cpu, uint32_t instruction);
-void AND(CPU *cpu, uint32_t instruction);
-
-//I-Type functions
-void JALR1(CPU *cpu, uint32_t instruction);
-void LB(CPU *cpu, uint32_t instruction);
-void LH(CPU *cpu, uint32_t instruction);
-void LW(CPU *cpu, uint32_t instruction);
-void LBU(CPU *cpu, uint32_t instruction);
-void LHU(CPU *cpu, uint32_t instruction);
-void ADDI(CPU *cpu, uint32_t instruction);
-void SLTI(CPU *cpu, uint32_t instruction);
-void SLTU(CPU *cpu, uint32_t instruction);
-void XORI(CPU *cpu, uint32_t instruction);
-void ORI(CPU *cpu, uint32_t instruction);
-void ANDI(CPU *cpu, uint32_t instruction);
-
-//S-Type functions
-void SB(CPU *cpu, uint32_t instruction);
-void SH(CPU *cpu, uint32_t instruction);
-void SW(CPU *cpu, uint32_t instruction);
-
-//B_Type function
-void BEQ(CPU *cpu, uint32_t instruction);
-void BNE(CPU *cpu, uint32_t instruction);
-void BLT(CPU *cpu, uint32_t instruction);
-void BGE(CPU *cpu, uint32_t instruction);
-void BLTU(CPU *cpu, uint32_t instruction);
-void BGEU(CPU *cpu, uint32_t instruction);
-
-//U-Type functions
-void LUI1(CPU *cpu, uint32_t instruction);
-void AUIPC1(CPU *cpu, uint32_t instruction);
-
-//J_Type functions
-void JAL1(CPU *cpu, uint32_t instruction);
-
-//shift functions
-void SLLI(CPU *cpu, uint32_t instruction);
-void SRLI(CPU *cpu, uint32_t instruction);
-void SRAI(CPU *cpu, uint32_t instruction);
-
-//initialises the cpu to the values given
-CPU *CPU_init(const char *path_to_inst_mem, const char *path_to_data_mem)
-{
-	CPU *cpu = (CPU *)malloc(sizeof(CPU));
-	cpu->data_mem_size_ = 0x400000;
-	cpu->pc_ = 0x0;
-	CPU_open_instruction_mem(cpu, path_to_inst_mem);
-	CPU_load_data_mem(cpu, path_to_data_mem);
-	return cpu;
-}
-
-void CPU_open_instruction_mem(CPU *cpu, const char *filename)
-{
-	uint32_t instr_mem_size;
-	FILE *input_file = fopen(filename, "r");
-	if (!input_file)
-	{
-		printf("no input\n");
-		exit(EXIT_FAILURE);
-	}
-	struct stat sb;
-	if (stat(filename, &sb) == -1)
-	{
-		printf("error stat\n");
-		perror("stat");
-		exit(EXIT_FAILURE);
-	}
-	printf("size of instruction memory: %d Byte\n\n", sb.st_size);
-	instr_mem_size = sb.st_size;
-	cpu->instr_mem_ = malloc(instr_mem_size);
-	fread(cpu->instr_mem_, sb.st_size, 1, input_file);
-	fclose(input_file);
-	return;
-}
+	uint8_t *data_;
+	size_t size_;
+	size_t capacity_;
+} OUTPUT_buffer;
 
-void CPU_load_data_mem(CPU *cpu, const char *filename)
+static void OUTPUT_append(void *context, uint8_t byte)
 {
-	FILE *input_file = fopen(filename, "r");
-	if (!input_file)
-	{
-		printf("no input\n");
-		exit(EXIT_FAILURE);
-	}
-	struct stat sb;
-	if (stat(filename, &sb) == -1)
+	OUTPUT_buffer *buffer = context;
+	if (buffer->size_ == buffer->capacity_)
 	{
-		printf("error stat\n");
-		perror("stat");
-		exit(EXIT_FAILURE);
+		//out of memory the output ends here
+		size_t capacity = buffer->capacity_ ? buffer->capacity_ * 2 : 256;
+		uint8_t *data = realloc(buffer->data_, capacity);
+		if (!data)
+		{
+			return;
+		}
+		buffer->data_ = data;
+		buffer->capacity_ = capacity;
 	}
-	printf("read data for data memory: %d Byte\n\n", sb.st_size);
-
-	cpu->data_mem_ = malloc(cpu->data_mem_size_);
-	fread(cpu->data_mem_, sb.st_size, 1, input_file);
-	fclose(input_file);
-	return;
+	buffer->data_[buffer->size_++] = byte;
 }
 
-/**
- * Instruction fetch Instruction decode, Execute, Memory access, Write back
- */
-
-//implementing functions
-
-int8_t getRS1(uint32_t instruction)
-{
-	// rs1 in bits 19..15
-	return (instruction >> 15) & 0x1f;
-};
-int8_t getRS2(uint32_t instruction)
-{
-	// rs2 in bits 24..20
-	return (instruction >> 20) & 0x1f;
-};
-
-//gives the address of the destination register
-int8_t getRD(uint32_t instruction)
+//command line front end of libhurv
+//a number of bytes, K/M/G suffixes allowed
+static size_t SIZE_parse(const char *text)
 {
-	// RD is in bits 7...11
-	return (instruction >> 7) & 0x1f;
+	char *suffix;
+	size_t size = strtoull(text, &suffix, 0);
+	switch (*suffix)
+	{
+	case 'G':
+		size <<= 10;
+		//fall through
+	case 'M':
+		size <<= 10;
+		//fall through
+	case 'K':
+		size <<= 10;
+		break;
+	}
+	return size;
 }
 
-uint8_t getOpCode(uint32_t instruction)
-{
-	uint8_t opcode = (instruction & 0x7f);
-	return opcode;
-};
-
-int8_t getFunc3(uint32_t instruction)
-{
-	return (instruction >> 12) & 0x7;
-};
-
-int8_t getFunc7(uint32_t instruction)
+int main(int argc, char *argv[])
 {
-	return (instruction >> 25) & 0x7f;
-};
-
-//PROBLEM IS IN SHAMT-- ENDLESS LOOP but why?
-int32_t shamt(uint32_t instruction)
-{ //shifting 20 bits to the left and ANDing with last 5 bits
-	//printf("%d", 9999);
+	printf("C Praktikum\nHU Risc-V  Emulator 2022\n");
 
-	uint32_t temp_instr = (instruction >> 20) & 0x1f;
+	if (argc < 3)
+	{
+		printf("usage: %s <instruction_mem.bin> <data_mem.bin> [options]\n"
+			   "  --steps=N           stop after N instructions (default 1000000)\n"
+			   "  --ram=SIZE          guest RAM in bytes, K/M/G suffixes allowed (default 4M)\n"
+			   "  --no-hugepages      back the guest RAM with small pages only\n"
+			   "  --engine=interp|predecode|tiered|lockstep\n"
+			   "  --tiers=P,T         tiered engine: decode after P entries, translate after T block runs (default 2,50)\n"
+			   "  --no-ir-opt         tiered engine: run translated blocks without the IR optimizer\n"
+			   "  --tcache=SIZE       tiered engine: one translation cache of SIZE bytes for all instances (default 32M each)\n"
+			   "  --sweep=a,b,...     also run the program on these data memories (lockstep: SIMD lanes)\n"
+			   "  --harts=N           N harts sharing the memory, one host thread each\n"
+			   "  --guests=N          N instances of the program, time-sliced on --workers threads\n"
+			   "  --workers=N         run all instances and harts on the scheduler with N threads (default: cores)\n"
+			   "  --quantum=N         instructions per time slice of the scheduler (default 10000)\n"
+			   "  --decode-cache=dir  keep the pre-decoded blocks in dir for the next run (pre-decoded engine)\n"
+			   "  --profile[=file]    opcode mix and hot spots at halt (pre-decoded engine)\n"
+			   "  --trace=file        binary execution trace, see trace.h (pre-decoded engine)\n"
+			   "  --stats             instructions, run time and MIPS on stderr\n"
+			   "  --perf              host performance counters around CPU_run (Linux)\n"
+			   "  --sample[=N]        sample the guest call stack every N instructions (default 1000)\n"
+			   "  --sample-out=file   collapsed stacks for flamegraph.pl (default stdout)\n"
+			   "  --symbols=file      ELF file or GNU ld .map file of the program for --sample and --hle\n"
+			   "  --hle[=f,...]       run memcpy, memset, strlen and _strnlen_s natively; f is a function of --symbols\n"
+			   "                      or f@address, e.g. memcpy@0x1a4\n"
+			   "  --accel[=f@n,...]   custom-0/1 instructions run native accelerators f (dot16, aes) in slot n,\n"
+			   "                      funct3 of custom-0 or 8 + funct3 of custom-1 (default: dot16@0,aes@1)\n"
+			   "  --syscalls          ECALL runs newlib system calls on the host (exit, read, write, open, ...)\n"
+			   "  --sandbox=dir,...   --syscalls, and open reaches the files inside these directories\n"
+			   "  --brk=ADDR          --syscalls, first program break (default: end of the data image)\n"
+			   "  --blk=file[,ro]     block device of every instance served from file (read-only with ro)\n"
+			   "  --privileged        M/S/U modes, traps and Sv32 paging through TLBs (interpreter)\n"
+			   "  --bpred[=btfn,bimodal,gshare,tage,ras]\n",
+			   argv[0]);
+		return EXIT_FAILURE;
+	}
 
-	if ((instruction >> 31) == 1)
+	uint64_t max_steps = 1000000;
+	size_t ram_size = CPU_DEFAULT_DATA_MEM_SIZE;
+	int memory_flags = CPU_MEM_DEFAULT;
+	int engine = ENGINE_INTERP;
+	int lockstep = 0;
+	char *sweep = NULL;
+	int harts = 1;
+	int guests = 1;
+	int workers = 0;
+	uint64_t quantum = 10000;
+	const char *decode_cache = NULL;
+	uint32_t tier_predecode = CPU_DEFAULT_PREDECODE_THRESHOLD;
+	uint32_t tier_translate = CPU_DEFAULT_TRANSLATE_THRESHOLD;
+	int ir_optimize = 1;
+	size_t tcache_budget = 0;
+	TCACHE *tcache = NULL;
+	const char *bpred_spec = NULL;
+	const char *profile_path = NULL;
+	const char *trace_path = NULL;
+	int stats = 0;
+	int perf = 0;
+	int sample = 0;
+	uint64_t sample_period = 0;
+	const char *sample_path = "-";
+	const char *symbols_path = NULL;
+	const char *hle = NULL;
+	int hle_default = 0; //the functions of the default list the program does not have are left out
+	const char *accel = NULL;
+	int syscalls = 0;
+	int privileged = 0;
+	char *sandbox = NULL;
+	uint32_t brk = 0;
+	char *blk_path = NULL;
+	int blk_writable = 1;
+	for (int i = 3; i < argc; i++)
 	{
-		return (temp_instr | 0xffffffe0);
+		if (strncmp(argv[i], "--steps=", 8) == 0)
+		{
+			max_steps = strtoull(argv[i] + 8, NULL, 0);
+		}
+		else if (strncmp(argv[i], "--ram=", 6) == 0)
+		{
+			ram_size = SIZE_parse(argv[i] + 6);
+		}
+		else if (strncmp(argv[i], "--tcache=", 9) == 0)
+		{
+			tcache_budget = SIZE_parse(argv[i] + 9);
+		}
+		else if (strcmp(argv[i], "--no-hugepages") == 0)
+		{
+			memory_flags |= CPU_MEM_NO_HUGEPAGES;
+		}
+		else if (strcmp(argv[i], "--engine=interp") == 0)
+		{
+			engine = ENGINE_INTERP;
+			lockstep = 0;
+		}
+		else if (strcmp(argv[i], "--engine=predecode") == 0)
+		{
+			engine = ENGINE_PREDECODE;
+			lockstep = 0;
+		}
+		else if (strcmp(argv[i], "--engine=tiered") == 0)
+		{
+			engine = ENGINE_TIERED;
+			lockstep = 0;
+		}
+		else if (strncmp(argv[i], "--tiers=", 8) == 0)
+		{
+			char *comma;
+			tier_predecode = strtoul(argv[i] + 8, &comma, 0);
+			if (*comma != ',')
+			{
+				printf("--tiers needs two numbers: --tiers=predecode,translate\n");
+				return EXIT_FAILURE;
+			}
+			tier_translate = strtoul(comma + 1, NULL, 0);
+		}
+		else if (strcmp(argv[i], "--no-ir-opt") == 0)
+		{
+			ir_optimize = 0;
+		}
+		else if (strcmp(argv[i], "--engine=lockstep") == 0)
+		{
+			engine = ENGINE_INTERP; //for lanes that fall back to scalar execution
+			lockstep = 1;
+		}
+		else if (strncmp(argv[i], "--sweep=", 8) == 0)
+		{
+			sweep = argv[i] + 8;
+		}
+		else if (strncmp(argv[i], "--harts=", 8) == 0)
+		{
+			harts = atoi(argv[i] + 8);
+		}
+		else if (strncmp(argv[i], "--guests=", 9) == 0)
+		{
+			guests = atoi(argv[i] + 9);
+		}
+		else if (strncmp(argv[i], "--workers=", 10) == 0)
+		{
+			workers = atoi(argv[i] + 10);
+		}
+		else if (strncmp(argv[i], "--quantum=", 10) == 0)
+		{
+			quantum = strtoull(argv[i] + 10, NULL, 0);
+		}
+		else if (strncmp(argv[i], "--decode-cache=", 15) == 0)
+		{
+			decode_cache = argv[i] + 15;
+		}
+		else if (strcmp(argv[i], "--profile") == 0)
+		{
+			profile_path = "-";
+		}
+		else if (strncmp(argv[i], "--profile=", 10) == 0)
+		{
+			profile_path = argv[i] + 10;
+		}
+		else if (strcmp(argv[i], "--perf") == 0)
+		{
+			perf = 1;
+		}
+		else if (strcmp(argv[i], "--sample") == 0)
+		{
+			sample = 1;
+		}
+		else if (strncmp(argv[i], "--sample=", 9) == 0)
+		{
+			sample = 1;
+			sample_period = strtoull(argv[i] + 9, NULL, 0);
+		}
+		else if (strncmp(argv[i], "--sample-out=", 13) == 0)
+		{
+			sample = 1;
+			sample_path = argv[i] + 13;
+		}
+		else if (strncmp(argv[i], "--symbols=", 10) == 0)
+		{
+			symbols_path = argv[i] + 10;
+		}
+		else if (strcmp(argv[i], "--hle") == 0)
+		{
+			hle = "memcpy,memset,strlen,_strnlen_s";
+			hle_default = 1;
+		}
+		else if (strncmp(argv[i], "--hle=", 6) == 0)
+		{
+			hle = argv[i] + 6;
+			hle_default = 0;
+		}
+		else if (strcmp(argv[i], "--accel") == 0)
+		{
+			accel = "dot16@0,aes@1";
+		}
+		else if (strncmp(argv[i], "--accel=", 8) == 0)
+		{
+			accel = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "--syscalls") == 0)
+		{
+			syscalls = 1;
+		}
+		else if (strncmp(argv[i], "--sandbox=", 10) == 0)
+		{
+			syscalls = 1;
+			sandbox = argv[i] + 10;
+		}
+		else if (strncmp(argv[i], "--brk=", 6) == 0)
+		{
+			syscalls = 1;
+			brk = strtoul(argv[i] + 6, NULL, 0);
+		}
+		else if (strcmp(argv[i], "--privileged") == 0)
+		{
+			privileged = 1;
+		}
+		else if (strncmp(argv[i], "--blk=", 6) == 0)
+		{
+			blk_path = argv[i] + 6;
+			char *comma = strrchr(blk_path, ',');
+			if (comma && strcmp(comma, ",ro") == 0)
+			{
+				*comma = '\0';
+				blk_writable = 0;
+			}
+		}
+		else if (strcmp(argv[i], "--stats") == 0)
+		{
+			stats = 1;
+		}
+		else if (strncmp(argv[i], "--trace=", 8) == 0)
+		{
+			trace_path = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "--bpred") == 0)
+		{
+			bpred_spec = "all";
+		}
+		else if (strncmp(argv[i], "--bpred=", 8) == 0)
+		{
+			bpred_spec = argv[i] + 8;
+		}
+		else
+		{
+			printf("unknown option: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
 	}
-	else
+	if (profile_path || trace_path)
 	{
-		//return (temp_instr & 0x0000001f);
-		return (temp_instr | 0x00000000);
+		//the profile is kept in the block counters of the pre-decoded engine,
+		//tracing is done on its micro-ops
+		engine = ENGINE_PREDECODE;
 	}
-}
-
-int32_t imm_I(uint32_t instruction)
-{
-	//sign extend the bit after shifting
-	uint32_t temp_instr = (instruction & 0xfff00000) >> 20;
-
-	//if bit is 1, then 'or' with the temp_instr
-	if ((instruction >> 31) == 1)
+	if (guests > 1 && workers == 0)
 	{
-		return (temp_instr | 0xfffff000);
+		workers = sysconf(_SC_NPROCESSORS_ONLN);
 	}
-	else
+	if (guests < 1 || workers < 0 || quantum == 0 || (workers && (lockstep || trace_path)))
 	{
-		return (temp_instr & 0x00000fff);
+		printf("--guests, --workers and --quantum need positive numbers and do not go with --engine=lockstep or --trace\n");
+		return EXIT_FAILURE;
 	}
-}
-
-
-int32_t imm_S(uint32_t instruction)
-{
-    int32_t S_immediate=(instruction&0x80000000) ? 0xFFFFF000 | (instruction&0xFE000000)>>20 | (instruction&0xF80)>>7
-    : (instruction&0xFE000000)>>20 | (instruction&0xF80)>>7;
-
-    return S_immediate;
-}
-
-
-int32_t imm_B(uint32_t instruction)
-{
-	return ((int32_t)(instruction & 0x80000000) >> 19) | ((instruction & 0x80) << 4) // imm[11]
-		   | ((instruction >> 20) & 0x7e0)											 // imm[10:5]
-		   | ((instruction >> 7) & 0x1e);											 // imm[4:1]
-};
-
-uint32_t imm_U(uint32_t instruction)
-{
-	return (int32_t)(instruction & 0xfffff000);
-}
-
-int32_t imm_J(uint32_t instruction)
-{
-	//printf("%d", 123);
-
-	// imm[20|10:1|11|19:12] = inst[31|30:21|20|19:12]
-	return ((int32_t)(instruction & 0x80000000) >> 11) | (instruction & 0xff000) // imm[19:12]
-		   | ((instruction >> 9) & 0x800)										 // imm[11]
-		   | ((instruction >> 20) & 0x7fe);										 // imm[10:1]
-};
-
-//R Type Instructions
-void ADD(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] + cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void SUB(CPU *cpu, uint32_t instruction)
-{
-	//printf("%d", 55555);
-
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] - cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void SLL(CPU *cpu, uint32_t instruction)
-{ //I am temporarily changing uint to int to check if it works (22.08.22)
-	//printf("%d", 55555);
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-
-	cpu->regfile_[rd] = cpu->regfile_[rs1] << cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void SLT(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = (int32_t)cpu->regfile_[rs1] < (int32_t)cpu->regfile_[rs2] ? 1 : 0;
-	cpu->pc_ += 4;
-}
-
-void SLTU(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = (uint32_t)cpu->regfile_[rs1] < (uint32_t)cpu->regfile_[rs2] ? 1 : 0;
-	cpu->pc_ += 4;
-}
-
-void XOR(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] ^ cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void SRL(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] >> cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void SRA(CPU *cpu, uint32_t instruction) // TODO
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = (int32_t)cpu->regfile_[rs1] >> cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void OR(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] | cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void AND(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] & cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-//I-Type Instruction
-void JALR1(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->pc_ + 0x4;
-	cpu->pc_ = (cpu->regfile_[rs1] + ((int32_t)imm));
-}
-
-void LB(CPU *cpu, uint32_t instruction) // TODO
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	uint8_t tmp = cpu->data_mem_[cpu->regfile_[rs1] + imm];
-
-	//take last 8 bits
-	if ((tmp & 0x80) > 1)
+	if ((lockstep || sweep || guests > 1) && (profile_path || trace_path || bpred_spec || sample))
 	{
-		cpu->regfile_[rd] = 0xffffff00 | tmp;
+		printf("--profile, --trace, --bpred and --sample need a single instance on the interp or predecode engine\n");
+		return EXIT_FAILURE;
 	}
-	else
+	if (harts < 1 || (harts > 1 && (lockstep || sweep)))
 	{
-		cpu->regfile_[rd] = 0x000000ff & tmp;
+		printf("--harts needs a number of at least 1 and does not go with --sweep or --engine=lockstep\n");
+		return EXIT_FAILURE;
 	}
 
-	cpu->pc_ += 0x4;
-}
-
-void LH(CPU *cpu, uint32_t instruction) // TODO
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	uint16_t tmp = *(uint16_t *)(cpu->regfile_[rs1] + imm + cpu->data_mem_);
-
-	//Take last 16 bits
-	if ((tmp & 0x8000) > 1)
+	CPU *cpu_inst = CPU_create_with_memory(ram_size, memory_flags);
+	if (!cpu_inst)
 	{
-		cpu->regfile_[rd] = 0xffff0000 | tmp;
+		printf("cannot allocate %zu bytes of guest RAM\n", ram_size);
+		return EXIT_FAILURE;
 	}
-	else
+	int status = CPU_load(cpu_inst, argv[1], argv[2]);
+	if (status != CPU_OK)
 	{
-		cpu->regfile_[rd] = 0x0000ffff & tmp;
+		printf("cannot load %s / %s: %s\n", argv[1], argv[2], CPU_error_string(status));
+		return EXIT_FAILURE;
 	}
-
-	cpu->pc_ += 0x4;
-}
-
-void LW(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = *(uint32_t *)(cpu->regfile_[rs1] + imm + cpu->data_mem_);
-	cpu->pc_ += 0x4;
-}
-
-void LBU(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->data_mem_[cpu->regfile_[rs1] + imm];
-	cpu->pc_ += 0x4;
-}
-
-void LHU(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = *(uint16_t *)(cpu->regfile_[rs1] + imm + cpu->data_mem_);
-	cpu->pc_ += 0x4;
-}
-
-void ADDI(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] + imm;
-	cpu->pc_ += 0x4;
-}
-
-void SLTI(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] < imm ? 1 : 0;
-	cpu->pc_ += 4;
-}
-
-void SLTIU(CPU *cpu, uint32_t instruction)
-{
-	uint8_t rd = getRD(instruction);
-	uint8_t rs1 = getRS1(instruction);
-	uint32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] < imm ? 1 : 0;
-	cpu->pc_ += 4;
-}
-
-void XORI(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] ^ imm;
-	cpu->pc_ += 0x4;
-}
-
-void ORI(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] | imm;
-	cpu->pc_ += 0x4;
-}
-
-void ANDI(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int32_t imm = imm_I(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] & imm;
-	cpu->pc_ += 0x4;
-}
-
-//S-Type Instructions
-void SB(CPU *cpu, uint32_t instruction) 
-{
-	uint8_t rd = getRD(instruction);
-	uint8_t rs1 = getRS1(instruction);
-	uint8_t rs2 = getRS2(instruction);
-	uint32_t imm = imm_S(instruction);
-
-	//Print character for SB
-	if ((cpu->regfile_[rs1]  == 0x5000))
+	printf("size of instruction memory: %zu Byte\n\n", CPU_get_instr_mem_size(cpu_inst));
+	printf("read data for data memory: %zu Byte\n\n", CPU_get_data_image_size(cpu_inst));
+	CPU_set_engine(cpu_inst, engine);
+
+	//parameter sweep: one more instance of the program for every data memory
+	int instances = 1;
+	CPU **cpus = malloc(sizeof(CPU *));
+	const char **data_paths = malloc(sizeof(char *));
+	OUTPUT_buffer *outputs = NULL;
+	if (!cpus || !data_paths)
 	{
-		putchar((char)cpu->regfile_[rs2]);
+		printf("out of memory\n");
+		return EXIT_FAILURE;
 	}
-
-	cpu->data_mem_[cpu->regfile_[rs1] + (int32_t)imm] = (uint8_t)cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void SH(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_S(instruction);
-	*(uint16_t *)(cpu->data_mem_ + cpu->regfile_[rs1] + imm) = (uint16_t)cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-void SW(CPU *cpu, uint32_t instruction) //PROBLEM HERE 
-{
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_S(instruction);
-	// printf("%d\n", imm);
-	// fflush(stdout);
-
-	//print imm s in decimal and then ffslush 
-	//pritnf imm word -- 14 immediate 
-	*(uint32_t *)(cpu->data_mem_ + cpu->regfile_[rs1] + (int32_t)imm) = (uint32_t)cpu->regfile_[rs2];
-	cpu->pc_ += 0x4;
-}
-
-//B-Type Instruction
-void BEQ(CPU *cpu, uint32_t instruction)
-{
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_B(instruction);
-
-	if (cpu->regfile_[rs1] == cpu->regfile_[rs2])
+	cpus[0] = cpu_inst;
+	data_paths[0] = argv[2];
+	for (char *path = sweep ? strtok(sweep, ",") : NULL; path; path = strtok(NULL, ","))
 	{
-		cpu->pc_ = cpu->pc_ + (int32_t)imm;
+		cpus = realloc(cpus, (instances + 1) * sizeof(CPU *));
+		data_paths = realloc(data_paths, (instances + 1) * sizeof(char *));
+		if (!cpus || !data_paths)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
+		cpus[instances] = CPU_create_with_memory(ram_size, memory_flags);
+		if (!cpus[instances])
+		{
+			printf("cannot allocate %zu bytes of guest RAM\n", ram_size);
+			return EXIT_FAILURE;
+		}
+		status = CPU_load(cpus[instances], argv[1], path);
+		if (status != CPU_OK)
+		{
+			printf("cannot load %s / %s: %s\n", argv[1], path, CPU_error_string(status));
+			return EXIT_FAILURE;
+		}
+		CPU_set_engine(cpus[instances], engine);
+		data_paths[instances++] = path;
 	}
-	else
+	//guests: more instances on the same data memory
+	cpus = realloc(cpus, (instances + guests - 1) * sizeof(CPU *));
+	data_paths = realloc(data_paths, (instances + guests - 1) * sizeof(char *));
+	if (!cpus || !data_paths)
 	{
-		cpu->pc_ += 0x4;
+		printf("out of memory\n");
+		return EXIT_FAILURE;
 	}
-}
-
-void BNE(CPU *cpu, uint32_t instruction)
-{
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_B(instruction);
-
-	if (cpu->regfile_[rs1] != cpu->regfile_[rs2])
+	for (int i = 1; i < guests; i++)
 	{
-		cpu->pc_ = cpu->pc_ + (int32_t)imm;
+		cpus[instances] = CPU_create_with_memory(ram_size, memory_flags);
+		if (!cpus[instances] || CPU_load(cpus[instances], argv[1], argv[2]) != CPU_OK)
+		{
+			printf("cannot create guest %d\n", i);
+			return EXIT_FAILURE;
+		}
+		CPU_set_engine(cpus[instances], engine);
+		data_paths[instances++] = argv[2];
 	}
-	else
+	//harts 1..N-1 share the memory of cpu_inst, the instrumentation watches hart 0
+	CPU **hart_cpus = malloc(harts * sizeof(CPU *));
+	if (!hart_cpus)
 	{
-		cpu->pc_ += 0x4;
+		printf("out of memory\n");
+		return EXIT_FAILURE;
 	}
-}
-
-void BLT(CPU *cpu, uint32_t instruction)
-{
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_B(instruction);
-
-	if (cpu->regfile_[rs1] < cpu->regfile_[rs2])
+	hart_cpus[0] = cpu_inst;
+	for (int i = 1; i < harts; i++)
 	{
-		cpu->pc_ = cpu->pc_ + imm;
+		hart_cpus[i] = CPU_create_hart(cpu_inst, i);
+		if (!hart_cpus[i])
+		{
+			printf("cannot create hart %d\n", i);
+			return EXIT_FAILURE;
+		}
 	}
-	else
+	if (tcache_budget)
 	{
-		cpu->pc_ += 0x4;
+		tcache = TCACHE_create(tcache_budget);
+		if (!tcache)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
 	}
-}
-
-void BGE(CPU *cpu, uint32_t instruction)
-{
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_B(instruction);
-
-	if ((int32_t)cpu->regfile_[rs1] >= (int32_t)cpu->regfile_[rs2])
+	for (int i = 0; i < instances + harts - 1; i++)
 	{
-		cpu->pc_ = cpu->pc_ + (int32_t)imm;
+		if (tcache)
+		{
+			CPU_set_translation_cache(i < instances ? cpus[i] : hart_cpus[i - instances + 1], tcache);
+		}
+		CPU_set_tier_thresholds(i < instances ? cpus[i] : hart_cpus[i - instances + 1], tier_predecode, tier_translate);
+		CPU_set_ir_optimize(i < instances ? cpus[i] : hart_cpus[i - instances + 1], ir_optimize);
 	}
-	else
+	for (int i = 0; decode_cache && i < instances + harts - 1; i++)
 	{
-		cpu->pc_ += 0x4;
+		if (CPU_set_decode_cache(i < instances ? cpus[i] : hart_cpus[i - instances + 1], decode_cache) != CPU_OK)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
 	}
-}
-
-void BLTU(CPU *cpu, uint32_t instruction)
-{
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_B(instruction);
-
-	if ((uint32_t)cpu->regfile_[rs1] < (uint32_t)cpu->regfile_[rs2])
+	//function hooks on every instance and hart
+	char *hle_list = hle ? strdup(hle) : NULL;
+	if (hle && !hle_list)
 	{
-		cpu->pc_ = cpu->pc_ + imm;
+		printf("out of memory\n");
+		return EXIT_FAILURE;
 	}
-	else
+	for (char *name = hle_list ? strtok(hle_list, ",") : NULL; name; name = strtok(NULL, ","))
 	{
-		cpu->pc_ += 0x4;
+		char *at = strchr(name, '@');
+		if (at)
+		{
+			*at = '\0';
+		}
+		int function = CPU_hle_function(name);
+		if (function < 0)
+		{
+			printf("no native version of %s, --hle knows memcpy, memset, strlen, strnlen and _strnlen_s\n", name);
+			return EXIT_FAILURE;
+		}
+		uint32_t addr;
+		if (at)
+		{
+			addr = strtoul(at + 1, NULL, 0);
+		}
+		else if (!symbols_path)
+		{
+			printf("--hle needs --symbols=file or function@address\n");
+			return EXIT_FAILURE;
+		}
+		else
+		{
+			status = CPU_find_symbol(symbols_path, name, &addr);
+			if (status == CPU_ERROR_ARGUMENT && hle_default)
+			{
+				continue;
+			}
+			if (status != CPU_OK)
+			{
+				printf("cannot find %s in %s: %s\n", name, symbols_path, CPU_error_string(status));
+				return EXIT_FAILURE;
+			}
+		}
+		for (int i = 0; i < instances + harts - 1; i++)
+		{
+			status = CPU_set_hle(i < instances ? cpus[i] : hart_cpus[i - instances + 1], addr, function);
+			if (status != CPU_OK)
+			{
+				printf("cannot hook %s at 0x%X: %s\n", name, addr, CPU_error_string(status));
+				return EXIT_FAILURE;
+			}
+		}
 	}
-}
-
-void BGEU(CPU *cpu, uint32_t instruction)
-{
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	int32_t imm = imm_B(instruction);
-
-	if ((uint32_t)cpu->regfile_[rs1] >= (uint32_t)cpu->regfile_[rs2])
+	free(hle_list);
+	//accelerators on every instance and hart
+	char *accel_list = accel ? strdup(accel) : NULL;
+	if (accel && !accel_list)
 	{
-		cpu->pc_ = cpu->pc_ + imm;
+		printf("out of memory\n");
+		return EXIT_FAILURE;
 	}
-	else
+	for (char *name = accel_list ? strtok(accel_list, ",") : NULL; name; name = strtok(NULL, ","))
 	{
-		cpu->pc_ += 0x4;
+		char *at = strchr(name, '@');
+		if (!at)
+		{
+			printf("--accel needs accelerator@slot, e.g. dot16@0\n");
+			return EXIT_FAILURE;
+		}
+		*at = '\0';
+		int function = CPU_accel_function(name);
+		if (function < 0)
+		{
+			printf("no accelerator %s, --accel knows dot16 and aes\n", name);
+			return EXIT_FAILURE;
+		}
+		int slot = atoi(at + 1);
+		for (int i = 0; i < instances + harts - 1; i++)
+		{
+			status = CPU_set_accel(i < instances ? cpus[i] : hart_cpus[i - instances + 1], slot, function);
+			if (status != CPU_OK)
+			{
+				printf("cannot put %s into slot %s: %s\n", name, at + 1, CPU_error_string(status));
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	free(accel_list);
+	//system calls on every instance and hart, each with its own files
+	for (int i = 0; syscalls && i < instances + harts - 1; i++)
+	{
+		CPU *cpu = i < instances ? cpus[i] : hart_cpus[i - instances + 1];
+		if (CPU_set_syscalls(cpu, 1) != CPU_OK)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
+		if (brk && CPU_set_brk(cpu, brk) != CPU_OK)
+		{
+			printf("--brk=0x%X is outside the data memory\n", brk);
+			return EXIT_FAILURE;
+		}
+		char *directories = sandbox ? strdup(sandbox) : NULL;
+		if (sandbox && !directories)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
+		for (char *directory = directories ? strtok(directories, ",") : NULL; directory; directory = strtok(NULL, ","))
+		{
+			status = CPU_syscall_allow(cpu, directory);
+			if (status != CPU_OK)
+			{
+				printf("cannot open %s for --sandbox: %s\n", directory, CPU_error_string(status));
+				return EXIT_FAILURE;
+			}
+		}
+		free(directories);
+	}
+	for (int i = 0; privileged && i < instances + harts - 1; i++)
+	{
+		if (CPU_set_privileged(i < instances ? cpus[i] : hart_cpus[i - instances + 1], 1) != CPU_OK)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
+	}
+	//a disk per instance, the harts use the one of their memory
+	for (int i = 0; blk_path && i < instances; i++)
+	{
+		status = CPU_attach_block(cpus[i], blk_path, blk_writable);
+		if (status != CPU_OK)
+		{
+			printf("cannot attach %s for --blk: %s\n", blk_path, CPU_error_string(status));
+			return EXIT_FAILURE;
+		}
+	}
+	if (instances > 1)
+	{
+		//the consoles of the instances are printed one after another
+		outputs = calloc(instances, sizeof(OUTPUT_buffer));
+		if (!outputs)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
+		for (int i = 0; i < instances; i++)
+		{
+			CPU_set_output(cpus[i], OUTPUT_append, &outputs[i]);
+		}
 	}
-}
-
-//U_Type Instruction
-void LUI1(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int32_t imm = imm_U(instruction);
-	cpu->regfile_[rd] = imm;
-	cpu->pc_ += 0x4;
-}
-
-void AUIPC1(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int32_t imm = imm_U(instruction);
-	cpu->regfile_[rd] = cpu->pc_ + imm;
-	cpu->pc_ += 0x4;
-}
-
-//J-Type Instruction
-void JAL1(CPU *cpu, uint32_t instruction)
-{
-	//printf("%d", 66666);
-	int8_t rd = getRD(instruction);
-	int32_t imm = imm_J(instruction);
-	cpu->regfile_[rd] = cpu->pc_ + 0x4;
-	cpu->pc_ = cpu->pc_ + (int32_t)imm;
-}
-
-//Shift Instruction
-void SLLI(CPU *cpu, uint32_t instruction)
-{
-	//printf("%d", 00000);
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
-	cpu->regfile_[rd] = cpu->regfile_[rs1] << rs2;
-	cpu->pc_ += 0x04;
-}
 
-void SRLI(CPU *cpu, uint32_t instruction)
-{
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
-	int8_t rs2 = getRS2(instruction);
+	BP_sim *bpred = NULL;
+	if (bpred_spec)
+	{
+		bpred = BP_create(bpred_spec, cpu_inst);
+		if (!bpred)
+		{
+			printf("cannot create branch predictors %s: unknown name or out of memory\n", bpred_spec);
+			return EXIT_FAILURE;
+		}
+		CPU_set_bpred(cpu_inst, bpred);
+	}
 
-	cpu->regfile_[rd] = cpu->regfile_[rs1] >> rs2;
-	cpu->pc_ += 0x04;
-}
+	SAMPLE_profiler *sampler = NULL;
+	if (sample)
+	{
+		sampler = SAMPLE_create(sample_period, CPU_get_pc(cpu_inst));
+		if (!sampler)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
+		if (symbols_path && SAMPLE_load_symbols(sampler, symbols_path) == -1)
+		{
+			printf("could not read symbols from %s\n", symbols_path);
+			return EXIT_FAILURE;
+		}
+		CPU_set_sampler(cpu_inst, sampler);
+	}
 
-void SRAI(CPU *cpu, uint32_t instruction) // TODO
-{
-	//printf("%d", 66666);
-	//I am temporarily changing uint to int to check if it works (22.08.22)
-	int32_t imm = shamt(instruction);
-	int8_t rd = getRD(instruction);
-	int8_t rs1 = getRS1(instruction);
+	TRACE_writer *trace_writer = NULL;
+	TRACE_ring *trace_ring = NULL;
+	if (trace_path)
+	{
+		trace_writer = TRACE_writer_create(trace_path);
+		if (!trace_writer)
+		{
+			perror(trace_path);
+			return EXIT_FAILURE;
+		}
+		trace_ring = TRACE_attach(trace_writer);
+		if (!trace_ring)
+		{
+			printf("out of memory\n");
+			return EXIT_FAILURE;
+		}
+		CPU_set_trace(cpu_inst, trace_ring);
+	}
 
-	//######### with a star (vorzeichen)
-	cpu->regfile_[rd] = (int32_t)cpu->regfile_[rs1] >> imm;
-	cpu->pc_ += 0x04;
-}
+	PERF_counters counters;
+	if (perf && PERF_open(&counters) == 0)
+	{
+		fprintf(stderr, "perf: no performance counters available\n");
+	}
 
-void CPU_execute(CPU *cpu)
-{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (perf)
+	{
+		PERF_start(&counters);
+	}
+	LOCKSTEP_stats lockstep_stats;
+	SCHED_stats sched_stats;
+	int parked = 0;
+	if (workers)
+	{
+		//every instance and every hart is a guest of the scheduler
+		SCHED_pool *pool = SCHED_create(workers, quantum);
+		if (!pool)
+		{
+			printf("cannot start %d worker threads\n", workers);
+			return EXIT_FAILURE;
+		}
+		for (int i = 0; i < instances + harts - 1; i++)
+		{
+			if (!SCHED_add(pool, i < instances ? cpus[i] : hart_cpus[i - instances + 1], 0, 0, max_steps))
+			{
+				printf("cannot add guest %d to the scheduler\n", i);
+				return EXIT_FAILURE;
+			}
+		}
+		parked = SCHED_wait(pool);
+		SCHED_get_stats(pool, &sched_stats);
+		SCHED_destroy(pool);
+	}
+	else if (lockstep)
+	{
+		status = CPU_run_lockstep(cpus, instances, max_steps, &lockstep_stats);
+		if (status != CPU_OK)
+		{
+			printf("lockstep: %s\n", CPU_error_string(status));
+			return EXIT_FAILURE;
+		}
+	}
+	else if (harts > 1)
+	{
+		status = CPU_run_smp(hart_cpus, harts, max_steps);
+		if (status != CPU_OK)
+		{
+			printf("harts: %s\n", CPU_error_string(status));
+			return EXIT_FAILURE;
+		}
+	}
+	else
+	{
+		for (int i = 0; i < instances; i++)
+		{
+			CPU_run(cpus[i], max_steps);
+		}
+	}
+	//an instance waiting for its disk runs on once the device raised its interrupt
+	for (int i = 0; blk_path && !workers && harts == 1 && i < instances; i++)
+	{
+		while (CPU_get_instret(cpus[i]) < max_steps && CPU_blk_wait(cpus[i]))
+		{
+			CPU_run(cpus[i], max_steps - CPU_get_instret(cpus[i]));
+		}
+	}
+	if (perf)
+	{
+		PERF_stop(&counters);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
 
-	uint32_t instruction = *(uint32_t *)(cpu->instr_mem_ + (cpu->pc_ & 0xFFFFF));
-	// TODO
+	if (trace_writer)
+	{
+		TRACE_flush(trace_ring);
+		CPU_set_trace(cpu_inst, NULL);
+		uint64_t records = TRACE_writer_close(trace_writer);
+		fprintf(stderr, "trace: %llu records written to %s\n", (unsigned long long)records, trace_path);
+	}
 
-	uint8_t opCode = getOpCode(instruction); //check if I need to do &(address) of instruction
-	int8_t func3 = getFunc3(instruction);
-	int8_t func7 = getFunc7(instruction);
+	uint64_t instret = 0;
+	int halted = 1;
+	for (int n = 0; n < instances; n++)
+	{
+		if (instances > 1)
+		{
+			printf("\n-----------------------instance %d: %s------------------------\n", n, data_paths[n]);
+			fwrite(outputs[n].data_, 1, outputs[n].size_, stdout);
+		}
+		printf("\n-----------------------RISC-V program terminate------------------------\nRegfile values:\n");
 
-	switch (opCode)
+		//output Regfile
+		for (uint32_t i = 0; i <= 31; i++)
+		{
+			printf("%d: %X\n", i, CPU_get_register(cpus[n], i));
+		}
+		instret += CPU_get_instret(cpus[n]);
+		halted &= CPU_is_halted(cpus[n]);
+		uint32_t fault;
+		if (CPU_get_fault(cpus[n], &fault))
+		{
+			fprintf(stderr, "fault: access at 0x%08X outside the data memory, pc 0x%08X\n", fault, CPU_get_pc(cpus[n]));
+		}
+	}
+	for (int i = 1; i < harts; i++)
 	{
+		instret += CPU_get_instret(hart_cpus[i]);
+		halted &= CPU_is_halted(hart_cpus[i]);
+	}
 
-	case R:
-		switch (func3)
+	if (stats)
+	{
+		//one line, parsed by the benchmark harness; instructions of all instances
+		double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "stats: instructions=%llu seconds=%.9f mips=%.3f halted=%d\n",
+				(unsigned long long)instret, seconds, seconds > 0 ? instret / seconds / 1e6 : 0.0, halted);
+		if (harts > 1)
 		{
-		case (0x00):
-			switch (func7)
+			fprintf(stderr, "harts: %d, instructions", harts);
+			for (int i = 0; i < harts; i++)
 			{
-			case (0x00):
-				ADD(cpu, instruction);
-				break;
-			case (0x20):
-				SUB(cpu, instruction);
-				break;
+				fprintf(stderr, " %llu", (unsigned long long)CPU_get_instret(hart_cpus[i]));
 			}
-			break;
-
-		case (0x01):
-			SLL(cpu, instruction);
-			break;
-
-		case (0x02):
-			SLT(cpu, instruction);
-			break;
-		case (0x03):
-			SLTU(cpu, instruction);
-			break;
-		case (0x04):
-			XOR(cpu, instruction);
-			break;
-
-		case (0x05):
-			switch (func7)
+			fprintf(stderr, "\n");
+		}
+		if (workers)
+		{
+			fprintf(stderr, "sched: %llu guests on %d workers, quantum %llu, %llu quanta, %llu steals, %d parked\n",
+					(unsigned long long)sched_stats.guests_, workers, (unsigned long long)quantum,
+					(unsigned long long)sched_stats.quanta_, (unsigned long long)sched_stats.steals_, parked);
+		}
+		if (lockstep)
+		{
+			fprintf(stderr, "lockstep: %d instances, %llu steps, %.2f lanes per step, %llu fell back (%llu instructions)\n",
+					instances, (unsigned long long)lockstep_stats.steps_,
+					lockstep_stats.steps_ ? (double)lockstep_stats.lane_steps_ / lockstep_stats.steps_ : 0.0,
+					(unsigned long long)lockstep_stats.fallback_lanes_, (unsigned long long)lockstep_stats.scalar_steps_);
+		}
+		if (engine == ENGINE_TIERED)
+		{
+			uint64_t tiers[3] = {0, 0, 0};
+			CPU_ir_stats ir = {0};
+			for (int i = 0; i < instances + harts - 1; i++)
 			{
-			case (0x00):
-				SRL(cpu, instruction);
-				break;
-			case (0x20):
-				SRA(cpu, instruction);
-				break;
+				CPU *cpu = i < instances ? cpus[i] : hart_cpus[i - instances + 1];
+				for (int tier = CPU_TIER_INTERP; tier <= CPU_TIER_TRANSLATED; tier++)
+				{
+					tiers[tier] += CPU_get_tier_instructions(cpu, tier);
+				}
+				CPU_ir_stats cpu_ir;
+				CPU_get_ir_stats(cpu, &cpu_ir);
+				ir.blocks_ += cpu_ir.blocks_;
+				ir.ops_ += cpu_ir.ops_;
+				ir.folded_ += cpu_ir.folded_;
+				ir.forwarded_ += cpu_ir.forwarded_;
+				ir.redundant_ += cpu_ir.redundant_;
+				ir.dead_ += cpu_ir.dead_;
+				ir.guarded_ += cpu_ir.guarded_;
+				ir.executed_ += cpu_ir.executed_;
+			}
+			fprintf(stderr, "tiers: interp %llu, predecode %llu, translated %llu\n", (unsigned long long)tiers[0],
+					(unsigned long long)tiers[1], (unsigned long long)tiers[2]);
+			fprintf(stderr, "ir: %llu blocks, %llu ops, %llu folded, %llu loads forwarded, %llu redundant and %llu dead writes dropped, %llu accesses checked at entry, %llu ops not executed\n",
+					(unsigned long long)ir.blocks_, (unsigned long long)ir.ops_, (unsigned long long)ir.folded_,
+					(unsigned long long)ir.forwarded_, (unsigned long long)ir.redundant_, (unsigned long long)ir.dead_,
+					(unsigned long long)ir.guarded_, (unsigned long long)ir.executed_);
+			CPU_jump_stats jumps;
+			CPU_get_jump_stats(cpu_inst, &jumps);
+			fprintf(stderr, "jumps: %llu returns, %.1f%% return-address stack hits, %llu indirect, %.1f%% inline cache hits\n",
+					(unsigned long long)jumps.returns_, jumps.returns_ ? 100.0 * jumps.ras_hits_ / jumps.returns_ : 0.0,
+					(unsigned long long)jumps.indirect_, jumps.indirect_ ? 100.0 * jumps.ic_hits_ / jumps.indirect_ : 0.0);
+			if (CPU_get_translation_cache(cpu_inst))
+			{
+				TCACHE_stats cache;
+				TCACHE_get_stats(CPU_get_translation_cache(cpu_inst), &cache);
+				fprintf(stderr, "tcache: %llu of %llu bytes (peak %llu), %llu blocks, %llu translations, %llu retranslations, %llu evictions, %llu flushes, %llu unlinks%s\n",
+						(unsigned long long)cache.bytes_, (unsigned long long)cache.budget_, (unsigned long long)cache.peak_bytes_,
+						(unsigned long long)cache.blocks_, (unsigned long long)cache.translations_,
+						(unsigned long long)cache.retranslations_, (unsigned long long)cache.evictions_,
+						(unsigned long long)cache.flushes_, (unsigned long long)cache.unlinks_, tcache ? ", shared" : "");
 			}
-			break;
-
-		case (0x06):
-			OR(cpu, instruction);
-			break;
-		case (0x07):
-			AND(cpu, instruction);
-			break;
-
-		default:;
 		}
-		break;
-
-	case I:
-		switch (func3)
-		{
-		case (0x00):
-			ADDI(cpu, instruction);
-			break;
-		case (0x02):
-			SLTI(cpu, instruction);
-			break;
-		case (0x01):
-			SLLI(cpu, instruction);
-			break;
-		case (0x03):
-			SLTIU(cpu, instruction);
-			break;
-		case (0x04):
-			XORI(cpu, instruction);
-			break;
-		case (0x06):
-			ORI(cpu, instruction);
-			break;
-		case (0x07):
-			ANDI(cpu, instruction);
-			break;
-		case (0x05):
-			switch (func7)
+		if (hle)
+		{
+			CPU_hook_stats hooks = {0};
+			for (int i = 0; i < instances + harts - 1; i++)
 			{
-			case (0x00):
-				SRLI(cpu, instruction);
-				break;
-			case (0x20):
-				SRAI(cpu, instruction);
-				break;
+				CPU_hook_stats cpu_hooks;
+				CPU_get_hook_stats(i < instances ? cpus[i] : hart_cpus[i - instances + 1], &cpu_hooks);
+				hooks.calls_ += cpu_hooks.calls_;
+				hooks.declined_ += cpu_hooks.declined_;
+				hooks.bytes_ += cpu_hooks.bytes_;
 			}
-			break;
+			fprintf(stderr, "hle: %llu calls run natively, %llu left to the guest code, %llu bytes\n",
+					(unsigned long long)hooks.calls_, (unsigned long long)hooks.declined_, (unsigned long long)hooks.bytes_);
 		}
-		break;
-
-	case S:
-		switch (func3)
-		{
-		case (0x00):
-			SB(cpu, instruction);
-			break;
-		case (0x01):
-			SH(cpu, instruction);
-			break;
-		case (0x02):
-			SW(cpu, instruction);
-			break;
+		if (accel)
+		{
+			CPU_accel_stats accels = {0};
+			for (int i = 0; i < instances + harts - 1; i++)
+			{
+				CPU_accel_stats cpu_accels;
+				CPU_get_accel_stats(i < instances ? cpus[i] : hart_cpus[i - instances + 1], &cpu_accels);
+				for (int slot = 0; slot < CPU_ACCEL_SLOTS; slot++)
+				{
+					accels.calls_[slot] += cpu_accels.calls_[slot];
+				}
+				accels.illegal_ += cpu_accels.illegal_;
+			}
+			fprintf(stderr, "accel:");
+			for (int slot = 0; slot < CPU_ACCEL_SLOTS; slot++)
+			{
+				if (accels.calls_[slot])
+				{
+					fprintf(stderr, " slot %d %llu instructions,", slot, (unsigned long long)accels.calls_[slot]);
+				}
+			}
+			fprintf(stderr, " %llu illegal\n", (unsigned long long)accels.illegal_);
 		}
-		break;
-
-	case L:
-		switch (func3)
-		{
-		case (0x00):
-			LB(cpu, instruction);
-			break;
-		case (0x01):
-			LH(cpu, instruction);
-			break;
-		case (0x02):
-			LW(cpu, instruction);
-			break;
-		case (0x04):
-			LBU(cpu, instruction);
-			break;
-		case (0x05):
-			LHU(cpu, instruction);
-			break;
+		if (syscalls)
+		{
+			CPU_syscall_stats calls = {0};
+			for (int i = 0; i < instances + harts - 1; i++)
+			{
+				CPU_syscall_stats cpu_calls;
+				CPU_get_syscall_stats(i < instances ? cpus[i] : hart_cpus[i - instances + 1], &cpu_calls);
+				calls.calls_ += cpu_calls.calls_;
+				calls.read_ += cpu_calls.read_;
+				calls.written_ += cpu_calls.written_;
+			}
+			fprintf(stderr, "syscalls: %llu calls, %llu bytes read, %llu bytes written\n", (unsigned long long)calls.calls_,
+					(unsigned long long)calls.read_, (unsigned long long)calls.written_);
 		}
-		break;
-
-	case B:
-		switch (func3)
-		{
-		case (0x00):
-			BEQ(cpu, instruction);
-			break;
-		case (0x01):
-			BNE(cpu, instruction);
-			break;
-		case (0x04):
-			BLT(cpu, instruction);
-			break;
-		case (0x05):
-			BGE(cpu, instruction);
-			break;
-		case (0x06):
-			BLTU(cpu, instruction);
-			break;
-		case (0x07):
-			BGEU(cpu, instruction);
-			break;
+		if (privileged)
+		{
+			CPU_tlb_stats tlb = {0};
+			for (int i = 0; i < instances + harts - 1; i++)
+			{
+				CPU_tlb_stats cpu_tlb;
+				CPU_get_tlb_stats(i < instances ? cpus[i] : hart_cpus[i - instances + 1], &cpu_tlb);
+				tlb.itlb_hits_ += cpu_tlb.itlb_hits_;
+				tlb.itlb_misses_ += cpu_tlb.itlb_misses_;
+				tlb.dtlb_hits_ += cpu_tlb.dtlb_hits_;
+				tlb.dtlb_misses_ += cpu_tlb.dtlb_misses_;
+				tlb.pte_reads_ += cpu_tlb.pte_reads_;
+				tlb.flushes_ += cpu_tlb.flushes_;
+				tlb.page_faults_ += cpu_tlb.page_faults_;
+				tlb.traps_ += cpu_tlb.traps_;
+				tlb.interrupts_ += cpu_tlb.interrupts_;
+			}
+			uint64_t itlb = tlb.itlb_hits_ + tlb.itlb_misses_;
+			uint64_t dtlb = tlb.dtlb_hits_ + tlb.dtlb_misses_;
+			fprintf(stderr, "tlb: itlb %llu misses (%.2f%%), dtlb %llu misses (%.2f%%), %llu pte reads, %llu sfence.vma, "
+							"%llu page faults, %llu traps, %llu interrupts\n",
+					(unsigned long long)tlb.itlb_misses_, itlb ? 100.0 * tlb.itlb_misses_ / itlb : 0.0,
+					(unsigned long long)tlb.dtlb_misses_, dtlb ? 100.0 * tlb.dtlb_misses_ / dtlb : 0.0,
+					(unsigned long long)tlb.pte_reads_, (unsigned long long)tlb.flushes_,
+					(unsigned long long)tlb.page_faults_, (unsigned long long)tlb.traps_, (unsigned long long)tlb.interrupts_);
 		}
-		break;
-
-	case LUI:
-		LUI1(cpu, instruction);
-		break;
-
-	case AUIPC:
-		AUIPC1(cpu, instruction);
-		break;
-
-	case JAL:
-		JAL1(cpu, instruction);
-		break;
-
-	case JALR:
-		JALR1(cpu, instruction);
-		break;
+		CPU_dma_stats dma = {0};
+		for (int i = 0; i < instances + harts - 1; i++)
+		{
+			CPU_dma_stats cpu_dma;
+			CPU_get_dma_stats(i < instances ? cpus[i] : hart_cpus[i - instances + 1], &cpu_dma);
+			dma.operations_ += cpu_dma.operations_;
+			dma.bytes_ += cpu_dma.bytes_;
+		}
+		if (dma.operations_)
+		{
+			fprintf(stderr, "dma: %llu operations, %llu bytes\n", (unsigned long long)dma.operations_,
+					(unsigned long long)dma.bytes_);
+		}
+		if (blk_path)
+		{
+			CPU_blk_stats blk = {0};
+			for (int i = 0; i < instances; i++)
+			{
+				CPU_blk_stats cpu_blk;
+				CPU_get_blk_stats(cpus[i], &cpu_blk);
+				blk.requests_ += cpu_blk.requests_;
+				blk.errors_ += cpu_blk.errors_;
+				blk.read_ += cpu_blk.read_;
+				blk.written_ += cpu_blk.written_;
+				blk.busy_ns_ += cpu_blk.busy_ns_;
+			}
+			fprintf(stderr, "blk: %llu requests (%llu failed), %llu bytes read, %llu bytes written, %.1f MB/s while busy\n",
+					(unsigned long long)blk.requests_, (unsigned long long)blk.errors_, (unsigned long long)blk.read_,
+					(unsigned long long)blk.written_, blk.busy_ns_ ? (blk.read_ + blk.written_) * 1e3 / blk.busy_ns_ : 0.0);
+		}
+		if (decode_cache)
+		{
+			fprintf(stderr, "decode cache: %zu blocks loaded from %s\n", CPU_get_decode_cache_blocks(cpu_inst), decode_cache);
+		}
+		static const char *backing[] = {"small pages", "transparent huge pages", "hugetlb"};
+		fprintf(stderr, "memory: %zu bytes, %s\n", CPU_get_data_mem_size(cpu_inst), backing[CPU_get_data_mem_backing(cpu_inst)]);
 	}
-
-	cpu->regfile_[0] = 0;
-}
-
-int main(int argc, char *argv[])
-{
-	printf("C Praktikum\nHU Risc-V  Emulator 2022\n");
-
-	CPU *cpu_inst;
-
-	cpu_inst = CPU_init(argv[1], argv[2]);
-	for (uint32_t i = 0; i < 1000000; i++)
-	{ // run 70000 cycles
-		CPU_execute(cpu_inst);
+	if (perf)
+	{
+		PERF_report(&counters, instret, stdout);
+		PERF_close(&counters);
+	}
+	if (bpred)
+	{
+		BP_report(bpred, stdout);
+		BP_destroy(bpred);
+	}
+	if (profile_path)
+	{
+		FILE *out = strcmp(profile_path, "-") == 0 ? stdout : fopen(profile_path, "w");
+		if (!out)
+		{
+			perror(profile_path);
+			return EXIT_FAILURE;
+		}
+		PROF_report(cpu_inst, out);
+		if (out != stdout)
+		{
+			fclose(out);
+		}
 	}
 
-	printf("\n-----------------------RISC-V program terminate------------------------\nRegfile values:\n");
-
-	//output Regfile
-	for (uint32_t i = 0; i <= 31; i++)
+	if (sampler)
 	{
-		printf("%d: %X\n", i, cpu_inst->regfile_[i]);
+		FILE *out = strcmp(sample_path, "-") == 0 ? stdout : fopen(sample_path, "w");
+		if (!out)
+		{
+			perror(sample_path);
+			return EXIT_FAILURE;
+		}
+		if (out == stdout)
+		{
+			printf("\n-----------------------sampled call stacks------------------------\n");
+		}
+		SAMPLE_report(sampler, out);
+		if (out != stdout)
+		{
+			fclose(out);
+		}
+		fprintf(stderr, "sample: %llu samples every %llu instructions\n", (unsigned long long)SAMPLE_get_samples(sampler),
+				(unsigned long long)SAMPLE_get_period(sampler));
+		SAMPLE_destroy(sampler);
 	}
 
+	//the exit code of the program is the one of the emulator
+	int exit_code = 0;
+	CPU_get_exit_code(cpu_inst, &exit_code);
+
 	//printf(%)
 	fflush(stdout);
+	for (int i = 1; i < harts; i++)
+	{
+		CPU_destroy(hart_cpus[i]);
+	}
+	free(hart_cpus);
+	for (int n = 0; n < instances; n++)
+	{
+		CPU_destroy(cpus[n]);
+		free(outputs ? outputs[n].data_ : NULL);
+	}
+	free(outputs);
+	free(data_paths);
+	free(cpus);
+	TCACHE_destroy(tcache);
 
 
-	return 0;
+	return exit_code;
 }
+
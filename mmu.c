@@ -0,0 +1,646 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Privileged mode and Sv32 paging
+ *
+ * The TLBs are direct mapped on the low bits of the virtual page number. A tag
+ * is the page number with the context of the access above it: the ASID and
+ * whether the access is made in user mode, or MMU_BARE for machine mode and
+ * satp in Bare mode, whose entries map a page to itself. A load then costs a
+ * compare of the tag over the raw indexing of data_mem_, see CPU_load_address;
+ * write_tag_ only matches once the page is writable and dirty, so a store to a
+ * clean page misses once and the walk sets D. Permissions that depend on
+ * mstatus (SUM, MXR) are not in the tag, changing them flushes the data TLB.
+ * Traps only change the context, the entries of the other mode stay.
+ *
+ * Privileged mode runs on the interpreter: the other engines index the data
+ * memory in their translated code and key their blocks by pc, which neither
+ * fits a virtual pc nor a trap in the middle of a block.
+ */
+
+#define CSR_SSTATUS 0x100
+#define CSR_SIE 0x104
+#define CSR_STVEC 0x105
+#define CSR_SSCRATCH 0x140
+#define CSR_SEPC 0x141
+#define CSR_SCAUSE 0x142
+#define CSR_STVAL 0x143
+#define CSR_SIP 0x144
+#define CSR_SATP 0x180
+#define CSR_MSTATUS 0x300
+#define CSR_MISA 0x301
+#define CSR_MEDELEG 0x302
+#define CSR_MIDELEG 0x303
+#define CSR_MIE 0x304
+#define CSR_MTVEC 0x305
+#define CSR_MEPC 0x341
+#define CSR_MCAUSE 0x342
+#define CSR_MTVAL 0x343
+#define CSR_MIP 0x344
+
+#define MSTATUS_SIE (1u << 1)
+#define MSTATUS_MIE (1u << 3)
+#define MSTATUS_SPIE (1u << 5)
+#define MSTATUS_MPIE (1u << 7)
+#define MSTATUS_SPP (1u << 8)
+#define MSTATUS_MPP (3u << 11)
+#define MSTATUS_MPRV (1u << 17)
+#define MSTATUS_SUM (1u << 18)
+#define MSTATUS_MXR (1u << 19)
+#define MSTATUS_WRITABLE (MSTATUS_SIE | MSTATUS_MIE | MSTATUS_SPIE | MSTATUS_MPIE | MSTATUS_SPP | MSTATUS_MPP | \
+						  MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR)
+#define SSTATUS_WRITABLE (MSTATUS_SIE | MSTATUS_SPIE | MSTATUS_SPP | MSTATUS_SUM | MSTATUS_MXR)
+
+//RV32 with A, D, F, I, S, U and V
+#define MISA (1u << 30 | 1u << 0 | 1u << 3 | 1u << 5 | 1u << 8 | 1u << 18 | 1u << 20 | 1u << 21)
+#define MEDELEG_WRITABLE 0xB3FFu //all exceptions but ECALL from machine mode
+#define MIE_WRITABLE 0xAAAu		 //software, timer and external interrupts of S and M
+#define SIE_WRITABLE 0x222u
+#define MIP_SEIP (1u << 9) //the block device, see MMU_interrupt
+
+#define PTE_V (1u << 0)
+#define PTE_R (1u << 1)
+#define PTE_W (1u << 2)
+#define PTE_X (1u << 3)
+#define PTE_U (1u << 4)
+#define PTE_G (1u << 5)
+#define PTE_A (1u << 6)
+#define PTE_D (1u << 7)
+
+static const uint32_t MMU_page_fault[] = {MMU_FETCH_PAGE_FAULT, MMU_LOAD_PAGE_FAULT, MMU_STORE_PAGE_FAULT};
+static const uint32_t MMU_access_fault[] = {MMU_FETCH_ACCESS, MMU_LOAD_ACCESS, MMU_STORE_ACCESS};
+
+static void MMU_flush(MMU_tlb_entry *tlb)
+{
+	for (int i = 0; i < CPU_TLB_ENTRIES; i++)
+	{
+		tlb[i].tag_ = MMU_TLB_INVALID;
+		tlb[i].write_tag_ = MMU_TLB_INVALID;
+		tlb[i].global_ = 0;
+	}
+}
+
+static uint32_t MMU_context(const MMU_state *mmu, int priv)
+{
+	if (priv == CPU_PRIV_MACHINE || !(mmu->satp_ >> 31))
+	{
+		return MMU_BARE;
+	}
+	return ((mmu->satp_ >> 22 & 0x1FF) | (uint32_t)(priv == CPU_PRIV_USER) << 9) << 20;
+}
+
+//after a change of the mode, mstatus or satp; loads and stores of machine mode use MPP with MPRV
+static void MMU_update(MMU_state *mmu)
+{
+	int data_priv = mmu->priv_ == CPU_PRIV_MACHINE && (mmu->mstatus_ & MSTATUS_MPRV) ? (int)(mmu->mstatus_ >> 11 & 3) : mmu->priv_;
+	mmu->fetch_context_ = MMU_context(mmu, mmu->priv_);
+	mmu->data_context_ = MMU_context(mmu, data_priv);
+}
+
+static void MMU_set_status(MMU_state *mmu, uint32_t value)
+{
+	//MPP is WARL, the reserved mode 2 becomes user mode
+	if ((value & MSTATUS_MPP) == 2u << 11)
+	{
+		value &= ~MSTATUS_MPP;
+	}
+	if ((value ^ mmu->mstatus_) & (MSTATUS_SUM | MSTATUS_MXR))
+	{
+		MMU_flush(mmu->dtlb_);
+	}
+	mmu->mstatus_ = value;
+	MMU_update(mmu);
+}
+
+void MMU_reset(CPU *cpu)
+{
+	MMU_state *mmu = cpu->mmu_;
+	memset(mmu, 0, sizeof(MMU_state));
+	MMU_flush(mmu->dtlb_);
+	MMU_flush(mmu->itlb_);
+	mmu->priv_ = CPU_PRIV_MACHINE;
+	MMU_update(mmu);
+}
+
+void MMU_trap(CPU *cpu, uint32_t cause, uint32_t tval)
+{
+	MMU_state *mmu = cpu->mmu_;
+	uint32_t status = mmu->mstatus_;
+	uint32_t delegation = cause & MMU_INTERRUPT ? mmu->mideleg_ : mmu->medeleg_;
+	int delegated = mmu->priv_ != CPU_PRIV_MACHINE && (delegation >> (cause & 31) & 1);
+	if (!delegated && !mmu->mtvec_)
+	{
+		//no handler: the pc stays and the CPU halts like without privileged mode
+		return;
+	}
+	uint32_t vector = cause & MMU_INTERRUPT ? 4 * (cause & 31) : 0; //of vectored mode
+	if (cause & MMU_INTERRUPT)
+	{
+		mmu->stats_.interrupts_++;
+	}
+	else
+	{
+		mmu->stats_.traps_++;
+	}
+	if (cause == MMU_FETCH_PAGE_FAULT || cause == MMU_LOAD_PAGE_FAULT || cause == MMU_STORE_PAGE_FAULT)
+	{
+		mmu->stats_.page_faults_++;
+	}
+	if (delegated)
+	{
+		mmu->sepc_ = cpu->pc_;
+		mmu->scause_ = cause;
+		mmu->stval_ = tval;
+		status &= ~(MSTATUS_SPIE | MSTATUS_SIE | MSTATUS_SPP);
+		status |= (mmu->mstatus_ & MSTATUS_SIE ? MSTATUS_SPIE : 0) | (mmu->priv_ == CPU_PRIV_SUPERVISOR ? MSTATUS_SPP : 0);
+		mmu->priv_ = CPU_PRIV_SUPERVISOR;
+		cpu->pc_ = (mmu->stvec_ & ~3u) + (mmu->stvec_ & 1 ? vector : 0);
+	}
+	else
+	{
+		mmu->mepc_ = cpu->pc_;
+		mmu->mcause_ = cause;
+		mmu->mtval_ = tval;
+		status &= ~(MSTATUS_MPIE | MSTATUS_MIE | MSTATUS_MPP);
+		status |= (mmu->mstatus_ & MSTATUS_MIE ? MSTATUS_MPIE : 0) | (uint32_t)mmu->priv_ << 11;
+		mmu->priv_ = CPU_PRIV_MACHINE;
+		cpu->pc_ = (mmu->mtvec_ & ~3u) + (mmu->mtvec_ & 1 ? vector : 0);
+	}
+	mmu->mstatus_ = status;
+	MMU_update(mmu);
+}
+
+/**
+ * Sv32 walk of addr for an access in priv (user or supervisor mode). Sets A and
+ * D in the leaf like the hardware updating them would, returns 0 with the
+ * physical page and the flags of the leaf (G of the tables above included) or
+ * the cause of the exception.
+ */
+static uint32_t MMU_walk(CPU *cpu, uint32_t addr, int access, int priv, uint64_t *page, uint32_t *flags)
+{
+	MMU_state *mmu = cpu->mmu_;
+	uint64_t table = (uint64_t)(mmu->satp_ & 0x3FFFFF) << 12;
+	uint32_t global = 0;
+
+	for (int level = 1; level >= 0; level--)
+	{
+		uint64_t entry = table + (addr >> (12 + 10 * level) & 0x3FF) * 4;
+		if (entry + 4 > cpu->data_mem_size_)
+		{
+			return MMU_access_fault[access];
+		}
+		mmu->stats_.pte_reads_++;
+		uint32_t *slot = (uint32_t *)(cpu->data_mem_ + entry);
+		uint32_t pte = __atomic_load_n(slot, __ATOMIC_RELAXED);
+		global |= pte & PTE_G;
+		if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W)))
+		{
+			return MMU_page_fault[access];
+		}
+		if (!(pte & (PTE_R | PTE_X)))
+		{
+			//pointer to the next level
+			table = (uint64_t)(pte >> 10) << 12;
+			continue;
+		}
+
+		//supervisor mode reaches user pages with SUM and never executes them
+		if (priv == CPU_PRIV_USER ? !(pte & PTE_U) : (pte & PTE_U) && (access == MMU_FETCH || !(mmu->mstatus_ & MSTATUS_SUM)))
+		{
+			return MMU_page_fault[access];
+		}
+		int allowed = access == MMU_FETCH  ? pte & PTE_X
+					  : access == MMU_LOAD ? pte & PTE_R || ((mmu->mstatus_ & MSTATUS_MXR) && (pte & PTE_X))
+										   : pte & PTE_W;
+		//a megapage has to be aligned to 4 MiB
+		if (!allowed || (level == 1 && (pte >> 10 & 0x3FF)))
+		{
+			return MMU_page_fault[access];
+		}
+		uint32_t update = PTE_A | (access == MMU_STORE ? PTE_D : 0);
+		if ((pte & update) != update)
+		{
+			pte = __atomic_or_fetch(slot, update, __ATOMIC_RELAXED);
+		}
+		*page = (uint64_t)(pte >> 20) << 22 | (level ? addr & 0x3FF000 : (uint64_t)(pte >> 10 & 0x3FF) << 12);
+		*flags = pte | global;
+		return 0;
+	}
+	return MMU_page_fault[access];
+}
+
+//loads and stores that missed the TLB, crossed a page or trap
+uint8_t *MMU_translate(CPU *cpu, uint32_t addr, uint32_t size, int access)
+{
+	MMU_state *mmu = cpu->mmu_;
+	uint32_t context = mmu->data_context_;
+	uint64_t physical = addr;
+	uint32_t flags = PTE_R | PTE_W | PTE_D;
+
+	if ((addr & 0xFFF) + size > 0x1000)
+	{
+		//the physical memory is one range, virtual pages are not
+		if (context != MMU_BARE)
+		{
+			MMU_trap(cpu, access == MMU_STORE ? MMU_STORE_MISALIGNED : MMU_LOAD_MISALIGNED, addr);
+			return NULL;
+		}
+		if ((uint64_t)addr + size <= cpu->data_mem_size_)
+		{
+			return cpu->data_mem_ + addr;
+		}
+	}
+	mmu->stats_.dtlb_misses_++;
+	if (context != MMU_BARE)
+	{
+		uint64_t page;
+		uint32_t cause = MMU_walk(cpu, addr, access, context >> 29 & 1 ? CPU_PRIV_USER : CPU_PRIV_SUPERVISOR, &page, &flags);
+		if (cause)
+		{
+			MMU_trap(cpu, cause, addr);
+			return NULL;
+		}
+		physical = page | (addr & 0xFFF);
+	}
+	if (physical + size > cpu->data_mem_size_)
+	{
+		MMU_trap(cpu, MMU_access_fault[access], addr);
+		return NULL;
+	}
+
+	//only pages that are whole in the data memory go into the TLB
+	uint64_t page = physical & ~(uint64_t)0xFFF;
+	if (page + 0x1000 <= cpu->data_mem_size_)
+	{
+		MMU_tlb_entry *entry = &mmu->dtlb_[addr >> 12 & (CPU_TLB_ENTRIES - 1)];
+		uint32_t tag = addr >> 12 | context;
+		int readable = (flags & PTE_R) || ((mmu->mstatus_ & MSTATUS_MXR) && (flags & PTE_X));
+		entry->tag_ = readable ? tag : MMU_TLB_INVALID;
+		entry->write_tag_ = (flags & (PTE_W | PTE_D)) == (PTE_W | PTE_D) ? tag : MMU_TLB_INVALID;
+		entry->addend_ = (uintptr_t)(cpu->data_mem_ + page) - (addr & ~0xFFFu);
+		entry->global_ = flags & PTE_G;
+	}
+	return cpu->data_mem_ + physical;
+}
+
+static const uint8_t *MMU_fetch_translate(CPU *cpu, uint32_t pc)
+{
+	MMU_state *mmu = cpu->mmu_;
+	uint32_t context = mmu->fetch_context_;
+	uint64_t physical = pc;
+	uint32_t flags = 0;
+
+	if (pc & 0x3)
+	{
+		MMU_trap(cpu, MMU_FETCH_MISALIGNED, pc);
+		return NULL;
+	}
+	mmu->stats_.itlb_misses_++;
+	if (context != MMU_BARE)
+	{
+		uint64_t page;
+		uint32_t cause = MMU_walk(cpu, pc, MMU_FETCH, mmu->priv_, &page, &flags);
+		if (cause)
+		{
+			MMU_trap(cpu, cause, pc);
+			return NULL;
+		}
+		physical = page | (pc & 0xFFF);
+	}
+	//the instruction memory repeats every MiB like the pc space without privileged mode
+	physical &= 0xFFFFF;
+	if (physical + 4 > cpu->instr_mem_size_)
+	{
+		MMU_trap(cpu, MMU_FETCH_ACCESS, pc);
+		return NULL;
+	}
+
+	//the copy of the instruction memory ends at a page, past the image a hit reads zeros (illegal)
+	MMU_tlb_entry *entry = &mmu->itlb_[pc >> 12 & (CPU_TLB_ENTRIES - 1)];
+	entry->tag_ = pc >> 12 | context;
+	entry->addend_ = (uintptr_t)(cpu->instr_mem_ + (physical & ~(uint64_t)0xFFF)) - (pc & ~0xFFFu);
+	entry->global_ = flags & PTE_G;
+	return cpu->instr_mem_ + physical;
+}
+
+//host address of the instruction at pc, NULL if the fetch trapped
+static inline const uint8_t *MMU_fetch_address(CPU *cpu, uint32_t pc)
+{
+	MMU_state *mmu = cpu->mmu_;
+	const MMU_tlb_entry *entry = &mmu->itlb_[pc >> 12 & (CPU_TLB_ENTRIES - 1)];
+	if (entry->tag_ == (pc >> 12 | mmu->fetch_context_) && !(pc & 0x3))
+	{
+		mmu->stats_.itlb_hits_++;
+		return (const uint8_t *)(entry->addend_ + pc);
+	}
+	return MMU_fetch_translate(cpu, pc);
+}
+
+//a jump to itself or exit, what halts in privileged mode
+static int MMU_halts(const CPU *cpu, uint32_t instruction)
+{
+	uint8_t opcode = getOpCode(instruction);
+	int code;
+	return opcode == JAL || opcode == JALR || opcode == B || CPU_get_exit_code(cpu, &code);
+}
+
+//mip: SEIP follows bit 0 of the ISR of the block device, nothing else is pending
+static uint32_t MMU_pending(const CPU *cpu)
+{
+	return BLK_pending(cpu) ? MIP_SEIP : 0;
+}
+
+/**
+ * Takes the external interrupt before the next instruction if it is pending and
+ * enabled: in machine mode, or in supervisor mode when mideleg delegates it,
+ * while the mode it traps to is less privileged than the current one or runs
+ * with MIE or SIE set. The line stays raised until the guest clears the ISR.
+ */
+static void MMU_interrupt(CPU *cpu)
+{
+	MMU_state *mmu = cpu->mmu_;
+	if (!(MMU_pending(cpu) & mmu->mie_))
+	{
+		return;
+	}
+	int enabled;
+	if (mmu->mideleg_ & MIP_SEIP)
+	{
+		enabled = mmu->priv_ == CPU_PRIV_USER || (mmu->priv_ == CPU_PRIV_SUPERVISOR && (mmu->mstatus_ & MSTATUS_SIE));
+	}
+	else
+	{
+		enabled = mmu->priv_ != CPU_PRIV_MACHINE || (mmu->mstatus_ & MSTATUS_MIE);
+	}
+	if (enabled)
+	{
+		MMU_trap(cpu, MMU_SUPERVISOR_EXTERNAL, 0);
+	}
+}
+
+//CPU_run_interpreter with the fetch through the TLB and traps instead of halts
+uint64_t MMU_run(CPU *cpu, uint64_t max_steps)
+{
+	MMU_state *mmu = cpu->mmu_;
+	uint64_t steps = 0;
+
+	while (steps < max_steps)
+	{
+		//only a guest that enabled the interrupt looks at the device
+		if (__builtin_expect(mmu->mie_ & MIP_SEIP, 0))
+		{
+			MMU_interrupt(cpu);
+		}
+		uint32_t pc = cpu->pc_;
+		uint64_t traps = mmu->stats_.traps_;
+		const uint8_t *host = MMU_fetch_address(cpu, pc);
+		if (host)
+		{
+			uint32_t instruction = *(const uint32_t *)host;
+			CPU_execute_instruction(cpu, instruction);
+			if (cpu->waiting_)
+			{
+				steps += cpu->pc_ != pc;
+				break;
+			}
+			if (cpu->pc_ == pc && mmu->stats_.traps_ == traps && !MMU_halts(cpu, instruction))
+			{
+				MMU_trap(cpu, MMU_ILLEGAL, instruction);
+			}
+		}
+		//a trap counts as a step, one into the pc that raised it would repeat forever
+		steps++;
+		if (cpu->pc_ == pc)
+		{
+			cpu->halted_ = 1;
+			break;
+		}
+	}
+	return steps;
+}
+
+int MMU_csr_allowed(const CPU *cpu, uint32_t csr, int write)
+{
+	return (int)(csr >> 8 & 3) <= cpu->mmu_->priv_ && !(write && (csr >> 10 & 3) == 3);
+}
+
+uint32_t MMU_csr_read(CPU *cpu, uint32_t csr)
+{
+	MMU_state *mmu = cpu->mmu_;
+	switch (csr)
+	{
+	case CSR_MSTATUS:
+		return mmu->mstatus_;
+	case CSR_MISA:
+		return MISA;
+	case CSR_MEDELEG:
+		return mmu->medeleg_;
+	case CSR_MIDELEG:
+		return mmu->mideleg_;
+	case CSR_MIE:
+		return mmu->mie_;
+	case CSR_MTVEC:
+		return mmu->mtvec_;
+	case CSR_MEPC:
+		return mmu->mepc_;
+	case CSR_MCAUSE:
+		return mmu->mcause_;
+	case CSR_MTVAL:
+		return mmu->mtval_;
+	case CSR_SSTATUS:
+		return mmu->mstatus_ & SSTATUS_WRITABLE;
+	case CSR_SIE:
+		return mmu->mie_ & mmu->mideleg_;
+	case CSR_STVEC:
+		return mmu->stvec_;
+	case CSR_SSCRATCH:
+		return mmu->sscratch_;
+	case CSR_SEPC:
+		return mmu->sepc_;
+	case CSR_SCAUSE:
+		return mmu->scause_;
+	case CSR_STVAL:
+		return mmu->stval_;
+	case CSR_SATP:
+		return mmu->satp_;
+	case CSR_MIP:
+		return MMU_pending(cpu);
+	case CSR_SIP:
+		return MMU_pending(cpu) & mmu->mideleg_;
+	}
+	return 0;
+}
+
+void MMU_csr_write(CPU *cpu, uint32_t csr, uint32_t value)
+{
+	MMU_state *mmu = cpu->mmu_;
+	switch (csr)
+	{
+	case CSR_MSTATUS:
+		MMU_set_status(mmu, (mmu->mstatus_ & ~MSTATUS_WRITABLE) | (value & MSTATUS_WRITABLE));
+		break;
+	case CSR_MEDELEG:
+		mmu->medeleg_ = value & MEDELEG_WRITABLE;
+		break;
+	case CSR_MIDELEG:
+		mmu->mideleg_ = value & SIE_WRITABLE;
+		break;
+	case CSR_MIE:
+		mmu->mie_ = value & MIE_WRITABLE;
+		break;
+	case CSR_MTVEC:
+		mmu->mtvec_ = value & ~2u; //direct or vectored
+		break;
+	case CSR_MEPC:
+		mmu->mepc_ = value & ~3u;
+		break;
+	case CSR_MCAUSE:
+		mmu->mcause_ = value;
+		break;
+	case CSR_MTVAL:
+		mmu->mtval_ = value;
+		break;
+	case CSR_SSTATUS:
+		MMU_set_status(mmu, (mmu->mstatus_ & ~SSTATUS_WRITABLE) | (value & SSTATUS_WRITABLE));
+		break;
+	case CSR_SIE:
+		mmu->mie_ = (mmu->mie_ & ~mmu->mideleg_) | (value & mmu->mideleg_);
+		break;
+	case CSR_STVEC:
+		mmu->stvec_ = value & ~2u;
+		break;
+	case CSR_SSCRATCH:
+		mmu->sscratch_ = value;
+		break;
+	case CSR_SEPC:
+		mmu->sepc_ = value & ~3u;
+		break;
+	case CSR_SCAUSE:
+		mmu->scause_ = value;
+		break;
+	case CSR_STVAL:
+		mmu->stval_ = value;
+		break;
+	case CSR_SATP:
+		//the TLBs keep the entries of the old ASID, SFENCE.VMA drops them
+		mmu->satp_ = value;
+		MMU_update(mmu);
+		break;
+	}
+}
+
+//rs1: the page at x[rs1] or all, rs2: the ASID in x[rs2] without the global pages or all
+static void MMU_sfence(MMU_tlb_entry *tlb, int rs1, uint32_t vpn, int rs2, uint32_t asid)
+{
+	//a page can only be in its slot
+	int first = rs1 ? (int)(vpn & (CPU_TLB_ENTRIES - 1)) : 0;
+	int end = rs1 ? first + 1 : CPU_TLB_ENTRIES;
+	for (int i = first; i < end; i++)
+	{
+		MMU_tlb_entry *entry = &tlb[i];
+		if ((rs1 == 0 || (entry->tag_ & 0xFFFFF) == vpn) &&
+			(rs2 == 0 || (!entry->global_ && (entry->tag_ >> 20 & 0x1FF) == asid)))
+		{
+			entry->tag_ = MMU_TLB_INVALID;
+			entry->write_tag_ = MMU_TLB_INVALID;
+		}
+	}
+}
+
+void MMU_system(CPU *cpu, uint32_t instruction)
+{
+	MMU_state *mmu = cpu->mmu_;
+	uint32_t status = mmu->mstatus_;
+
+	if (instruction == 0x30200073 && mmu->priv_ == CPU_PRIV_MACHINE) //MRET
+	{
+		int previous = status >> 11 & 3;
+		status = (status & ~(MSTATUS_MIE | MSTATUS_MPP)) | (status & MSTATUS_MPIE ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+		if (previous != CPU_PRIV_MACHINE)
+		{
+			status &= ~MSTATUS_MPRV;
+		}
+		mmu->mstatus_ = status;
+		mmu->priv_ = previous;
+		cpu->pc_ = mmu->mepc_;
+		MMU_update(mmu);
+	}
+	else if (instruction == 0x10200073 && mmu->priv_ != CPU_PRIV_USER) //SRET
+	{
+		int previous = status & MSTATUS_SPP ? CPU_PRIV_SUPERVISOR : CPU_PRIV_USER;
+		status = (status & ~(MSTATUS_SIE | MSTATUS_SPP | MSTATUS_MPRV)) | (status & MSTATUS_SPIE ? MSTATUS_SIE : 0) | MSTATUS_SPIE;
+		mmu->mstatus_ = status;
+		mmu->priv_ = previous;
+		cpu->pc_ = mmu->sepc_;
+		MMU_update(mmu);
+	}
+	else if ((instruction & 0xFE007FFF) == 0x12000073 && mmu->priv_ != CPU_PRIV_USER) //SFENCE.VMA
+	{
+		int rs1 = getRS1(instruction);
+		int rs2 = getRS2(instruction);
+		uint32_t vpn = cpu->regfile_[rs1] >> 12;
+		uint32_t asid = cpu->regfile_[rs2] & 0x1FF;
+		MMU_sfence(mmu->dtlb_, rs1, vpn, rs2, asid);
+		MMU_sfence(mmu->itlb_, rs1, vpn, rs2, asid);
+		mmu->stats_.flushes_++;
+		cpu->pc_ += 0x4;
+	}
+	else if (instruction == 0x00100073) //EBREAK
+	{
+		MMU_trap(cpu, MMU_BREAKPOINT, cpu->pc_);
+	}
+}
+
+int MMU_ecall(CPU *cpu)
+{
+	MMU_state *mmu = cpu->mmu_;
+	if (mmu->priv_ == CPU_PRIV_MACHINE && cpu->syscalls_)
+	{
+		return 0;
+	}
+	MMU_trap(cpu, MMU_ECALL_U + mmu->priv_, 0);
+	return 1;
+}
+
+int CPU_set_privileged(CPU *cpu, int enable)
+{
+	if (!enable)
+	{
+		free(cpu->mmu_);
+		cpu->mmu_ = NULL;
+		cpu->data_limit_ = cpu->data_mem_size_;
+		return CPU_OK;
+	}
+	if (!cpu->mmu_)
+	{
+		cpu->mmu_ = malloc(sizeof(MMU_state));
+		if (!cpu->mmu_)
+		{
+			return CPU_ERROR_MEMORY;
+		}
+		MMU_reset(cpu);
+		cpu->data_limit_ = 0;
+	}
+	return CPU_OK;
+}
+
+int CPU_get_privilege(const CPU *cpu)
+{
+	return cpu->mmu_ ? cpu->mmu_->priv_ : CPU_PRIV_MACHINE;
+}
+
+void CPU_get_tlb_stats(const CPU *cpu, CPU_tlb_stats *stats)
+{
+	if (cpu->mmu_)
+	{
+		*stats = cpu->mmu_->stats_;
+	}
+	else
+	{
+		memset(stats, 0, sizeof(CPU_tlb_stats));
+	}
+}
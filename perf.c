@@ -0,0 +1,167 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include "hurv.h"
+
+/**
+ * Host performance counters around CPU_run (Linux perf_event_open, user space
+ * only). Counters the host or the VM does not provide are reported as n/a.
+ */
+
+static const char *PERF_names[PERF_COUNTERS] = {
+	"cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses", "dtlb_misses", "task_clock_ns", "page_faults"};
+
+#ifdef __linux__
+static int PERF_open_event(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	//more events than hardware counters are multiplexed, the times allow scaling
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define PERF_CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+//returns the number of counters that could be opened
+int PERF_open(PERF_counters *counters)
+{
+	int opened = 0;
+	memset(counters, 0, sizeof(PERF_counters));
+#ifdef __linux__
+	static const struct
+	{
+		uint32_t type_;
+		uint64_t config_;
+	} events[PERF_COUNTERS] = {
+		[PERF_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+		[PERF_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		[PERF_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		[PERF_L1D_MISSES] = {PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+		[PERF_LLC_MISSES] = {PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL)},
+		[PERF_DTLB_MISSES] = {PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+		[PERF_TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+		[PERF_PAGE_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+	};
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		counters->fd_[i] = PERF_open_event(events[i].type_, events[i].config_);
+		if (counters->fd_[i] >= 0)
+		{
+			opened++;
+		}
+	}
+#else
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		counters->fd_[i] = -1;
+	}
+#endif
+	return opened;
+}
+
+void PERF_start(PERF_counters *counters)
+{
+#ifdef __linux__
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		if (counters->fd_[i] >= 0)
+		{
+			ioctl(counters->fd_[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters->fd_[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+void PERF_stop(PERF_counters *counters)
+{
+#ifdef __linux__
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		if (counters->fd_[i] >= 0)
+		{
+			ioctl(counters->fd_[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		uint64_t data[3]; //value, time enabled, time running
+		counters->valid_[i] = 0;
+		if (counters->fd_[i] >= 0 && read(counters->fd_[i], data, sizeof(data)) == sizeof(data) && data[2] > 0)
+		{
+			counters->value_[i] = data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+			counters->valid_[i] = 1;
+		}
+	}
+#endif
+}
+
+void PERF_close(PERF_counters *counters)
+{
+#ifdef __linux__
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		if (counters->fd_[i] >= 0)
+		{
+			close(counters->fd_[i]);
+		}
+	}
+#endif
+}
+
+//host events per guest instruction; the perf: line on stderr is read by the benchmark harness
+void PERF_report(const PERF_counters *counters, uint64_t guest_instructions, FILE *out)
+{
+	double guest = guest_instructions ? (double)guest_instructions : 1.0;
+
+	fprintf(out, "\n-----------------------host performance counters------------------------\n");
+	fprintf(out, "guest instructions: %llu\n", (unsigned long long)guest_instructions);
+	fprintf(out, "%-16s %16s %16s\n", "counter", "host", "per guest instr");
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		if (counters->valid_[i])
+		{
+			fprintf(out, "%-16s %16llu %16.4f\n", PERF_names[i], (unsigned long long)counters->value_[i], counters->value_[i] / guest);
+		}
+		else
+		{
+			fprintf(out, "%-16s %16s %16s\n", PERF_names[i], "n/a", "n/a");
+		}
+	}
+	if (counters->valid_[PERF_CYCLES] && counters->valid_[PERF_INSTRUCTIONS] && counters->value_[PERF_CYCLES])
+	{
+		fprintf(out, "host IPC: %.3f\n", (double)counters->value_[PERF_INSTRUCTIONS] / counters->value_[PERF_CYCLES]);
+	}
+	if (counters->valid_[PERF_BRANCH_MISSES])
+	{
+		fprintf(out, "host branch misses per 1000 guest instructions: %.3f\n", 1000.0 * counters->value_[PERF_BRANCH_MISSES] / guest);
+	}
+
+	fprintf(stderr, "perf:");
+	for (int i = 0; i < PERF_COUNTERS; i++)
+	{
+		if (counters->valid_[i])
+		{
+			fprintf(stderr, " %s=%llu", PERF_names[i], (unsigned long long)counters->value_[i]);
+		}
+	}
+	fprintf(stderr, "\n");
+}
+
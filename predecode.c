@@ -0,0 +1,531 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Pre-decoded engine
+ *
+ * The instruction memory is decoded once into basic blocks of micro-ops. A block
+ * starts at a jump target and ends with a branch, a jump or an instruction that
+ * is not implemented. Every block carries its own execution counter (and a taken
+ * counter when it ends in a branch), which is all the profiler needs: the per-PC
+ * and per-mnemonic numbers are expanded from the block counters at the end.
+ * With a decode cache directory set, the tables start out as the ones an
+ * earlier run of the same program left there, see dcache.c.
+ */
+
+//instructions CPU_execute does not implement leave the pc where it is
+static void CPU_invalid(CPU *cpu, uint32_t instruction)
+{
+}
+
+const CPU_op CPU_ops[OP_COUNT] = {
+	[OP_INVALID] = {"invalid", CPU_invalid},
+	[OP_ADD] = {"add", ADD}, [OP_SUB] = {"sub", SUB}, [OP_SLL] = {"sll", SLL},
+	[OP_SLT] = {"slt", SLT}, [OP_SLTU] = {"sltu", SLTU}, [OP_XOR] = {"xor", XOR},
+	[OP_SRL] = {"srl", SRL}, [OP_SRA] = {"sra", SRA}, [OP_OR] = {"or", OR}, [OP_AND] = {"and", AND},
+	[OP_ADDI] = {"addi", ADDI}, [OP_SLTI] = {"slti", SLTI}, [OP_SLTIU] = {"sltiu", SLTIU},
+	[OP_XORI] = {"xori", XORI}, [OP_ORI] = {"ori", ORI}, [OP_ANDI] = {"andi", ANDI},
+	[OP_SLLI] = {"slli", SLLI}, [OP_SRLI] = {"srli", SRLI}, [OP_SRAI] = {"srai", SRAI},
+	[OP_LB] = {"lb", LB}, [OP_LH] = {"lh", LH}, [OP_LW] = {"lw", LW}, [OP_LBU] = {"lbu", LBU}, [OP_LHU] = {"lhu", LHU},
+	[OP_SB] = {"sb", SB}, [OP_SH] = {"sh", SH}, [OP_SW] = {"sw", SW},
+	[OP_BEQ] = {"beq", BEQ}, [OP_BNE] = {"bne", BNE}, [OP_BLT] = {"blt", BLT},
+	[OP_BGE] = {"bge", BGE}, [OP_BLTU] = {"bltu", BLTU}, [OP_BGEU] = {"bgeu", BGEU},
+	[OP_LUI] = {"lui", LUI1}, [OP_AUIPC] = {"auipc", AUIPC1}, [OP_JAL] = {"jal", JAL1}, [OP_JALR] = {"jalr", JALR1},
+	[OP_FENCE] = {"fence", FENCE}, [OP_WFI] = {"wfi", WFI}, [OP_CSRRW] = {"csrrw", CSRRW}, [OP_CSRRS] = {"csrrs", CSRRS},
+	[OP_CSRRC] = {"csrrc", CSRRC}, [OP_CSRRWI] = {"csrrwi", CSRRWI}, [OP_CSRRSI] = {"csrrsi", CSRRSI},
+	[OP_CSRRCI] = {"csrrci", CSRRCI}, [OP_LR_W] = {"lr.w", LR_W}, [OP_SC_W] = {"sc.w", SC_W},
+	[OP_AMOSWAP_W] = {"amoswap.w", AMOSWAP_W}, [OP_AMOADD_W] = {"amoadd.w", AMOADD_W},
+	[OP_AMOXOR_W] = {"amoxor.w", AMOXOR_W}, [OP_AMOAND_W] = {"amoand.w", AMOAND_W}, [OP_AMOOR_W] = {"amoor.w", AMOOR_W},
+	[OP_AMOMIN_W] = {"amomin.w", AMOMIN_W}, [OP_AMOMAX_W] = {"amomax.w", AMOMAX_W},
+	[OP_AMOMINU_W] = {"amominu.w", AMOMINU_W}, [OP_AMOMAXU_W] = {"amomaxu.w", AMOMAXU_W},
+	[OP_HLE] = {"hle", HLE}, [OP_ECALL] = {"ecall", ECALL}, [OP_ACCEL] = {"accel", ACCEL},
+	[OP_FLW] = {"flw", FLW}, [OP_FLD] = {"fld", FLD}, [OP_FSW] = {"fsw", FSW}, [OP_FSD] = {"fsd", FSD},
+	[OP_FMADD_S] = {"fmadd.s", FMADD_S}, [OP_FMSUB_S] = {"fmsub.s", FMSUB_S}, [OP_FNMSUB_S] = {"fnmsub.s", FNMSUB_S},
+	[OP_FNMADD_S] = {"fnmadd.s", FNMADD_S}, [OP_FADD_S] = {"fadd.s", FADD_S}, [OP_FSUB_S] = {"fsub.s", FSUB_S},
+	[OP_FMUL_S] = {"fmul.s", FMUL_S}, [OP_FDIV_S] = {"fdiv.s", FDIV_S}, [OP_FSQRT_S] = {"fsqrt.s", FSQRT_S},
+	[OP_FSGNJ_S] = {"fsgnj.s", FSGNJ_S}, [OP_FMIN_S] = {"fmin.s", FMIN_S}, [OP_FCMP_S] = {"fcmp.s", FCMP_S},
+	[OP_FCLASS_S] = {"fclass.s", FCLASS_S}, [OP_FCVT_W_S] = {"fcvt.w.s", FCVT_W_S}, [OP_FCVT_S_W] = {"fcvt.s.w", FCVT_S_W},
+	[OP_FMV_X_W] = {"fmv.x.w", FMV_X_W}, [OP_FMV_W_X] = {"fmv.w.x", FMV_W_X},
+	[OP_FMADD_D] = {"fmadd.d", FMADD_D}, [OP_FMSUB_D] = {"fmsub.d", FMSUB_D}, [OP_FNMSUB_D] = {"fnmsub.d", FNMSUB_D},
+	[OP_FNMADD_D] = {"fnmadd.d", FNMADD_D}, [OP_FADD_D] = {"fadd.d", FADD_D}, [OP_FSUB_D] = {"fsub.d", FSUB_D},
+	[OP_FMUL_D] = {"fmul.d", FMUL_D}, [OP_FDIV_D] = {"fdiv.d", FDIV_D}, [OP_FSQRT_D] = {"fsqrt.d", FSQRT_D},
+	[OP_FSGNJ_D] = {"fsgnj.d", FSGNJ_D}, [OP_FMIN_D] = {"fmin.d", FMIN_D}, [OP_FCMP_D] = {"fcmp.d", FCMP_D},
+	[OP_FCLASS_D] = {"fclass.d", FCLASS_D}, [OP_FCVT_W_D] = {"fcvt.w.d", FCVT_W_D}, [OP_FCVT_D_W] = {"fcvt.d.w", FCVT_D_W},
+	[OP_FCVT_S_D] = {"fcvt.s.d", FCVT_S_D}, [OP_FCVT_D_S] = {"fcvt.d.s", FCVT_D_S},
+	[OP_VSETVL] = {"vsetvl", VSETVL}, [OP_VLE] = {"vle", VLE}, [OP_VLSE] = {"vlse", VLSE}, [OP_VSE] = {"vse", VSE},
+	[OP_VSSE] = {"vsse", VSSE}, [OP_VLM] = {"vlm", VLM}, [OP_VSM] = {"vsm", VSM}, [OP_VARITH] = {"varith", VARITH},
+	[OP_VCMP] = {"vcmp", VCMP}, [OP_VRED] = {"vred", VRED}, [OP_VMASK] = {"vmask", VMASK}, [OP_VCPOP] = {"vcpop", VCPOP},
+	[OP_VFIRST] = {"vfirst", VFIRST}, [OP_VMV_X_S] = {"vmv.x.s", VMV_X_S}, [OP_VMV_S_X] = {"vmv.s.x", VMV_S_X},
+	[OP_VID] = {"vid", VID},
+};
+
+//maps an instruction to its micro-op, mirrors the dispatch in CPU_execute
+uint16_t CPU_decode(uint32_t instruction)
+{
+	int8_t func3 = getFunc3(instruction);
+	int8_t func7 = getFunc7(instruction);
+
+	switch (getOpCode(instruction))
+	{
+	case R:
+		switch (func3)
+		{
+		case (0x00):
+			return func7 == 0x00 ? OP_ADD : func7 == 0x20 ? OP_SUB : OP_INVALID;
+		case (0x01):
+			return OP_SLL;
+		case (0x02):
+			return OP_SLT;
+		case (0x03):
+			return OP_SLTU;
+		case (0x04):
+			return OP_XOR;
+		case (0x05):
+			return func7 == 0x00 ? OP_SRL : func7 == 0x20 ? OP_SRA : OP_INVALID;
+		case (0x06):
+			return OP_OR;
+		case (0x07):
+			return OP_AND;
+		}
+		break;
+
+	case I:
+		switch (func3)
+		{
+		case (0x00):
+			return OP_ADDI;
+		case (0x01):
+			return OP_SLLI;
+		case (0x02):
+			return OP_SLTI;
+		case (0x03):
+			return OP_SLTIU;
+		case (0x04):
+			return OP_XORI;
+		case (0x05):
+			return func7 == 0x00 ? OP_SRLI : func7 == 0x20 ? OP_SRAI : OP_INVALID;
+		case (0x06):
+			return OP_ORI;
+		case (0x07):
+			return OP_ANDI;
+		}
+		break;
+
+	case S:
+		switch (func3)
+		{
+		case (0x00):
+			return OP_SB;
+		case (0x01):
+			return OP_SH;
+		case (0x02):
+			return OP_SW;
+		}
+		break;
+
+	case L:
+		switch (func3)
+		{
+		case (0x00):
+			return OP_LB;
+		case (0x01):
+			return OP_LH;
+		case (0x02):
+			return OP_LW;
+		case (0x04):
+			return OP_LBU;
+		case (0x05):
+			return OP_LHU;
+		}
+		break;
+
+	case B:
+		switch (func3)
+		{
+		case (0x00):
+			return OP_BEQ;
+		case (0x01):
+			return OP_BNE;
+		case (0x04):
+			return OP_BLT;
+		case (0x05):
+			return OP_BGE;
+		case (0x06):
+			return OP_BLTU;
+		case (0x07):
+			return OP_BGEU;
+		}
+		break;
+
+	case LUI:
+		return OP_LUI;
+	case AUIPC:
+		return OP_AUIPC;
+	case JAL:
+		return OP_JAL;
+	case JALR:
+		return OP_JALR;
+	case MISC_MEM:
+		return func3 == 0x00 ? OP_FENCE : OP_INVALID;
+
+	case SYSTEM:
+		switch (func3)
+		{
+		case (0x00):
+			return instruction == 0x10500073 ? OP_WFI : instruction == 0x00000073 ? OP_ECALL : OP_INVALID;
+		case (0x01):
+			return OP_CSRRW;
+		case (0x02):
+			return OP_CSRRS;
+		case (0x03):
+			return OP_CSRRC;
+		case (0x05):
+			return OP_CSRRWI;
+		case (0x06):
+			return OP_CSRRSI;
+		case (0x07):
+			return OP_CSRRCI;
+		}
+		break;
+
+	case CUSTOM_0:
+	case CUSTOM_1:
+		return OP_ACCEL;
+
+	case LOAD_FP:
+	case STORE_FP:
+	case MADD:
+	case MSUB:
+	case NMSUB:
+	case NMADD:
+	case FP:
+		return FPU_decode(instruction);
+
+	case VECTOR:
+		return VEC_decode(instruction);
+
+	case AMO:
+		if (func3 != 0x02)
+		{
+			break;
+		}
+		switch (func7 >> 2)
+		{
+		case (0x02):
+			return OP_LR_W;
+		case (0x03):
+			return OP_SC_W;
+		case (0x01):
+			return OP_AMOSWAP_W;
+		case (0x00):
+			return OP_AMOADD_W;
+		case (0x04):
+			return OP_AMOXOR_W;
+		case (0x0C):
+			return OP_AMOAND_W;
+		case (0x08):
+			return OP_AMOOR_W;
+		case (0x10):
+			return OP_AMOMIN_W;
+		case (0x14):
+			return OP_AMOMAX_W;
+		case (0x18):
+			return OP_AMOMINU_W;
+		case (0x1C):
+			return OP_AMOMAXU_W;
+		}
+		break;
+	}
+	return OP_INVALID;
+}
+
+//ops after which the next pc is not simply pc + 4 (AMOs stay at a misaligned address, a hook returns, exit and
+//an illegal accelerator instruction halt) and WFI
+int CPU_ends_block(uint16_t op)
+{
+	return op == OP_INVALID || (op >= OP_BEQ && op <= OP_BGEU) || op == OP_JAL || op == OP_JALR || op == OP_WFI ||
+		   (op >= OP_LR_W && op <= OP_ACCEL);
+}
+
+CPU_decoded *CPU_decoded_create(const CPU *cpu)
+{
+	//blocks from the cache do not stop at hooked pcs
+	CPU_decoded *decoded = cpu->decode_cache_ && !cpu->hook_count_ ? DCACHE_load(cpu) : NULL;
+	if (decoded)
+	{
+		return decoded;
+	}
+	decoded = calloc(1, sizeof(CPU_decoded));
+	if (!decoded)
+	{
+		return NULL;
+	}
+	decoded->pcs_ = cpu->instr_mem_size_ / 4;
+	decoded->block_of_ = malloc((decoded->pcs_ ? decoded->pcs_ : 1) * sizeof(int32_t));
+	if (!decoded->block_of_)
+	{
+		free(decoded);
+		return NULL;
+	}
+	for (size_t i = 0; i < decoded->pcs_; i++)
+	{
+		decoded->block_of_[i] = -1;
+	}
+	return decoded;
+}
+
+//the array lies in the mapped decode cache file
+static int CPU_decoded_mapped(const CPU_decoded *decoded, const void *array)
+{
+	return decoded->mapping_ && (const uint8_t *)array >= decoded->mapping_ &&
+		   (const uint8_t *)array < decoded->mapping_ + decoded->mapping_size_;
+}
+
+//realloc for the tables, arrays in the mapped file are copied out when they grow;
+//NULL if out of memory, the array stays as it is then
+static void *CPU_decoded_grow(const CPU_decoded *decoded, void *array, size_t used, size_t size)
+{
+	if (!CPU_decoded_mapped(decoded, array))
+	{
+		return realloc(array, size);
+	}
+	void *copy = malloc(size);
+	if (copy)
+	{
+		memcpy(copy, array, used);
+	}
+	return copy;
+}
+
+void CPU_decoded_destroy(CPU_decoded *decoded)
+{
+	if (!CPU_decoded_mapped(decoded, decoded->block_of_))
+	{
+		free(decoded->block_of_);
+	}
+	if (!CPU_decoded_mapped(decoded, decoded->blocks_))
+	{
+		free(decoded->blocks_);
+	}
+	if (!CPU_decoded_mapped(decoded, decoded->uops_))
+	{
+		free(decoded->uops_);
+	}
+	if (decoded->mapping_)
+	{
+		munmap(decoded->mapping_, decoded->mapping_size_);
+	}
+	for (size_t i = 0; i < decoded->translated_capacity_; i++)
+	{
+		while (decoded->translated_[i])
+		{
+			TRANS_block *alias = decoded->translated_[i]->alias_;
+			TCACHE_remove(decoded->cache_, decoded->translated_[i]->bytes_, 0);
+			free(decoded->translated_[i]);
+			decoded->translated_[i] = alias;
+		}
+	}
+	free(decoded->translated_);
+	free(decoded->evicted_);
+	free(decoded->heat_);
+	free(decoded->partial_counts_);
+	free(decoded);
+}
+
+//decodes the block starting at pc_index, the index must be inside the instruction memory
+int32_t CPU_decode_block(CPU *cpu, CPU_decoded *decoded, size_t pc_index)
+{
+	if (decoded->block_count_ == decoded->block_capacity_)
+	{
+		size_t capacity = decoded->block_capacity_ ? 2 * decoded->block_capacity_ : 256;
+		CPU_block *blocks = CPU_decoded_grow(decoded, decoded->blocks_, decoded->block_count_ * sizeof(CPU_block),
+											 capacity * sizeof(CPU_block));
+		if (!blocks)
+		{
+			return -1;
+		}
+		decoded->blocks_ = blocks;
+		decoded->block_capacity_ = capacity;
+	}
+	CPU_block *block = &decoded->blocks_[decoded->block_count_];
+	block->start_ = decoded->uop_count_;
+	block->pc_index_ = pc_index;
+	block->length_ = 0;
+	block->count_ = 0;
+	block->taken_ = 0;
+
+	for (size_t index = pc_index; index < decoded->pcs_; index++)
+	{
+		if (decoded->uop_count_ == decoded->uop_capacity_)
+		{
+			size_t capacity = decoded->uop_capacity_ ? 2 * decoded->uop_capacity_ : 1024;
+			CPU_uop *uops = CPU_decoded_grow(decoded, decoded->uops_, decoded->uop_count_ * sizeof(CPU_uop),
+											 capacity * sizeof(CPU_uop));
+			if (!uops)
+			{
+				//the ops decoded so far are dropped again
+				decoded->uop_count_ = block->start_;
+				return -1;
+			}
+			decoded->uops_ = uops;
+			decoded->uop_capacity_ = capacity;
+		}
+		if (HLE_hooked(cpu, index << 2) && index > pc_index)
+		{
+			//a hooked pc starts a block of its own
+			break;
+		}
+		CPU_uop *uop = &decoded->uops_[decoded->uop_count_++];
+		uop->instruction_ = *(uint32_t *)(cpu->instr_mem_ + (index << 2));
+		uop->op_ = HLE_hooked(cpu, index << 2) ? OP_HLE : CPU_decode(uop->instruction_);
+		uop->trace_ = TRACE_layout(uop->instruction_, uop->op_);
+		block->length_++;
+		if (CPU_ends_block(uop->op_))
+		{
+			break;
+		}
+	}
+
+	decoded->block_of_[pc_index] = decoded->block_count_;
+	return decoded->block_count_++;
+}
+
+//feeds the control transfer at the end of a block to the branch predictor simulation
+static void CPU_observe_control(CPU *cpu, uint32_t pc, uint32_t instruction)
+{
+	if (getOpCode(instruction) == B)
+	{
+		BP_branch(cpu->bpred_, pc, pc + imm_B(instruction), cpu->pc_ != pc + 4);
+	}
+	else if (getOpCode(instruction) == JAL || getOpCode(instruction) == JALR)
+	{
+		BP_jump(cpu->bpred_, pc, instruction, cpu->pc_);
+	}
+}
+
+//count instructions of a block starting at pc_index retired without the rest of it;
+//only the profile reads them, out of memory they are not counted
+static void CPU_count_partial(CPU_decoded *decoded, size_t pc_index, uint64_t count)
+{
+	if (!decoded->partial_counts_)
+	{
+		decoded->partial_counts_ = calloc(decoded->pcs_, sizeof(uint64_t));
+	}
+	for (uint64_t i = 0; decoded->partial_counts_ && i < count; i++)
+	{
+		decoded->partial_counts_[pc_index + i]++;
+	}
+}
+
+uint64_t CPU_run_predecoded(CPU *cpu, uint64_t max_steps)
+{
+	CPU_decoded *decoded = cpu->decoded_;
+	uint64_t steps = 0;
+
+	while (steps < max_steps)
+	{
+		size_t pc_index = (cpu->pc_ & 0xFFFFF) >> 2;
+		if (pc_index >= decoded->pcs_)
+		{
+			cpu->halted_ = 1;
+			break;
+		}
+		int32_t id = decoded->block_of_[pc_index];
+		if (id < 0)
+		{
+			id = CPU_decode_block(cpu, decoded, pc_index);
+		}
+		if (id < 0)
+		{
+			//out of memory for the block
+			steps += CPU_run_interpreter(cpu, max_steps - steps);
+			break;
+		}
+		CPU_block *block = &decoded->blocks_[id];
+		const CPU_uop *uop = &decoded->uops_[block->start_];
+		uint32_t length = block->length_;
+		uint32_t pc = cpu->pc_;
+
+		if (length > max_steps - steps)
+		{
+			//not enough budget left for the whole block
+			uint64_t started = steps;
+			for (uint32_t i = 0; steps < max_steps && !cpu->waiting_; i++)
+			{
+				pc = cpu->pc_;
+				if (cpu->trace_)
+				{
+					TRACE_uop(cpu, &uop[i]);
+				}
+				else
+				{
+					CPU_ops[uop[i].op_].handler_(cpu, uop[i].instruction_);
+					cpu->regfile_[0] = 0;
+				}
+				if (cpu->pc_ != pc || !cpu->waiting_)
+				{
+					steps++;
+				}
+			}
+			CPU_count_partial(decoded, pc_index, steps - started);
+			break;
+		}
+
+		//WFI ends its block, a load waiting for console input or an access outside
+		//the data memory can stop one early
+		uint32_t executed = length;
+		uint64_t calls = cpu->hook_stats_.calls_;
+		if (cpu->trace_)
+		{
+			executed = TRACE_block(cpu, uop, length);
+			pc += 4 * (executed - 1);
+		}
+		else
+		{
+			for (uint32_t i = 0; i < length; i++)
+			{
+				pc = cpu->pc_;
+				CPU_ops[uop[i].op_].handler_(cpu, uop[i].instruction_);
+				cpu->regfile_[0] = 0;
+				if (cpu->waiting_)
+				{
+					executed = i + 1;
+					break;
+				}
+			}
+		}
+		if (cpu->waiting_)
+		{
+			//the waiting load is executed again after CPU_wake
+			executed -= cpu->pc_ == pc;
+			CPU_count_partial(decoded, pc_index, executed);
+			steps += executed;
+			break;
+		}
+		steps += length;
+		block->count_++;
+		block->taken_ += cpu->pc_ != pc + 4;
+
+		//a hooked call that ran returned to ra
+		uint32_t end = cpu->hook_stats_.calls_ != calls ? HLE_RETURN : uop[length - 1].instruction_;
+		if (cpu->bpred_)
+		{
+			CPU_observe_control(cpu, pc, end);
+		}
+		if (cpu->sampler_)
+		{
+			SAMPLE_retire(cpu->sampler_, pc - 4 * (length - 1), length, pc, end, cpu->pc_);
+		}
+		if (cpu->pc_ == pc)
+		{
+			cpu->halted_ = 1;
+			break;
+		}
+	}
+	return steps;
+}
+
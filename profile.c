@@ -0,0 +1,455 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Dynamic instruction profile of the pre-decoded engine: opcode mix, hot PCs,
+ * hot basic blocks and taken/not-taken counts of the branches.
+ */
+
+#define PROF_REPORT_TOP 20
+
+typedef struct
+{
+	size_t key_;
+	uint64_t count_;
+} PROF_entry;
+
+static int PROF_compare_count(const void *a, const void *b)
+{
+	const PROF_entry *left = a;
+	const PROF_entry *right = b;
+	return left->count_ < right->count_ ? 1 : left->count_ > right->count_ ? -1 : 0;
+}
+
+//sorts the entries with a non-zero count to the front and returns their number
+static size_t PROF_sort(PROF_entry *entries, size_t count)
+{
+	size_t used = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (entries[i].count_)
+		{
+			entries[used++] = entries[i];
+		}
+	}
+	qsort(entries, used, sizeof(PROF_entry), PROF_compare_count);
+	return used;
+}
+
+void PROF_report(const CPU *cpu, FILE *out)
+{
+	CPU_decoded *decoded = cpu->decoded_;
+	if (!decoded)
+	{
+		return;
+	}
+	uint64_t total = 0;
+	uint64_t mix[OP_COUNT] = {0};
+	uint64_t *pc_counts = calloc(decoded->pcs_ ? decoded->pcs_ : 1, sizeof(uint64_t));
+	uint64_t *taken = calloc(decoded->pcs_ ? decoded->pcs_ : 1, sizeof(uint64_t));
+	PROF_entry *entries = malloc((decoded->pcs_ > OP_COUNT ? decoded->pcs_ : OP_COUNT) * sizeof(PROF_entry));
+	if (!pc_counts || !taken || !entries)
+	{
+		fprintf(out, "\ninstruction profile: out of memory\n");
+		free(pc_counts);
+		free(taken);
+		free(entries);
+		return;
+	}
+
+	for (size_t i = 0; i < decoded->block_count_; i++)
+	{
+		const CPU_block *block = &decoded->blocks_[i];
+		for (uint32_t j = 0; j < block->length_; j++)
+		{
+			pc_counts[block->pc_index_ + j] += block->count_;
+			mix[decoded->uops_[block->start_ + j].op_] += block->count_;
+		}
+	}
+	for (size_t i = 0; decoded->partial_counts_ && i < decoded->pcs_; i++)
+	{
+		pc_counts[i] += decoded->partial_counts_[i];
+		mix[CPU_decode(*(uint32_t *)(cpu->instr_mem_ + (i << 2)))] += decoded->partial_counts_[i];
+	}
+	for (size_t i = 0; i < OP_COUNT; i++)
+	{
+		total += mix[i];
+	}
+	if (total == 0)
+	{
+		total = 1;
+	}
+
+	fprintf(out, "\n-----------------------instruction profile------------------------\n");
+	fprintf(out, "retired instructions: %llu, basic blocks: %zu\n", (unsigned long long)cpu->instret_, decoded->block_count_);
+
+	size_t used;
+
+	for (size_t i = 0; i < OP_COUNT; i++)
+	{
+		entries[i].key_ = i;
+		entries[i].count_ = mix[i];
+	}
+	used = PROF_sort(entries, OP_COUNT);
+	fprintf(out, "\nopcode mix:\n%-8s %14s %7s\n", "mnemonic", "executed", "share");
+	for (size_t i = 0; i < used; i++)
+	{
+		fprintf(out, "%-8s %14llu %6.2f%%\n", CPU_ops[entries[i].key_].mnemonic_,
+				(unsigned long long)entries[i].count_, 100.0 * entries[i].count_ / total);
+	}
+
+	for (size_t i = 0; i < decoded->pcs_; i++)
+	{
+		entries[i].key_ = i;
+		entries[i].count_ = pc_counts[i];
+	}
+	used = PROF_sort(entries, decoded->pcs_);
+	fprintf(out, "\nhot PCs:\n%-8s %-8s %-8s %14s %7s\n", "pc", "word", "mnemonic", "executed", "share");
+	for (size_t i = 0; i < used && i < PROF_REPORT_TOP; i++)
+	{
+		uint32_t instruction = *(uint32_t *)(cpu->instr_mem_ + (entries[i].key_ << 2));
+		fprintf(out, "%08zX %08X %-8s %14llu %6.2f%%\n", entries[i].key_ << 2, instruction,
+				CPU_ops[CPU_decode(instruction)].mnemonic_, (unsigned long long)entries[i].count_, 100.0 * entries[i].count_ / total);
+	}
+
+	for (size_t i = 0; i < decoded->block_count_; i++)
+	{
+		entries[i].key_ = i;
+		entries[i].count_ = decoded->blocks_[i].count_ * decoded->blocks_[i].length_;
+	}
+	used = PROF_sort(entries, decoded->block_count_);
+	fprintf(out, "\nhot basic blocks:\n%-8s %6s %14s %14s %7s\n", "start", "length", "entries", "instructions", "share");
+	for (size_t i = 0; i < used && i < PROF_REPORT_TOP; i++)
+	{
+		const CPU_block *block = &decoded->blocks_[entries[i].key_];
+		fprintf(out, "%08X %6u %14llu %14llu %6.2f%%\n", block->pc_index_ << 2, block->length_,
+				(unsigned long long)block->count_, (unsigned long long)entries[i].count_, 100.0 * entries[i].count_ / total);
+	}
+
+	//blocks entered in the middle of another one end in the same branch, sum them up per pc
+	memset(pc_counts, 0, decoded->pcs_ * sizeof(uint64_t));
+	for (size_t i = 0; i < decoded->block_count_; i++)
+	{
+		const CPU_block *block = &decoded->blocks_[i];
+		size_t last = block->pc_index_ + block->length_ - 1;
+		if (getOpCode(decoded->uops_[block->start_ + block->length_ - 1].instruction_) == B)
+		{
+			pc_counts[last] += block->count_;
+			taken[last] += block->taken_;
+		}
+	}
+	for (size_t i = 0; i < decoded->pcs_; i++)
+	{
+		entries[i].key_ = i;
+		entries[i].count_ = pc_counts[i];
+	}
+	used = PROF_sort(entries, decoded->pcs_);
+	fprintf(out, "\nbranches:\n%-8s %-8s %14s %14s %14s\n", "pc", "mnemonic", "executed", "taken", "not taken");
+	for (size_t i = 0; i < used && i < PROF_REPORT_TOP; i++)
+	{
+		size_t index = entries[i].key_;
+		fprintf(out, "%08zX %-8s %14llu %14llu %14llu\n", index << 2,
+				CPU_ops[CPU_decode(*(uint32_t *)(cpu->instr_mem_ + (index << 2)))].mnemonic_,
+				(unsigned long long)entries[i].count_, (unsigned long long)taken[index],
+				(unsigned long long)(entries[i].count_ - taken[index]));
+	}
+
+	free(taken);
+	free(entries);
+	free(pc_counts);
+}
+
+/**
+ * Sampling profiler
+ *
+ * Every period_ retired instructions the guest pc is recorded together with a
+ * shadow call stack. The stack follows the link register convention the branch
+ * predictor uses: a JAL/JALR writing x1/x5 is a call (the call site is pushed),
+ * a JALR through x1/x5 is a return. Frames are folded to the start of the
+ * function they are in when the samples are taken, so identical stacks share
+ * one counter. Symbols come from the ELF symbol table or a GNU ld .map file of
+ * the program; without them a frame is the entry address its call jumped to.
+ * The report is in the collapsed stack format of flamegraph.pl ("caller;callee;leaf
+ * count" per line).
+ */
+
+#define SAMPLE_DEFAULT_PERIOD 1000
+#define SAMPLE_MAX_DEPTH 256
+
+typedef struct
+{
+	uint64_t hash_;
+	uint32_t offset_; //first frame in frames_
+	uint32_t depth_;
+	uint64_t count_;
+} SAMPLE_stack;
+
+struct SAMPLE_profiler
+{
+	uint64_t period_;
+	int64_t countdown_; //instructions until the next sample
+	uint64_t samples_;
+
+	uint32_t calls_[SAMPLE_MAX_DEPTH];		 //return addresses of the shadow stack
+	uint32_t entries_[SAMPLE_MAX_DEPTH + 1]; //entry of the program, then the call targets
+	uint32_t depth_;						 //may exceed SAMPLE_MAX_DEPTH, deeper calls are not recorded
+
+	SYM_table symbols_; //one symbol per address
+
+	SAMPLE_stack *stacks_; //open addressing, capacity is a power of two
+	size_t stack_capacity_;
+	size_t stack_count_;
+	uint32_t *frames_;
+	size_t frame_count_;
+	size_t frame_capacity_;
+};
+
+//entry_pc: pc the program starts at, the bottom frame without symbols
+SAMPLE_profiler *SAMPLE_create(uint64_t period, uint32_t entry_pc)
+{
+	SAMPLE_profiler *profiler = calloc(1, sizeof(SAMPLE_profiler));
+	if (!profiler)
+	{
+		return NULL;
+	}
+	profiler->period_ = period ? period : SAMPLE_DEFAULT_PERIOD;
+	profiler->entries_[0] = entry_pc & 0xFFFFF;
+	profiler->countdown_ = profiler->period_;
+	profiler->stack_capacity_ = 1024;
+	profiler->stacks_ = calloc(profiler->stack_capacity_, sizeof(SAMPLE_stack));
+	profiler->frame_capacity_ = 4096;
+	profiler->frames_ = malloc(profiler->frame_capacity_ * sizeof(uint32_t));
+	if (!profiler->stacks_ || !profiler->frames_)
+	{
+		SAMPLE_destroy(profiler);
+		return NULL;
+	}
+	return profiler;
+}
+
+uint64_t SAMPLE_get_samples(const SAMPLE_profiler *profiler)
+{
+	return profiler->samples_;
+}
+
+uint64_t SAMPLE_get_period(const SAMPLE_profiler *profiler)
+{
+	return profiler->period_;
+}
+
+void SAMPLE_destroy(SAMPLE_profiler *profiler)
+{
+	SYM_free(&profiler->symbols_);
+	free(profiler->stacks_);
+	free(profiler->frames_);
+	free(profiler);
+}
+
+//loads the symbols of an ELF file or a GNU ld map file, -1 on error
+int SAMPLE_load_symbols(SAMPLE_profiler *profiler, const char *filename)
+{
+	SYM_table *table = &profiler->symbols_;
+	int status = SYM_load(table, filename);
+	//labels at the same address: keep the first one
+	size_t used = 0;
+	for (size_t i = 0; i < table->count_; i++)
+	{
+		if (used && table->symbols_[used - 1].addr_ == table->symbols_[i].addr_)
+		{
+			free(table->symbols_[i].name_);
+			continue;
+		}
+		table->symbols_[used++] = table->symbols_[i];
+	}
+	table->count_ = used;
+	return status;
+}
+
+//a frame is the start of its function, or the pc itself outside of all symbols
+static uint32_t SAMPLE_frame(const SAMPLE_profiler *profiler, uint32_t pc)
+{
+	const SYM_symbol *symbol = SYM_lookup(&profiler->symbols_, pc);
+	return symbol ? symbol->addr_ : pc & 0xFFFFF;
+}
+
+//out of memory the table stays as it is, SAMPLE_take stops adding stacks before it is full
+static void SAMPLE_grow_stacks(SAMPLE_profiler *profiler)
+{
+	size_t capacity = profiler->stack_capacity_ * 2;
+	SAMPLE_stack *stacks = calloc(capacity, sizeof(SAMPLE_stack));
+	if (!stacks)
+	{
+		return;
+	}
+	for (size_t i = 0; i < profiler->stack_capacity_; i++)
+	{
+		const SAMPLE_stack *stack = &profiler->stacks_[i];
+		if (stack->count_)
+		{
+			size_t slot = stack->hash_ & (capacity - 1);
+			while (stacks[slot].count_)
+			{
+				slot = (slot + 1) & (capacity - 1);
+			}
+			stacks[slot] = *stack;
+		}
+	}
+	free(profiler->stacks_);
+	profiler->stacks_ = stacks;
+	profiler->stack_capacity_ = capacity;
+}
+
+static void SAMPLE_take(SAMPLE_profiler *profiler, uint32_t pc)
+{
+	uint32_t frames[SAMPLE_MAX_DEPTH + 1];
+	uint32_t depth = profiler->depth_ < SAMPLE_MAX_DEPTH ? profiler->depth_ : SAMPLE_MAX_DEPTH;
+	uint64_t hash = 14695981039346656037ULL; //FNV-1a over the frames
+
+	for (uint32_t i = 0; i <= depth; i++)
+	{
+		if (profiler->symbols_.count_)
+		{
+			//the call sites tell the callers, which also keeps tail calls right
+			frames[i] = SAMPLE_frame(profiler, i < depth ? profiler->calls_[i] - 4 : pc);
+		}
+		else
+		{
+			frames[i] = profiler->entries_[i];
+		}
+		hash = (hash ^ frames[i]) * 1099511628211ULL;
+	}
+	depth++;
+	profiler->samples_++;
+
+	size_t slot = hash & (profiler->stack_capacity_ - 1);
+	for (;;)
+	{
+		SAMPLE_stack *stack = &profiler->stacks_[slot];
+		if (stack->count_ == 0)
+		{
+			break;
+		}
+		if (stack->hash_ == hash && stack->depth_ == depth &&
+			memcmp(profiler->frames_ + stack->offset_, frames, depth * sizeof(uint32_t)) == 0)
+		{
+			stack->count_++;
+			return;
+		}
+		slot = (slot + 1) & (profiler->stack_capacity_ - 1);
+	}
+
+	//a new stack, dropped when there is no memory for it
+	if (profiler->stack_count_ + 1 == profiler->stack_capacity_)
+	{
+		return;
+	}
+	if (profiler->frame_count_ + depth > profiler->frame_capacity_)
+	{
+		size_t capacity = 2 * (profiler->frame_count_ + depth);
+		uint32_t *grown = realloc(profiler->frames_, capacity * sizeof(uint32_t));
+		if (!grown)
+		{
+			return;
+		}
+		profiler->frames_ = grown;
+		profiler->frame_capacity_ = capacity;
+	}
+	memcpy(profiler->frames_ + profiler->frame_count_, frames, depth * sizeof(uint32_t));
+	profiler->stacks_[slot] = (SAMPLE_stack){hash, profiler->frame_count_, depth, 1};
+	profiler->frame_count_ += depth;
+	if (++profiler->stack_count_ * 4 > profiler->stack_capacity_ * 3)
+	{
+		SAMPLE_grow_stacks(profiler);
+	}
+}
+
+/**
+ * count instructions starting at first_pc were retired in sequence, the last one
+ * (instruction at last_pc) continued at next_pc. The engines call this once per
+ * block, the interpreter once per instruction.
+ */
+void SAMPLE_retire(SAMPLE_profiler *profiler, uint32_t first_pc, uint32_t count, uint32_t last_pc, uint32_t instruction, uint32_t next_pc)
+{
+	profiler->countdown_ -= count;
+	while (profiler->countdown_ <= 0)
+	{
+		SAMPLE_take(profiler, first_pc + 4 * (uint32_t)(count - 1 + profiler->countdown_));
+		profiler->countdown_ += profiler->period_;
+	}
+
+	uint8_t opcode = getOpCode(instruction);
+	if (opcode != JAL && opcode != JALR)
+	{
+		return;
+	}
+	int8_t rd = getRD(instruction);
+	int8_t rs1 = getRS1(instruction);
+	int is_call = BP_is_link(rd);
+	int is_return = opcode == JALR && BP_is_link(rs1) && !(is_call && rd == rs1);
+
+	if (is_return && profiler->depth_ > SAMPLE_MAX_DEPTH)
+	{
+		profiler->depth_--;
+	}
+	else if (is_return && profiler->depth_)
+	{
+		//unwind to the frame returned to, a mismatch (longjmp style) only drops the top
+		uint32_t i = profiler->depth_;
+		while (i > 0 && profiler->calls_[i - 1] != next_pc)
+		{
+			i--;
+		}
+		profiler->depth_ = i ? i - 1 : profiler->depth_ - 1;
+	}
+	if (is_call)
+	{
+		if (profiler->depth_ < SAMPLE_MAX_DEPTH)
+		{
+			profiler->calls_[profiler->depth_] = last_pc + 4;
+			profiler->entries_[profiler->depth_ + 1] = next_pc & 0xFFFFF;
+		}
+		profiler->depth_++;
+	}
+}
+
+static void SAMPLE_print_frame(const SAMPLE_profiler *profiler, uint32_t frame, FILE *out)
+{
+	const SYM_symbol *symbol = SYM_lookup(&profiler->symbols_, frame);
+	if (symbol && symbol->addr_ == frame)
+	{
+		fputs(symbol->name_, out);
+	}
+	else
+	{
+		fprintf(out, "0x%05X", frame);
+	}
+}
+
+//collapsed stacks, one line per distinct stack: "outer;inner;leaf samples"
+void SAMPLE_report(const SAMPLE_profiler *profiler, FILE *out)
+{
+	for (size_t i = 0; i < profiler->stack_capacity_; i++)
+	{
+		const SAMPLE_stack *stack = &profiler->stacks_[i];
+		if (stack->count_ == 0)
+		{
+			continue;
+		}
+		for (uint32_t j = 0; j < stack->depth_; j++)
+		{
+			if (j)
+			{
+				fputc(';', out);
+			}
+			SAMPLE_print_frame(profiler, profiler->frames_[stack->offset_ + j], out);
+		}
+		fprintf(out, " %llu\n", (unsigned long long)stack->count_);
+	}
+}
+
@@ -0,0 +1,439 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hurv_internal.h"
+
+/**
+ * N:M scheduler
+ *
+ * Time-slices any number of CPUs on a fixed pool of worker threads. A guest runs
+ * for one quantum with CPU_run on whatever worker picked it, so a context switch
+ * is nothing but handing the CPU pointer on: the whole guest state (registers,
+ * pc, memory) stays in the CPU object.
+ *
+ * Every worker has a run queue of its own, a binary heap ordered by priority,
+ * then by deadline (earliest first), then round robin. A worker takes its next
+ * guest from its own queue and steals the best one from another worker when it
+ * is empty. Guests stopped by WFI or by a console load that has no input yet
+ * are parked, they stay out of all queues until SCHED_wake.
+ */
+
+enum sched_state
+{
+	SCHED_RUNNABLE, //queued or running
+	SCHED_PARKED,
+	SCHED_DONE
+};
+
+struct SCHED_guest
+{
+	CPU *cpu_;
+	SCHED_pool *pool_;
+	int priority_;
+	uint64_t deadline_; //CLOCK_MONOTONIC ns, UINT64_MAX if none
+	uint64_t max_steps_;
+	uint64_t steps_;
+	uint64_t sequence_; //round robin among equal priority and deadline
+	int state_;			//enum sched_state, under the pool mutex
+	int wake_pending_;	//SCHED_wake before the guest parked
+};
+
+//one cache line apart, the queue lock is taken by thieves
+typedef struct
+{
+	SCHED_pool *pool_;
+	pthread_t thread_;
+	pthread_mutex_t lock_;
+	SCHED_guest **heap_;
+	size_t size_;
+	size_t capacity_;
+	uint64_t quanta_;
+	uint64_t instructions_;
+	uint64_t steals_;
+} __attribute__((aligned(64))) SCHED_worker;
+
+struct SCHED_pool
+{
+	SCHED_worker *workers_;
+	int worker_count_;
+	uint64_t quantum_;
+	uint64_t sequence_;
+	uint64_t queued_; //guests in the queues, atomic
+
+	//guest list, states and the counters below
+	pthread_mutex_t mutex_;
+	pthread_cond_t work_; //idle workers
+	pthread_cond_t idle_; //SCHED_wait
+	SCHED_guest **guests_;
+	size_t guest_count_;
+	size_t guest_capacity_;
+	int active_; //runnable guests
+	int stop_;
+	uint64_t parks_;
+	uint64_t wakes_;
+	uint64_t finished_;
+	uint64_t deadline_misses_;
+	int next_worker_; //of SCHED_add
+};
+
+static uint64_t SCHED_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+//a runs before b
+static int SCHED_before(const SCHED_guest *a, const SCHED_guest *b)
+{
+	if (a->priority_ != b->priority_)
+	{
+		return a->priority_ > b->priority_;
+	}
+	if (a->deadline_ != b->deadline_)
+	{
+		return a->deadline_ < b->deadline_;
+	}
+	return a->sequence_ < b->sequence_;
+}
+
+//the heap has room for every guest, see SCHED_add
+static void SCHED_push(SCHED_worker *worker, SCHED_guest *guest)
+{
+	guest->sequence_ = __atomic_fetch_add(&worker->pool_->sequence_, 1, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&worker->lock_);
+	size_t i = worker->size_++;
+	while (i > 0 && SCHED_before(guest, worker->heap_[(i - 1) / 2]))
+	{
+		worker->heap_[i] = worker->heap_[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	worker->heap_[i] = guest;
+	pthread_mutex_unlock(&worker->lock_);
+	__atomic_fetch_add(&worker->pool_->queued_, 1, __ATOMIC_SEQ_CST);
+}
+
+//best guest of the queue, NULL if it is empty
+static SCHED_guest *SCHED_pop(SCHED_worker *worker)
+{
+	pthread_mutex_lock(&worker->lock_);
+	if (worker->size_ == 0)
+	{
+		pthread_mutex_unlock(&worker->lock_);
+		return NULL;
+	}
+	SCHED_guest *top = worker->heap_[0];
+	SCHED_guest *last = worker->heap_[--worker->size_];
+	size_t i = 0;
+	for (;;)
+	{
+		size_t child = 2 * i + 1;
+		if (child >= worker->size_)
+		{
+			break;
+		}
+		if (child + 1 < worker->size_ && SCHED_before(worker->heap_[child + 1], worker->heap_[child]))
+		{
+			child++;
+		}
+		if (!SCHED_before(worker->heap_[child], last))
+		{
+			break;
+		}
+		worker->heap_[i] = worker->heap_[child];
+		i = child;
+	}
+	worker->heap_[i] = last;
+	pthread_mutex_unlock(&worker->lock_);
+	__atomic_fetch_sub(&worker->pool_->queued_, 1, __ATOMIC_SEQ_CST);
+	return top;
+}
+
+//next guest for a worker: its own queue first, then the others in turn
+static SCHED_guest *SCHED_next(SCHED_worker *worker)
+{
+	SCHED_pool *pool = worker->pool_;
+	SCHED_guest *guest = SCHED_pop(worker);
+	int self = worker - pool->workers_;
+	for (int i = 1; !guest && i < pool->worker_count_ && __atomic_load_n(&pool->queued_, __ATOMIC_SEQ_CST); i++)
+	{
+		guest = SCHED_pop(&pool->workers_[(self + i) % pool->worker_count_]);
+		worker->steals_ += guest != NULL;
+	}
+	return guest;
+}
+
+//under the pool mutex: the guest no longer counts as runnable
+static void SCHED_retire(SCHED_pool *pool, SCHED_guest *guest, int state)
+{
+	guest->state_ = state;
+	if (--pool->active_ == 0)
+	{
+		pthread_cond_broadcast(&pool->idle_);
+	}
+}
+
+//after a quantum: queue the guest again, park it or finish it
+static void SCHED_after_quantum(SCHED_worker *worker, SCHED_guest *guest)
+{
+	SCHED_pool *pool = worker->pool_;
+	CPU *cpu = guest->cpu_;
+	if (!cpu->halted_ && guest->steps_ < guest->max_steps_ && !cpu->waiting_)
+	{
+		SCHED_push(worker, guest);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex_);
+	if (cpu->halted_ || guest->steps_ >= guest->max_steps_)
+	{
+		pool->finished_++;
+		pool->deadline_misses_ += guest->deadline_ != UINT64_MAX && SCHED_now() > guest->deadline_;
+		SCHED_retire(pool, guest, SCHED_DONE);
+	}
+	else if (guest->wake_pending_)
+	{
+		//woken while it was running, it goes on right away
+		guest->wake_pending_ = 0;
+		cpu->waiting_ = 0;
+		pool->wakes_++;
+		SCHED_push(worker, guest);
+	}
+	else
+	{
+		pool->parks_++;
+		SCHED_retire(pool, guest, SCHED_PARKED);
+	}
+	pthread_mutex_unlock(&pool->mutex_);
+}
+
+static void *SCHED_work(void *argument)
+{
+	SCHED_worker *worker = argument;
+	SCHED_pool *pool = worker->pool_;
+
+	while (!__atomic_load_n(&pool->stop_, __ATOMIC_RELAXED))
+	{
+		SCHED_guest *guest = SCHED_next(worker);
+		if (!guest)
+		{
+			//queued_ is raised before the mutex is taken to signal, so no wakeup is lost
+			pthread_mutex_lock(&pool->mutex_);
+			while (!pool->stop_ && __atomic_load_n(&pool->queued_, __ATOMIC_SEQ_CST) == 0)
+			{
+				pthread_cond_wait(&pool->work_, &pool->mutex_);
+			}
+			int stop = pool->stop_;
+			pthread_mutex_unlock(&pool->mutex_);
+			if (stop)
+			{
+				return NULL;
+			}
+			continue;
+		}
+
+		uint64_t left = guest->max_steps_ - guest->steps_;
+		uint64_t steps = CPU_run(guest->cpu_, left < pool->quantum_ ? left : pool->quantum_);
+		guest->steps_ += steps;
+		worker->instructions_ += steps;
+		worker->quanta_++;
+		SCHED_after_quantum(worker, guest);
+	}
+	return NULL;
+}
+
+SCHED_pool *SCHED_create(int workers, uint64_t quantum)
+{
+	if (workers <= 0 || quantum == 0)
+	{
+		return NULL;
+	}
+	SCHED_pool *pool = calloc(1, sizeof(SCHED_pool));
+	if (!pool)
+	{
+		return NULL;
+	}
+	pool->workers_ = aligned_alloc(64, workers * sizeof(SCHED_worker));
+	if (!pool->workers_)
+	{
+		free(pool);
+		return NULL;
+	}
+	memset(pool->workers_, 0, workers * sizeof(SCHED_worker));
+	pool->quantum_ = quantum;
+	pthread_mutex_init(&pool->mutex_, NULL);
+	pthread_cond_init(&pool->work_, NULL);
+	pthread_cond_init(&pool->idle_, NULL);
+	for (int i = 0; i < workers; i++)
+	{
+		SCHED_worker *worker = &pool->workers_[i];
+		worker->pool_ = pool;
+		pthread_mutex_init(&worker->lock_, NULL);
+		if (pthread_create(&worker->thread_, NULL, SCHED_work, worker) != 0)
+		{
+			pthread_mutex_destroy(&worker->lock_);
+			SCHED_destroy(pool);
+			return NULL;
+		}
+		pool->worker_count_++;
+	}
+	return pool;
+}
+
+SCHED_guest *SCHED_add(SCHED_pool *pool, CPU *cpu, int priority, uint64_t deadline_ns, uint64_t max_steps)
+{
+	SCHED_guest *guest = calloc(1, sizeof(SCHED_guest));
+	if (!guest)
+	{
+		return NULL;
+	}
+	guest->cpu_ = cpu;
+	guest->pool_ = pool;
+	guest->priority_ = priority;
+	guest->deadline_ = deadline_ns ? SCHED_now() + deadline_ns : UINT64_MAX;
+	guest->max_steps_ = max_steps;
+
+	pthread_mutex_lock(&pool->mutex_);
+	if (pool->guest_count_ == pool->guest_capacity_)
+	{
+		//every queue can end up holding all guests, so pushing never allocates
+		size_t capacity = pool->guest_capacity_ ? pool->guest_capacity_ * 2 : 64;
+		SCHED_guest **guests = realloc(pool->guests_, capacity * sizeof(SCHED_guest *));
+		int grown = guests != NULL;
+		pool->guests_ = guests ? guests : pool->guests_;
+		for (int i = 0; grown && i < pool->worker_count_; i++)
+		{
+			SCHED_worker *worker = &pool->workers_[i];
+			pthread_mutex_lock(&worker->lock_);
+			SCHED_guest **heap = realloc(worker->heap_, capacity * sizeof(SCHED_guest *));
+			worker->heap_ = heap ? heap : worker->heap_;
+			worker->capacity_ = heap ? capacity : worker->capacity_;
+			pthread_mutex_unlock(&worker->lock_);
+			grown = heap != NULL;
+		}
+		if (!grown)
+		{
+			pthread_mutex_unlock(&pool->mutex_);
+			free(guest);
+			return NULL;
+		}
+		pool->guest_capacity_ = capacity;
+	}
+	pool->guests_[pool->guest_count_++] = guest;
+
+	if (cpu->halted_ || max_steps == 0)
+	{
+		pool->finished_++;
+		guest->state_ = SCHED_DONE;
+	}
+	else if (cpu->waiting_)
+	{
+		pool->parks_++;
+		guest->state_ = SCHED_PARKED;
+	}
+	else
+	{
+		pool->active_++;
+		SCHED_push(&pool->workers_[pool->next_worker_], guest);
+		pool->next_worker_ = (pool->next_worker_ + 1) % pool->worker_count_;
+		pthread_cond_signal(&pool->work_);
+	}
+	pthread_mutex_unlock(&pool->mutex_);
+	return guest;
+}
+
+void SCHED_wake(SCHED_guest *guest)
+{
+	SCHED_pool *pool = guest->pool_;
+	pthread_mutex_lock(&pool->mutex_);
+	if (guest->state_ == SCHED_PARKED)
+	{
+		guest->state_ = SCHED_RUNNABLE;
+		guest->cpu_->waiting_ = 0;
+		pool->wakes_++;
+		pool->active_++;
+		SCHED_push(&pool->workers_[pool->next_worker_], guest);
+		pool->next_worker_ = (pool->next_worker_ + 1) % pool->worker_count_;
+		pthread_cond_signal(&pool->work_);
+	}
+	else if (guest->state_ == SCHED_RUNNABLE)
+	{
+		guest->wake_pending_ = 1;
+	}
+	pthread_mutex_unlock(&pool->mutex_);
+}
+
+int SCHED_is_parked(const SCHED_guest *guest)
+{
+	SCHED_pool *pool = guest->pool_;
+	pthread_mutex_lock(&pool->mutex_);
+	int parked = guest->state_ == SCHED_PARKED;
+	pthread_mutex_unlock(&pool->mutex_);
+	return parked;
+}
+
+int SCHED_wait(SCHED_pool *pool)
+{
+	pthread_mutex_lock(&pool->mutex_);
+	while (pool->active_ > 0)
+	{
+		pthread_cond_wait(&pool->idle_, &pool->mutex_);
+	}
+	int parked = 0;
+	for (size_t i = 0; i < pool->guest_count_; i++)
+	{
+		parked += pool->guests_[i]->state_ == SCHED_PARKED;
+	}
+	pthread_mutex_unlock(&pool->mutex_);
+	return parked;
+}
+
+void SCHED_get_stats(SCHED_pool *pool, SCHED_stats *stats)
+{
+	memset(stats, 0, sizeof(SCHED_stats));
+	pthread_mutex_lock(&pool->mutex_);
+	for (int i = 0; i < pool->worker_count_; i++)
+	{
+		stats->quanta_ += pool->workers_[i].quanta_;
+		stats->instructions_ += pool->workers_[i].instructions_;
+		stats->steals_ += pool->workers_[i].steals_;
+	}
+	stats->guests_ = pool->guest_count_;
+	stats->parks_ = pool->parks_;
+	stats->wakes_ = pool->wakes_;
+	stats->finished_ = pool->finished_;
+	stats->deadline_misses_ = pool->deadline_misses_;
+	pthread_mutex_unlock(&pool->mutex_);
+}
+
+void SCHED_destroy(SCHED_pool *pool)
+{
+	if (!pool)
+	{
+		return;
+	}
+	pthread_mutex_lock(&pool->mutex_);
+	__atomic_store_n(&pool->stop_, 1, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&pool->work_);
+	pthread_mutex_unlock(&pool->mutex_);
+	for (int i = 0; i < pool->worker_count_; i++)
+	{
+		pthread_join(pool->workers_[i].thread_, NULL);
+		pthread_mutex_destroy(&pool->workers_[i].lock_);
+		free(pool->workers_[i].heap_);
+	}
+	for (size_t i = 0; i < pool->guest_count_; i++)
+	{
+		free(pool->guests_[i]);
+	}
+	free(pool->guests_);
+	free(pool->workers_);
+	pthread_cond_destroy(&pool->idle_);
+	pthread_cond_destroy(&pool->work_);
+	pthread_mutex_destroy(&pool->mutex_);
+	free(pool);
+}
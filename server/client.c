@@ -0,0 +1,242 @@
+/**
+ * Client of the emulator server: sends one job (repeated --repeat times over the
+ * same connection), prints the console output of the guest and the result.
+ *
+ *   ./server/hu_risc-v_client <socket> <instruction_mem.bin> <data_mem.bin>
+ *       [--steps=N] [--engine=interp|predecode] [--inline] [--input=file] [--repeat=N]
+ *
+ * Without --inline the paths are sent and the server loads (and caches) the
+ * files itself, so they have to be valid on the server side.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../hurv.h"
+#include "protocol.h"
+
+static int CLIENT_write_all(int fd, const void *buffer, size_t size)
+{
+	const uint8_t *p = buffer;
+	while (size)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int CLIENT_read_all(int fd, void *buffer, size_t size)
+{
+	uint8_t *p = buffer;
+	while (size)
+	{
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+//whole file, NULL on error
+static uint8_t *CLIENT_read_file(const char *path, size_t *size)
+{
+	FILE *file = fopen(path, "rb");
+	struct stat sb;
+	if (!file || fstat(fileno(file), &sb) == -1)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	*size = sb.st_size;
+	uint8_t *data = malloc(*size ? *size : 1);
+	if (!data || fread(data, 1, *size, file) != *size)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	fclose(file);
+	return data;
+}
+
+static double CLIENT_seconds(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 4)
+	{
+		printf("usage: %s <socket> <instruction_mem.bin> <data_mem.bin> [--steps=N] [--engine=interp|predecode]"
+			   " [--inline] [--input=file] [--repeat=N]\n",
+			   argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	SERVER_request request;
+	memset(&request, 0, sizeof(request));
+	request.magic_ = SERVER_REQUEST_MAGIC;
+	request.kind_ = SERVER_JOB_PATHS;
+	request.engine_ = ENGINE_INTERP;
+	request.max_steps_ = 1000000;
+	const char *input_path = NULL;
+	int repeat = 1;
+
+	for (int i = 4; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--steps=", 8) == 0)
+		{
+			request.max_steps_ = strtoull(argv[i] + 8, NULL, 0);
+		}
+		else if (strcmp(argv[i], "--engine=interp") == 0)
+		{
+			request.engine_ = ENGINE_INTERP;
+		}
+		else if (strcmp(argv[i], "--engine=predecode") == 0)
+		{
+			request.engine_ = ENGINE_PREDECODE;
+		}
+		else if (strcmp(argv[i], "--inline") == 0)
+		{
+			request.kind_ = SERVER_JOB_INLINE;
+		}
+		else if (strncmp(argv[i], "--input=", 8) == 0)
+		{
+			input_path = argv[i] + 8;
+		}
+		else if (strncmp(argv[i], "--repeat=", 9) == 0)
+		{
+			repeat = atoi(argv[i] + 9);
+		}
+		else
+		{
+			printf("unknown option: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	const uint8_t *instr;
+	const uint8_t *data;
+	size_t instr_size;
+	size_t data_size;
+	if (request.kind_ == SERVER_JOB_INLINE)
+	{
+		instr = CLIENT_read_file(argv[2], &instr_size);
+		data = CLIENT_read_file(argv[3], &data_size);
+	}
+	else
+	{
+		//the server resolves the paths, relative ones against its own directory
+		char *instr_path = realpath(argv[2], NULL);
+		char *data_path = realpath(argv[3], NULL);
+		instr = (const uint8_t *)(instr_path ? instr_path : argv[2]);
+		data = (const uint8_t *)(data_path ? data_path : argv[3]);
+		instr_size = strlen((const char *)instr);
+		data_size = strlen((const char *)data);
+	}
+	size_t input_size = 0;
+	uint8_t *input = input_path ? CLIENT_read_file(input_path, &input_size) : NULL;
+	request.instr_size_ = instr_size;
+	request.data_size_ = data_size;
+	request.input_size_ = input_size;
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	SERVER_response response;
+	uint8_t *output = NULL;
+	double total = 0, best = 0, run = 0;
+	for (int i = 0; i < repeat; i++)
+	{
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (CLIENT_write_all(fd, &request, sizeof(request)) == -1 || CLIENT_write_all(fd, instr, instr_size) == -1 ||
+			CLIENT_write_all(fd, data, data_size) == -1 || CLIENT_write_all(fd, input, input_size) == -1 ||
+			CLIENT_read_all(fd, &response, sizeof(response)) == -1 || response.magic_ != SERVER_RESPONSE_MAGIC)
+		{
+			printf("connection to the server failed\n");
+			return EXIT_FAILURE;
+		}
+		uint8_t *buffer = realloc(output, response.output_size_ + 1);
+		if (!buffer)
+		{
+			printf("%s\n", CPU_error_string(CPU_ERROR_MEMORY));
+			return EXIT_FAILURE;
+		}
+		output = buffer;
+		if (CLIENT_read_all(fd, output, response.output_size_) == -1)
+		{
+			printf("connection to the server failed\n");
+			return EXIT_FAILURE;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		double seconds = CLIENT_seconds(&start, &end);
+		total += seconds;
+		best = i == 0 || seconds < best ? seconds : best;
+		run += response.run_ns_ / 1e9;
+		if (response.status_ != CPU_OK)
+		{
+			printf("job failed: %s\n", CPU_error_string(response.status_));
+			return EXIT_FAILURE;
+		}
+	}
+	close(fd);
+
+	fwrite(output, 1, response.output_size_, stdout);
+	if (response.output_truncated_)
+	{
+		printf("\n[output truncated by the server]");
+	}
+	if (response.fault_)
+	{
+		printf("\n[fault: access at 0x%08X outside the data memory, pc 0x%08X]", response.fault_address_, response.pc_);
+	}
+	if (response.limited_)
+	{
+		printf("\n[stopped by the step or time limit of the server]");
+	}
+	printf("\n-----------------------RISC-V program terminate------------------------\nRegfile values:\n");
+	for (int i = 0; i <= 31; i++)
+	{
+		printf("%d: %X\n", i, response.regfile_[i]);
+	}
+	fprintf(stderr, "jobs: %d instructions=%llu halted=%u latency avg=%.1fus min=%.1fus run avg=%.1fus\n", repeat,
+			(unsigned long long)response.instret_, response.halted_, total / repeat * 1e6, best * 1e6, run / repeat * 1e6);
+	return 0;
+}
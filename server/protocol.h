@@ -0,0 +1,70 @@
+/**
+ * Wire format of the emulator server (hu_risc-v_server)
+ *
+ * A client connects to the Unix domain socket of the server and sends any number
+ * of jobs over the connection; every job is answered with one result, in order.
+ * All numbers are little endian.
+ *
+ *   request:  SERVER_request, instr_size_ bytes, data_size_ bytes, input_size_ bytes
+ *   response: SERVER_response, output_size_ bytes of console output
+ *
+ * For SERVER_JOB_PATHS the two image payloads are the paths of the image files
+ * on the server (without a terminating 0), the server keeps them loaded between
+ * jobs. For SERVER_JOB_INLINE they are the instruction and data memory images.
+ * The input bytes are the console input of the guest (LB/LBU from 0x5004).
+ * The server runs a job for at most its own step and time limits, whatever
+ * max_steps_ asks for.
+ * A request with a bad magic or sizes over the limits is answered with
+ * CPU_ERROR_ARGUMENT / CPU_ERROR_SIZE and the connection is closed.
+ */
+
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include <stdint.h>
+
+#define SERVER_REQUEST_MAGIC 0x51525548	 //"HURQ"
+#define SERVER_RESPONSE_MAGIC 0x53525548 //"HURS"
+
+#define SERVER_MAX_PATH 4096
+#define SERVER_MAX_INSTR 0x100000
+#define SERVER_MAX_DATA 0x400000
+#define SERVER_MAX_INPUT 0x100000
+
+enum server_job
+{
+	SERVER_JOB_PATHS,
+	SERVER_JOB_INLINE
+};
+
+typedef struct
+{
+	uint32_t magic_;
+	uint32_t kind_;	  //enum server_job
+	uint32_t engine_; //enum engine of hurv.h
+	uint32_t reserved_;
+	uint64_t max_steps_;
+	uint32_t instr_size_;
+	uint32_t data_size_;
+	uint32_t input_size_;
+	uint32_t reserved2_;
+} SERVER_request;
+
+typedef struct
+{
+	uint32_t magic_;
+	int32_t status_; //CPU_OK or CPU_ERROR_*
+	uint32_t halted_;
+	uint32_t pc_;
+	uint64_t instret_;
+	uint64_t run_ns_; //time in CPU_run
+	uint32_t regfile_[32];
+	uint32_t output_size_;
+	uint32_t output_truncated_; //output beyond the limit of the server was dropped
+	uint32_t limited_;			//stopped by the step or time limit of the server, not the budget of the job
+	uint32_t fault_;			//halted at an access outside the data memory (CPU_get_fault)
+	uint32_t fault_address_;
+	uint32_t reserved_;
+} SERVER_response;
+
+#endif
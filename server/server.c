@@ -0,0 +1,582 @@
+/**
+ * Emulator server: runs jobs sent over a Unix domain socket (protocol.h) on a
+ * pool of CPUs that are created once at startup.
+ *
+ * Every worker thread owns one CPU and accepts connections on the shared socket.
+ * Images given by path are read once into a cache (and read again when the file
+ * changes); a worker whose CPU already holds the image of a job only resets it,
+ * which also keeps its pre-decoded blocks. Console output is collected per job
+ * and returned with the result. A job runs for at most --max-steps instructions
+ * and --timeout milliseconds whatever budget the client asks for, so a client
+ * cannot keep a worker busy; guest accesses outside the data memory halt the job
+ * (see CPU_run) and do not reach the server.
+ *
+ *   ./server/hu_risc-v_server <socket> [--workers=N] [--max-output=bytes] [--max-steps=N] [--timeout=ms]
+ *       [--preload=instr.bin,data.bin]...
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../hurv.h"
+#include "protocol.h"
+
+#define SERVER_DEFAULT_WORKERS 4
+#define SERVER_DEFAULT_MAX_OUTPUT 0x100000
+#define SERVER_CACHE_IMAGES 64
+#define SERVER_MAX_PRELOAD 16
+#define SERVER_DEFAULT_MAX_STEPS 10000000000ull
+#define SERVER_DEFAULT_TIMEOUT_MS 10000
+#define SERVER_SLICE_STEPS (1u << 22) //instructions between two looks at the clock
+
+typedef struct
+{
+	char *instr_path_;
+	char *data_path_;
+	struct stat instr_stat_; //to notice changed files
+	struct stat data_stat_;
+	uint8_t *instr_;
+	size_t instr_size_;
+	uint8_t *data_;
+	size_t data_size_;
+	uint64_t id_; //unique per load, 0 is never used
+	uint64_t last_used_;
+} SERVER_image;
+
+typedef struct
+{
+	pthread_mutex_t lock_;
+	SERVER_image images_[SERVER_CACHE_IMAGES];
+	int count_;
+	uint64_t next_id_;
+	uint64_t clock_;
+} SERVER_cache;
+
+typedef struct
+{
+	int listen_fd_;
+	size_t max_output_;
+	uint64_t max_steps_;
+	uint64_t timeout_ns_;
+	SERVER_cache cache_;
+} SERVER;
+
+typedef struct
+{
+	SERVER *server_;
+	pthread_t thread_;
+	CPU *cpu_;
+	uint64_t loaded_id_; //cache image the CPU holds, 0 if none
+	uint8_t *payload_;
+	size_t payload_capacity_;
+	uint8_t *output_;
+	size_t output_size_;
+	size_t output_capacity_;
+	int output_truncated_;
+	int output_failed_; //out of memory for the output, the job fails with CPU_ERROR_MEMORY
+	const uint8_t *input_;
+	size_t input_size_;
+	size_t input_position_;
+} SERVER_worker;
+
+static const char *SERVER_socket_path;
+
+static void SERVER_output(void *context, uint8_t byte)
+{
+	SERVER_worker *worker = context;
+	if (worker->output_size_ == worker->server_->max_output_)
+	{
+		worker->output_truncated_ = 1;
+		return;
+	}
+	if (worker->output_size_ == worker->output_capacity_)
+	{
+		size_t capacity = worker->output_capacity_ ? 2 * worker->output_capacity_ : 4096;
+		uint8_t *output = realloc(worker->output_, capacity);
+		if (!output)
+		{
+			worker->output_failed_ = 1;
+			return;
+		}
+		worker->output_ = output;
+		worker->output_capacity_ = capacity;
+	}
+	worker->output_[worker->output_size_++] = byte;
+}
+
+static int SERVER_input(void *context)
+{
+	SERVER_worker *worker = context;
+	return worker->input_position_ < worker->input_size_ ? worker->input_[worker->input_position_++] : -1;
+}
+
+static int SERVER_read_file(const char *path, uint8_t **data, size_t *size, struct stat *sb)
+{
+	FILE *file = fopen(path, "rb");
+	if (!file)
+	{
+		return CPU_ERROR_OPEN;
+	}
+	if (fstat(fileno(file), sb) == -1)
+	{
+		fclose(file);
+		return CPU_ERROR_OPEN;
+	}
+	*size = sb->st_size;
+	*data = malloc(*size ? *size : 1);
+	if (!*data)
+	{
+		fclose(file);
+		return CPU_ERROR_MEMORY;
+	}
+	if (fread(*data, 1, *size, file) != *size)
+	{
+		free(*data);
+		fclose(file);
+		return CPU_ERROR_OPEN;
+	}
+	fclose(file);
+	return CPU_OK;
+}
+
+static int SERVER_same_file(const struct stat *a, const struct stat *b)
+{
+	return a->st_ino == b->st_ino && a->st_dev == b->st_dev && a->st_size == b->st_size &&
+		   a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void SERVER_image_free(SERVER_image *image)
+{
+	free(image->instr_path_);
+	free(image->data_path_);
+	free(image->instr_);
+	free(image->data_);
+	memset(image, 0, sizeof(SERVER_image));
+}
+
+/**
+ * Loads the image into the worker's CPU, from the cache if it is there and the
+ * files did not change. A CPU that already holds it is only reset.
+ */
+static int SERVER_load_paths(SERVER_worker *worker, const char *instr_path, const char *data_path)
+{
+	SERVER_cache *cache = &worker->server_->cache_;
+	struct stat instr_stat, data_stat;
+	if (stat(instr_path, &instr_stat) == -1 || stat(data_path, &data_stat) == -1)
+	{
+		return CPU_ERROR_OPEN;
+	}
+
+	pthread_mutex_lock(&cache->lock_);
+	SERVER_image *image = NULL;
+	for (int i = 0; i < cache->count_; i++)
+	{
+		SERVER_image *entry = &cache->images_[i];
+		if (strcmp(entry->instr_path_, instr_path) == 0 && strcmp(entry->data_path_, data_path) == 0)
+		{
+			if (SERVER_same_file(&entry->instr_stat_, &instr_stat) && SERVER_same_file(&entry->data_stat_, &data_stat))
+			{
+				image = entry;
+			}
+			else
+			{
+				//changed on disk, the entry is loaded again below
+				SERVER_image_free(entry);
+				cache->images_[i] = cache->images_[--cache->count_];
+			}
+			break;
+		}
+	}
+
+	if (!image)
+	{
+		//a free slot or the least recently used one
+		int slot = cache->count_;
+		if (slot == SERVER_CACHE_IMAGES)
+		{
+			slot = 0;
+			for (int i = 1; i < cache->count_; i++)
+			{
+				if (cache->images_[i].last_used_ < cache->images_[slot].last_used_)
+				{
+					slot = i;
+				}
+			}
+			SERVER_image_free(&cache->images_[slot]);
+		}
+		else
+		{
+			cache->count_++;
+		}
+		image = &cache->images_[slot];
+		int status = SERVER_read_file(instr_path, &image->instr_, &image->instr_size_, &image->instr_stat_);
+		if (status == CPU_OK)
+		{
+			status = SERVER_read_file(data_path, &image->data_, &image->data_size_, &image->data_stat_);
+			if (status != CPU_OK)
+			{
+				free(image->instr_);
+			}
+		}
+		if (status != CPU_OK)
+		{
+			memset(image, 0, sizeof(SERVER_image));
+			cache->images_[slot] = cache->images_[--cache->count_];
+			pthread_mutex_unlock(&cache->lock_);
+			return status;
+		}
+		image->instr_path_ = strdup(instr_path);
+		image->data_path_ = strdup(data_path);
+		if (!image->instr_path_ || !image->data_path_)
+		{
+			SERVER_image_free(image);
+			cache->images_[slot] = cache->images_[--cache->count_];
+			pthread_mutex_unlock(&cache->lock_);
+			return CPU_ERROR_MEMORY;
+		}
+		image->id_ = ++cache->next_id_;
+	}
+	image->last_used_ = ++cache->clock_;
+
+	if (worker->loaded_id_ == image->id_)
+	{
+		pthread_mutex_unlock(&cache->lock_);
+		CPU_reset(worker->cpu_);
+		return CPU_OK;
+	}
+	//the images are copied into the CPU, the cache entry may go away afterwards
+	int status = CPU_load_image(worker->cpu_, image->instr_, image->instr_size_, image->data_, image->data_size_);
+	worker->loaded_id_ = status == CPU_OK ? image->id_ : 0;
+	pthread_mutex_unlock(&cache->lock_);
+	return status;
+}
+
+static int SERVER_read_all(int fd, void *buffer, size_t size)
+{
+	uint8_t *p = buffer;
+	while (size)
+	{
+		ssize_t n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int SERVER_write_all(int fd, const void *buffer, size_t size)
+{
+	const uint8_t *p = buffer;
+	while (size)
+	{
+		ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if (n <= 0)
+		{
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
+}
+
+static int SERVER_reply(SERVER_worker *worker, int fd, int status, uint64_t run_ns, int limited)
+{
+	SERVER_response response;
+	memset(&response, 0, sizeof(response));
+	response.magic_ = SERVER_RESPONSE_MAGIC;
+	response.status_ = status;
+	if (status == CPU_OK)
+	{
+		response.halted_ = CPU_is_halted(worker->cpu_);
+		response.pc_ = CPU_get_pc(worker->cpu_);
+		response.instret_ = CPU_get_instret(worker->cpu_);
+		response.run_ns_ = run_ns;
+		for (int i = 0; i < 32; i++)
+		{
+			response.regfile_[i] = CPU_get_register(worker->cpu_, i);
+		}
+		response.output_size_ = worker->output_size_;
+		response.output_truncated_ = worker->output_truncated_;
+		response.limited_ = limited;
+		response.fault_ = CPU_get_fault(worker->cpu_, &response.fault_address_);
+	}
+	if (SERVER_write_all(fd, &response, sizeof(response)) == -1)
+	{
+		return -1;
+	}
+	return SERVER_write_all(fd, worker->output_, response.output_size_);
+}
+
+//one job of a connection, -1 if the connection has to be closed
+static int SERVER_job(SERVER_worker *worker, int fd)
+{
+	SERVER_request request;
+	if (SERVER_read_all(fd, &request, sizeof(request)) == -1)
+	{
+		return -1;
+	}
+	worker->output_size_ = 0;
+	worker->output_truncated_ = 0;
+	worker->output_failed_ = 0;
+	if (request.magic_ != SERVER_REQUEST_MAGIC || request.kind_ > SERVER_JOB_INLINE)
+	{
+		SERVER_reply(worker, fd, CPU_ERROR_ARGUMENT, 0, 0);
+		return -1;
+	}
+	size_t limit_instr = request.kind_ == SERVER_JOB_PATHS ? SERVER_MAX_PATH : SERVER_MAX_INSTR;
+	size_t limit_data = request.kind_ == SERVER_JOB_PATHS ? SERVER_MAX_PATH : SERVER_MAX_DATA;
+	if (request.instr_size_ > limit_instr || request.data_size_ > limit_data || request.input_size_ > SERVER_MAX_INPUT)
+	{
+		SERVER_reply(worker, fd, CPU_ERROR_SIZE, 0, 0);
+		return -1;
+	}
+
+	//paths get a terminating 0 each
+	size_t size = (size_t)request.instr_size_ + request.data_size_ + request.input_size_ + 2;
+	if (size > worker->payload_capacity_)
+	{
+		uint8_t *payload = realloc(worker->payload_, size);
+		if (!payload)
+		{
+			//the payload is not read, the connection cannot go on
+			SERVER_reply(worker, fd, CPU_ERROR_MEMORY, 0, 0);
+			return -1;
+		}
+		worker->payload_ = payload;
+		worker->payload_capacity_ = size;
+	}
+	uint8_t *instr = worker->payload_;
+	uint8_t *data = instr + request.instr_size_ + 1;
+	uint8_t *input = data + request.data_size_ + 1;
+	if (SERVER_read_all(fd, instr, request.instr_size_) == -1 || SERVER_read_all(fd, data, request.data_size_) == -1 ||
+		SERVER_read_all(fd, input, request.input_size_) == -1)
+	{
+		return -1;
+	}
+	instr[request.instr_size_] = '\0';
+	data[request.data_size_] = '\0';
+
+	int status;
+	if (request.kind_ == SERVER_JOB_PATHS)
+	{
+		status = SERVER_load_paths(worker, (const char *)instr, (const char *)data);
+	}
+	else
+	{
+		status = CPU_load_image(worker->cpu_, instr, request.instr_size_, data, request.data_size_);
+		worker->loaded_id_ = 0;
+	}
+	if (status == CPU_OK)
+	{
+		status = CPU_set_engine(worker->cpu_, request.engine_);
+	}
+	if (status != CPU_OK)
+	{
+		return SERVER_reply(worker, fd, status, 0, 0);
+	}
+
+	worker->input_ = input;
+	worker->input_size_ = request.input_size_;
+	worker->input_position_ = 0;
+
+	//the budget of the client within the limits of the server, run in slices to watch the clock
+	SERVER *server = worker->server_;
+	uint64_t steps = request.max_steps_ < server->max_steps_ ? request.max_steps_ : server->max_steps_;
+	int limited = 0;
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	uint64_t run_ns = 0;
+	for (;;)
+	{
+		uint64_t slice = steps < SERVER_SLICE_STEPS ? steps : SERVER_SLICE_STEPS;
+		uint64_t done = CPU_run(worker->cpu_, slice);
+		steps -= done;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		run_ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000u + end.tv_nsec - start.tv_nsec;
+		if (done < slice || !steps || CPU_is_halted(worker->cpu_) || CPU_is_waiting(worker->cpu_))
+		{
+			limited = !steps && request.max_steps_ > server->max_steps_ && !CPU_is_halted(worker->cpu_);
+			break;
+		}
+		if (run_ns >= server->timeout_ns_)
+		{
+			limited = 1;
+			break;
+		}
+	}
+	return SERVER_reply(worker, fd, worker->output_failed_ ? CPU_ERROR_MEMORY : CPU_OK, run_ns, limited);
+}
+
+static void *SERVER_worker_main(void *arg)
+{
+	SERVER_worker *worker = arg;
+	for (;;)
+	{
+		int fd = accept(worker->server_->listen_fd_, NULL, NULL);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			perror("accept");
+			return NULL;
+		}
+		while (SERVER_job(worker, fd) == 0)
+		{
+		}
+		close(fd);
+	}
+}
+
+static void SERVER_stop(int signal)
+{
+	unlink(SERVER_socket_path);
+	_exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: %s <socket> [--workers=N] [--max-output=bytes] [--max-steps=N] [--timeout=ms]"
+			   " [--preload=instr.bin,data.bin]...\n",
+			   argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int workers = SERVER_DEFAULT_WORKERS;
+	SERVER server;
+	memset(&server, 0, sizeof(server));
+	server.max_output_ = SERVER_DEFAULT_MAX_OUTPUT;
+	server.max_steps_ = SERVER_DEFAULT_MAX_STEPS;
+	server.timeout_ns_ = SERVER_DEFAULT_TIMEOUT_MS * 1000000ull;
+	pthread_mutex_init(&server.cache_.lock_, NULL);
+	char *preload[SERVER_MAX_PRELOAD];
+	int preload_count = 0;
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--workers=", 10) == 0)
+		{
+			workers = atoi(argv[i] + 10);
+		}
+		else if (strncmp(argv[i], "--max-output=", 13) == 0)
+		{
+			server.max_output_ = strtoull(argv[i] + 13, NULL, 0);
+		}
+		else if (strncmp(argv[i], "--max-steps=", 12) == 0)
+		{
+			server.max_steps_ = strtoull(argv[i] + 12, NULL, 0);
+		}
+		else if (strncmp(argv[i], "--timeout=", 10) == 0)
+		{
+			server.timeout_ns_ = strtoull(argv[i] + 10, NULL, 0) * 1000000ull;
+		}
+		else if (strncmp(argv[i], "--preload=", 10) == 0 && strchr(argv[i] + 10, ',') && preload_count < SERVER_MAX_PRELOAD)
+		{
+			preload[preload_count++] = argv[i] + 10;
+		}
+		else
+		{
+			printf("unknown option: %s\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (workers < 1)
+	{
+		workers = 1;
+	}
+
+	SERVER_worker *pool = calloc(workers, sizeof(SERVER_worker));
+	if (!pool)
+	{
+		printf("%s\n", CPU_error_string(CPU_ERROR_MEMORY));
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < workers; i++)
+	{
+		pool[i].server_ = &server;
+		pool[i].cpu_ = CPU_create();
+		if (!pool[i].cpu_)
+		{
+			printf("%s\n", CPU_error_string(CPU_ERROR_MEMORY));
+			return EXIT_FAILURE;
+		}
+		CPU_set_output(pool[i].cpu_, SERVER_output, &pool[i]);
+		CPU_set_input(pool[i].cpu_, SERVER_input, &pool[i]);
+	}
+
+	//the last preloaded image stays in the CPUs
+	for (int i = 0; i < preload_count; i++)
+	{
+		char *comma = strchr(preload[i], ',');
+		*comma = '\0';
+		for (int j = 0; j < workers; j++)
+		{
+			int status = SERVER_load_paths(&pool[j], preload[i], comma + 1);
+			if (status != CPU_OK)
+			{
+				printf("cannot preload %s / %s: %s\n", preload[i], comma + 1, CPU_error_string(status));
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(argv[1]) >= sizeof(address.sun_path))
+	{
+		printf("socket path too long: %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	strcpy(address.sun_path, argv[1]);
+	server.listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(argv[1]);
+	if (server.listen_fd_ < 0 || bind(server.listen_fd_, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+		listen(server.listen_fd_, 128) == -1)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+	SERVER_socket_path = argv[1];
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, SERVER_stop);
+	signal(SIGTERM, SERVER_stop);
+
+	printf("listening on %s with %d workers\n", argv[1], workers);
+	fflush(stdout);
+	for (int i = 0; i < workers; i++)
+	{
+		pthread_create(&pool[i].thread_, NULL, SERVER_worker_main, &pool[i]);
+	}
+	for (int i = 0; i < workers; i++)
+	{
+		pthread_join(pool[i].thread_, NULL);
+	}
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,100 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Multi-hart emulation
+ *
+ * Every hart is a CPU of its own; the harts made with CPU_create_hart share the
+ * instruction and data memory of the boot hart and tell each other apart by
+ * mhartid. CPU_run_smp runs them on one host thread each. Plain loads and stores
+ * go to the shared memory directly (the host's memory order, TSO on x86), the A
+ * extension and FENCE use host atomics, see the handlers in cpu.c.
+ */
+
+CPU *CPU_create_hart(CPU *boot, uint32_t hartid)
+{
+	if (!boot || boot->memory_owner_)
+	{
+		return NULL;
+	}
+	CPU *cpu = (CPU *)calloc(1, sizeof(CPU));
+	if (!cpu)
+	{
+		return NULL;
+	}
+	cpu->memory_owner_ = boot;
+	cpu->hartid_ = hartid;
+	cpu->instr_mem_ = boot->instr_mem_;
+	cpu->instr_mem_size_ = boot->instr_mem_size_;
+	cpu->data_mem_ = boot->data_mem_;
+	cpu->data_mem_size_ = boot->data_mem_size_;
+	cpu->data_limit_ = boot->data_mem_size_;
+	cpu->data_mem_mapped_ = boot->data_mem_mapped_;
+	cpu->data_mem_backing_ = boot->data_mem_backing_;
+	cpu->engine_ = boot->engine_;
+	memcpy(cpu->tier_thresholds_, boot->tier_thresholds_, sizeof(cpu->tier_thresholds_));
+	cpu->ir_optimize_ = boot->ir_optimize_;
+	cpu->output_ = boot->output_;
+	cpu->output_context_ = boot->output_context_;
+	VEC_reset(cpu);
+	return cpu;
+}
+
+uint32_t CPU_get_hartid(const CPU *cpu)
+{
+	return cpu->hartid_;
+}
+
+typedef struct
+{
+	CPU *cpu_;
+	uint64_t max_steps_;
+	pthread_t thread_;
+} SMP_hart;
+
+static void *SMP_run(void *argument)
+{
+	SMP_hart *hart = argument;
+	CPU_run(hart->cpu_, hart->max_steps_);
+	return NULL;
+}
+
+int CPU_run_smp(CPU **harts, int count, uint64_t max_steps)
+{
+	if (count <= 0)
+	{
+		return CPU_OK;
+	}
+	SMP_hart *threads = calloc(count, sizeof(SMP_hart));
+	if (!threads)
+	{
+		return CPU_ERROR_MEMORY;
+	}
+
+	//the first hart runs on the calling thread, so its instrumentation stays there
+	int started = 1;
+	int status = CPU_OK;
+	for (; started < count; started++)
+	{
+		threads[started].cpu_ = harts[started];
+		threads[started].max_steps_ = max_steps;
+		if (pthread_create(&threads[started].thread_, NULL, SMP_run, &threads[started]) != 0)
+		{
+			status = CPU_ERROR_MEMORY;
+			break;
+		}
+	}
+	if (status == CPU_OK)
+	{
+		CPU_run(harts[0], max_steps);
+	}
+	for (int i = 1; i < started; i++)
+	{
+		pthread_join(threads[i].thread_, NULL);
+	}
+	free(threads);
+	return status;
+}
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Symbol tables of guest programs, read from the ELF symbol table or from a GNU
+ * ld .map file. The sampling profiler names its frames with them, the function
+ * hooks find the functions they replace.
+ */
+
+//-1 if out of memory
+static int SYM_add(SYM_table *table, uint32_t addr, uint32_t size, const char *name, size_t length)
+{
+	//local labels of the assembler and the RISC-V mapping symbols are no functions
+	if (length == 0 || (length >= 2 && name[0] == '.' && name[1] == 'L') || name[0] == '$')
+	{
+		return 0;
+	}
+	if (table->count_ == table->capacity_)
+	{
+		size_t capacity = table->capacity_ ? 2 * table->capacity_ : 256;
+		SYM_symbol *symbols = realloc(table->symbols_, capacity * sizeof(SYM_symbol));
+		if (!symbols)
+		{
+			return -1;
+		}
+		table->symbols_ = symbols;
+		table->capacity_ = capacity;
+	}
+	char *copy = strndup(name, length);
+	if (!copy)
+	{
+		return -1;
+	}
+	SYM_symbol *symbol = &table->symbols_[table->count_++];
+	symbol->addr_ = addr & 0xFFFFF;
+	symbol->size_ = size;
+	symbol->name_ = copy;
+	return 0;
+}
+
+static int SYM_compare(const void *a, const void *b)
+{
+	const SYM_symbol *left = a;
+	const SYM_symbol *right = b;
+	return left->addr_ < right->addr_ ? -1 : left->addr_ > right->addr_ ? 1 : 0;
+}
+
+//symbols of the executable sections of an ELF32 file, -1 if the file is damaged or out of memory
+static int SYM_load_elf(SYM_table *table, const uint8_t *data, size_t size)
+{
+	const Elf32_Ehdr *header = (const Elf32_Ehdr *)data;
+	if (size < sizeof(Elf32_Ehdr) || header->e_ident[EI_CLASS] != ELFCLASS32 ||
+		header->e_shentsize != sizeof(Elf32_Shdr) || header->e_shoff + (size_t)header->e_shnum * sizeof(Elf32_Shdr) > size)
+	{
+		return -1;
+	}
+	const Elf32_Shdr *sections = (const Elf32_Shdr *)(data + header->e_shoff);
+
+	for (size_t i = 0; i < header->e_shnum; i++)
+	{
+		const Elf32_Shdr *symtab = &sections[i];
+		if (symtab->sh_type != SHT_SYMTAB || symtab->sh_link >= header->e_shnum)
+		{
+			continue;
+		}
+		const Elf32_Shdr *strtab = &sections[symtab->sh_link];
+		if (symtab->sh_offset + (size_t)symtab->sh_size > size || strtab->sh_offset + (size_t)strtab->sh_size > size)
+		{
+			return -1;
+		}
+		const Elf32_Sym *symbols = (const Elf32_Sym *)(data + symtab->sh_offset);
+		const char *names = (const char *)(data + strtab->sh_offset);
+
+		for (size_t j = 0; j < symtab->sh_size / sizeof(Elf32_Sym); j++)
+		{
+			const Elf32_Sym *symbol = &symbols[j];
+			int type = ELF32_ST_TYPE(symbol->st_info);
+			if ((type != STT_FUNC && type != STT_NOTYPE) || symbol->st_shndx == SHN_UNDEF ||
+				symbol->st_shndx >= header->e_shnum || !(sections[symbol->st_shndx].sh_flags & SHF_EXECINSTR) ||
+				symbol->st_name >= strtab->sh_size)
+			{
+				continue;
+			}
+			const char *name = names + symbol->st_name;
+			if (SYM_add(table, symbol->st_value, symbol->st_size, name, strnlen(name, strtab->sh_size - symbol->st_name)) == -1)
+			{
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+//"                0x80000094                main" lines below .init/.text of a GNU ld map file, -1 if out of memory
+static int SYM_load_map(SYM_table *table, const char *data, size_t size)
+{
+	int in_text = 0;
+	const char *end = data + size;
+
+	for (const char *line = data; line < end;)
+	{
+		const char *next = memchr(line, '\n', end - line);
+		next = next ? next + 1 : end;
+
+		const char *p = line;
+		while (p < next && (*p == ' ' || *p == '\t'))
+		{
+			p++;
+		}
+		if (p < next && *p == '.')
+		{
+			//output section or input section line, e.g. " .text  0x80000000  0x1c0 main.o"
+			in_text = strncmp(p, ".text", 5) == 0 || strncmp(p, ".init", 5) == 0;
+		}
+		else if (in_text && p > line && next - p > 2 && p[0] == '0' && p[1] == 'x')
+		{
+			char *after;
+			uint32_t addr = strtoul(p, &after, 16);
+			while (after < next && (*after == ' ' || *after == '\t'))
+			{
+				after++;
+			}
+			const char *name = after;
+			while (after < next && (*after == '_' || *after == '.' || *after == '$' || (*after >= '0' && *after <= '9') ||
+									((*after | 0x20) >= 'a' && (*after | 0x20) <= 'z')))
+			{
+				after++;
+			}
+			//assignments ("_end = .") and PROVIDE lines have more on the line
+			const char *rest = after;
+			while (rest < next && (*rest == ' ' || *rest == '\t' || *rest == '\r' || *rest == '\n'))
+			{
+				rest++;
+			}
+			if (after > name && rest == next && !(*name >= '0' && *name <= '9') && SYM_add(table, addr, 0, name, after - name) == -1)
+			{
+				return -1;
+			}
+		}
+		line = next;
+	}
+	return 0;
+}
+
+//adds the symbols of an ELF file or a GNU ld map file and sorts the table by address, -1 on error
+int SYM_load(SYM_table *table, const char *filename)
+{
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+	{
+		return -1;
+	}
+	struct stat sb;
+	if (fstat(fileno(file), &sb) == -1)
+	{
+		fclose(file);
+		return -1;
+	}
+	char *data = malloc(sb.st_size + 1);
+	if (!data)
+	{
+		fclose(file);
+		return -1;
+	}
+	size_t size = fread(data, 1, sb.st_size, file);
+	fclose(file);
+	data[size] = '\0';
+
+	int status = size >= SELFMAG && memcmp(data, ELFMAG, SELFMAG) == 0
+					 ? SYM_load_elf(table, (const uint8_t *)data, size)
+					 : SYM_load_map(table, data, size);
+	free(data);
+
+	qsort(table->symbols_, table->count_, sizeof(SYM_symbol), SYM_compare);
+	return status;
+}
+
+//symbol containing pc, NULL if there is none
+const SYM_symbol *SYM_lookup(const SYM_table *table, uint32_t pc)
+{
+	size_t low = 0;
+	size_t high = table->count_;
+	pc &= 0xFFFFF;
+	while (low < high)
+	{
+		size_t middle = (low + high) / 2;
+		if (table->symbols_[middle].addr_ <= pc)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+	if (low == 0)
+	{
+		return NULL;
+	}
+	const SYM_symbol *symbol = &table->symbols_[low - 1];
+	if (symbol->size_ && pc >= symbol->addr_ + symbol->size_)
+	{
+		return NULL;
+	}
+	return symbol;
+}
+
+//symbol of that name, NULL if there is none
+const SYM_symbol *SYM_find(const SYM_table *table, const char *name)
+{
+	for (size_t i = 0; i < table->count_; i++)
+	{
+		if (strcmp(table->symbols_[i].name_, name) == 0)
+		{
+			return &table->symbols_[i];
+		}
+	}
+	return NULL;
+}
+
+void SYM_free(SYM_table *table)
+{
+	for (size_t i = 0; i < table->count_; i++)
+	{
+		free(table->symbols_[i].name_);
+	}
+	free(table->symbols_);
+	table->symbols_ = NULL;
+	table->count_ = table->capacity_ = 0;
+}
@@ -0,0 +1,606 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#if defined(__has_include) && __has_include(<linux/openat2.h>)
+#include <asm/unistd.h>
+#include <linux/openat2.h>
+#endif
+
+#include "hurv_internal.h"
+
+/**
+ * System calls
+ *
+ * ECALL with the numbers and structures of newlib's libgloss for RISC-V, so a
+ * guest linked against newlib does its I/O on the host. read and write hand
+ * the guest buffer in the data memory to the host call, there is no copy in
+ * between. The guest can only open files inside the sandbox directories: the
+ * path is made absolute and "." and ".." are folded without looking at the
+ * file system, and the part below a sandbox directory is opened relative to a
+ * descriptor of that directory with openat2 (RESOLVE_BENEATH and no symbolic
+ * links), so neither a link nor a rename between check and open leads out.
+ * The errno values of the host are the ones of newlib for everything a guest
+ * sees here. There is no ECALL translation, the translated tier runs it as a
+ * call, which also keeps the IR from forwarding memory across a read.
+ */
+
+//numbers of libgloss/riscv/machine/syscall.h
+enum SYS_number
+{
+	SYS_OPENAT = 56,
+	SYS_CLOSE = 57,
+	SYS_LSEEK = 62,
+	SYS_READ = 63,
+	SYS_WRITE = 64,
+	SYS_FSTAT = 80,
+	SYS_EXIT = 93,
+	SYS_EXIT_GROUP = 94,
+	SYS_GETTIMEOFDAY = 169,
+	SYS_BRK = 214,
+	SYS_CLOCK_GETTIME64 = 403,
+	SYS_OPEN = 1024
+};
+
+//open flags of newlib's sys/_default_fcntl.h
+#define SYS_O_ACCMODE 0x0003
+#define SYS_O_APPEND 0x0008
+#define SYS_O_CREAT 0x0200
+#define SYS_O_TRUNC 0x0400
+#define SYS_O_EXCL 0x0800
+#define SYS_AT_FDCWD (-100)
+
+//[addr, addr + size) is in the data memory
+static int SYS_range(const CPU *cpu, uint32_t addr, uint64_t size)
+{
+	return (uint64_t)addr + size <= cpu->data_mem_size_;
+}
+
+//host descriptor of a guest fd, -1 if it is not open
+static int SYS_file(const SYS_state *sys, uint32_t fd)
+{
+	return fd < CPU_SYSCALL_FILES ? sys->files_[fd] : -1;
+}
+
+//copies the NUL terminated guest string at addr into path
+static int64_t SYS_path(const CPU *cpu, uint32_t addr, char *path)
+{
+	if (addr >= cpu->data_mem_size_)
+	{
+		return -EFAULT;
+	}
+	size_t scan = cpu->data_mem_size_ - addr < PATH_MAX ? cpu->data_mem_size_ - addr : PATH_MAX;
+	const uint8_t *end = memchr(cpu->data_mem_ + addr, 0, scan);
+	if (!end)
+	{
+		return scan < PATH_MAX ? -EFAULT : -ENAMETOOLONG;
+	}
+	memcpy(path, cpu->data_mem_ + addr, end - (cpu->data_mem_ + addr) + 1);
+	return 0;
+}
+
+//the absolute path with "." and ".." folded, without looking at the file system
+static int64_t SYS_absolute(const char *path, char *absolute)
+{
+	char joined[2 * PATH_MAX];
+	if (path[0] == '/')
+	{
+		strcpy(joined, path);
+	}
+	else
+	{
+		if (!getcwd(joined, PATH_MAX))
+		{
+			return -errno;
+		}
+		strcat(joined, "/");
+		strcat(joined, path);
+	}
+	size_t length = 0;
+	char *save;
+	for (char *component = strtok_r(joined, "/", &save); component; component = strtok_r(NULL, "/", &save))
+	{
+		if (strcmp(component, ".") == 0)
+		{
+			continue;
+		}
+		if (strcmp(component, "..") == 0)
+		{
+			while (length && absolute[--length] != '/')
+			{
+			}
+			continue;
+		}
+		size_t size = strlen(component);
+		if (length + 1 + size >= PATH_MAX)
+		{
+			return -ENAMETOOLONG;
+		}
+		absolute[length++] = '/';
+		memcpy(absolute + length, component, size);
+		length += size;
+	}
+	if (!length)
+	{
+		absolute[length++] = '/';
+	}
+	absolute[length] = '\0';
+	return 0;
+}
+
+//the sandbox directory of path and the part of path below it, "." for the directory itself
+static int64_t SYS_sandbox(const SYS_state *sys, const char *path, int *directory, const char **relative)
+{
+	for (size_t i = 0; i < sys->allowed_count_; i++)
+	{
+		const char *allowed = sys->allowed_[i];
+		size_t length = strcmp(allowed, "/") == 0 ? 0 : strlen(allowed);
+		if (strncmp(path, allowed, length) == 0 && (path[length] == '\0' || path[length] == '/'))
+		{
+			*directory = sys->allowed_fds_[i];
+			*relative = path[length] && path[length + 1] ? path + length + 1 : ".";
+			return 0;
+		}
+	}
+	return -EACCES;
+}
+
+//opens relative (no "." or ".." but a lone ".") below directory without following symbolic links
+static int64_t SYS_open_beneath(int directory, const char *relative, int flags, mode_t mode)
+{
+#ifdef __NR_openat2
+	struct open_how how;
+	memset(&how, 0, sizeof(how));
+	how.flags = flags;
+	how.mode = flags & O_CREAT ? mode : 0;
+	how.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS;
+	long host = syscall(__NR_openat2, directory, relative, &how, sizeof(how));
+	if (host != -1)
+	{
+		return host;
+	}
+	if (errno != ENOSYS)
+	{
+		return -errno;
+	}
+#endif
+	//kernels before 5.6: every directory on the way is opened without following a link
+	char path[PATH_MAX];
+	strcpy(path, relative);
+	int current = directory;
+	char *component = path;
+	for (char *slash; (slash = strchr(component, '/')); component = slash + 1)
+	{
+		*slash = '\0';
+		int next = openat(current, component, O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+		int error = errno;
+		if (current != directory)
+		{
+			close(current);
+		}
+		if (next == -1)
+		{
+			return -error;
+		}
+		current = next;
+	}
+	//the file itself is never a link, and it is created only where there is nothing yet
+	int fd;
+	if ((flags & O_CREAT) && !(flags & O_EXCL))
+	{
+		fd = openat(current, component, (flags & ~O_CREAT) | O_NOFOLLOW);
+		if (fd == -1 && errno == ENOENT)
+		{
+			fd = openat(current, component, flags | O_EXCL | O_NOFOLLOW, mode);
+		}
+	}
+	else
+	{
+		fd = openat(current, component, flags | O_NOFOLLOW, mode);
+	}
+	int error = errno;
+	if (current != directory)
+	{
+		close(current);
+	}
+	return fd == -1 ? -error : fd;
+}
+
+static int64_t SYS_open(CPU *cpu, int32_t dirfd, uint32_t name, uint32_t flags, uint32_t mode)
+{
+	SYS_state *sys = cpu->syscalls_;
+	char path[PATH_MAX];
+	char absolute[PATH_MAX];
+	int directory;
+	const char *relative;
+	if (dirfd != SYS_AT_FDCWD)
+	{
+		return -EBADF;
+	}
+	int64_t status = SYS_path(cpu, name, path);
+	if (status == 0)
+	{
+		status = SYS_absolute(path, absolute);
+	}
+	if (status == 0)
+	{
+		status = SYS_sandbox(sys, absolute, &directory, &relative);
+	}
+	if (status != 0)
+	{
+		return status;
+	}
+	int fd = 0;
+	while (fd < CPU_SYSCALL_FILES && sys->files_[fd] != -1)
+	{
+		fd++;
+	}
+	if (fd == CPU_SYSCALL_FILES)
+	{
+		return -EMFILE;
+	}
+	static const int access[] = {O_RDONLY, O_WRONLY, O_RDWR, O_RDWR};
+	int host_flags = access[flags & SYS_O_ACCMODE] | O_CLOEXEC | (flags & SYS_O_APPEND ? O_APPEND : 0) |
+					 (flags & SYS_O_CREAT ? O_CREAT : 0) | (flags & SYS_O_TRUNC ? O_TRUNC : 0) |
+					 (flags & SYS_O_EXCL ? O_EXCL : 0);
+	int64_t host = SYS_open_beneath(directory, relative, host_flags, mode & 0777);
+	if (host < 0)
+	{
+		return host;
+	}
+	sys->files_[fd] = host;
+	return fd;
+}
+
+static int64_t SYS_close(CPU *cpu, uint32_t fd)
+{
+	SYS_state *sys = cpu->syscalls_;
+	int host = SYS_file(sys, fd);
+	if (host == -1)
+	{
+		return -EBADF;
+	}
+	sys->files_[fd] = -1;
+	//the standard streams belong to the emulator
+	return host > STDERR_FILENO && close(host) == -1 ? -errno : 0;
+}
+
+static int64_t SYS_read(CPU *cpu, uint32_t fd, uint32_t buffer, uint32_t count)
+{
+	int host = SYS_file(cpu->syscalls_, fd);
+	if (host == -1)
+	{
+		return -EBADF;
+	}
+	if (!SYS_range(cpu, buffer, count))
+	{
+		return -EFAULT;
+	}
+	ssize_t done = read(host, cpu->data_mem_ + buffer, count);
+	if (done == -1)
+	{
+		return -errno;
+	}
+	cpu->syscalls_->stats_.read_ += done;
+	return done;
+}
+
+static int64_t SYS_write(CPU *cpu, uint32_t fd, uint32_t buffer, uint32_t count)
+{
+	int host = SYS_file(cpu->syscalls_, fd);
+	if (host == -1)
+	{
+		return -EBADF;
+	}
+	if (!SYS_range(cpu, buffer, count))
+	{
+		return -EFAULT;
+	}
+	ssize_t done;
+	if ((host == STDOUT_FILENO || host == STDERR_FILENO) && cpu->output_ != CPU_output_stdout)
+	{
+		//the console of the CPU, e.g. the buffer of an instance
+		for (uint32_t i = 0; i < count; i++)
+		{
+			cpu->output_(cpu->output_context_, cpu->data_mem_[buffer + i]);
+		}
+		done = count;
+	}
+	else
+	{
+		//the console bytes written so far go first
+		if (host == STDOUT_FILENO)
+		{
+			fflush(stdout);
+		}
+		done = write(host, cpu->data_mem_ + buffer, count);
+		if (done == -1)
+		{
+			return -errno;
+		}
+	}
+	cpu->syscalls_->stats_.written_ += done;
+	return done;
+}
+
+static int64_t SYS_lseek(CPU *cpu, uint32_t fd, int32_t offset, uint32_t whence)
+{
+	int host = SYS_file(cpu->syscalls_, fd);
+	if (host == -1)
+	{
+		return -EBADF;
+	}
+	if (whence > SEEK_END)
+	{
+		return -EINVAL;
+	}
+	off_t position = lseek(host, offset, whence);
+	if (position == -1)
+	{
+		return -errno;
+	}
+	return position > INT32_MAX ? -EOVERFLOW : position;
+}
+
+static void SYS_store32(CPU *cpu, uint32_t addr, uint32_t value)
+{
+	memcpy(cpu->data_mem_ + addr, &value, 4);
+}
+
+static void SYS_store64(CPU *cpu, uint32_t addr, uint64_t value)
+{
+	memcpy(cpu->data_mem_ + addr, &value, 8);
+}
+
+//struct kernel_stat of libgloss up to st_blocks, the times are left alone
+static int64_t SYS_fstat(CPU *cpu, uint32_t fd, uint32_t buffer)
+{
+	int host = SYS_file(cpu->syscalls_, fd);
+	struct stat sb;
+	if (host == -1)
+	{
+		return -EBADF;
+	}
+	if (!SYS_range(cpu, buffer, 72))
+	{
+		return -EFAULT;
+	}
+	if (fstat(host, &sb) == -1)
+	{
+		return -errno;
+	}
+	memset(cpu->data_mem_ + buffer, 0, 72);
+	SYS_store64(cpu, buffer, sb.st_dev);
+	SYS_store64(cpu, buffer + 8, sb.st_ino);
+	SYS_store32(cpu, buffer + 16, sb.st_mode);
+	SYS_store32(cpu, buffer + 20, sb.st_nlink);
+	SYS_store32(cpu, buffer + 24, sb.st_uid);
+	SYS_store32(cpu, buffer + 28, sb.st_gid);
+	SYS_store64(cpu, buffer + 32, sb.st_rdev);
+	SYS_store64(cpu, buffer + 48, sb.st_size);
+	SYS_store32(cpu, buffer + 56, sb.st_blksize);
+	SYS_store64(cpu, buffer + 64, sb.st_blocks);
+	return 0;
+}
+
+//struct timeval or struct timespec of newlib, a 64 bit time_t and a 32 bit fraction
+static int64_t SYS_time(CPU *cpu, uint32_t buffer, int nanoseconds)
+{
+	struct timespec now;
+	if (!SYS_range(cpu, buffer, 12))
+	{
+		return -EFAULT;
+	}
+	clock_gettime(CLOCK_REALTIME, &now);
+	SYS_store64(cpu, buffer, now.tv_sec);
+	SYS_store32(cpu, buffer + 8, nanoseconds ? now.tv_nsec : now.tv_nsec / 1000);
+	return 0;
+}
+
+static uint32_t SYS_brk_base(const CPU *cpu)
+{
+	const CPU *owner = cpu->memory_owner_ ? cpu->memory_owner_ : cpu;
+	return cpu->syscalls_->brk_base_ ? cpu->syscalls_->brk_base_ : (owner->data_image_size_ + 0xFFF) & ~0xFFFu;
+}
+
+//the new break, or the old one if it cannot move there
+static int64_t SYS_brk(CPU *cpu, uint32_t addr)
+{
+	SYS_state *sys = cpu->syscalls_;
+	//the heap grows up to the stack
+	uint64_t limit = cpu->regfile_[2] ? cpu->regfile_[2] : cpu->data_mem_size_;
+	if (addr >= SYS_brk_base(cpu) && addr <= limit && addr <= cpu->data_mem_size_)
+	{
+		sys->brk_ = addr;
+	}
+	return sys->brk_;
+}
+
+void ECALL(CPU *cpu, uint32_t instruction)
+{
+	SYS_state *sys = cpu->syscalls_;
+	uint32_t *x = cpu->regfile_;
+	int64_t result;
+	//in privileged mode only machine mode makes system calls, the others trap
+	if (cpu->mmu_ && MMU_ecall(cpu))
+	{
+		return;
+	}
+	if (!sys)
+	{
+		//not implemented: the pc stays and the CPU halts
+		return;
+	}
+	sys->stats_.calls_++;
+	switch (x[17])
+	{
+	case SYS_EXIT:
+	case SYS_EXIT_GROUP:
+		sys->exited_ = 1;
+		sys->exit_code_ = (int32_t)x[10];
+		return;
+	case SYS_READ: result = SYS_read(cpu, x[10], x[11], x[12]); break;
+	case SYS_WRITE: result = SYS_write(cpu, x[10], x[11], x[12]); break;
+	case SYS_OPEN: result = SYS_open(cpu, SYS_AT_FDCWD, x[10], x[11], x[12]); break;
+	case SYS_OPENAT: result = SYS_open(cpu, x[10], x[11], x[12], x[13]); break;
+	case SYS_CLOSE: result = SYS_close(cpu, x[10]); break;
+	case SYS_LSEEK: result = SYS_lseek(cpu, x[10], x[11], x[12]); break;
+	case SYS_FSTAT: result = SYS_fstat(cpu, x[10], x[11]); break;
+	case SYS_GETTIMEOFDAY: result = SYS_time(cpu, x[10], 0); break;
+	case SYS_CLOCK_GETTIME64: result = SYS_time(cpu, x[11], 1); break;
+	case SYS_BRK: result = SYS_brk(cpu, x[10]); break;
+	default: result = -ENOSYS; break;
+	}
+	x[10] = (uint32_t)result;
+	cpu->pc_ += 0x4;
+}
+
+static void SYS_close_files(SYS_state *sys)
+{
+	for (int fd = 0; fd < CPU_SYSCALL_FILES; fd++)
+	{
+		if (sys->files_[fd] > STDERR_FILENO)
+		{
+			close(sys->files_[fd]);
+		}
+		sys->files_[fd] = fd <= STDERR_FILENO ? fd : -1;
+	}
+}
+
+void SYS_reset(CPU *cpu)
+{
+	SYS_state *sys = cpu->syscalls_;
+	if (!sys)
+	{
+		return;
+	}
+	SYS_close_files(sys);
+	sys->brk_ = SYS_brk_base(cpu);
+	sys->exited_ = 0;
+	sys->exit_code_ = 0;
+	memset(&sys->stats_, 0, sizeof(sys->stats_));
+}
+
+void SYS_clear(CPU *cpu)
+{
+	SYS_state *sys = cpu->syscalls_;
+	if (!sys)
+	{
+		return;
+	}
+	SYS_close_files(sys);
+	for (size_t i = 0; i < sys->allowed_count_; i++)
+	{
+		free(sys->allowed_[i]);
+		close(sys->allowed_fds_[i]);
+	}
+	free(sys->allowed_);
+	free(sys->allowed_fds_);
+	free(sys);
+	cpu->syscalls_ = NULL;
+}
+
+int CPU_set_syscalls(CPU *cpu, int enable)
+{
+	if (!enable)
+	{
+		SYS_clear(cpu);
+		return CPU_OK;
+	}
+	if (cpu->syscalls_)
+	{
+		return CPU_OK;
+	}
+	cpu->syscalls_ = calloc(1, sizeof(SYS_state));
+	if (!cpu->syscalls_)
+	{
+		return CPU_ERROR_MEMORY;
+	}
+	for (int fd = 0; fd < CPU_SYSCALL_FILES; fd++)
+	{
+		cpu->syscalls_->files_[fd] = fd <= STDERR_FILENO ? fd : -1;
+	}
+	cpu->syscalls_->brk_ = SYS_brk_base(cpu);
+	return CPU_OK;
+}
+
+int CPU_syscall_allow(CPU *cpu, const char *directory)
+{
+	SYS_state *sys = cpu->syscalls_;
+	if (!sys)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	char *resolved = realpath(directory, NULL);
+	if (!resolved)
+	{
+		return CPU_ERROR_OPEN;
+	}
+	int fd = open(resolved, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		free(resolved);
+		return CPU_ERROR_OPEN;
+	}
+	char **allowed = realloc(sys->allowed_, (sys->allowed_count_ + 1) * sizeof(char *));
+	if (allowed)
+	{
+		sys->allowed_ = allowed;
+	}
+	int *fds = realloc(sys->allowed_fds_, (sys->allowed_count_ + 1) * sizeof(int));
+	if (fds)
+	{
+		sys->allowed_fds_ = fds;
+	}
+	if (!allowed || !fds)
+	{
+		close(fd);
+		free(resolved);
+		return CPU_ERROR_MEMORY;
+	}
+	sys->allowed_[sys->allowed_count_] = resolved;
+	sys->allowed_fds_[sys->allowed_count_++] = fd;
+	return CPU_OK;
+}
+
+int CPU_set_brk(CPU *cpu, uint32_t addr)
+{
+	if (!cpu->syscalls_ || addr > cpu->data_mem_size_)
+	{
+		return CPU_ERROR_ARGUMENT;
+	}
+	cpu->syscalls_->brk_base_ = addr;
+	cpu->syscalls_->brk_ = SYS_brk_base(cpu);
+	return CPU_OK;
+}
+
+int CPU_get_exit_code(const CPU *cpu, int *code)
+{
+	if (!cpu->syscalls_ || !cpu->syscalls_->exited_)
+	{
+		return 0;
+	}
+	*code = cpu->syscalls_->exit_code_;
+	return 1;
+}
+
+void CPU_get_syscall_stats(const CPU *cpu, CPU_syscall_stats *stats)
+{
+	if (cpu->syscalls_)
+	{
+		*stats = cpu->syscalls_->stats_;
+	}
+	else
+	{
+		memset(stats, 0, sizeof(CPU_syscall_stats));
+	}
+}
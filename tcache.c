@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Translation cache
+ *
+ * Accounting and generations only: the translated blocks stay with the
+ * CPU_decoded of the CPU that translated them, and only that CPU frees them,
+ * so no CPU ever runs a block another thread is freeing. A translation that
+ * takes the cache over its budget starts a new generation; every CPU drops its
+ * blocks that did not run in the generation before, the translating CPU right
+ * away and the others the next time they look a block up (tier.c).
+ */
+
+TCACHE *TCACHE_create(size_t budget)
+{
+	TCACHE *cache = calloc(1, sizeof(TCACHE));
+	if (!cache)
+	{
+		return NULL;
+	}
+	cache->budget_ = budget;
+	cache->generation_ = 2; //blocks from generation 0 are always old
+	return cache;
+}
+
+void TCACHE_destroy(TCACHE *cache)
+{
+	free(cache);
+}
+
+void TCACHE_get_stats(const TCACHE *cache, TCACHE_stats *stats)
+{
+	stats->budget_ = cache->budget_;
+	stats->bytes_ = __atomic_load_n(&cache->bytes_, __ATOMIC_RELAXED);
+	stats->peak_bytes_ = __atomic_load_n(&cache->peak_bytes_, __ATOMIC_RELAXED);
+	stats->blocks_ = __atomic_load_n(&cache->blocks_, __ATOMIC_RELAXED);
+	stats->translations_ = __atomic_load_n(&cache->translations_, __ATOMIC_RELAXED);
+	stats->retranslations_ = __atomic_load_n(&cache->retranslations_, __ATOMIC_RELAXED);
+	stats->evictions_ = __atomic_load_n(&cache->evictions_, __ATOMIC_RELAXED);
+	stats->flushes_ = __atomic_load_n(&cache->flushes_, __ATOMIC_RELAXED);
+	stats->unlinks_ = __atomic_load_n(&cache->unlinks_, __ATOMIC_RELAXED);
+}
+
+int TCACHE_add(TCACHE *cache, size_t bytes, int retranslation)
+{
+	size_t used = __atomic_add_fetch(&cache->bytes_, bytes, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&cache->peak_bytes_, __ATOMIC_RELAXED);
+	while (used > peak && !__atomic_compare_exchange_n(&cache->peak_bytes_, &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+	__atomic_add_fetch(&cache->blocks_, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&cache->translations_, 1, __ATOMIC_RELAXED);
+	if (retranslation)
+	{
+		__atomic_add_fetch(&cache->retranslations_, 1, __ATOMIC_RELAXED);
+	}
+	return used > cache->budget_;
+}
+
+void TCACHE_remove(TCACHE *cache, size_t bytes, int evicted)
+{
+	__atomic_sub_fetch(&cache->bytes_, bytes, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&cache->blocks_, 1, __ATOMIC_RELAXED);
+	if (evicted)
+	{
+		__atomic_add_fetch(&cache->evictions_, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void TCACHE_unlinked(TCACHE *cache, uint64_t links)
+{
+	__atomic_add_fetch(&cache->unlinks_, links, __ATOMIC_RELAXED);
+}
+
+uint32_t TCACHE_flush(TCACHE *cache)
+{
+	__atomic_add_fetch(&cache->flushes_, 1, __ATOMIC_RELAXED);
+	return __atomic_add_fetch(&cache->generation_, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Tiered engine
+ *
+ * Code starts on the interpreter (CPU_execute, tier 0) and moves up by hotness:
+ * a pc where execution entered cold code more than the predecode threshold
+ * times is decoded into a block of the pre-decoded engine (tier 1), and a block
+ * executed more than the translate threshold times is translated (tier 2, see
+ * trans.c). All tiers work on the registers and pc in the CPU, so switching
+ * between them at block boundaries costs nothing. Once instrumentation is
+ * attached the pre-decoded engine runs instead, it is the one that feeds it.
+ */
+
+//tier 0: CPU_execute up to the next jump or the start of a decoded block, stop when the CPU halted
+static uint64_t TIER_interpret(CPU *cpu, const CPU_decoded *decoded, uint64_t max_steps, int *stop)
+{
+	uint64_t steps = 0;
+	while (steps < max_steps)
+	{
+		uint32_t pc = cpu->pc_;
+		if ((pc & 0xFFFFF) + 4 > cpu->instr_mem_size_)
+		{
+			cpu->halted_ = 1;
+			*stop = 1;
+			break;
+		}
+		CPU_execute(cpu);
+		if (cpu->waiting_)
+		{
+			steps += cpu->pc_ != pc;
+			break;
+		}
+		steps++;
+		if (cpu->pc_ == pc)
+		{
+			cpu->halted_ = 1;
+			*stop = 1;
+			break;
+		}
+		size_t next = (cpu->pc_ & 0xFFFFF) >> 2;
+		if (cpu->pc_ != pc + 4 || next >= decoded->pcs_ || decoded->block_of_[next] >= 0)
+		{
+			break;
+		}
+	}
+	cpu->tier_instructions_[CPU_TIER_INTERP] += steps;
+	return steps;
+}
+
+//tier 1: the handlers of the micro-ops
+static uint32_t TIER_run_block(CPU *cpu, const CPU_decoded *decoded, const CPU_block *block)
+{
+	const CPU_uop *uop = &decoded->uops_[block->start_];
+	for (uint32_t i = 0; i < block->length_; i++)
+	{
+		uint32_t pc = cpu->pc_;
+		CPU_ops[uop[i].op_].handler_(cpu, uop[i].instruction_);
+		cpu->regfile_[0] = 0;
+		if (cpu->waiting_)
+		{
+			return i + (cpu->pc_ != pc);
+		}
+	}
+	return block->length_;
+}
+
+//drops the translated blocks of this CPU that last ran before generation oldest
+static void TIER_collect(CPU_decoded *decoded, uint32_t oldest)
+{
+	size_t victims = 0;
+	for (size_t i = 0; i < decoded->translated_capacity_; i++)
+	{
+		for (TRANS_block *block = decoded->translated_[i]; block; block = block->alias_)
+		{
+			victims += block->generation_ < oldest;
+		}
+	}
+	if (!victims)
+	{
+		return;
+	}
+	//unlink first, the chains and inline caches only ever point to blocks of the same CPU
+	uint64_t unlinks = 0;
+	for (size_t i = 0; i < decoded->translated_capacity_; i++)
+	{
+		for (TRANS_block *block = decoded->translated_[i]; block; block = block->alias_)
+		{
+			for (int e = 0; e < 2; e++)
+			{
+				if (block->chain_[e] && block->chain_[e]->generation_ < oldest)
+				{
+					block->chain_[e] = NULL;
+					unlinks++;
+				}
+				if (block->ic_block_[e] && block->ic_block_[e]->generation_ < oldest)
+				{
+					block->ic_block_[e] = NULL;
+					unlinks++;
+				}
+			}
+		}
+	}
+	for (size_t i = 0; i < decoded->translated_capacity_; i++)
+	{
+		TRANS_block **link = &decoded->translated_[i];
+		while (*link)
+		{
+			TRANS_block *block = *link;
+			if (block->generation_ >= oldest)
+			{
+				link = &block->alias_;
+				continue;
+			}
+			TCACHE_remove(decoded->cache_, block->bytes_, 1);
+			//translated again once it is hot again
+			decoded->blocks_[block->id_].count_ = 0;
+			*link = block->alias_;
+			free(block);
+			decoded->evicted_[i] = 1;
+		}
+	}
+	TCACHE_unlinked(decoded->cache_, unlinks);
+}
+
+//tier 2 for block id entered at pc, NULL if out of memory
+static TRANS_block *TIER_translate(CPU *cpu, CPU_decoded *decoded, int32_t id, uint32_t pc)
+{
+	if (!cpu->tcache_)
+	{
+		cpu->tcache_ = TCACHE_create(CPU_DEFAULT_TRANSLATION_BUDGET);
+		if (!cpu->tcache_)
+		{
+			return NULL;
+		}
+		cpu->tcache_owned_ = 1;
+	}
+	if (!decoded->cache_)
+	{
+		decoded->cache_ = cpu->tcache_;
+		decoded->generation_ = TCACHE_generation(cpu->tcache_);
+	}
+	if ((size_t)id >= decoded->translated_capacity_)
+	{
+		size_t capacity = decoded->block_capacity_;
+		TRANS_block **translated = realloc(decoded->translated_, capacity * sizeof(TRANS_block *));
+		if (!translated)
+		{
+			return NULL;
+		}
+		decoded->translated_ = translated;
+		uint8_t *evicted = realloc(decoded->evicted_, capacity);
+		if (!evicted)
+		{
+			return NULL;
+		}
+		decoded->evicted_ = evicted;
+		memset(translated + decoded->translated_capacity_, 0, (capacity - decoded->translated_capacity_) * sizeof(TRANS_block *));
+		memset(evicted + decoded->translated_capacity_, 0, capacity - decoded->translated_capacity_);
+		decoded->translated_capacity_ = capacity;
+	}
+	CPU_block *block = &decoded->blocks_[id];
+	TRANS_block *translated = TRANS_translate(&decoded->uops_[block->start_], block->length_, pc);
+	if (!translated)
+	{
+		return NULL;
+	}
+	if (cpu->ir_optimize_)
+	{
+		translated = IR_optimize(translated, &cpu->ir_stats_);
+	}
+	translated->id_ = id;
+	const TRANS_op *last = &translated->ops_[translated->op_count_ - 1];
+	translated->exit_pc_[0] = translated->exit_pc_[1] = 1;
+	if (last->kind_ >= T_BEQ && last->kind_ <= T_BGEU)
+	{
+		translated->exit_pc_[0] = last->imm_;
+		translated->exit_pc_[1] = last->pc_ + 4;
+	}
+	else if (last->kind_ == T_JAL || last->kind_ == T_EXIT)
+	{
+		translated->exit_pc_[0] = last->imm_;
+	}
+
+	if (TCACHE_add(decoded->cache_, translated->bytes_, decoded->evicted_[id]))
+	{
+		//over the budget: a new generation, and what did not run in the last one goes
+		decoded->generation_ = TCACHE_flush(decoded->cache_);
+		TIER_collect(decoded, decoded->generation_ - 1);
+	}
+	translated->generation_ = decoded->generation_;
+	translated->alias_ = decoded->translated_[id];
+	decoded->translated_[id] = translated;
+	return translated;
+}
+
+static int TIER_is_link(uint32_t reg)
+{
+	return reg == 1 || reg == 5;
+}
+
+static int32_t TIER_block_at(const CPU_decoded *decoded, uint32_t pc)
+{
+	size_t pc_index = (pc & 0xFFFFF) >> 2;
+	return pc_index < decoded->pcs_ ? decoded->block_of_[pc_index] : -1;
+}
+
+//the translation of block id entered at pc, NULL if there is none; the fetch masks
+//the pc, and a block run at several aliases of it has a translation for each
+static TRANS_block *TIER_translation(const CPU_decoded *decoded, int32_t id, uint32_t pc)
+{
+	TRANS_block *translated = id >= 0 && (size_t)id < decoded->translated_capacity_ ? decoded->translated_[id] : NULL;
+	while (translated && translated->pc_ != pc)
+	{
+		translated = translated->alias_;
+	}
+	return translated;
+}
+
+//the block at the target of the jump that ended a block, -1 if it has to be looked up;
+//jump is the last micro-op, translated the block that ran if it was the translated one,
+//whose inline cache hits set *chained to the translation to go on with;
+//kept out of the loop of CPU_run_tiered, which gets slower with it inlined
+static __attribute__((noinline)) int32_t TIER_jump(CPU *cpu, const CPU_decoded *decoded, TRANS_block *translated, const CPU_uop *jump,
+												   uint32_t return_pc, TRANS_block **chained)
+{
+	//a hooked call that ran returned like "ret"
+	uint32_t instruction = jump->op_ == OP_HLE ? HLE_RETURN : jump->instruction_;
+	uint32_t rd = getRD(instruction);
+	uint32_t rs1 = getRS1(instruction);
+	int32_t next = -1;
+	if (jump->op_ == OP_JALR || jump->op_ == OP_HLE)
+	{
+		if (TIER_is_link(rs1) && (!TIER_is_link(rd) || rd != rs1))
+		{
+			cpu->jump_stats_.returns_++;
+			if (cpu->ras_count_)
+			{
+				cpu->ras_top_ = (cpu->ras_top_ + CPU_RAS_DEPTH - 1) % CPU_RAS_DEPTH;
+				cpu->ras_count_--;
+				if (cpu->ras_pc_[cpu->ras_top_] == cpu->pc_)
+				{
+					next = cpu->ras_block_[cpu->ras_top_];
+					cpu->jump_stats_.ras_hits_ += next >= 0;
+				}
+			}
+		}
+		if (next < 0 && translated)
+		{
+			cpu->jump_stats_.indirect_++;
+			if (translated->ic_block_[0] && translated->ic_pc_[0] == cpu->pc_)
+			{
+				cpu->jump_stats_.ic_hits_++;
+				*chained = translated->ic_block_[0];
+			}
+			else if (translated->ic_block_[1] && translated->ic_pc_[1] == cpu->pc_)
+			{
+				cpu->jump_stats_.ic_hits_++;
+				*chained = translated->ic_block_[1];
+			}
+			else
+			{
+				//only targets that are translated already go into the cache
+				next = TIER_block_at(decoded, cpu->pc_);
+				TRANS_block *target = TIER_translation(decoded, next, cpu->pc_);
+				if (target)
+				{
+					translated->ic_pc_[1] = translated->ic_pc_[0];
+					translated->ic_block_[1] = translated->ic_block_[0];
+					translated->ic_pc_[0] = cpu->pc_;
+					translated->ic_block_[0] = target;
+				}
+			}
+		}
+	}
+	if (TIER_is_link(rd))
+	{
+		//a full stack loses its oldest entry
+		cpu->ras_pc_[cpu->ras_top_] = return_pc;
+		cpu->ras_block_[cpu->ras_top_] = TIER_block_at(decoded, return_pc);
+		cpu->ras_top_ = (cpu->ras_top_ + 1) % CPU_RAS_DEPTH;
+		cpu->ras_count_ += cpu->ras_count_ < CPU_RAS_DEPTH;
+	}
+	return next;
+}
+
+//the translation to go on with at pc, chained to the exit of block it was found for
+static TRANS_block *TIER_chain(const CPU_decoded *decoded, TRANS_block *block, uint32_t pc)
+{
+	int exit = pc == block->exit_pc_[0] ? 0 : pc == block->exit_pc_[1] ? 1 : -1;
+	if (exit < 0)
+	{
+		return NULL;
+	}
+	if (!block->chain_[exit])
+	{
+		block->chain_[exit] = TIER_translation(decoded, TIER_block_at(decoded, pc), pc);
+	}
+	return block->chain_[exit];
+}
+
+uint64_t CPU_run_tiered(CPU *cpu, uint64_t max_steps)
+{
+	if (cpu->trace_ || cpu->bpred_ || cpu->sampler_)
+	{
+		uint64_t steps = CPU_run_predecoded(cpu, max_steps);
+		cpu->tier_instructions_[CPU_TIER_PREDECODE] += steps;
+		return steps;
+	}
+	CPU_decoded *decoded = cpu->decoded_;
+	if (!decoded->heat_)
+	{
+		decoded->heat_ = calloc(decoded->pcs_ ? decoded->pcs_ : 1, sizeof(uint32_t));
+	}
+	uint64_t steps = 0;
+	int stop = 0;
+	int32_t next = -1;			//block found by TIER_jump
+	TRANS_block *chained = NULL; //translation the last one is chained to or its inline cache hit
+
+	while (steps < max_steps && !stop && !cpu->waiting_)
+	{
+		size_t pc_index = (cpu->pc_ & 0xFFFFF) >> 2;
+		TRANS_block *translated = chained;
+		int32_t id = translated ? translated->id_ : next;
+		chained = NULL;
+		next = -1;
+		if (!translated && decoded->cache_ && TCACHE_generation(decoded->cache_) != decoded->generation_)
+		{
+			//another CPU sharing the cache started a generation
+			decoded->generation_ = TCACHE_generation(decoded->cache_);
+			TIER_collect(decoded, decoded->generation_ - 1);
+		}
+		if (id < 0 && pc_index >= decoded->pcs_)
+		{
+			cpu->halted_ = 1;
+			break;
+		}
+		if (id < 0)
+		{
+			id = decoded->block_of_[pc_index];
+		}
+		if (id < 0)
+		{
+			//without the heat counters every pc is hot
+			if (decoded->heat_ && decoded->heat_[pc_index] < cpu->tier_thresholds_[CPU_TIER_INTERP])
+			{
+				decoded->heat_[pc_index]++;
+				steps += TIER_interpret(cpu, decoded, max_steps - steps, &stop);
+				continue;
+			}
+			id = CPU_decode_block(cpu, decoded, pc_index);
+		}
+		if (id < 0)
+		{
+			//out of memory for the block
+			steps += TIER_interpret(cpu, decoded, max_steps - steps, &stop);
+			continue;
+		}
+		CPU_block *block = &decoded->blocks_[id];
+		uint32_t length = block->length_;
+		if (length > max_steps - steps)
+		{
+			//not enough budget left for the whole block
+			steps += TIER_interpret(cpu, decoded, max_steps - steps, &stop);
+			continue;
+		}
+
+		uint32_t last = cpu->pc_ + 4 * (length - 1);
+		if (!translated)
+		{
+			translated = TIER_translation(decoded, id, cpu->pc_);
+		}
+		if (!translated && block->count_ >= cpu->tier_thresholds_[CPU_TIER_PREDECODE])
+		{
+			translated = TIER_translate(cpu, decoded, id, cpu->pc_);
+		}
+		uint32_t retired = TRANS_UNGUARDED;
+		if (translated)
+		{
+			//a block whose guards fail runs pre-decoded, where every access is checked
+			retired = TRANS_run(cpu, translated);
+		}
+		if (retired == TRANS_UNGUARDED)
+		{
+			translated = NULL;
+		}
+		if (translated)
+		{
+			cpu->tier_instructions_[CPU_TIER_TRANSLATED] += retired;
+			if (retired == length)
+			{
+				cpu->ir_stats_.executed_ += translated->eliminated_;
+				translated->generation_ = decoded->generation_;
+				chained = TIER_chain(decoded, translated, cpu->pc_);
+			}
+		}
+		else
+		{
+			retired = TIER_run_block(cpu, decoded, block);
+			cpu->tier_instructions_[CPU_TIER_PREDECODE] += retired;
+		}
+		steps += retired;
+		if (cpu->waiting_)
+		{
+			break;
+		}
+		block->count_++;
+		block->taken_ += cpu->pc_ != last + 4;
+		if (cpu->pc_ == last)
+		{
+			cpu->halted_ = 1;
+			break;
+		}
+		const CPU_uop *jump = &decoded->uops_[block->start_ + length - 1];
+		if (jump->op_ == OP_JAL || jump->op_ == OP_JALR || (jump->op_ == OP_HLE && cpu->pc_ != last + 4))
+		{
+			next = TIER_jump(cpu, decoded, translated, jump, last + 4, &chained);
+		}
+	}
+	return steps;
+}
@@ -0,0 +1,93 @@
+/**
+ * Execution trace file format and reader library
+ *
+ * A trace file is written by the emulator with --trace=<file>. All numbers are
+ * little endian, the file can be mapped into memory and walked in place:
+ *
+ *   TRACE_file_header                         once at offset 0
+ *   { TRACE_chunk_header, TRACE_record[n] }   repeated until the end of the file
+ *
+ * Every emulated CPU (one per host thread) writes its own stream of records, the
+ * chunk header tells which stream the following records belong to. Chunks of
+ * different streams may be interleaved, the chunks of one stream are in order.
+ *
+ * One record is written per retired instruction. The pc is delta encoded against
+ * the pc of the previous record of the same stream: pc = previous pc + 4 * pc_delta_.
+ * If the distance does not fit, a record with TRACE_SYNC is written first whose
+ * addr_ holds the absolute pc of the next record, which then has a pc_delta_ of 0.
+ * The first record of a stream is always a TRACE_SYNC record.
+ *
+ *   flags_        TRACE_RD: rd_ was written with value_
+ *                 TRACE_LOAD / TRACE_STORE: memory access at addr_, the access
+ *                 size in bytes is 1 << ((flags_ >> TRACE_SIZE_SHIFT) & 3).
+ *                 A store keeps the stored value in value_, a load the value
+ *                 written to rd_ (sign or zero extended like the instruction does).
+ *                 LR/SC and the AMOs have both flags, value_ is the value written
+ *                 to rd_ (the old word, for SC the success flag).
+ *   instruction_  the instruction word
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "HURVTRC1"
+#define TRACE_VERSION 1
+#define TRACE_CHUNK_MAGIC 0x4B4E4843 //"CHNK"
+
+#define TRACE_RD 0x01
+#define TRACE_LOAD 0x02
+#define TRACE_STORE 0x04
+#define TRACE_SYNC 0x08
+#define TRACE_SIZE_SHIFT 4
+
+typedef struct
+{
+	char magic_[8];
+	uint32_t version_;
+	uint32_t header_size_; //offset of the first chunk
+	uint32_t record_size_;
+	uint32_t reserved_;
+} TRACE_file_header;
+
+typedef struct
+{
+	uint32_t magic_;
+	uint32_t stream_;
+	uint32_t records_;
+	uint32_t reserved_;
+} TRACE_chunk_header;
+
+typedef struct
+{
+	uint8_t flags_;
+	uint8_t rd_;
+	int16_t pc_delta_;
+	uint32_t instruction_;
+	uint32_t value_;
+	uint32_t addr_;
+} TRACE_record;
+
+//one retired instruction with the absolute pc restored
+typedef struct
+{
+	uint32_t stream_;
+	uint32_t pc_;
+	uint32_t instruction_;
+	uint8_t flags_;
+	uint8_t rd_;
+	uint32_t value_;
+	uint32_t addr_;
+} TRACE_event;
+
+typedef struct TRACE_reader TRACE_reader;
+
+//maps the file and checks the header, NULL on error (errno is set)
+TRACE_reader *TRACE_open(const char *path);
+//next event in file order, returns 0 at the end of the trace and -1 if the file is damaged or out of memory
+int TRACE_next(TRACE_reader *reader, TRACE_event *event);
+void TRACE_rewind(TRACE_reader *reader);
+void TRACE_close(TRACE_reader *reader);
+
+#endif
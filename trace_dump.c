@@ -0,0 +1,57 @@
+/**
+ * Prints an execution trace written with --trace=<file> as text, one line per
+ * retired instruction. Also an example of the reader library in trace.h.
+ *
+ *   gcc trace_dump.c trace_reader.c -o trace_dump -std=c11
+ *   ./trace_dump trace.bin [max_events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: %s <trace file> [max_events]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	unsigned long long max_events = argc > 2 ? strtoull(argv[2], NULL, 0) : ~0ull;
+
+	TRACE_reader *reader = TRACE_open(argv[1]);
+	if (!reader)
+	{
+		perror(argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	TRACE_event event;
+	unsigned long long events = 0;
+	int status = 0;
+	while (events < max_events && (status = TRACE_next(reader, &event)) > 0)
+	{
+		printf("%u %08X %08X", event.stream_, event.pc_, event.instruction_);
+		if (event.flags_ & TRACE_RD)
+		{
+			printf(" x%u=%08X", event.rd_, event.value_);
+		}
+		if (event.flags_ & TRACE_LOAD)
+		{
+			printf(" load%d [%08X]", 1 << ((event.flags_ >> TRACE_SIZE_SHIFT) & 3), event.addr_);
+		}
+		if (event.flags_ & TRACE_STORE)
+		{
+			printf(" store%d [%08X]=%08X", 1 << ((event.flags_ >> TRACE_SIZE_SHIFT) & 3), event.addr_, event.value_);
+		}
+		printf("\n");
+		events++;
+	}
+	if (status < 0)
+	{
+		printf("trace file is damaged\n");
+	}
+	TRACE_close(reader);
+	return status < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+struct TRACE_reader
+{
+	const uint8_t *data_;
+	size_t size_;
+	size_t offset_;		//next chunk header
+	uint32_t stream_;	//stream of the current chunk
+	uint32_t remaining_; //records left in the current chunk
+	const TRACE_record *record_;
+	uint32_t *last_pc_; //per stream
+	uint32_t streams_;
+};
+
+TRACE_reader *TRACE_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	struct stat sb;
+	if (fstat(fd, &sb) == -1)
+	{
+		close(fd);
+		return NULL;
+	}
+	if ((size_t)sb.st_size < sizeof(TRACE_file_header))
+	{
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	void *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		return NULL;
+	}
+
+	const TRACE_file_header *header = data;
+	if (memcmp(header->magic_, TRACE_MAGIC, 8) != 0 || header->version_ != TRACE_VERSION ||
+		header->record_size_ != sizeof(TRACE_record) || header->header_size_ > (size_t)sb.st_size)
+	{
+		munmap(data, sb.st_size);
+		errno = EINVAL;
+		return NULL;
+	}
+	madvise(data, sb.st_size, MADV_SEQUENTIAL);
+
+	TRACE_reader *reader = calloc(1, sizeof(TRACE_reader));
+	if (!reader)
+	{
+		munmap(data, sb.st_size);
+		return NULL;
+	}
+	reader->data_ = data;
+	reader->size_ = sb.st_size;
+	TRACE_rewind(reader);
+	return reader;
+}
+
+void TRACE_rewind(TRACE_reader *reader)
+{
+	reader->offset_ = ((const TRACE_file_header *)reader->data_)->header_size_;
+	reader->remaining_ = 0;
+	memset(reader->last_pc_, 0, reader->streams_ * sizeof(uint32_t));
+}
+
+//moves to the next non-empty chunk, 0 at the end of the file, -1 if it is truncated or out of memory
+static int TRACE_next_chunk(TRACE_reader *reader)
+{
+	while (reader->remaining_ == 0)
+	{
+		if (reader->offset_ == reader->size_)
+		{
+			return 0;
+		}
+		if (reader->size_ - reader->offset_ < sizeof(TRACE_chunk_header))
+		{
+			return -1;
+		}
+		const TRACE_chunk_header *chunk = (const TRACE_chunk_header *)(reader->data_ + reader->offset_);
+		size_t bytes = (size_t)chunk->records_ * sizeof(TRACE_record);
+		if (chunk->magic_ != TRACE_CHUNK_MAGIC || reader->size_ - reader->offset_ - sizeof(TRACE_chunk_header) < bytes)
+		{
+			return -1;
+		}
+		if (chunk->stream_ >= reader->streams_)
+		{
+			uint32_t *last_pc = realloc(reader->last_pc_, (chunk->stream_ + 1) * sizeof(uint32_t));
+			if (!last_pc)
+			{
+				return -1;
+			}
+			reader->last_pc_ = last_pc;
+			memset(reader->last_pc_ + reader->streams_, 0, (chunk->stream_ + 1 - reader->streams_) * sizeof(uint32_t));
+			reader->streams_ = chunk->stream_ + 1;
+		}
+		reader->stream_ = chunk->stream_;
+		reader->remaining_ = chunk->records_;
+		reader->record_ = (const TRACE_record *)(chunk + 1);
+		reader->offset_ += sizeof(TRACE_chunk_header) + bytes;
+	}
+	return 1;
+}
+
+int TRACE_next(TRACE_reader *reader, TRACE_event *event)
+{
+	for (;;)
+	{
+		int status = TRACE_next_chunk(reader);
+		if (status <= 0)
+		{
+			return status;
+		}
+		const TRACE_record *record = reader->record_++;
+		reader->remaining_--;
+
+		uint32_t *last_pc = &reader->last_pc_[reader->stream_];
+		if (record->flags_ & TRACE_SYNC)
+		{
+			*last_pc = record->addr_;
+			continue;
+		}
+		*last_pc += 4 * (int32_t)record->pc_delta_;
+
+		event->stream_ = reader->stream_;
+		event->pc_ = *last_pc;
+		event->instruction_ = record->instruction_;
+		event->flags_ = record->flags_;
+		event->rd_ = record->rd_;
+		event->value_ = record->value_;
+		event->addr_ = record->addr_;
+		return 1;
+	}
+}
+
+void TRACE_close(TRACE_reader *reader)
+{
+	munmap((void *)reader->data_, reader->size_);
+	free(reader->last_pc_);
+	free(reader);
+}
@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "hurv_internal.h"
+#include "trace.h"
+
+/**
+ * Execution trace writer
+ *
+ * Every traced CPU appends fixed size records to its own single producer/single
+ * consumer ring buffer. A background thread drains all rings into the trace file
+ * (format in trace.h), the emulating thread only waits when its ring is full.
+ */
+
+#define TRACE_RING_BITS 20		 //records per ring: 2^20 (16 MiB)
+#define TRACE_PUBLISH_BATCH 1024 //records made visible to the writer at once
+#define TRACE_MAX_RINGS 64
+#define TRACE_IDLE_NS 200000 //writer sleep when all rings are empty
+
+struct TRACE_ring
+{
+	TRACE_record *records_;
+	uint32_t stream_;
+	uint32_t last_pc_;
+	int synced_;
+	uint64_t head_local_;  //producer side, includes records not published yet
+	uint64_t tail_cached_; //producer side copy of tail_
+	_Atomic uint64_t head_;
+	_Atomic uint64_t tail_;
+};
+
+struct TRACE_writer
+{
+	FILE *file_;
+	pthread_t thread_;
+	pthread_mutex_t lock_; //protects rings_ and ring_count_
+	TRACE_ring *rings_[TRACE_MAX_RINGS];
+	int ring_count_;
+	_Atomic int stop_;
+	uint64_t records_written_;
+};
+
+//writes all published records of one ring, returns their number
+static uint64_t TRACE_drain(TRACE_writer *writer, TRACE_ring *ring)
+{
+	const uint64_t mask = (1u << TRACE_RING_BITS) - 1;
+	uint64_t head = atomic_load_explicit(&ring->head_, memory_order_acquire);
+	uint64_t tail = atomic_load_explicit(&ring->tail_, memory_order_relaxed);
+	uint64_t drained = head - tail;
+
+	while (tail != head)
+	{
+		//up to the end of the ring buffer, the rest follows in the next chunk
+		uint64_t count = head - tail;
+		if ((tail & mask) + count > mask + 1)
+		{
+			count = mask + 1 - (tail & mask);
+		}
+		TRACE_chunk_header chunk = {TRACE_CHUNK_MAGIC, ring->stream_, (uint32_t)count, 0};
+		fwrite(&chunk, sizeof(chunk), 1, writer->file_);
+		fwrite(&ring->records_[tail & mask], sizeof(TRACE_record), count, writer->file_);
+		tail += count;
+		atomic_store_explicit(&ring->tail_, tail, memory_order_release);
+	}
+	writer->records_written_ += drained;
+	return drained;
+}
+
+static void *TRACE_writer_main(void *arg)
+{
+	TRACE_writer *writer = arg;
+	struct timespec idle = {0, TRACE_IDLE_NS};
+
+	for (;;)
+	{
+		//stop_ is read before draining, so nothing published before it was set is lost
+		int stopping = atomic_load(&writer->stop_);
+		uint64_t drained = 0;
+
+		pthread_mutex_lock(&writer->lock_);
+		for (int i = 0; i < writer->ring_count_; i++)
+		{
+			drained += TRACE_drain(writer, writer->rings_[i]);
+		}
+		pthread_mutex_unlock(&writer->lock_);
+
+		if (drained == 0)
+		{
+			if (stopping)
+			{
+				break;
+			}
+			nanosleep(&idle, NULL);
+		}
+	}
+	return NULL;
+}
+
+TRACE_writer *TRACE_writer_create(const char *path)
+{
+	FILE *file = fopen(path, "wb");
+	if (!file)
+	{
+		return NULL;
+	}
+	TRACE_file_header header = {TRACE_MAGIC, TRACE_VERSION, sizeof(TRACE_file_header), sizeof(TRACE_record), 0};
+	fwrite(&header, sizeof(header), 1, file);
+
+	TRACE_writer *writer = calloc(1, sizeof(TRACE_writer));
+	if (!writer)
+	{
+		fclose(file);
+		return NULL;
+	}
+	writer->file_ = file;
+	pthread_mutex_init(&writer->lock_, NULL);
+	if (pthread_create(&writer->thread_, NULL, TRACE_writer_main, writer) != 0)
+	{
+		pthread_mutex_destroy(&writer->lock_);
+		fclose(file);
+		free(writer);
+		return NULL;
+	}
+	return writer;
+}
+
+//a ring for one emulating thread, stream ids are handed out in attach order;
+//NULL if all rings are taken or there is no memory for one
+TRACE_ring *TRACE_attach(TRACE_writer *writer)
+{
+	TRACE_ring *ring = calloc(1, sizeof(TRACE_ring));
+	if (!ring)
+	{
+		return NULL;
+	}
+	ring->records_ = malloc(sizeof(TRACE_record) << TRACE_RING_BITS);
+	if (!ring->records_)
+	{
+		free(ring);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&writer->lock_);
+	if (writer->ring_count_ == TRACE_MAX_RINGS)
+	{
+		pthread_mutex_unlock(&writer->lock_);
+		free(ring->records_);
+		free(ring);
+		return NULL;
+	}
+	ring->stream_ = writer->ring_count_;
+	writer->rings_[writer->ring_count_++] = ring;
+	pthread_mutex_unlock(&writer->lock_);
+	return ring;
+}
+
+//makes all records of the ring visible to the writer thread
+void TRACE_flush(TRACE_ring *ring)
+{
+	atomic_store_explicit(&ring->head_, ring->head_local_, memory_order_release);
+}
+
+//waits for the writer thread to drain every ring, then closes the file
+uint64_t TRACE_writer_close(TRACE_writer *writer)
+{
+	atomic_store(&writer->stop_, 1);
+	pthread_join(writer->thread_, NULL);
+	fclose(writer->file_);
+
+	uint64_t written = writer->records_written_;
+	for (int i = 0; i < writer->ring_count_; i++)
+	{
+		free(writer->rings_[i]->records_);
+		free(writer->rings_[i]);
+	}
+	pthread_mutex_destroy(&writer->lock_);
+	free(writer);
+	return written;
+}
+
+//waits until the writer thread left room for n more records
+static void TRACE_make_room(TRACE_ring *ring, uint32_t n)
+{
+	if (ring->head_local_ + n - ring->tail_cached_ > (1u << TRACE_RING_BITS))
+	{
+		TRACE_flush(ring);
+		while (ring->head_local_ + n - (ring->tail_cached_ = atomic_load_explicit(&ring->tail_, memory_order_acquire)) >
+			   (1u << TRACE_RING_BITS))
+		{
+			sched_yield();
+		}
+	}
+}
+
+//the next record, appended by TRACE_commit once it is filled
+static TRACE_record *TRACE_head(TRACE_ring *ring)
+{
+	return &ring->records_[ring->head_local_ & ((1u << TRACE_RING_BITS) - 1)];
+}
+
+//appends the next n records, published in batches
+static void TRACE_commit(TRACE_ring *ring, uint32_t n)
+{
+	uint64_t head = ring->head_local_ + n;
+	int publish = ((head ^ ring->head_local_) & ~(uint64_t)(TRACE_PUBLISH_BATCH - 1)) != 0;
+	ring->head_local_ = head;
+	if (publish)
+	{
+		TRACE_flush(ring);
+	}
+}
+
+//pc_delta_ of the record of the instruction at pc, after a TRACE_SYNC record if it does not fit
+static int16_t TRACE_delta(TRACE_ring *ring, uint32_t pc)
+{
+	int32_t delta = (int32_t)(pc - ring->last_pc_) / 4;
+	if (!ring->synced_ || delta < INT16_MIN || delta > INT16_MAX || ((pc - ring->last_pc_) & 3))
+	{
+		TRACE_make_room(ring, 1);
+		TRACE_record *sync = TRACE_head(ring);
+		memset(sync, 0, sizeof(TRACE_record));
+		sync->flags_ = TRACE_SYNC;
+		sync->addr_ = pc;
+		TRACE_commit(ring, 1);
+		ring->synced_ = 1;
+		delta = 0;
+	}
+	return delta;
+}
+
+//the flags of the record of an instruction, worked out once when it is decoded
+uint8_t TRACE_layout(uint32_t instruction, uint16_t op)
+{
+	uint8_t opcode = getOpCode(instruction);
+	uint8_t flags = 0;
+	if (opcode == L)
+	{
+		flags = TRACE_LOAD | (getFunc3(instruction) & 0x3) << TRACE_SIZE_SHIFT;
+	}
+	else if (opcode == S)
+	{
+		flags = TRACE_STORE | (getFunc3(instruction) & 0x3) << TRACE_SIZE_SHIFT;
+	}
+	else if (opcode == AMO)
+	{
+		//read and write of a word, value_ is the old value that goes to rd
+		flags = TRACE_LOAD | TRACE_STORE | 2 << TRACE_SIZE_SHIFT;
+	}
+	if (getRD(instruction) != 0 && op != OP_INVALID && opcode != S && opcode != B)
+	{
+		flags |= TRACE_RD;
+	}
+	return flags;
+}
+
+//fills the record of uop before it runs: the address has to be taken before a
+//load overwrites its base register
+static inline void TRACE_begin(const CPU *cpu, TRACE_record *record, const CPU_uop *uop, int16_t delta)
+{
+	const uint32_t *x = cpu->regfile_;
+	uint32_t instruction = uop->instruction_;
+	record->flags_ = uop->trace_;
+	record->rd_ = getRD(instruction);
+	record->pc_delta_ = delta;
+	record->instruction_ = instruction;
+	record->value_ = 0;
+	record->addr_ = 0;
+	switch (uop->trace_ & (TRACE_LOAD | TRACE_STORE))
+	{
+	case TRACE_LOAD: record->addr_ = x[getRS1(instruction)] + imm_I(instruction); break;
+	case TRACE_STORE:
+	{
+		int size = (uop->trace_ >> TRACE_SIZE_SHIFT) & 0x3;
+		uint32_t value = x[getRS2(instruction)];
+		record->addr_ = x[getRS1(instruction)] + imm_S(instruction);
+		record->value_ = size == 0 ? (uint8_t)value : size == 1 ? (uint16_t)value : value;
+		break;
+	}
+	case TRACE_LOAD | TRACE_STORE: record->addr_ = x[getRS1(instruction)]; break;
+	}
+}
+
+//executes uop and completes its record
+static inline void TRACE_execute(CPU *cpu, TRACE_record *record, const CPU_uop *uop)
+{
+	uint64_t calls = cpu->hook_stats_.calls_;
+	CPU_ops[uop->op_].handler_(cpu, uop->instruction_);
+	cpu->regfile_[0] = 0;
+
+	if (cpu->hook_stats_.calls_ != calls)
+	{
+		//a hooked call that ran is recorded as the return to ra with the a0 it left
+		record->flags_ = TRACE_RD;
+		record->instruction_ = HLE_RETURN;
+		record->rd_ = 10;
+		record->value_ = cpu->regfile_[10];
+		record->addr_ = 0;
+		return;
+	}
+	if (record->flags_ & TRACE_RD)
+	{
+		record->value_ = cpu->regfile_[record->rd_];
+	}
+}
+
+//executes one micro-op and appends its trace record
+void TRACE_uop(CPU *cpu, const CPU_uop *uop)
+{
+	TRACE_ring *ring = cpu->trace_;
+	int16_t delta = TRACE_delta(ring, cpu->pc_);
+	ring->last_pc_ = cpu->pc_;
+	TRACE_make_room(ring, 1);
+	TRACE_record *record = TRACE_head(ring);
+	TRACE_begin(cpu, record, uop, delta);
+	TRACE_execute(cpu, record, uop);
+	//published only once it is complete, the writer thread may take it right away
+	TRACE_commit(ring, 1);
+}
+
+//executes the micro-ops of a block, filling their records in one piece of the ring
+uint32_t TRACE_block(CPU *cpu, const CPU_uop *uops, uint32_t length)
+{
+	const uint64_t mask = (1u << TRACE_RING_BITS) - 1;
+	TRACE_ring *ring = cpu->trace_;
+	uint32_t pc = cpu->pc_;
+	uint32_t i = 0;
+
+	if ((ring->head_local_ & mask) + length + 1 > mask + 1)
+	{
+		//the block and a sync record may not fit before the ring wraps around
+		while (i < length)
+		{
+			TRACE_uop(cpu, &uops[i++]);
+			if (cpu->waiting_)
+			{
+				break;
+			}
+		}
+		return i;
+	}
+	int16_t delta = TRACE_delta(ring, pc);
+	TRACE_make_room(ring, length);
+	TRACE_record *records = TRACE_head(ring);
+	//the instructions of a block follow each other, a jump can only end it
+	while (i < length)
+	{
+		TRACE_begin(cpu, &records[i], &uops[i], i ? 1 : delta);
+		TRACE_execute(cpu, &records[i], &uops[i]);
+		i++;
+		if (cpu->waiting_)
+		{
+			break;
+		}
+	}
+	ring->last_pc_ = pc + 4 * (i - 1);
+	TRACE_commit(ring, i);
+	return i;
+}
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Translated tier of the tiered engine
+ *
+ * A block that got hot on the pre-decoded tier is translated once more: every
+ * micro-op becomes a TRANS_op with the registers, the sign extended immediate
+ * and the jump targets already worked out, and AUIPC/LUI become constants.
+ * TRANS_run executes the ops in one switch without calling a handler and without
+ * updating the pc in between; only the op at the end of the block writes it.
+ * Results are exactly those of the handlers, including their quirks (BLT and
+ * SLTI compare unsigned, register shifts use the low 5 bits, JALR writes rd
+ * before it reads rs1). Ops without a translation (CSRs, AMOs, FENCE, WFI, the
+ * invalid op) call their handler with the pc set.
+ */
+
+//an op that writes x0 and has no other effect is dropped
+static int TRANS_pure(int kind)
+{
+	return kind <= T_LI;
+}
+
+TRANS_block *TRANS_translate(const CPU_uop *uops, uint32_t length, uint32_t pc)
+{
+	size_t bytes = sizeof(TRANS_block) + (length + 1) * sizeof(TRANS_op);
+	TRANS_block *block = malloc(bytes);
+	if (!block)
+	{
+		return NULL;
+	}
+	block->bytes_ = bytes;
+	block->generation_ = 0;
+	block->chain_[0] = block->chain_[1] = NULL;
+	block->alias_ = NULL;
+	block->pc_ = pc;
+	block->length_ = length;
+	block->eliminated_ = 0;
+	block->ic_block_[0] = block->ic_block_[1] = NULL;
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		uint32_t instruction = uops[i].instruction_;
+		uint32_t at = pc + 4 * i;
+		TRANS_op op = {T_CALL, getRD(instruction), getRS1(instruction), getRS2(instruction), imm_I(instruction), at};
+		switch (uops[i].op_)
+		{
+		case OP_ADD: op.kind_ = T_ADD; break;
+		case OP_SUB: op.kind_ = T_SUB; break;
+		case OP_SLL: op.kind_ = T_SLL; break;
+		case OP_SLT: op.kind_ = T_SLT; break;
+		case OP_SLTU: op.kind_ = T_SLTU; break;
+		case OP_XOR: op.kind_ = T_XOR; break;
+		case OP_SRL: op.kind_ = T_SRL; break;
+		case OP_SRA: op.kind_ = T_SRA; break;
+		case OP_OR: op.kind_ = T_OR; break;
+		case OP_AND: op.kind_ = T_AND; break;
+		case OP_ADDI: op.kind_ = T_ADDI; break;
+		case OP_SLTI: op.kind_ = T_SLTIU; break; //unsigned like its handler
+		case OP_SLTIU: op.kind_ = T_SLTIU; break;
+		case OP_XORI: op.kind_ = T_XORI; break;
+		case OP_ORI: op.kind_ = T_ORI; break;
+		case OP_ANDI: op.kind_ = T_ANDI; break;
+		case OP_SLLI: op.kind_ = T_SLLI; op.imm_ = op.rs2_; break;
+		case OP_SRLI: op.kind_ = T_SRLI; op.imm_ = op.rs2_; break;
+		case OP_SRAI: op.kind_ = T_SRAI; op.imm_ = shamt(instruction); break;
+		case OP_LUI: op.kind_ = T_LI; op.imm_ = imm_U(instruction); break;
+		case OP_AUIPC: op.kind_ = T_LI; op.imm_ = at + imm_U(instruction); break;
+		case OP_LB: op.kind_ = T_LB; break;
+		case OP_LH: op.kind_ = T_LH; break;
+		case OP_LW: op.kind_ = T_LW; break;
+		case OP_LBU: op.kind_ = T_LBU; break;
+		case OP_LHU: op.kind_ = T_LHU; break;
+		case OP_SB: op.kind_ = T_SB; op.imm_ = imm_S(instruction); break;
+		case OP_SH: op.kind_ = T_SH; op.imm_ = imm_S(instruction); break;
+		case OP_SW: op.kind_ = T_SW; op.imm_ = imm_S(instruction); break;
+		case OP_BEQ: op.kind_ = T_BEQ; op.imm_ = at + imm_B(instruction); break;
+		case OP_BNE: op.kind_ = T_BNE; op.imm_ = at + imm_B(instruction); break;
+		case OP_BLT: op.kind_ = T_BLTU; op.imm_ = at + imm_B(instruction); break; //unsigned like its handler
+		case OP_BGE: op.kind_ = T_BGE; op.imm_ = at + imm_B(instruction); break;
+		case OP_BLTU: op.kind_ = T_BLTU; op.imm_ = at + imm_B(instruction); break;
+		case OP_BGEU: op.kind_ = T_BGEU; op.imm_ = at + imm_B(instruction); break;
+		case OP_JAL: op.kind_ = T_JAL; op.imm_ = at + imm_J(instruction); break;
+		case OP_JALR: op.kind_ = T_JALR; break;
+		default:
+			//the handler index goes into rd_
+			op.rd_ = uops[i].op_;
+			op.imm_ = instruction;
+			break;
+		}
+		if (op.kind_ >= T_LB && op.kind_ <= T_LHU && op.rd_ == 0)
+		{
+			//a load into x0 still reads the console, the handler does that
+			op.kind_ = T_CALL;
+			op.rd_ = uops[i].op_;
+			op.imm_ = instruction;
+		}
+		if (TRANS_pure(op.kind_) && op.rd_ == 0)
+		{
+			continue;
+		}
+		block->ops_[count++] = op;
+	}
+	//blocks that do not end in a jump continue behind their last instruction
+	if (count == 0 || block->ops_[count - 1].kind_ < T_BEQ || block->ops_[count - 1].kind_ > T_JALR)
+	{
+		block->ops_[count++] = (TRANS_op){T_EXIT, 0, 0, 0, pc + 4 * length, pc + 4 * (length - 1)};
+	}
+	block->op_count_ = count;
+	return block;
+}
+
+//outside the data memory the block ends at the access like at a waiting load, the CPU halts there
+#define TRANS_CHECK(address, size)                                   \
+	if (__builtin_expect((uint64_t)(address) + (size) > limit, 0)) \
+	{                                                                \
+		CPU_memory_fault(cpu, address);                              \
+		cpu->pc_ = op->pc_;                                          \
+		return (op->pc_ - block->pc_) / 4;                           \
+	}
+
+uint32_t TRANS_run(CPU *cpu, const TRANS_block *block)
+{
+	uint32_t *x = cpu->regfile_;
+	uint8_t *mem = cpu->data_mem_;
+	uint64_t limit = cpu->data_mem_size_;
+
+	for (const TRANS_op *op = block->ops_;; op++)
+	{
+		switch (op->kind_)
+		{
+		case T_ADD: x[op->rd_] = x[op->rs1_] + x[op->rs2_]; break;
+		case T_SUB: x[op->rd_] = x[op->rs1_] - x[op->rs2_]; break;
+		case T_SLL: x[op->rd_] = x[op->rs1_] << (x[op->rs2_] & 31); break;
+		case T_SLT: x[op->rd_] = (int32_t)x[op->rs1_] < (int32_t)x[op->rs2_]; break;
+		case T_SLTU: x[op->rd_] = x[op->rs1_] < x[op->rs2_]; break;
+		case T_XOR: x[op->rd_] = x[op->rs1_] ^ x[op->rs2_]; break;
+		case T_SRL: x[op->rd_] = x[op->rs1_] >> (x[op->rs2_] & 31); break;
+		case T_SRA: x[op->rd_] = (int32_t)x[op->rs1_] >> (x[op->rs2_] & 31); break;
+		case T_OR: x[op->rd_] = x[op->rs1_] | x[op->rs2_]; break;
+		case T_AND: x[op->rd_] = x[op->rs1_] & x[op->rs2_]; break;
+		case T_ADDI: x[op->rd_] = x[op->rs1_] + op->imm_; break;
+		case T_SLTIU: x[op->rd_] = x[op->rs1_] < op->imm_; break;
+		case T_XORI: x[op->rd_] = x[op->rs1_] ^ op->imm_; break;
+		case T_ORI: x[op->rd_] = x[op->rs1_] | op->imm_; break;
+		case T_ANDI: x[op->rd_] = x[op->rs1_] & op->imm_; break;
+		case T_SLLI: x[op->rd_] = x[op->rs1_] << op->imm_; break;
+		case T_SRLI: x[op->rd_] = x[op->rs1_] >> op->imm_; break;
+		case T_SRAI: x[op->rd_] = (int32_t)x[op->rs1_] >> (int32_t)op->imm_; break;
+		case T_LI: x[op->rd_] = op->imm_; break;
+
+		case T_LB:
+		case T_LBU:
+		{
+			uint32_t address = x[op->rs1_] + op->imm_;
+			int byte;
+			TRANS_CHECK(address, 1);
+			if (address == CPU_CONSOLE_IN && cpu->input_)
+			{
+				byte = cpu->input_(cpu->input_context_);
+				if (byte == CPU_INPUT_WAIT)
+				{
+					cpu->waiting_ = 1;
+					cpu->pc_ = op->pc_;
+					return (op->pc_ - block->pc_) / 4;
+				}
+			}
+			else
+			{
+				byte = mem[address];
+			}
+			x[op->rd_] = op->kind_ == T_LB ? (uint32_t)(int8_t)byte : (uint8_t)byte;
+			break;
+		}
+		case T_LH:
+		case T_LHU:
+		{
+			uint32_t address = x[op->rs1_] + op->imm_;
+			TRANS_CHECK(address, 2);
+			uint16_t half = *(uint16_t *)(mem + address);
+			x[op->rd_] = op->kind_ == T_LH ? (uint32_t)(int16_t)half : half;
+			break;
+		}
+		case T_LW:
+		{
+			uint32_t address = x[op->rs1_] + op->imm_;
+			TRANS_CHECK(address, 4);
+			x[op->rd_] = *(uint32_t *)(mem + address);
+			break;
+		}
+
+		case T_SB:
+			TRANS_CHECK(x[op->rs1_] + op->imm_, 1);
+			//fall through
+		case T_GSB:
+		{
+			uint32_t address = x[op->rs1_] + op->imm_;
+			if (x[op->rs1_] == CPU_CONSOLE_OUT)
+			{
+				cpu->output_(cpu->output_context_, (uint8_t)x[op->rs2_]);
+			}
+			mem[address] = (uint8_t)x[op->rs2_];
+			if (__builtin_expect((address & ~0xFFu) == CPU_DEVICE_PAGE, 0))
+			{
+				CPU_device_store(cpu, address, (uint8_t)x[op->rs2_]);
+			}
+			break;
+		}
+		case T_SH:
+		{
+			uint32_t address = x[op->rs1_] + op->imm_;
+			TRANS_CHECK(address, 2);
+			*(uint16_t *)(mem + address) = (uint16_t)x[op->rs2_];
+			break;
+		}
+		case T_SW:
+		{
+			uint32_t address = x[op->rs1_] + op->imm_;
+			TRANS_CHECK(address, 4);
+			*(uint32_t *)(mem + address) = x[op->rs2_];
+			break;
+		}
+
+		//in the range of a T_GUARD in front of the block
+		case T_GLH: x[op->rd_] = (uint32_t)(int16_t)*(uint16_t *)(mem + (uint32_t)(x[op->rs1_] + op->imm_)); break;
+		case T_GLHU: x[op->rd_] = *(uint16_t *)(mem + (uint32_t)(x[op->rs1_] + op->imm_)); break;
+		case T_GLW: x[op->rd_] = *(uint32_t *)(mem + (uint32_t)(x[op->rs1_] + op->imm_)); break;
+		case T_GSH: *(uint16_t *)(mem + (uint32_t)(x[op->rs1_] + op->imm_)) = (uint16_t)x[op->rs2_]; break;
+		case T_GSW: *(uint32_t *)(mem + (uint32_t)(x[op->rs1_] + op->imm_)) = x[op->rs2_]; break;
+
+		case T_BEQ: cpu->pc_ = x[op->rs1_] == x[op->rs2_] ? op->imm_ : op->pc_ + 4; return block->length_;
+		case T_BNE: cpu->pc_ = x[op->rs1_] != x[op->rs2_] ? op->imm_ : op->pc_ + 4; return block->length_;
+		case T_BLTU: cpu->pc_ = x[op->rs1_] < x[op->rs2_] ? op->imm_ : op->pc_ + 4; return block->length_;
+		case T_BGE: cpu->pc_ = (int32_t)x[op->rs1_] >= (int32_t)x[op->rs2_] ? op->imm_ : op->pc_ + 4; return block->length_;
+		case T_BGEU: cpu->pc_ = x[op->rs1_] >= x[op->rs2_] ? op->imm_ : op->pc_ + 4; return block->length_;
+		case T_JAL:
+			x[op->rd_] = op->pc_ + 4;
+			x[0] = 0;
+			cpu->pc_ = op->imm_;
+			return block->length_;
+		case T_JALR:
+			x[op->rd_] = op->pc_ + 4;
+			cpu->pc_ = x[op->rs1_] + op->imm_;
+			x[0] = 0;
+			return block->length_;
+
+		case T_CALL:
+			cpu->pc_ = op->pc_;
+			CPU_ops[op->rd_].handler_(cpu, op->imm_);
+			x[0] = 0;
+			if (cpu->pc_ != op->pc_ + 4)
+			{
+				//a load waiting for input is not retired, anything else ends its block
+				return (op->pc_ - block->pc_) / 4 + !(cpu->waiting_ && cpu->pc_ == op->pc_);
+			}
+			break;
+		case T_EXIT:
+			cpu->pc_ = op->imm_;
+			return block->length_;
+
+		case T_GUARD:
+			//the T_G* accesses, the optimizer counted on them not ending the block
+			if (__builtin_expect((uint64_t)(uint32_t)(x[op->rs1_] + op->imm_) + op->pc_ > limit, 0))
+			{
+				return TRANS_UNGUARDED;
+			}
+			break;
+		}
+	}
+}
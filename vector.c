@@ -0,0 +1,931 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "hurv_internal.h"
+
+/**
+ * Vector extension (a subset of RVV 1.0)
+ *
+ * VLEN is CPU_VLEN (256) bits and ELEN 32, like Zve32x: SEW 8, 16 and 32 with
+ * LMUL 1/8 to 8. The 32 vector registers lie one after another in vregs_, so a
+ * register group of LMUL registers is one contiguous array of elements. The
+ * arithmetic runs on whole registers as GCC vector extensions of VEC_CHUNK
+ * bytes (the Makefile builds this file with -march=native, one AVX2 operation
+ * per register), into a scratch group that VEC_commit then writes to vd for the
+ * active elements only, so masks and the tail cost a blend, not a branch per
+ * element.
+ *
+ * Supported: vsetvli, vsetivli, vsetvl; unit-stride and strided loads and
+ * stores of 8, 16 and 32 bit elements, vlm.v and vsm.v; vadd, vsub, vrsub,
+ * vand, vor, vxor, vsll, vsrl, vsra, vminu, vmin, vmaxu, vmax, vmul, vmerge and
+ * vmv.v (.vv, .vx and .vi where the spec has them); the integer compares
+ * vmseq..vmsgt; vredsum, vredand, vredor, vredxor, vredminu, vredmin,
+ * vredmaxu, vredmax; the mask instructions vmand.mm..vmxnor.mm, vcpop.m,
+ * vfirst.m, vid.v, vmv.x.s and vmv.s.x. Every instruction runs to the end, so
+ * vstart stays 0. Tail and inactive elements are left undisturbed, which the
+ * agnostic policies allow as well. Anything else, an illegal vtype (vill) or a
+ * misaligned register group is an illegal instruction: the pc stays and the
+ * CPU halts. Vector loads and stores go to the data memory only, not to the
+ * console or the other devices.
+ */
+
+#define VEC_CHUNK VEC_VLENB
+#define VEC_ELEN_SHIFT 2 //ELEN 32: log2 of the widest element in bytes
+#define VEC_GROUP (8 * VEC_VLENB)
+
+typedef uint8_t VEC_u8 __attribute__((vector_size(VEC_CHUNK)));
+typedef int8_t VEC_i8 __attribute__((vector_size(VEC_CHUNK)));
+typedef uint16_t VEC_u16 __attribute__((vector_size(VEC_CHUNK)));
+typedef int16_t VEC_i16 __attribute__((vector_size(VEC_CHUNK)));
+typedef uint32_t VEC_u32 __attribute__((vector_size(VEC_CHUNK)));
+typedef int32_t VEC_i32 __attribute__((vector_size(VEC_CHUNK)));
+
+//funct3 of the OP-V opcode
+enum VEC_category
+{
+	VEC_OPIVV,
+	VEC_OPFVV,
+	VEC_OPMVV,
+	VEC_OPIVI,
+	VEC_OPIVX,
+	VEC_OPFVF,
+	VEC_OPMVX,
+	VEC_OPCFG
+};
+
+//element-wise operations, vd = vs2 op operand
+enum VEC_operation
+{
+	VEC_ADD,
+	VEC_SUB,
+	VEC_RSUB,
+	VEC_AND,
+	VEC_OR,
+	VEC_XOR,
+	VEC_SLL,
+	VEC_SRL,
+	VEC_SRA,
+	VEC_MINU,
+	VEC_MIN,
+	VEC_MAXU,
+	VEC_MAX,
+	VEC_MUL,
+	VEC_MOVE, //vmerge and vmv.v: the operand
+	VEC_SEQ,  //compares: all ones where true
+	VEC_SNE,
+	VEC_SLTU,
+	VEC_SLT,
+	VEC_SLEU,
+	VEC_SLE,
+	VEC_SGTU,
+	VEC_SGT,
+	VEC_OPERATION_COUNT,
+	VEC_NONE = -1
+};
+
+//funct6 of OPIVV, OPIVX and OPIVI
+static const int8_t VEC_integer[64] = {
+	[0x00] = VEC_ADD, [0x01] = VEC_NONE, [0x02] = VEC_SUB, [0x03] = VEC_RSUB, [0x04] = VEC_MINU, [0x05] = VEC_MIN,
+	[0x06] = VEC_MAXU, [0x07] = VEC_MAX, [0x08] = VEC_NONE, [0x09] = VEC_AND, [0x0A] = VEC_OR, [0x0B] = VEC_XOR,
+	[0x0C ... 0x16] = VEC_NONE, [0x17] = VEC_MOVE, [0x18] = VEC_SEQ, [0x19] = VEC_SNE, [0x1A] = VEC_SLTU,
+	[0x1B] = VEC_SLT, [0x1C] = VEC_SLEU, [0x1D] = VEC_SLE, [0x1E] = VEC_SGTU, [0x1F] = VEC_SGT,
+	[0x20 ... 0x24] = VEC_NONE, [0x25] = VEC_SLL, [0x26 ... 0x27] = VEC_NONE, [0x28] = VEC_SRL, [0x29] = VEC_SRA,
+	[0x2A ... 0x3F] = VEC_NONE,
+};
+
+//per operation the forms the spec has: bit 0 .vv, bit 1 .vx, bit 2 .vi
+static const uint8_t VEC_forms[VEC_OPERATION_COUNT] = {
+	[VEC_ADD] = 7, [VEC_SUB] = 3, [VEC_RSUB] = 6, [VEC_AND] = 7, [VEC_OR] = 7, [VEC_XOR] = 7,
+	[VEC_SLL] = 7, [VEC_SRL] = 7, [VEC_SRA] = 7, [VEC_MINU] = 3, [VEC_MIN] = 3, [VEC_MAXU] = 3,
+	[VEC_MAX] = 3, [VEC_MUL] = 3, [VEC_MOVE] = 7, [VEC_SEQ] = 7, [VEC_SNE] = 7, [VEC_SLTU] = 3,
+	[VEC_SLT] = 3, [VEC_SLEU] = 7, [VEC_SLE] = 7, [VEC_SGTU] = 6, [VEC_SGT] = 6,
+};
+
+//vredsum..vredmax (funct6 0..7 of OPMVV) as element-wise operations and their identities
+static const int8_t VEC_reduction[8] = {VEC_ADD, VEC_AND, VEC_OR, VEC_XOR, VEC_MINU, VEC_MIN, VEC_MAXU, VEC_MAX};
+
+//a whole register group: d = a op b, b advancing by b_step bytes per register (0: a broadcast scalar)
+typedef void (*VEC_kernel)(uint8_t *d, const uint8_t *a, const uint8_t *b, size_t b_step, int chunks);
+
+#define VEC_SELECT(mask, x, y) (((x) & (mask)) | ((y) & ~(mask)))
+
+#define VEC_KERNEL(name, U, S, bits, expression)                                       \
+	static void name(uint8_t *d, const uint8_t *a_, const uint8_t *b_, size_t b_step, int chunks) \
+	{                                                                                  \
+		for (int c = 0; c < chunks; c++)                                               \
+		{                                                                              \
+			U a, b, r;                                                                 \
+			memcpy(&a, a_ + c * VEC_CHUNK, VEC_CHUNK);                                 \
+			memcpy(&b, b_ + c * b_step, VEC_CHUNK);                                    \
+			S sa = (S)a, sb = (S)b;                                                    \
+			(void)sa;                                                                  \
+			(void)sb;                                                                  \
+			r = (expression);                                                          \
+			memcpy(d + c * VEC_CHUNK, &r, VEC_CHUNK);                                  \
+		}                                                                              \
+	}
+
+#define VEC_KERNELS(bits, U, S)                                                                 \
+	VEC_KERNEL(VEC_add_##bits, U, S, bits, a + b)                                               \
+	VEC_KERNEL(VEC_sub_##bits, U, S, bits, a - b)                                               \
+	VEC_KERNEL(VEC_rsub_##bits, U, S, bits, b - a)                                              \
+	VEC_KERNEL(VEC_and_##bits, U, S, bits, a & b)                                               \
+	VEC_KERNEL(VEC_or_##bits, U, S, bits, a | b)                                                \
+	VEC_KERNEL(VEC_xor_##bits, U, S, bits, a ^ b)                                               \
+	VEC_KERNEL(VEC_sll_##bits, U, S, bits, a << (b & (bits - 1)))                               \
+	VEC_KERNEL(VEC_srl_##bits, U, S, bits, a >> (b & (bits - 1)))                               \
+	VEC_KERNEL(VEC_sra_##bits, U, S, bits, (U)(sa >> (S)(b & (bits - 1))))                      \
+	VEC_KERNEL(VEC_minu_##bits, U, S, bits, VEC_SELECT((U)(a < b), a, b))                       \
+	VEC_KERNEL(VEC_min_##bits, U, S, bits, VEC_SELECT((U)(sa < sb), a, b))                      \
+	VEC_KERNEL(VEC_maxu_##bits, U, S, bits, VEC_SELECT((U)(a > b), a, b))                       \
+	VEC_KERNEL(VEC_max_##bits, U, S, bits, VEC_SELECT((U)(sa > sb), a, b))                      \
+	VEC_KERNEL(VEC_mul_##bits, U, S, bits, a * b)                                               \
+	VEC_KERNEL(VEC_move_##bits, U, S, bits, b)                                                  \
+	VEC_KERNEL(VEC_seq_##bits, U, S, bits, (U)(a == b))                                         \
+	VEC_KERNEL(VEC_sne_##bits, U, S, bits, (U)(a != b))                                         \
+	VEC_KERNEL(VEC_sltu_##bits, U, S, bits, (U)(a < b))                                         \
+	VEC_KERNEL(VEC_slt_##bits, U, S, bits, (U)(sa < sb))                                        \
+	VEC_KERNEL(VEC_sleu_##bits, U, S, bits, (U)(a <= b))                                        \
+	VEC_KERNEL(VEC_sle_##bits, U, S, bits, (U)(sa <= sb))                                       \
+	VEC_KERNEL(VEC_sgtu_##bits, U, S, bits, (U)(a > b))                                         \
+	VEC_KERNEL(VEC_sgt_##bits, U, S, bits, (U)(sa > sb))                                        \
+	static const VEC_kernel VEC_kernels_##bits[VEC_OPERATION_COUNT] = {                         \
+		VEC_add_##bits, VEC_sub_##bits, VEC_rsub_##bits, VEC_and_##bits, VEC_or_##bits,         \
+		VEC_xor_##bits, VEC_sll_##bits, VEC_srl_##bits, VEC_sra_##bits, VEC_minu_##bits,        \
+		VEC_min_##bits, VEC_maxu_##bits, VEC_max_##bits, VEC_mul_##bits, VEC_move_##bits,       \
+		VEC_seq_##bits, VEC_sne_##bits, VEC_sltu_##bits, VEC_slt_##bits, VEC_sleu_##bits,       \
+		VEC_sle_##bits, VEC_sgtu_##bits, VEC_sgt_##bits,                                        \
+	};
+
+VEC_KERNELS(8, VEC_u8, VEC_i8)
+VEC_KERNELS(16, VEC_u16, VEC_i16)
+VEC_KERNELS(32, VEC_u32, VEC_i32)
+
+//by log2 of the element size in bytes
+static const VEC_kernel *const VEC_kernels[3] = {VEC_kernels_8, VEC_kernels_16, VEC_kernels_32};
+
+//per byte of a register: the mask byte of its element and the bit in it, by log2 of the element size
+#define VEC_LANES(e)                                                                          \
+	{                                                                                         \
+		e(0), e(1), e(2), e(3), e(4), e(5), e(6), e(7), e(8), e(9), e(10), e(11), e(12), e(13), \
+			e(14), e(15), e(16), e(17), e(18), e(19), e(20), e(21), e(22), e(23), e(24), e(25), \
+			e(26), e(27), e(28), e(29), e(30), e(31)                                          \
+	}
+#define VEC_BYTE_0(j) ((j) >> 3)
+#define VEC_BYTE_1(j) ((j) >> 4)
+#define VEC_BYTE_2(j) ((j) >> 5)
+#define VEC_BIT_0(j) ((j)&7)
+#define VEC_BIT_1(j) ((j) >> 1 & 7)
+#define VEC_BIT_2(j) ((j) >> 2 & 7)
+#define VEC_INDEX(j) (j)
+static const VEC_u8 VEC_mask_byte[3] = {VEC_LANES(VEC_BYTE_0), VEC_LANES(VEC_BYTE_1), VEC_LANES(VEC_BYTE_2)};
+static const VEC_u8 VEC_mask_bit[3] = {VEC_LANES(VEC_BIT_0), VEC_LANES(VEC_BIT_1), VEC_LANES(VEC_BIT_2)};
+static const VEC_u8 VEC_byte_index = VEC_LANES(VEC_INDEX);
+
+//vtype
+#define VEC_VILL 0x80000000u
+#define VEC_VTYPE_RESERVED 0x7FFFFF00u
+
+static uint8_t *VEC_reg(CPU *cpu, int index)
+{
+	return cpu->vregs_ + index * VEC_VLENB;
+}
+
+static int VEC_sew_shift(const CPU *cpu) //log2 of SEW in bytes
+{
+	return cpu->vtype_ >> 3 & 7;
+}
+
+static int VEC_lmul_shift(uint32_t vtype) //log2 of LMUL, -3..3
+{
+	int vlmul = vtype & 7;
+	return vlmul < 4 ? vlmul : vlmul - 8;
+}
+
+//registers of a group of log2 size emul_shift; 0 if index is not a multiple of it
+static int VEC_aligned(int index, int emul_shift)
+{
+	return emul_shift <= 0 || !(index & ((1 << emul_shift) - 1));
+}
+
+//a vtype with a legal SEW and LMUL, vl and vtype are set
+static int VEC_ready(const CPU *cpu)
+{
+	return !(cpu->vtype_ & VEC_VILL);
+}
+
+static int VEC_mask_bit_of(CPU *cpu, uint32_t element)
+{
+	return cpu->vregs_[element >> 3] >> (element & 7) & 1;
+}
+
+//per byte of register chunk of a group of 1 << shift byte elements: all ones where the element is active
+static VEC_u8 VEC_active(CPU *cpu, int chunk, int shift, uint32_t vl, int vm)
+{
+	int bytes = (int)(vl << shift) - chunk * VEC_CHUNK;
+	VEC_u8 active = (VEC_u8)(VEC_byte_index < (uint8_t)(bytes > VEC_CHUNK ? VEC_CHUNK : bytes < 0 ? 0 : bytes));
+	if (!vm)
+	{
+		//the mask bits of the chunk start at a byte of v0: 32, 16 or 8 elements
+		VEC_u8 bits = {0};
+		memcpy(&bits, cpu->vregs_ + (chunk * (VEC_CHUNK >> shift) >> 3), (VEC_CHUNK >> shift) >> 3);
+		bits = __builtin_shuffle(bits, VEC_mask_byte[shift]) >> VEC_mask_bit[shift] & 1;
+		active &= -bits;
+	}
+	return active;
+}
+
+//first vl bits set, a mask register
+static VEC_u8 VEC_prefix(uint32_t vl)
+{
+	VEC_u8 full = (VEC_u8)(VEC_byte_index < (uint8_t)(vl >> 3));
+	VEC_u8 partial = (VEC_u8)(VEC_byte_index == (uint8_t)(vl >> 3)) & (uint8_t)((1u << (vl & 7)) - 1);
+	return full | partial;
+}
+
+//writes the active elements of result to the group at vd, the others stay
+static void VEC_commit(CPU *cpu, int vd, const uint8_t *result, int shift, uint32_t vl, int vm)
+{
+	uint8_t *d = VEC_reg(cpu, vd);
+	if (vm)
+	{
+		memcpy(d, result, (size_t)vl << shift);
+		return;
+	}
+	int chunks = (int)(((vl << shift) + VEC_CHUNK - 1) / VEC_CHUNK);
+	for (int c = 0; c < chunks; c++)
+	{
+		VEC_u8 r, old;
+		memcpy(&r, result + c * VEC_CHUNK, VEC_CHUNK);
+		memcpy(&old, d + c * VEC_CHUNK, VEC_CHUNK);
+		VEC_u8 active = VEC_active(cpu, c, shift, vl, vm);
+		old = VEC_SELECT(active, r, old);
+		memcpy(d + c * VEC_CHUNK, &old, VEC_CHUNK);
+	}
+}
+
+//a register filled with value at the element size
+static void VEC_broadcast(uint8_t *chunk, uint32_t value, int shift)
+{
+	VEC_u32 v;
+	switch (shift)
+	{
+	case 0:
+		value = (value & 0xFF) * 0x01010101u;
+		break;
+	case 1:
+		value = (value & 0xFFFF) * 0x00010001u;
+		break;
+	}
+	v = (VEC_u32){0} + value;
+	memcpy(chunk, &v, VEC_CHUNK);
+}
+
+static uint32_t VEC_element(CPU *cpu, int index, uint32_t element, int shift)
+{
+	const uint8_t *p = VEC_reg(cpu, index) + (element << shift);
+	switch (shift)
+	{
+	case 0:
+		return *p;
+	case 1:
+	{
+		uint16_t v;
+		memcpy(&v, p, 2);
+		return v;
+	}
+	}
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t VEC_sign_extend(uint32_t value, int shift)
+{
+	int bits = 32 - (8 << shift);
+	return bits ? (uint32_t)((int32_t)(value << bits) >> bits) : value;
+}
+
+void VSETVL(CPU *cpu, uint32_t instruction)
+{
+	int rd = getRD(instruction);
+	int rs1 = getRS1(instruction);
+	uint32_t vtype;
+	uint32_t avl;
+	if (!(instruction >> 31)) //vsetvli
+	{
+		vtype = instruction >> 20 & 0x7FF;
+	}
+	else if (instruction >> 30 & 1) //vsetivli
+	{
+		vtype = instruction >> 20 & 0x3FF;
+	}
+	else //vsetvl
+	{
+		vtype = cpu->regfile_[getRS2(instruction)];
+	}
+	if ((instruction >> 30) == 3)
+	{
+		avl = rs1; //uimm
+	}
+	else if (rs1 != 0)
+	{
+		avl = cpu->regfile_[rs1];
+	}
+	else
+	{
+		avl = rd != 0 ? UINT32_MAX : cpu->vl_;
+	}
+
+	int sew_shift = vtype >> 3 & 7;
+	int lmul_shift = VEC_lmul_shift(vtype);
+	if ((vtype & VEC_VTYPE_RESERVED) || sew_shift > VEC_ELEN_SHIFT || (vtype & 7) == 4 ||
+		sew_shift > VEC_ELEN_SHIFT + lmul_shift)
+	{
+		cpu->vtype_ = VEC_VILL;
+		cpu->vl_ = 0;
+	}
+	else
+	{
+		//VLMAX = VLEN / SEW * LMUL
+		uint32_t vlmax = lmul_shift >= 0 ? (uint32_t)VEC_VLENB >> sew_shift << lmul_shift
+										 : (uint32_t)VEC_VLENB >> sew_shift >> -lmul_shift;
+		cpu->vtype_ = vtype;
+		cpu->vl_ = avl < vlmax ? avl : vlmax;
+	}
+	cpu->regfile_[rd] = cpu->vl_;
+	cpu->pc_ += 0x4;
+}
+
+//element size and register group of a load or store, -1 if its EMUL is not legal or vd/vs3 misaligned
+static int VEC_memory_shift(CPU *cpu, uint32_t instruction)
+{
+	int width = getFunc3(instruction);
+	int shift = width == 0 ? 0 : width - 4; //vle8: 0, vle16: 5, vle32: 6
+	int emul_shift = shift - VEC_sew_shift(cpu) + VEC_lmul_shift(cpu->vtype_);
+	int vd = getRD(instruction);
+	if (!VEC_ready(cpu) || emul_shift < -3 || emul_shift > 3 || !VEC_aligned(vd, emul_shift) ||
+		(!(instruction >> 25 & 1) && vd == 0))
+	{
+		return -1;
+	}
+	return shift;
+}
+
+/**
+ * size bytes between buffer and the guest memory at addr, 0 if the access
+ * trapped. In privileged mode a page at a time; a store that traps in its
+ * second page has written the first, like an element store that traps halfway.
+ */
+static int VEC_transfer(CPU *cpu, uint8_t *buffer, uint32_t addr, size_t size, int store)
+{
+	while (size)
+	{
+		size_t part = cpu->mmu_ && (addr & 0xFFF) + size > 0x1000 ? 0x1000 - (addr & 0xFFF) : size;
+		uint8_t *host = store ? CPU_store_address(cpu, addr, part) : CPU_load_address(cpu, addr, part);
+		if (!host)
+		{
+			return 0;
+		}
+		if (store)
+		{
+			memcpy(host, buffer, part);
+		}
+		else
+		{
+			memcpy(buffer, host, part);
+		}
+		buffer += part;
+		addr += part;
+		size -= part;
+	}
+	return 1;
+}
+
+void VLE(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_memory_shift(cpu, instruction);
+	if (shift < 0)
+	{
+		return;
+	}
+	uint8_t result[VEC_GROUP];
+	if (!VEC_transfer(cpu, result, cpu->regfile_[getRS1(instruction)], (size_t)cpu->vl_ << shift, 0))
+	{
+		return;
+	}
+	VEC_commit(cpu, getRD(instruction), result, shift, cpu->vl_, instruction >> 25 & 1);
+	cpu->pc_ += 0x4;
+}
+
+void VLSE(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_memory_shift(cpu, instruction);
+	if (shift < 0)
+	{
+		return;
+	}
+	uint8_t result[VEC_GROUP];
+	uint32_t address = cpu->regfile_[getRS1(instruction)];
+	uint32_t stride = cpu->regfile_[getRS2(instruction)];
+	for (uint32_t i = 0; i < cpu->vl_; i++, address += stride)
+	{
+		if (!VEC_transfer(cpu, result + (i << shift), address, (size_t)1 << shift, 0))
+		{
+			return;
+		}
+	}
+	VEC_commit(cpu, getRD(instruction), result, shift, cpu->vl_, instruction >> 25 & 1);
+	cpu->pc_ += 0x4;
+}
+
+void VSE(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_memory_shift(cpu, instruction);
+	if (shift < 0)
+	{
+		return;
+	}
+	uint32_t address = cpu->regfile_[getRS1(instruction)];
+	uint8_t *vs3 = VEC_reg(cpu, getRD(instruction));
+	if (instruction >> 25 & 1)
+	{
+		if (!VEC_transfer(cpu, vs3, address, (size_t)cpu->vl_ << shift, 1))
+		{
+			return;
+		}
+	}
+	else
+	{
+		for (uint32_t i = 0; i < cpu->vl_; i++)
+		{
+			if (VEC_mask_bit_of(cpu, i) && !VEC_transfer(cpu, vs3 + (i << shift), address + (i << shift), (size_t)1 << shift, 1))
+			{
+				return;
+			}
+		}
+	}
+	cpu->pc_ += 0x4;
+}
+
+void VSSE(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_memory_shift(cpu, instruction);
+	if (shift < 0)
+	{
+		return;
+	}
+	uint8_t *vs3 = VEC_reg(cpu, getRD(instruction));
+	uint32_t address = cpu->regfile_[getRS1(instruction)];
+	uint32_t stride = cpu->regfile_[getRS2(instruction)];
+	int vm = instruction >> 25 & 1;
+	for (uint32_t i = 0; i < cpu->vl_; i++, address += stride)
+	{
+		if ((vm || VEC_mask_bit_of(cpu, i)) && !VEC_transfer(cpu, vs3 + (i << shift), address, (size_t)1 << shift, 1))
+		{
+			return;
+		}
+	}
+	cpu->pc_ += 0x4;
+}
+
+//vlm.v and vsm.v: ceil(vl / 8) bytes of a mask register
+void VLM(CPU *cpu, uint32_t instruction)
+{
+	if (!VEC_ready(cpu))
+	{
+		return;
+	}
+	uint8_t mask[VEC_VLENB];
+	if (!VEC_transfer(cpu, mask, cpu->regfile_[getRS1(instruction)], (cpu->vl_ + 7) >> 3, 0))
+	{
+		return;
+	}
+	memcpy(VEC_reg(cpu, getRD(instruction)), mask, (cpu->vl_ + 7) >> 3);
+	cpu->pc_ += 0x4;
+}
+
+void VSM(CPU *cpu, uint32_t instruction)
+{
+	if (!VEC_ready(cpu))
+	{
+		return;
+	}
+	if (!VEC_transfer(cpu, VEC_reg(cpu, getRD(instruction)), cpu->regfile_[getRS1(instruction)], (cpu->vl_ + 7) >> 3, 1))
+	{
+		return;
+	}
+	cpu->pc_ += 0x4;
+}
+
+//the operand of an OPIVV/OPIVX/OPIVI/OPMVV/OPMVX instruction: vs1, x[rs1] or simm5 broadcast into scalar
+static const uint8_t *VEC_operand(CPU *cpu, uint32_t instruction, int shift, uint8_t *scalar, size_t *step)
+{
+	int rs1 = getRS1(instruction);
+	switch (getFunc3(instruction))
+	{
+	case VEC_OPIVV:
+	case VEC_OPMVV:
+		*step = VEC_CHUNK;
+		return VEC_reg(cpu, rs1);
+	case VEC_OPIVI:
+		VEC_broadcast(scalar, (uint32_t)((int32_t)((uint32_t)rs1 << 27) >> 27), shift);
+		break;
+	default:
+		VEC_broadcast(scalar, cpu->regfile_[rs1], shift);
+		break;
+	}
+	*step = 0;
+	return scalar;
+}
+
+static int VEC_operation_of(uint32_t instruction)
+{
+	int category = getFunc3(instruction);
+	return category == VEC_OPMVV || category == VEC_OPMVX ? VEC_MUL : VEC_integer[instruction >> 26];
+}
+
+//element-wise integer operations, vmerge and vmv.v
+void VARITH(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_sew_shift(cpu);
+	int lmul_shift = VEC_lmul_shift(cpu->vtype_);
+	int vd = getRD(instruction);
+	int vs2 = getRS2(instruction);
+	int vm = instruction >> 25 & 1;
+	int vv = getFunc3(instruction) == VEC_OPIVV || getFunc3(instruction) == VEC_OPMVV;
+	if (!VEC_ready(cpu) || !VEC_aligned(vd, lmul_shift) || !VEC_aligned(vs2, lmul_shift) ||
+		(vv && !VEC_aligned(getRS1(instruction), lmul_shift)) || (!vm && vd == 0))
+	{
+		return;
+	}
+	int operation = VEC_operation_of(instruction);
+	uint8_t scalar[VEC_CHUNK];
+	uint8_t result[VEC_GROUP];
+	size_t step;
+	const uint8_t *operand = VEC_operand(cpu, instruction, shift, scalar, &step);
+	int chunks = (int)(((cpu->vl_ << shift) + VEC_CHUNK - 1) / VEC_CHUNK);
+	VEC_kernels[shift][operation](result, VEC_reg(cpu, vs2), operand, step, chunks);
+	if (operation == VEC_MOVE && !vm)
+	{
+		//vmerge: vs2 where the mask is clear
+		memmove(VEC_reg(cpu, vd), VEC_reg(cpu, vs2), (size_t)cpu->vl_ << shift);
+	}
+	VEC_commit(cpu, vd, result, shift, cpu->vl_, vm);
+	cpu->pc_ += 0x4;
+}
+
+//integer compares, a mask register with a bit per element
+void VCMP(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_sew_shift(cpu);
+	int lmul_shift = VEC_lmul_shift(cpu->vtype_);
+	int vs2 = getRS2(instruction);
+	int vm = instruction >> 25 & 1;
+	if (!VEC_ready(cpu) || !VEC_aligned(vs2, lmul_shift) ||
+		(getFunc3(instruction) == VEC_OPIVV && !VEC_aligned(getRS1(instruction), lmul_shift)))
+	{
+		return;
+	}
+	uint8_t scalar[VEC_CHUNK];
+	uint8_t result[VEC_GROUP];
+	size_t step;
+	uint32_t vl = cpu->vl_;
+	const uint8_t *operand = VEC_operand(cpu, instruction, shift, scalar, &step);
+	int chunks = (int)(((vl << shift) + VEC_CHUNK - 1) / VEC_CHUNK);
+	VEC_kernels[shift][VEC_integer[instruction >> 26]](result, VEC_reg(cpu, vs2), operand, step, chunks);
+
+	VEC_u8 bits = {0}, active, old;
+	for (uint32_t i = 0; i < vl; i++)
+	{
+		bits[i >> 3] |= (result[i << shift] & 1) << (i & 7);
+	}
+	active = VEC_prefix(vl);
+	if (!vm)
+	{
+		VEC_u8 mask;
+		memcpy(&mask, cpu->vregs_, VEC_CHUNK);
+		active &= mask;
+	}
+	uint8_t *d = VEC_reg(cpu, getRD(instruction));
+	memcpy(&old, d, VEC_CHUNK);
+	old = VEC_SELECT(active, bits, old);
+	memcpy(d, &old, VEC_CHUNK);
+	cpu->pc_ += 0x4;
+}
+
+static uint32_t VEC_scalar(int operation, uint32_t a, uint32_t b, int shift)
+{
+	int32_t sa = (int32_t)VEC_sign_extend(a, shift), sb = (int32_t)VEC_sign_extend(b, shift);
+	switch (operation)
+	{
+	case VEC_ADD:
+		return a + b;
+	case VEC_AND:
+		return a & b;
+	case VEC_OR:
+		return a | b;
+	case VEC_XOR:
+		return a ^ b;
+	case VEC_MINU:
+		return a < b ? a : b;
+	case VEC_MIN:
+		return sa < sb ? a : b;
+	case VEC_MAXU:
+		return a > b ? a : b;
+	}
+	return sa > sb ? a : b;
+}
+
+//identity of a reduction at the element size
+static uint32_t VEC_identity(int operation, int shift)
+{
+	uint32_t ones = shift == 2 ? UINT32_MAX : (1u << (8 << shift)) - 1;
+	switch (operation)
+	{
+	case VEC_AND:
+	case VEC_MINU:
+		return ones;
+	case VEC_MIN:
+		return ones >> 1;
+	case VEC_MAX:
+		return (ones >> 1) + 1;
+	}
+	return 0;
+}
+
+//vd[0] = vs1[0] op the active elements of vs2, register by register in SIMD, then across the lanes
+void VRED(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_sew_shift(cpu);
+	int vs2 = getRS2(instruction);
+	int vm = instruction >> 25 & 1;
+	if (!VEC_ready(cpu) || !VEC_aligned(vs2, VEC_lmul_shift(cpu->vtype_)))
+	{
+		return;
+	}
+	uint32_t vl = cpu->vl_;
+	if (vl)
+	{
+		int operation = VEC_reduction[instruction >> 26];
+		VEC_kernel kernel = VEC_kernels[shift][operation];
+		uint8_t identity[VEC_CHUNK], accumulator[VEC_CHUNK];
+		VEC_broadcast(identity, VEC_identity(operation, shift), shift);
+		memcpy(accumulator, identity, VEC_CHUNK);
+		int chunks = (int)(((vl << shift) + VEC_CHUNK - 1) / VEC_CHUNK);
+		for (int c = 0; c < chunks; c++)
+		{
+			VEC_u8 x, fill;
+			memcpy(&x, VEC_reg(cpu, vs2) + c * VEC_CHUNK, VEC_CHUNK);
+			memcpy(&fill, identity, VEC_CHUNK);
+			x = VEC_SELECT(VEC_active(cpu, c, shift, vl, vm), x, fill);
+			kernel(accumulator, accumulator, (const uint8_t *)&x, 0, 1);
+		}
+		uint32_t result = VEC_element(cpu, getRS1(instruction), 0, shift);
+		for (int i = 0; i < VEC_CHUNK >> shift; i++)
+		{
+			uint32_t lane = 0;
+			memcpy(&lane, accumulator + (i << shift), (size_t)1 << shift);
+			result = VEC_scalar(operation, result, lane, shift);
+		}
+		memcpy(VEC_reg(cpu, getRD(instruction)), &result, (size_t)1 << shift);
+	}
+	cpu->pc_ += 0x4;
+}
+
+//vmand.mm..vmxnor.mm on the first vl bits
+void VMASK(CPU *cpu, uint32_t instruction)
+{
+	if (!VEC_ready(cpu))
+	{
+		return;
+	}
+	VEC_u8 a, b, r, old;
+	memcpy(&a, VEC_reg(cpu, getRS2(instruction)), VEC_CHUNK);
+	memcpy(&b, VEC_reg(cpu, getRS1(instruction)), VEC_CHUNK);
+	switch (instruction >> 26 & 7)
+	{
+	case 0:
+		r = a & ~b;
+		break;
+	case 1:
+		r = a & b;
+		break;
+	case 2:
+		r = a | b;
+		break;
+	case 3:
+		r = a ^ b;
+		break;
+	case 4:
+		r = a | ~b;
+		break;
+	case 5:
+		r = ~(a & b);
+		break;
+	case 6:
+		r = ~(a | b);
+		break;
+	default:
+		r = ~(a ^ b);
+		break;
+	}
+	uint8_t *d = VEC_reg(cpu, getRD(instruction));
+	memcpy(&old, d, VEC_CHUNK);
+	old = VEC_SELECT(VEC_prefix(cpu->vl_), r, old);
+	memcpy(d, &old, VEC_CHUNK);
+	cpu->pc_ += 0x4;
+}
+
+//the active bits of the mask register vs2, as 64-bit words
+static void VEC_mask_words(CPU *cpu, uint32_t instruction, uint64_t *words)
+{
+	VEC_u8 bits = VEC_prefix(cpu->vl_), source;
+	memcpy(&source, VEC_reg(cpu, getRS2(instruction)), VEC_CHUNK);
+	bits &= source;
+	if (!(instruction >> 25 & 1))
+	{
+		VEC_u8 mask;
+		memcpy(&mask, cpu->vregs_, VEC_CHUNK);
+		bits &= mask;
+	}
+	memcpy(words, &bits, VEC_CHUNK);
+}
+
+void VCPOP(CPU *cpu, uint32_t instruction)
+{
+	if (!VEC_ready(cpu))
+	{
+		return;
+	}
+	uint64_t words[VEC_CHUNK / 8];
+	uint32_t count = 0;
+	VEC_mask_words(cpu, instruction, words);
+	for (int i = 0; i < VEC_CHUNK / 8; i++)
+	{
+		count += __builtin_popcountll(words[i]);
+	}
+	cpu->regfile_[getRD(instruction)] = count;
+	cpu->pc_ += 0x4;
+}
+
+void VFIRST(CPU *cpu, uint32_t instruction)
+{
+	if (!VEC_ready(cpu))
+	{
+		return;
+	}
+	uint64_t words[VEC_CHUNK / 8];
+	uint32_t first = UINT32_MAX;
+	VEC_mask_words(cpu, instruction, words);
+	for (int i = 0; i < VEC_CHUNK / 8; i++)
+	{
+		if (words[i])
+		{
+			first = i * 64 + __builtin_ctzll(words[i]);
+			break;
+		}
+	}
+	cpu->regfile_[getRD(instruction)] = first;
+	cpu->pc_ += 0x4;
+}
+
+void VMV_X_S(CPU *cpu, uint32_t instruction)
+{
+	if (!VEC_ready(cpu))
+	{
+		return;
+	}
+	int shift = VEC_sew_shift(cpu);
+	cpu->regfile_[getRD(instruction)] = VEC_sign_extend(VEC_element(cpu, getRS2(instruction), 0, shift), shift);
+	cpu->pc_ += 0x4;
+}
+
+void VMV_S_X(CPU *cpu, uint32_t instruction)
+{
+	if (!VEC_ready(cpu))
+	{
+		return;
+	}
+	if (cpu->vl_)
+	{
+		uint32_t value = cpu->regfile_[getRS1(instruction)];
+		memcpy(VEC_reg(cpu, getRD(instruction)), &value, (size_t)1 << VEC_sew_shift(cpu));
+	}
+	cpu->pc_ += 0x4;
+}
+
+void VID(CPU *cpu, uint32_t instruction)
+{
+	int shift = VEC_sew_shift(cpu);
+	int vd = getRD(instruction);
+	int vm = instruction >> 25 & 1;
+	if (!VEC_ready(cpu) || !VEC_aligned(vd, VEC_lmul_shift(cpu->vtype_)) || (!vm && vd == 0))
+	{
+		return;
+	}
+	uint8_t result[VEC_GROUP];
+	for (uint32_t i = 0; i < cpu->vl_; i++)
+	{
+		memcpy(result + (i << shift), &i, (size_t)1 << shift);
+	}
+	VEC_commit(cpu, vd, result, shift, cpu->vl_, vm);
+	cpu->pc_ += 0x4;
+}
+
+void VEC_reset(CPU *cpu)
+{
+	memset(cpu->vregs_, 0, sizeof(cpu->vregs_));
+	cpu->vl_ = 0;
+	cpu->vtype_ = VEC_VILL;
+}
+
+uint16_t VEC_decode(uint32_t instruction)
+{
+	uint8_t opcode = getOpCode(instruction);
+	int func3 = getFunc3(instruction);
+	int funct6 = instruction >> 26;
+	int vm = instruction >> 25 & 1;
+	int rs1 = getRS1(instruction);
+	int rs2 = getRS2(instruction);
+
+	if (opcode == LOAD_FP || opcode == STORE_FP)
+	{
+		//8, 16 and 32 bit elements, no segments (nf) and no mew
+		int mop = instruction >> 26 & 3;
+		if ((func3 != 0 && func3 != 5 && func3 != 6) || instruction >> 28)
+		{
+			return OP_INVALID;
+		}
+		if (mop == 2)
+		{
+			return opcode == LOAD_FP ? OP_VLSE : OP_VSSE;
+		}
+		if (mop != 0)
+		{
+			return OP_INVALID;
+		}
+		if (rs2 == 0)
+		{
+			return opcode == LOAD_FP ? OP_VLE : OP_VSE;
+		}
+		if (rs2 == 0x0B && func3 == 0 && vm)
+		{
+			return opcode == LOAD_FP ? OP_VLM : OP_VSM;
+		}
+		return OP_INVALID;
+	}
+
+	int operation = VEC_integer[funct6];
+	switch (func3)
+	{
+	case VEC_OPCFG:
+		//vsetvli, vsetivli, vsetvl
+		return !(instruction >> 31) || instruction >> 30 == 3 || (funct6 == 0x20 && !vm) ? OP_VSETVL : OP_INVALID;
+	case VEC_OPIVV:
+	case VEC_OPIVX:
+	case VEC_OPIVI:
+	{
+		int form = func3 == VEC_OPIVV ? 1 : func3 == VEC_OPIVX ? 2 : 4;
+		if (operation == VEC_NONE || !(VEC_forms[operation] & form) || (operation == VEC_MOVE && vm && rs2 != 0))
+		{
+			return OP_INVALID;
+		}
+		return operation >= VEC_SEQ ? OP_VCMP : OP_VARITH;
+	}
+	case VEC_OPMVV:
+		if (funct6 < 0x08)
+		{
+			return OP_VRED;
+		}
+		if (funct6 >= 0x18 && funct6 < 0x20)
+		{
+			return vm ? OP_VMASK : OP_INVALID;
+		}
+		if (funct6 == 0x10) //VWXUNARY0
+		{
+			if (rs1 == 0x00)
+			{
+				return vm ? OP_VMV_X_S : OP_INVALID;
+			}
+			return rs1 == 0x10 ? OP_VCPOP : rs1 == 0x11 ? OP_VFIRST : OP_INVALID;
+		}
+		if (funct6 == 0x14) //VMUNARY0
+		{
+			return rs1 == 0x11 && rs2 == 0 ? OP_VID : OP_INVALID;
+		}
+		return funct6 == 0x25 ? OP_VARITH : OP_INVALID; //vmul
+	case VEC_OPMVX:
+		if (funct6 == 0x10) //VRXUNARY0
+		{
+			return rs2 == 0 && vm ? OP_VMV_S_X : OP_INVALID;
+		}
+		return funct6 == 0x25 ? OP_VARITH : OP_INVALID;
+	}
+	return OP_INVALID;
+}
+
+uint8_t *CPU_get_vregister(CPU *cpu, int index)
+{
+	return index >= 0 && index < 32 ? VEC_reg(cpu, index) : NULL;
+}